@@ -1,5 +1,6 @@
 #include "api.hpp"
 #include "vertex.hpp"
+#include "ztile.hpp"
 
 namespace fp {
 
@@ -45,7 +46,12 @@ void glTexCoord2xv(const tGLfixed *v) {
 
 /* Special Functions */
 void glFlush() {
-    /* nothing to do */
+    GLContext *c = gl_get_context();
+    ZB_tileFlush(c->zb);
+}
+
+void glFinish() {
+    glFlush();
 }
 
 /* Non standard functions */
@@ -54,4 +60,94 @@ void glDebug(int mode) {
     c->print_flag = mode;
 }
 
+/*
+ * The triangles are binned when raster threads are asked for, or on a
+ * single thread for the depth prepass which needs the triangle list, the
+ * bands and the tiled layout, only drawn by tiles.
+ */
+int gl_update_tiler(GLContext *c) {
+    int nb_threads = c->raster_threads;
+
+    if (nb_threads == 0 && (c->zb->depth_prepass || c->zb->band_rows > 0 || c->zb->tiled))
+        nb_threads = 1;
+
+    if (nb_threads == 0) {
+        ZB_tileClose(c->zb);
+    } else if (c->zb->tiler == NULL || c->zb->tiler->nb_threads != nb_threads) {
+        return ZB_tileOpen(c->zb, nb_threads);
+    }
+    return 0;
+}
+
+/*
+ * Select the rasterizer: 0 draws the triangles as they come, n > 0 bins
+ * them into tiles rasterized by n threads and n < 0 uses one thread per cpu.
+ * The other values also size the worker threads, as glWorkerThreads().
+ */
+void glRasterThreads(int nb_threads) {
+    GLContext *c = gl_get_context();
+
+    c->raster_threads = nb_threads;
+    if (nb_threads != 0)
+        ZB_setThreads(c->zb, nb_threads > 0 ? nb_threads : 0);
+    if (gl_update_tiler(c) != 0)
+        gl_error(GL_OUT_OF_MEMORY, "glRasterThreads: out of memory");
+}
+
+/*
+ * Number of threads of the tiler, the framebuffer copy and conversion, the
+ * dither and the clears, <= 0 for one per cpu (the default). They are
+ * started on their first use and kept until the context is destroyed.
+ */
+void glWorkerThreads(int nb_threads) {
+    GLContext *c = gl_get_context();
+
+    ZB_setThreads(c->zb, nb_threads > 0 ? nb_threads : 0);
+}
+
+/* the time taken to wake the workers up, nb_threads is 0 before they are started */
+void glWorkerStats(ZBPoolStats *stats) {
+    GLContext *c = gl_get_context();
+
+    if (c->zb->pool == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    ZB_poolStats(c->zb->pool, stats);
+}
+
+/* the memory of the color, z and texture buffers of all the contexts, see zsurface.hpp */
+void glSurfaceStats(ZBSurfaceStats *stats) {
+    ZB_surfaceStats(stats);
+}
+
+/* the indices of glDrawElements() found transformed, since the context was created */
+void glVertexCacheStats(GLVertexCacheStats *stats) {
+    *stats = gl_get_context()->vertex_cache.stats;
+}
+
+/*
+ * The pixels written since the last glXSwapBuffers() or glDamageReset(),
+ * in rectangles of whole tiles (see ZB_damageRects()), with y going down
+ */
+int glDamageRects(ZBRect *rects, int max_rects) {
+    GLContext *c = gl_get_context();
+
+    return ZB_damageRects(c->zb, &c->zb->damage, rects, max_rects);
+}
+
+/* pixels to show again, changed outside of the renderer */
+void glDamage(GLint x, GLint y, GLsizei width, GLsizei height) {
+    GLContext *c = gl_get_context();
+
+    if (width > 0 && height > 0)
+        ZB_damage(c->zb, x, y, x + width - 1, y + height - 1);
+}
+
+void glDamageReset() {
+    GLContext *c = gl_get_context();
+
+    ZB_damageReset(&c->zb->damage);
+}
+
 } // namespace fp
@@ -8,6 +8,9 @@
 #include "misc.hpp"
 #include "clear.hpp"
 #include "get.hpp"
+#include "zjit.hpp"
+#include "zthread.hpp"
+#include "zsurface.hpp"
 
 namespace fp {
 
@@ -31,8 +34,19 @@ void glTexCoord2xv(const tGLfixed *v);
 
 /* Special Functions */
 void glFlush();
+void glFinish();
 
 /* Non standard functions */
 void glDebug(int mode);
+void glRasterThreads(int nb_threads);
+void glWorkerThreads(int nb_threads);
+void glWorkerStats(ZBPoolStats *stats);
+void glSurfaceStats(ZBSurfaceStats *stats);
+void glVertexCacheStats(GLVertexCacheStats *stats);
+void glJitCodeLimit(GLsizei bytes);
+void glJitStats(ZBJitStats *stats);
+int glDamageRects(ZBRect *rects, int max_rects);
+void glDamage(GLint x, GLint y, GLsizei width, GLsizei height);
+void glDamageReset();
 
 } // namespace fp
@@ -6,66 +6,687 @@
 
 namespace fp {
 
-void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {
-    glBegin(mode);
-    if (type != GL_UNSIGNED_SHORT) {
-        fprintf(stderr, "tinygles: can't handle type 0x%04x in glDrawElements\n", type);
+/*
+ * The vertices of glDrawArrays() and glDrawElements() go through the
+ * pipeline GL_VERTEX_BATCH at a time, each stage looping on the
+ * attributes of the whole batch stored by component, then the
+ * primitives are assembled from the vertices in order, as glVertex4x().
+ */
+#define GL_VERTEX_BATCH 64
+
+typedef struct {
+    int nb;
+    M4 m;             /* of the positions, with their scale and bias */
+    GLArrayFetch fetch; /* of the positions */
+    tGLfixed x[GL_VERTEX_BATCH], y[GL_VERTEX_BATCH], z[GL_VERTEX_BATCH], w[GL_VERTEX_BATCH]; /* object, W = 1 is assumed */
+    tGLfixed ex[GL_VERTEX_BATCH], ey[GL_VERTEX_BATCH], ez[GL_VERTEX_BATCH], ew[GL_VERTEX_BATCH]; /* eye, when lit */
+    tGLfixed px[GL_VERTEX_BATCH], py[GL_VERTEX_BATCH], pz[GL_VERTEX_BATCH], pw[GL_VERTEX_BATCH]; /* clip */
+    tGLfixed nx[GL_VERTEX_BATCH], ny[GL_VERTEX_BATCH], nz[GL_VERTEX_BATCH];
+    tGLfixed r[GL_VERTEX_BATCH], g[GL_VERTEX_BATCH], b[GL_VERTEX_BATCH], a[GL_VERTEX_BATCH];
+    tGLfixed s[GL_VERTEX_BATCH], t[GL_VERTEX_BATCH], u[GL_VERTEX_BATCH], q[GL_VERTEX_BATCH];
+    int clip_code[GL_VERTEX_BATCH];
+    ZBufferPoint zp[GL_VERTEX_BATCH];
+} GLVertexBatch;
+
+typedef struct {
+    GLint first;
+    const GLushort *indices;
+} GLBatchIndices;
+
+/* conversions of the components of the arrays */
+#define GL_FETCH_FIXED 0
+#define GL_FETCH_FLOAT 1
+#define GL_FETCH_INT   2 /* GL_BYTE and GL_SHORT positions and texture coordinates */
+#define GL_FETCH_UNORM 3 /* GL_UNSIGNED_BYTE colors, 255 is 1 */
+#define GL_FETCH_SNORM 4 /* GL_BYTE and GL_SHORT normals, (2c + 1) / (2^b - 1) */
+#define GL_FETCH_RAW   5 /* GL_BYTE and GL_SHORT positions scaled by the matrix, 2^-16 per unit */
+
+/* the components missing from the elements are 0, 0, 0, 1 */
+template <typename T, int CONV, int SIZE>
+static void gl_fetch(const GLArray *a, int first, const GLushort *indices, int n, tGLfixed *const *out, int nb) {
+    int j, k;
+
+    for (k = 0; k < n; k++) {
+        const T *p = (const T *)(a->p + (size_t)(indices != NULL ? indices[k] : first + k) * a->stride);
+
+        for (j = 0; j < SIZE; j++) {
+            if constexpr (CONV == GL_FETCH_FIXED)
+                out[j][k] = tGLfixed::from_data(p[j]);
+            else if constexpr (CONV == GL_FETCH_FLOAT)
+                out[j][k] = tGLfixed(p[j]);
+            else if constexpr (CONV == GL_FETCH_INT)
+                out[j][k] = tGLfixed::from_data(p[j] * 65536);
+            else if constexpr (CONV == GL_FETCH_UNORM)
+                out[j][k] = tGLfixed::from_data((p[j] << 8 | p[j]) + (p[j] >> 7));
+            else if constexpr (CONV == GL_FETCH_SNORM)
+                out[j][k] = tGLfixed::from_data((int)((2 * (long long)p[j] + 1) * 65536 / ((1 << 8 * sizeof(T)) - 1)));
+            else
+                out[j][k] = tGLfixed::from_data(p[j]);
+        }
     }
-    const GLshort *shorts = (const GLshort *)indices;
-    for (int i = 0; i < count; i++) {
-        glArrayElement(shorts[i]);
+    for (j = SIZE; j < nb; j++) {
+        for (k = 0; k < n; k++)
+            out[j][k] = j == 3 ? tGLfixed(1.0f) : tGLfixed(0.0f);
     }
-    glEnd();
 }
 
-void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+#define GL_FETCH_SIZES(T, CONV) \
+    (size == 2 ? &gl_fetch<T, CONV, 2> : size == 3 ? &gl_fetch<T, CONV, 3> : &gl_fetch<T, CONV, 4>)
+
+/* ints is the conversion of GL_BYTE and GL_SHORT, or of GL_UNSIGNED_BYTE for GL_FETCH_UNORM */
+static GLArrayFetch gl_array_fetch(GLenum type, int size, int ints) {
+    switch (type) {
+    case GL_BYTE:
+        if (ints == GL_FETCH_INT)
+            return GL_FETCH_SIZES(GLbyte, GL_FETCH_INT);
+        if (ints == GL_FETCH_SNORM)
+            return GL_FETCH_SIZES(GLbyte, GL_FETCH_SNORM);
+        if (ints == GL_FETCH_RAW)
+            return GL_FETCH_SIZES(GLbyte, GL_FETCH_RAW);
+        return NULL;
+    case GL_SHORT:
+        if (ints == GL_FETCH_INT)
+            return GL_FETCH_SIZES(GLshort, GL_FETCH_INT);
+        if (ints == GL_FETCH_SNORM)
+            return GL_FETCH_SIZES(GLshort, GL_FETCH_SNORM);
+        if (ints == GL_FETCH_RAW)
+            return GL_FETCH_SIZES(GLshort, GL_FETCH_RAW);
+        return NULL;
+    case GL_UNSIGNED_BYTE:
+        return ints == GL_FETCH_UNORM ? GL_FETCH_SIZES(GLubyte, GL_FETCH_UNORM) : NULL;
+    case GL_FIXED:
+        return ints != GL_FETCH_RAW ? GL_FETCH_SIZES(GLfixed, GL_FETCH_FIXED) : NULL;
+    case GL_FLOAT:
+        return ints != GL_FETCH_RAW ? GL_FETCH_SIZES(GLfloat, GL_FETCH_FLOAT) : NULL;
+    default:
+        return NULL;
+    }
+}
+
+static int gl_type_size(GLenum type) {
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+/* the components of element idx of the array */
+static void gl_array_element(GLArray *a, int idx, V4 *v) {
+    tGLfixed *out[4] = {&v->X, &v->Y, &v->Z, &v->W};
+
+    a->p = a->buffer != NULL ? a->buffer->data + (GLintptr)a->pointer : (const GLubyte *)a->pointer;
+    a->fetch(a, idx, NULL, 1, out, 4);
+}
+
+/* the columns of an array converted in its buffer */
+static void gl_fetch_columns(const GLArray *a, int first, const GLushort *indices, int n, tGLfixed *const *out, int nb) {
+    int j, k;
+
+    for (j = 0; j < nb; j++) {
+        const tGLfixed *column = a->converted->columns[j];
+
+        if (indices != NULL) {
+            for (k = 0; k < n; k++)
+                out[j][k] = column[indices[k]];
+        } else {
+            for (k = 0; k < n; k++)
+                out[j][k] = column[first + k];
+        }
+    }
+}
+
+/*
+ * The array in its buffer converted to columns, on its first draw with
+ * this layout. The GL_BYTE and GL_SHORT positions are kept as they are,
+ * see gl_batch_matrix().
+ */
+static GLBufferArray *gl_buffer_array(GLArray *a) {
+    GLBuffer *b = a->buffer;
+    GLintptr offset = (GLintptr)a->pointer;
+    int element = a->size * gl_type_size(a->type), n, j;
+    tGLfixed *columns;
+    GLBufferArray *ba;
+
+    GLArrayFetch fetch = a->fetch_raw != NULL ? a->fetch_raw : a->fetch;
+
+    for (ba = b->arrays; ba != NULL; ba = ba->next) {
+        if (ba->fetch == fetch && ba->offset == offset && ba->stride == a->stride)
+            return ba;
+    }
+
+    ba = (GLBufferArray *)calloc(1, sizeof(GLBufferArray));
+    if (ba == NULL)
+        return NULL;
+    ba->count = offset >= 0 && b->size >= offset + element ? (b->size - offset - element) / a->stride + 1 : 0;
+    /* each column aligned on 64 bytes */
+    n = (ba->count + 15) & ~15;
+    if (posix_memalign((void **)&columns, 64, 4 * (n > 0 ? n : 16) * sizeof(tGLfixed)) != 0) {
+        free(ba);
+        return NULL;
+    }
+    for (j = 0; j < 4; j++)
+        ba->columns[j] = columns + j * n;
+    ba->fetch = fetch;
+    ba->offset = offset;
+    ba->stride = a->stride;
+    a->p = b->data + offset;
+    fetch(a, 0, NULL, ba->count, ba->columns, 4);
+
+    ba->next = b->arrays;
+    b->arrays = ba;
+    return ba;
+}
+
+/* the data of the enabled arrays, converted for those in buffers */
+void gl_arrays_prepare(GLContext *c) {
+    GLArray *arrays[4] = {&c->array.vertex, &c->array.normal, &c->array.color, &c->array.tex_coord};
+    int bits[4] = {VERTEX_ARRAY, NORMAL_ARRAY, COLOR_ARRAY, TEXCOORD_ARRAY}, i;
+
+    for (i = 0; i < 4; i++) {
+        GLArray *a = arrays[i];
+
+        if (!(c->client_states & bits[i]))
+            continue;
+        if (a->buffer != NULL) {
+            a->p = a->buffer->data + (GLintptr)a->pointer;
+            a->converted = gl_buffer_array(a);
+        } else {
+            a->p = (const GLubyte *)a->pointer;
+            a->converted = NULL;
+        }
+    }
+}
+
+/* the fetch of the array in the batches */
+static inline GLArrayFetch gl_batch_fetch(const GLArray *a) {
+    return a->converted != NULL ? gl_fetch_columns : a->fetch;
+}
+
+/*
+ * The matrix of the positions, the model-view one with the lights and
+ * the model-projection one without, by the scale and bias of the GL_BYTE
+ * and GL_SHORT positions, and their fetch: those are read as they are
+ * when the matrix can take the 2^16 of their conversion, as they are
+ * converted in the buffers.
+ */
+static void gl_batch_matrix(GLContext *c, GLVertexBatch *vb) {
+    const GLArray *a = &c->array.vertex;
+    const M4 *m = c->light.enabled ? c->matrix.stack_ptr[0] : &c->matrix.model_projection;
+    double f[4][4], unit = 1.0;
+    int i, j;
+
+    vb->m = *m;
+    vb->fetch = gl_batch_fetch(a);
+    if (a->fetch_raw == NULL)
+        return;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++)
+            f[i][j] = m->m[i][j].data() / 65536.0;
+        f[i][3] += f[i][0] * c->array.bias[0] + f[i][1] * c->array.bias[1] + f[i][2] * c->array.bias[2];
+        for (j = 0; j < 3; j++)
+            f[i][j] *= c->array.scale[j];
+    }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 3; j++) {
+            if (f[i][j] * 65536.0 >= 32767.0 || f[i][j] * 65536.0 <= -32767.0)
+                break;
+        }
+        if (j < 3)
+            break;
+    }
+    if (i == 4) {
+        unit = 65536.0;
+        vb->fetch = a->converted != NULL ? gl_fetch_columns : a->fetch_raw;
+    } else {
+        vb->fetch = a->fetch;
+    }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++)
+            vb->m.m[i][j] = tGLfixed(j < 3 ? f[i][j] * unit : f[i][j]);
+    }
+}
+
+/*
+ * The attributes used by the pipeline state, from the arrays or the
+ * current ones: the normals for the lights, the colors without them and
+ * the texture coordinates with a texture.
+ */
+static void gl_batch_gather(GLContext *c, GLVertexBatch *vb, const GLBatchIndices *ix) {
+    int states = c->client_states, k;
+
+    {
+        tGLfixed *out[4] = {vb->x, vb->y, vb->z, vb->w};
+
+        vb->fetch(&c->array.vertex, ix->first, ix->indices, vb->nb, out, 4);
+    }
+
+    if (c->light.enabled && (states & NORMAL_ARRAY)) {
+        tGLfixed *out[3] = {vb->nx, vb->ny, vb->nz};
+
+        gl_batch_fetch(&c->array.normal)(&c->array.normal, ix->first, ix->indices, vb->nb, out, 3);
+    } else if (c->light.enabled) {
+        for (k = 0; k < vb->nb; k++) {
+            vb->nx[k] = c->current.normal.X;
+            vb->ny[k] = c->current.normal.Y;
+            vb->nz[k] = c->current.normal.Z;
+        }
+    }
+
+    if (!c->light.enabled && (states & COLOR_ARRAY)) {
+        tGLfixed *out[4] = {vb->r, vb->g, vb->b, vb->a};
+
+        gl_batch_fetch(&c->array.color)(&c->array.color, ix->first, ix->indices, vb->nb, out, 4);
+    } else if (!c->light.enabled) {
+        for (k = 0; k < vb->nb; k++) {
+            vb->r[k] = c->current.color.X;
+            vb->g[k] = c->current.color.Y;
+            vb->b[k] = c->current.color.Z;
+            vb->a[k] = c->current.color.W;
+        }
+    }
+
+    if (c->texture.enabled_2d && (states & TEXCOORD_ARRAY)) {
+        tGLfixed *out[4] = {vb->s, vb->t, vb->u, vb->q};
+
+        gl_batch_fetch(&c->array.tex_coord)(&c->array.tex_coord, ix->first, ix->indices, vb->nb, out, 4);
+    } else if (c->texture.enabled_2d) {
+        for (k = 0; k < vb->nb; k++) {
+            vb->s[k] = c->current.tex_coord.X;
+            vb->t[k] = c->current.tex_coord.Y;
+            vb->u[k] = c->current.tex_coord.Z;
+            vb->q[k] = c->current.tex_coord.W;
+        }
+    }
+}
+
+/* coordinates and normals, as gl_vertex_transform() */
+static void gl_batch_transform(GLContext *c, GLVertexBatch *vb) {
+    const tGLfixed *m;
+    int k;
+
+    if (c->light.enabled) {
+        m = &vb->m.m[0][0];
+        for (k = 0; k < vb->nb; k++) {
+            vb->ex[k] = vb->x[k] * m[0] + vb->y[k] * m[1] + vb->z[k] * m[2] + m[3];
+            vb->ey[k] = vb->x[k] * m[4] + vb->y[k] * m[5] + vb->z[k] * m[6] + m[7];
+            vb->ez[k] = vb->x[k] * m[8] + vb->y[k] * m[9] + vb->z[k] * m[10] + m[11];
+            vb->ew[k] = vb->x[k] * m[12] + vb->y[k] * m[13] + vb->z[k] * m[14] + m[15];
+        }
+        m = &c->matrix.stack_ptr[1]->m[0][0];
+        for (k = 0; k < vb->nb; k++) {
+            vb->px[k] = vb->ex[k] * m[0] + vb->ey[k] * m[1] + vb->ez[k] * m[2] + vb->ew[k] * m[3];
+            vb->py[k] = vb->ex[k] * m[4] + vb->ey[k] * m[5] + vb->ez[k] * m[6] + vb->ew[k] * m[7];
+            vb->pz[k] = vb->ex[k] * m[8] + vb->ey[k] * m[9] + vb->ez[k] * m[10] + vb->ew[k] * m[11];
+            vb->pw[k] = vb->ex[k] * m[12] + vb->ey[k] * m[13] + vb->ez[k] * m[14] + vb->ew[k] * m[15];
+        }
+        m = &c->matrix.model_view_inv.m[0][0];
+        for (k = 0; k < vb->nb; k++) {
+            V3 n;
+
+            n.X = vb->nx[k] * m[0] + vb->ny[k] * m[1] + vb->nz[k] * m[2];
+            n.Y = vb->nx[k] * m[4] + vb->ny[k] * m[5] + vb->nz[k] * m[6];
+            n.Z = vb->nx[k] * m[8] + vb->ny[k] * m[9] + vb->nz[k] * m[10];
+            if (c->normalize_enabled)
+                gl_V3_Norm(&n);
+            vb->nx[k] = n.X;
+            vb->ny[k] = n.Y;
+            vb->nz[k] = n.Z;
+        }
+    } else {
+        /* W = 1 is assumed */
+        m = &vb->m.m[0][0];
+        for (k = 0; k < vb->nb; k++) {
+            vb->px[k] = vb->x[k] * m[0] + vb->y[k] * m[1] + vb->z[k] * m[2] + m[3];
+            vb->py[k] = vb->x[k] * m[4] + vb->y[k] * m[5] + vb->z[k] * m[6] + m[7];
+            vb->pz[k] = vb->x[k] * m[8] + vb->y[k] * m[9] + vb->z[k] * m[10] + m[11];
+        }
+        if (c->matrix.model_projection_no_w_transform) {
+            for (k = 0; k < vb->nb; k++)
+                vb->pw[k] = m[15];
+        } else {
+            for (k = 0; k < vb->nb; k++)
+                vb->pw[k] = vb->x[k] * m[12] + vb->y[k] * m[13] + vb->z[k] * m[14] + m[15];
+        }
+    }
+
+    for (k = 0; k < vb->nb; k++)
+        vb->clip_code[k] = gl_clipcode(vb->px[k], vb->py[k], vb->pz[k], vb->pw[k]);
+}
+
+/* colors of the lights, and texture coordinates */
+static void gl_batch_shade(GLContext *c, GLVertexBatch *vb) {
+    int k;
+
+    if (c->light.enabled) {
+        GLVertex v;
+
+        for (k = 0; k < vb->nb; k++) {
+            v.normal.X = vb->nx[k];
+            v.normal.Y = vb->ny[k];
+            v.normal.Z = vb->nz[k];
+            v.ec.X = vb->ex[k];
+            v.ec.Y = vb->ey[k];
+            v.ec.Z = vb->ez[k];
+            gl_shade_vertex(c, &v);
+            vb->r[k] = v.color.X;
+            vb->g[k] = v.color.Y;
+            vb->b[k] = v.color.Z;
+            vb->a[k] = v.color.W;
+        }
+    }
+
+    if (c->texture.enabled_2d && c->matrix.apply_texture) {
+        const tGLfixed *m = &c->matrix.stack_ptr[2]->m[0][0];
+
+        for (k = 0; k < vb->nb; k++) {
+            tGLfixed s = vb->s[k], t = vb->t[k], u = vb->u[k], q = vb->q[k];
+
+            vb->s[k] = s * m[0] + t * m[1] + u * m[2] + q * m[3];
+            vb->t[k] = s * m[4] + t * m[5] + u * m[6] + q * m[7];
+            vb->u[k] = s * m[8] + t * m[9] + u * m[10] + q * m[11];
+            vb->q[k] = s * m[12] + t * m[13] + u * m[14] + q * m[15];
+        }
+    }
+}
+
+/* window coordinates of the vertices inside the frustum, as gl_transform_to_viewport() */
+static void gl_batch_viewport(GLContext *c, GLVertexBatch *vb) {
+    GLViewport *vp = &c->viewport;
+    int k, z;
+
+    for (k = 0; k < vb->nb; k++) {
+        ZBufferPoint *zp = &vb->zp[k];
+        tGLfixed winv, zn;
+
+        if (vb->clip_code[k] != 0)
+            continue;
+        winv = 1.0 / vb->pw[k];
+        zp->x = (int)(vb->px[k] * winv * vp->scale.X + vp->trans.X);
+        zp->y = (int)(vb->py[k] * winv * vp->scale.Y + vp->trans.Y);
+        zn = vb->pz[k] * winv;
+        z = vp->ztrans + zn.data() * vp->zscale;
+        if (z < vp->zmin)
+            z = vp->zmin;
+        else if (z > vp->zmax)
+            z = vp->zmax;
+        zp->z = z;
+    }
+
+    /* the current color is already converted by glColor4x() */
+    if (!c->light.enabled && !(c->client_states & COLOR_ARRAY)) {
+        for (k = 0; k < vb->nb; k++) {
+            vb->zp[k].r = c->current.longcolor[0];
+            vb->zp[k].g = c->current.longcolor[1];
+            vb->zp[k].b = c->current.longcolor[2];
+            vb->zp[k].a = c->current.longcolor[3];
+        }
+    } else if (!c->light.enabled) {
+        /* converted as glColor4x() */
+        for (k = 0; k < vb->nb; k++) {
+            ZBufferPoint *zp = &vb->zp[k];
+
+            zp->r = (unsigned int)(vb->r[k] * (ZB_POINT_RED_MAX - ZB_POINT_RED_MIN) + ZB_POINT_RED_MIN);
+            zp->g = (unsigned int)(vb->g[k] * (ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN) + ZB_POINT_GREEN_MIN);
+            zp->b = (unsigned int)(vb->b[k] * (ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN) + ZB_POINT_BLUE_MIN);
+            zp->a = (unsigned int)(vb->a[k] * (ZB_POINT_ALPHA_MAX - ZB_POINT_ALPHA_MIN) + ZB_POINT_ALPHA_MIN);
+        }
+    } else {
+        for (k = 0; k < vb->nb; k++) {
+            ZBufferPoint *zp = &vb->zp[k];
+
+            zp->r = (int)(vb->r[k] * (ZB_POINT_RED_MAX - ZB_POINT_RED_MIN) + ZB_POINT_RED_MIN);
+            zp->g = (int)(vb->g[k] * (ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN) + ZB_POINT_GREEN_MIN);
+            zp->b = (int)(vb->b[k] * (ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN) + ZB_POINT_BLUE_MIN);
+            zp->a = (int)(vb->a[k] * (ZB_POINT_ALPHA_MAX - ZB_POINT_ALPHA_MIN) + ZB_POINT_ALPHA_MIN);
+        }
+    }
+
+    if (c->texture.enabled_2d) {
+        for (k = 0; k < vb->nb; k++) {
+            vb->zp[k].s = (int)(vb->s[k] * (ZB_POINT_S_MAX - ZB_POINT_S_MIN) + ZB_POINT_S_MIN);
+            vb->zp[k].t = (int)(vb->t[k] * (ZB_POINT_T_MAX - ZB_POINT_T_MIN) + ZB_POINT_T_MIN);
+        }
+    }
+}
+
+/* the primitives of the batch, in the order of its vertices */
+static void gl_batch_assemble(GLContext *c, GLVertexBatch *vb) {
+    int k;
+
+    for (k = 0; k < vb->nb; k++) {
+        GLVertex *v = &c->vertex[c->vertex_n];
+
+        v->pc.X = vb->px[k];
+        v->pc.Y = vb->py[k];
+        v->pc.Z = vb->pz[k];
+        v->pc.W = vb->pw[k];
+        v->color.X = vb->r[k];
+        v->color.Y = vb->g[k];
+        v->color.Z = vb->b[k];
+        v->color.W = vb->a[k];
+        if (c->texture.enabled_2d) {
+            v->tex_coord.X = vb->s[k];
+            v->tex_coord.Y = vb->t[k];
+            v->tex_coord.Z = vb->u[k];
+            v->tex_coord.W = vb->q[k];
+        }
+        v->clip_code = vb->clip_code[k];
+        v->zp = vb->zp[k];
+        v->edge_flag = c->current.edge_flag;
+        gl_assemble_vertex(c);
+    }
+}
+
+/* the vertices of the batch, to be kept in the cache */
+static void gl_batch_store(GLContext *c, GLVertexBatch *vb, GLCachedVertex *out) {
+    int k;
+
+    for (k = 0; k < vb->nb; k++) {
+        GLCachedVertex *e = &out[k];
+
+        e->pc.X = vb->px[k];
+        e->pc.Y = vb->py[k];
+        e->pc.Z = vb->pz[k];
+        e->pc.W = vb->pw[k];
+        e->color.X = vb->r[k];
+        e->color.Y = vb->g[k];
+        e->color.Z = vb->b[k];
+        e->color.W = vb->a[k];
+        if (c->texture.enabled_2d) {
+            e->tex_coord.X = vb->s[k];
+            e->tex_coord.Y = vb->t[k];
+            e->tex_coord.Z = vb->u[k];
+            e->tex_coord.W = vb->q[k];
+        }
+        e->clip_code = vb->clip_code[k];
+        e->zp = vb->zp[k];
+    }
+}
+
+static void gl_assemble_cached(GLContext *c, const GLCachedVertex *e) {
+    GLVertex *v = &c->vertex[c->vertex_n];
+
+    v->pc = e->pc;
+    v->color = e->color;
+    if (c->texture.enabled_2d)
+        v->tex_coord = e->tex_coord;
+    v->clip_code = e->clip_code;
+    v->zp = e->zp;
+    v->edge_flag = c->current.edge_flag;
+    gl_assemble_vertex(c);
+}
+
+/*
+ * The indices GL_VERTEX_BATCH at a time: those found in the cache are
+ * not transformed again, the others are transformed in one batch and
+ * take their entry, unless the batch already uses it.
+ */
+static void gl_draw_cached(GLContext *c, GLVertexBatch *vb, const GLushort *indices, int count) {
+    GLVertexCache *vc = &c->vertex_cache;
+    GLBatchIndices ix;
+    GLushort miss[GL_VERTEX_BATCH];
+    GLCachedVertex out[GL_VERTEX_BATCH];
+    GLCachedVertex *claim[GL_VERTEX_BATCH];
+    const GLCachedVertex *ref[GL_VERTEX_BATCH];
+    int i, k, n;
+
+    /* a batch per GL_VERTEX_BATCH indices at most: the stamps of a draw don't wrap */
+    if (vc->stamp >= 0x80000000u) {
+        for (i = 0; i < VERTEX_HASH_SIZE; i++)
+            vc->entries[i].stamp = 0;
+        vc->stamp = 0;
+    }
+    vc->draw_stamp = vc->stamp + 1;
+    vc->stats.draws++;
+
+    ix.first = 0;
+    ix.indices = miss;
+    for (i = 0; i < count; i += GL_VERTEX_BATCH) {
+        n = count - i < GL_VERTEX_BATCH ? count - i : GL_VERTEX_BATCH;
+        vc->stamp++;
+        vb->nb = 0;
+        for (k = 0; k < n; k++) {
+            int idx = indices[i + k];
+            GLCachedVertex *e = &vc->entries[idx % VERTEX_HASH_SIZE];
+
+            if (e->index == idx && e->stamp >= vc->draw_stamp) {
+                e->stamp = vc->stamp;
+                ref[k] = e;
+                continue;
+            }
+            miss[vb->nb] = idx;
+            if (e->stamp == vc->stamp) {
+                claim[vb->nb] = NULL;
+                ref[k] = &out[vb->nb];
+            } else {
+                e->index = idx;
+                e->stamp = vc->stamp;
+                claim[vb->nb] = e;
+                ref[k] = e;
+            }
+            vb->nb++;
+        }
+        vc->stats.hits += n - vb->nb;
+        vc->stats.misses += vb->nb;
+
+        if (vb->nb > 0) {
+            gl_batch_gather(c, vb, &ix);
+            gl_batch_transform(c, vb);
+            gl_batch_shade(c, vb);
+            gl_batch_viewport(c, vb);
+            gl_batch_store(c, vb, out);
+            for (k = 0; k < vb->nb; k++) {
+                if (claim[k] != NULL) {
+                    unsigned int stamp = claim[k]->stamp;
+                    int idx = claim[k]->index;
+
+                    *claim[k] = out[k];
+                    claim[k]->stamp = stamp;
+                    claim[k]->index = idx;
+                }
+            }
+        }
+        for (k = 0; k < n; k++)
+            gl_assemble_cached(c, ref[k]);
+    }
+}
+
+/*
+ * The vertices first + i, or indices[i] through the vertex cache if
+ * indices is not NULL. The vertex array is needed, and the material
+ * follows glColor4x() with the color array and GL_COLOR_MATERIAL: those
+ * go through glArrayElement(), as the draws recorded in a list.
+ */
+void gl_draw_batches(GLContext *c, GLenum mode, GLint first, const GLushort *indices, int count) {
+    GLVertexBatch vb;
+    GLBatchIndices ix;
+    int i, states = c->client_states;
+
     glBegin(mode);
-    for (int i = first; i < first + count; i++) {
-        glArrayElement(i);
+    if (c->compile_flag || !(states & VERTEX_ARRAY) || ((states & COLOR_ARRAY) && c->material.color.enabled)) {
+        for (i = 0; i < count; i++)
+            glArrayElement(indices != NULL ? indices[i] : first + i);
+        glEnd();
+        return;
+    }
+
+    gl_arrays_prepare(c);
+    gl_batch_matrix(c, &vb);
+    if (indices != NULL) {
+        gl_draw_cached(c, &vb, indices, count);
+    } else {
+        for (i = 0; i < count; i += GL_VERTEX_BATCH) {
+            vb.nb = count - i < GL_VERTEX_BATCH ? count - i : GL_VERTEX_BATCH;
+            ix.first = first + i;
+            ix.indices = NULL;
+            gl_batch_gather(c, &vb, &ix);
+            gl_batch_transform(c, &vb);
+            gl_batch_shade(c, &vb);
+            gl_batch_viewport(c, &vb);
+            gl_batch_assemble(c, &vb);
+        }
+    }
+
+    /* the attributes of the arrays are current after the last vertex, as with glArrayElement() */
+    if (count > 0) {
+        int last = indices != NULL ? indices[count - 1] : first + count - 1;
+
+        if (states & (COLOR_ARRAY | NORMAL_ARRAY | TEXCOORD_ARRAY)) {
+            c->client_states = states & ~VERTEX_ARRAY;
+            glArrayElement(last);
+            c->client_states = states;
+        }
     }
     glEnd();
 }
 
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {
+    GLContext *c = gl_get_context();
+
+    if (type != GL_UNSIGNED_SHORT) {
+        fprintf(stderr, "tinygles: can't handle type 0x%04x in glDrawElements\n", type);
+    }
+    /* an offset in the GL_ELEMENT_ARRAY_BUFFER bound */
+    if (c->array.element_buffer != NULL)
+        indices = c->array.element_buffer->data + (GLintptr)indices;
+    gl_draw_batches(c, mode, 0, (const GLushort *)indices, count);
+}
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    gl_draw_batches(gl_get_context(), mode, first, NULL, count);
+}
+
 void glArrayElement(GLint idx) {
     GLContext *c = gl_get_context();
-    int i;
     int states = c->client_states;
+    V4 v;
 
     if (states & COLOR_ARRAY) {
-        int size = c->array.color.size;
-        tGLfixed *ptr = c->array.color.p;
-        i = idx * (size + c->array.color.stride);
-        glColor4x(
-            ptr[i],
-            ptr[i+1],
-            ptr[i+2],
-            size > 3 ? ptr[i+3] : tGLfixed(1.0f)
-        );
+        gl_array_element(&c->array.color, idx, &v);
+        glColor4x(v.X, v.Y, v.Z, v.W);
     }
     if (states & NORMAL_ARRAY) {
-        i = idx * (3 + c->array.normal.stride);
-        c->current.normal.X = c->array.normal.p[i];
-        c->current.normal.Y = c->array.normal.p[i+1];
-        c->current.normal.Z = c->array.normal.p[i+2];
-        c->current.normal.Z = 0.0f;
+        gl_array_element(&c->array.normal, idx, &v);
+        glNormal3x(v.X, v.Y, v.Z);
     }
     if (states & TEXCOORD_ARRAY) {
-        int size = c->array.tex_coord.size;
-        i = idx * (size + c->array.tex_coord.stride);
-        c->current.tex_coord.X = c->array.tex_coord.p[i];
-        c->current.tex_coord.Y = c->array.tex_coord.p[i+1];
-        c->current.tex_coord.Z = size > 2 ? c->array.tex_coord.p[i+2] : tGLfixed(0.0f);
-        c->current.tex_coord.W = size > 3 ? c->array.tex_coord.p[i+3] : tGLfixed(1.0f);
+        gl_array_element(&c->array.tex_coord, idx, &v);
+        glTexCoord4x(v.X, v.Y, v.Z, v.W);
     }
     if (states & VERTEX_ARRAY) {
-        int size = c->array.vertex.size;
-        i = idx * (size + c->array.vertex.stride);
-        glVertex4x(
-            c->array.vertex.p[i],
-            c->array.vertex.p[i+1],
-            size > 2 ? c->array.vertex.p[i+2] : tGLfixed(0.0f),
-            size > 3 ? c->array.vertex.p[i+3] : tGLfixed(1.0f)
-        );
+        gl_array_element(&c->array.vertex, idx, &v);
+        if (c->array.vertex.fetch_raw != NULL) {
+            v.X = tGLfixed((float)v.X * c->array.scale[0] + c->array.bias[0]);
+            v.Y = tGLfixed((float)v.Y * c->array.scale[1] + c->array.bias[1]);
+            v.Z = tGLfixed((float)v.Z * c->array.scale[2] + c->array.bias[2]);
+        }
+        glVertex4x(v.X, v.Y, v.Z, v.W);
     }
 }
 
@@ -115,36 +736,74 @@ void glDisableClientState(GLenum array) {
     c->client_states &= bit;
 }
 
-// TODO: support other types? or do we want to assume glshim is helping us?
+/*
+ * The array of size components of type, stride bytes apart or packed if
+ * 0, at pointer or at that offset in the GL_ARRAY_BUFFER bound. ints is
+ * the conversion of its integer types, which are refused without one.
+ * Returns -1 on error.
+ */
+static int gl_array_pointer(GLArray *a, const char *name, GLint size, GLint min_size, GLenum type,
+                             GLsizei stride, const GLvoid *pointer, int ints) {
+    GLArrayFetch fetch;
+
+    if (size < min_size || size > 4 || stride < 0) {
+        gl_error(GL_INVALID_VALUE, name);
+        return -1;
+    }
+    fetch = gl_array_fetch(type, size, ints);
+    if (fetch == NULL) {
+        gl_error(GL_INVALID_ENUM, name);
+        return -1;
+    }
+    a->pointer = pointer;
+    a->buffer = gl_get_context()->array.array_buffer;
+    a->p = a->buffer == NULL ? (const GLubyte *)pointer : NULL;
+    a->converted = NULL;
+    a->size = size;
+    a->type = type;
+    a->stride = stride != 0 ? stride : size * gl_type_size(type);
+    a->fetch = fetch;
+    a->fetch_raw = NULL;
+    return 0;
+}
+
 void glVertexPointer(GLint size, GLenum type, GLsizei stride,
                      const GLvoid *pointer) {
     GLContext *c = gl_get_context();
-    c->array.vertex.size = size;
-    c->array.vertex.stride = stride;
-    c->array.vertex.p = (tGLfixed*)pointer;
+
+    if (gl_array_pointer(&c->array.vertex, "glVertexPointer", size, 2, type, stride, pointer, GL_FETCH_INT) == 0)
+        c->array.vertex.fetch_raw = gl_array_fetch(type, size, GL_FETCH_RAW);
 }
 
 void glColorPointer(GLint size, GLenum type, GLsizei stride,
                     const GLvoid *pointer) {
     GLContext *c = gl_get_context();
-    c->array.color.size = size;
-    c->array.color.stride = stride;
-    c->array.color.p = (tGLfixed*)pointer;
+
+    gl_array_pointer(&c->array.color, "glColorPointer", size, 3, type, stride, pointer, GL_FETCH_UNORM);
 }
 
 void glNormalPointer(GLenum type, GLsizei stride,
                 const GLvoid *pointer) {
     GLContext *c = gl_get_context();
-    c->array.normal.stride = stride;
-    c->array.normal.p = (tGLfixed*)pointer;
+
+    gl_array_pointer(&c->array.normal, "glNormalPointer", 3, 3, type, stride, pointer, GL_FETCH_SNORM);
 }
 
 void glTexCoordPointer(GLint size, GLenum type, GLsizei stride,
                        const GLvoid *pointer) {
     GLContext *c = gl_get_context();
-    c->array.tex_coord.size = size;
-    c->array.tex_coord.stride = stride;
-    c->array.tex_coord.p = (tGLfixed*)pointer;
+
+    gl_array_pointer(&c->array.tex_coord, "glTexCoordPointer", size, 2, type, stride, pointer, GL_FETCH_INT);
+}
+
+void glVertexScaleBias(const GLfloat *scale, const GLfloat *bias) {
+    GLContext *c = gl_get_context();
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        c->array.scale[i] = scale[i];
+        c->array.bias[i] = bias[i];
+    }
 }
 
 } // namespace fp
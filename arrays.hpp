@@ -18,7 +18,7 @@ void glEnableClientState(GLenum array);
 
 void glDisableClientState(GLenum array);
 
-// TODO: support other types? or do we want to assume glshim is helping us?
+/* GL_BYTE, GL_SHORT, GL_FIXED and GL_FLOAT, GL_UNSIGNED_BYTE for the colors */
 void glVertexPointer(GLint size, GLenum type, GLsizei stride,
                      const GLvoid *pointer);
 
@@ -29,4 +29,11 @@ void glNormalPointer(GLenum type, GLsizei stride,
                 const GLvoid *pointer);
 void glTexCoordPointer(GLint size, GLenum type, GLsizei stride,
                        const GLvoid *pointer);
+
+/*
+ * Non standard: the positions of the GL_BYTE and GL_SHORT vertex arrays
+ * are x * scale + bias, 1 and 0 by default. The scale and bias are
+ * applied with the matrices.
+ */
+void glVertexScaleBias(const GLfloat *scale, const GLfloat *bias);
 } // namespace fp
@@ -4,19 +4,170 @@ namespace fp {
 
 void glAlphaFunc(GLenum func, GLclampf ref) {
     GLContext *c = gl_get_context();
+    int r = (int)(ref * 255.0f + 0.5f);
+
+    if (c->compile_flag) {
+        GLParam p[2];
+        p[0].i = func;
+        p[1].f = ref;
+        gl_compile_state(c, GL_LIST_ALPHA_FUNC, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->alpha.func = func;
-    c->alpha.ref = ref;
+    c->alpha.ref = r < 0 ? 0 : r > 255 ? 255 : r;
+    c->fragment_state_updated = 1;
 }
 
 void glBlendFunc(GLenum sfactor, GLenum dfactor) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[2];
+        p[0].i = sfactor;
+        p[1].i = dfactor;
+        gl_compile_state(c, GL_LIST_BLEND_FUNC, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->blend.sfactor = sfactor;
     c->blend.dfactor = dfactor;
+    c->fragment_state_updated = 1;
 }
 
 void glLogicOp(GLenum opcode) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].i = opcode;
+        gl_compile_state(c, GL_LIST_LOGIC_OP, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->logic.op = opcode;
 }
 
+void glDepthFunc(GLenum func) {
+    GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].i = func;
+        gl_compile_state(c, GL_LIST_DEPTH_FUNC, p);
+        if (!c->exec_flag)
+            return;
+    }
+    c->depth_func = func;
+    c->fragment_state_updated = 1;
+}
+
+void glDepthMask(GLboolean flag) {
+    GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].i = flag;
+        gl_compile_state(c, GL_LIST_DEPTH_MASK, p);
+        if (!c->exec_flag)
+            return;
+    }
+    c->depth_mask = flag;
+    c->fragment_state_updated = 1;
+}
+
+static unsigned int gl_depth_func(int func) {
+    switch (func) {
+        case GL_NEVER: return ZB_DEPTH_NEVER;
+        case GL_LESS: return ZB_DEPTH_LESS;
+        case GL_EQUAL: return ZB_DEPTH_EQUAL;
+        case GL_LEQUAL: return ZB_DEPTH_LEQUAL;
+        case GL_GREATER: return ZB_DEPTH_GREATER;
+        case GL_NOTEQUAL: return ZB_DEPTH_NOTEQUAL;
+        case GL_GEQUAL: return ZB_DEPTH_GEQUAL;
+        default: return ZB_DEPTH_ALWAYS;
+    }
+}
+
+/* the test of the reversed z of ZB_flipDepth() */
+static const unsigned char gl_depth_mirror[8] = {
+    ZB_DEPTH_ALWAYS, ZB_DEPTH_NEVER, ZB_DEPTH_GREATER, ZB_DEPTH_GEQUAL,
+    ZB_DEPTH_EQUAL, ZB_DEPTH_LESS, ZB_DEPTH_LEQUAL, ZB_DEPTH_NOTEQUAL
+};
+
+/* factor of ZB_BLEND_FACTORS, the color buffer having no alpha */
+static int gl_blend_factor(int factor) {
+    switch (factor) {
+        case GL_ONE: return ZB_FACTOR_ONE;
+        case GL_SRC_COLOR: return ZB_FACTOR_SRC_COLOR;
+        case GL_ONE_MINUS_SRC_COLOR: return ZB_FACTOR_ONE_MINUS_SRC_COLOR;
+        case GL_DST_COLOR: return ZB_FACTOR_DST_COLOR;
+        case GL_ONE_MINUS_DST_COLOR: return ZB_FACTOR_ONE_MINUS_DST_COLOR;
+        case GL_SRC_ALPHA: return ZB_FACTOR_SRC_ALPHA;
+        case GL_ONE_MINUS_SRC_ALPHA: return ZB_FACTOR_ONE_MINUS_SRC_ALPHA;
+        case GL_DST_ALPHA: return ZB_FACTOR_ONE;
+        /* GL_ONE_MINUS_DST_ALPHA, GL_SRC_ALPHA_SATURATE: min(as, 1 - 1) */
+        default: return ZB_FACTOR_ZERO;
+    }
+}
+
+/* the factors without a blend equation of their own are drawn with ZB_BLEND_FACTORS */
+static unsigned int gl_blend_func(int sfactor, int dfactor) {
+    if (sfactor == GL_ONE && dfactor == GL_ZERO)
+        return ZB_BLEND_NONE;
+    if (sfactor == GL_ONE && dfactor == GL_ONE)
+        return ZB_BLEND_ADD;
+    if (sfactor == GL_SRC_ALPHA && dfactor == GL_ONE)
+        return ZB_BLEND_ADD_ALPHA;
+    if ((sfactor == GL_DST_COLOR && dfactor == GL_ZERO) || (sfactor == GL_ZERO && dfactor == GL_SRC_COLOR))
+        return ZB_BLEND_MODULATE;
+    if (sfactor == GL_ONE && dfactor == GL_ONE_MINUS_SRC_ALPHA)
+        return ZB_BLEND_PREMUL;
+    if (sfactor == GL_ZERO && dfactor == GL_ONE)
+        return ZB_BLEND_KEEP;
+    if (sfactor == GL_SRC_ALPHA && dfactor == GL_ONE_MINUS_SRC_ALPHA)
+        return ZB_BLEND_ALPHA;
+    return ZB_BLEND_FACTORS;
+}
+
+/*
+ * Pipeline state word of the triangles from the depth test, blending and
+ * alpha test of the context, called before drawing when they changed.
+ */
+void gl_update_fragment_state(GLContext *c) {
+    ZBuffer *zb = c->zb;
+    unsigned int state = 0, depth;
+    int ref = c->alpha.ref;
+
+    /* without depth test, the z buffer is neither read nor written */
+    if (c->depth_test) {
+        depth = gl_depth_func(c->depth_func);
+        if (zb->depth_flip)
+            depth = gl_depth_mirror[depth];
+        state |= depth << ZB_STATE_DEPTH_SHIFT;
+        if (c->depth_mask)
+            state |= ZB_STATE_ZWRITE;
+    }
+    zb->blend = 0;
+    if (c->blend.enabled) {
+        state |= gl_blend_func(c->blend.sfactor, c->blend.dfactor) << ZB_STATE_BLEND_SHIFT;
+        zb->blend = ZB_BLEND_FACTORS_INDEX(gl_blend_factor(c->blend.sfactor), gl_blend_factor(c->blend.dfactor));
+    }
+
+    /* range of the alpha values passing the test, modulo 256 */
+    zb->alpha_lo = 0;
+    zb->alpha_range = 255;
+    if (c->alpha.enabled && c->alpha.func != GL_ALWAYS) {
+        state |= ZB_STATE_ALPHA_TEST;
+        switch (c->alpha.func) {
+            case GL_NEVER: zb->alpha_range = -1; break;
+            case GL_LESS: zb->alpha_range = ref - 1; break;
+            case GL_LEQUAL: zb->alpha_range = ref; break;
+            case GL_EQUAL: zb->alpha_lo = ref; zb->alpha_range = 0; break;
+            case GL_GREATER: zb->alpha_lo = ref + 1; zb->alpha_range = 254 - ref; break;
+            case GL_GEQUAL: zb->alpha_lo = ref; zb->alpha_range = 255 - ref; break;
+            case GL_NOTEQUAL: zb->alpha_lo = ref + 1; zb->alpha_range = 254; break;
+        }
+    }
+
+    zb->state = state | (zb->state & ZB_STATE_COLOR16);
+    c->fragment_state_updated = 0;
+}
+
 } // namespace fp
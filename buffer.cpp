@@ -0,0 +1,212 @@
+#include "buffer.hpp"
+#include "zgl.hpp"
+
+namespace fp {
+
+static GLuint next_buffer_handle = 1;
+
+GLBuffer *find_buffer(GLContext *c, GLuint h) {
+    GLBuffer *b;
+
+    for (b = c->shared_state.buffer_hash_table[h % BUFFER_HASH_TABLE_SIZE]; b != NULL; b = b->next) {
+        if (b->handle == h)
+            return b;
+    }
+    return NULL;
+}
+
+static GLBuffer *alloc_buffer(GLContext *c, GLuint h) {
+    GLBuffer **ht = &c->shared_state.buffer_hash_table[h % BUFFER_HASH_TABLE_SIZE];
+    GLBuffer *b = (GLBuffer *)calloc(1, sizeof(GLBuffer));
+
+    if (b == NULL) {
+        gl_error(GL_OUT_OF_MEMORY, "glBindBuffer: failed to allocate the buffer");
+        return NULL;
+    }
+    b->handle = h;
+    b->usage = GL_STATIC_DRAW;
+    b->next = *ht;
+    *ht = b;
+    return b;
+}
+
+void gl_buffer_drop_arrays(GLBuffer *b) {
+    GLBufferArray *a, *next;
+
+    for (a = b->arrays; a != NULL; a = next) {
+        next = a->next;
+        free(a->columns[0]);
+        free(a);
+    }
+    b->arrays = NULL;
+}
+
+static void free_buffer(GLBuffer *b) {
+    gl_buffer_drop_arrays(b);
+    free(b->data);
+    free(b);
+}
+
+void gl_free_buffers(GLContext *c) {
+    GLBuffer *b, *next;
+    int i;
+
+    for (i = 0; i < BUFFER_HASH_TABLE_SIZE; i++) {
+        for (b = c->shared_state.buffer_hash_table[i]; b != NULL; b = next) {
+            next = b->next;
+            free_buffer(b);
+        }
+        c->shared_state.buffer_hash_table[i] = NULL;
+    }
+}
+
+/* the buffer bound to target, NULL with an error if none */
+static GLBuffer *gl_bound_buffer(GLContext *c, GLenum target, const char *name) {
+    GLBuffer *b;
+
+    if (target == GL_ARRAY_BUFFER) {
+        b = c->array.array_buffer;
+    } else if (target == GL_ELEMENT_ARRAY_BUFFER) {
+        b = c->array.element_buffer;
+    } else {
+        gl_error(GL_INVALID_ENUM, name);
+        return NULL;
+    }
+    if (b == NULL)
+        gl_error(GL_INVALID_OPERATION, name);
+    return b;
+}
+
+void glGenBuffers(GLsizei n, GLuint *buffers) {
+    if (n < 0) {
+        gl_error(GL_INVALID_VALUE, "glGenBuffers: n < 0");
+        return;
+    }
+    for (GLsizei i = 0; i < n; i++)
+        buffers[i] = next_buffer_handle++;
+}
+
+/* the bindings of a deleted buffer go back to 0, those of the arrays too */
+void glDeleteBuffers(GLsizei n, const GLuint *buffers) {
+    GLContext *c = gl_get_context();
+    GLArray *arrays[4] = {&c->array.vertex, &c->array.normal, &c->array.color, &c->array.tex_coord};
+
+    if (n < 0) {
+        gl_error(GL_INVALID_VALUE, "glDeleteBuffers: n < 0");
+        return;
+    }
+    for (GLsizei i = 0; i < n; i++) {
+        GLBuffer *b = buffers[i] != 0 ? find_buffer(c, buffers[i]) : NULL;
+        GLBuffer **p;
+
+        if (b == NULL)
+            continue;
+        if (c->array.array_buffer == b)
+            c->array.array_buffer = NULL;
+        if (c->array.element_buffer == b)
+            c->array.element_buffer = NULL;
+        for (int j = 0; j < 4; j++) {
+            if (arrays[j]->buffer == b) {
+                arrays[j]->buffer = NULL;
+                arrays[j]->converted = NULL;
+            }
+        }
+        for (p = &c->shared_state.buffer_hash_table[b->handle % BUFFER_HASH_TABLE_SIZE]; *p != b; p = &(*p)->next)
+            ;
+        *p = b->next;
+        free_buffer(b);
+    }
+}
+
+void glBindBuffer(GLenum target, GLuint buffer) {
+    GLContext *c = gl_get_context();
+    GLBuffer *b = NULL;
+
+    if (target != GL_ARRAY_BUFFER && target != GL_ELEMENT_ARRAY_BUFFER) {
+        gl_error(GL_INVALID_ENUM, "glBindBuffer: bad target");
+        return;
+    }
+    if (buffer != 0) {
+        b = find_buffer(c, buffer);
+        if (b == NULL) {
+            b = alloc_buffer(c, buffer);
+            if (b == NULL)
+                return;
+        }
+    }
+    if (target == GL_ARRAY_BUFFER)
+        c->array.array_buffer = b;
+    else
+        c->array.element_buffer = b;
+}
+
+void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage) {
+    GLContext *c = gl_get_context();
+    GLBuffer *b;
+    GLubyte *p;
+
+    if (usage != GL_STATIC_DRAW && usage != GL_DYNAMIC_DRAW) {
+        gl_error(GL_INVALID_ENUM, "glBufferData: bad usage");
+        return;
+    }
+    if (size < 0) {
+        gl_error(GL_INVALID_VALUE, "glBufferData: size < 0");
+        return;
+    }
+    b = gl_bound_buffer(c, target, "glBufferData: no buffer bound");
+    if (b == NULL)
+        return;
+    p = (GLubyte *)malloc(size > 0 ? size : 1);
+    if (p == NULL) {
+        gl_error(GL_OUT_OF_MEMORY, "glBufferData: failed to allocate the data");
+        return;
+    }
+    if (data != NULL)
+        memcpy(p, data, size);
+    else
+        memset(p, 0, size);
+    gl_buffer_drop_arrays(b);
+    free(b->data);
+    b->data = p;
+    b->size = size;
+    b->usage = usage;
+}
+
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data) {
+    GLContext *c = gl_get_context();
+    GLBuffer *b = gl_bound_buffer(c, target, "glBufferSubData: no buffer bound");
+
+    if (b == NULL)
+        return;
+    if (offset < 0 || size < 0 || offset + size > b->size) {
+        gl_error(GL_INVALID_VALUE, "glBufferSubData: out of the buffer");
+        return;
+    }
+    gl_buffer_drop_arrays(b);
+    memcpy(b->data + offset, data, size);
+}
+
+GLboolean glIsBuffer(GLuint buffer) {
+    return buffer != 0 && find_buffer(gl_get_context(), buffer) != NULL ? GL_TRUE : GL_FALSE;
+}
+
+void glGetBufferParameteriv(GLenum target, GLenum pname, GLint *params) {
+    GLContext *c = gl_get_context();
+    GLBuffer *b = gl_bound_buffer(c, target, "glGetBufferParameteriv: no buffer bound");
+
+    if (b == NULL)
+        return;
+    switch (pname) {
+    case GL_BUFFER_SIZE:
+        *params = b->size;
+        break;
+    case GL_BUFFER_USAGE:
+        *params = b->usage;
+        break;
+    default:
+        gl_error(GL_INVALID_ENUM, "glGetBufferParameteriv: bad pname");
+        break;
+    }
+}
+
+} // namespace fp
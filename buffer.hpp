@@ -0,0 +1,56 @@
+#pragma once
+
+#include "mygl.h"
+#include "fixed_point_type.hpp"
+
+/*
+ * Buffer objects. The data of a buffer is kept as uploaded. Each array
+ * drawn from it is converted once to tGLfixed columns, one per
+ * component, which the draws read without any conversion until the data
+ * changes.
+ */
+
+#define BUFFER_HASH_TABLE_SIZE 64
+
+namespace fp {
+
+struct GLContext;
+struct GLArray;
+
+/* the elements first + k, or indices[k] if not NULL, to the nb columns of out */
+typedef void (*GLArrayFetch)(const GLArray *a, int first, const GLushort *indices, int n,
+                             tGLfixed *const *out, int nb);
+
+/* an array of a buffer, converted */
+struct GLBufferArray {
+    GLBufferArray *next;
+    GLArrayFetch fetch; /* of the type, size and conversion of the array */
+    GLintptr offset;
+    int stride;
+    int count;            /* elements in the buffer from offset */
+    tGLfixed *columns[4]; /* count each, the missing components being 0, 0, 0, 1 */
+};
+
+struct GLBuffer {
+    GLuint handle;
+    GLubyte *data;
+    GLsizeiptr size;
+    GLenum usage;
+    GLBufferArray *arrays; /* dropped when the data changes */
+    GLBuffer *next;        /* in the hash table */
+};
+
+void glGenBuffers(GLsizei n, GLuint *buffers);
+void glDeleteBuffers(GLsizei n, const GLuint *buffers);
+void glBindBuffer(GLenum target, GLuint buffer);
+void glBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage);
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data);
+GLboolean glIsBuffer(GLuint buffer);
+void glGetBufferParameteriv(GLenum target, GLenum pname, GLint *params);
+
+GLBuffer *find_buffer(GLContext *c, GLuint h);
+/* the converted arrays of b */
+void gl_buffer_drop_arrays(GLBuffer *b);
+void gl_free_buffers(GLContext *c);
+
+} // namespace fp
@@ -2,8 +2,23 @@
 
 namespace fp {
 
+/* z range and depth tests of the other half of the z buffer */
+static void gl_flip_depth(GLContext *c) {
+    ZB_flipDepth(c->zb);
+    c->viewport.updated = 1;
+    c->fragment_state_updated = 1;
+}
+
 void glClearColor4xv(const tGLfixed* v) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[4];
+        for (int i = 0; i < 4; i++)
+            p[i].i = v[i].data();
+        gl_compile_state(c, GL_LIST_CLEAR_COLOR, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->clear.color.X = v[0];
     c->clear.color.Y = v[1];
     c->clear.color.Z = v[2];
@@ -12,6 +27,16 @@ void glClearColor4xv(const tGLfixed* v) {
 
 void glClearColor4x(const tGLfixed& r, const tGLfixed& g, const tGLfixed& b, const tGLfixed& a) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[4];
+        p[0].i = r.data();
+        p[1].i = g.data();
+        p[2].i = b.data();
+        p[3].i = a.data();
+        gl_compile_state(c, GL_LIST_CLEAR_COLOR, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->clear.color.X = r;
     c->clear.color.Y = g;
     c->clear.color.Z = b;
@@ -20,6 +45,13 @@ void glClearColor4x(const tGLfixed& r, const tGLfixed& g, const tGLfixed& b, con
 
 void glClearDepth(double depth) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].i = tGLfixed(depth).data();
+        gl_compile_state(c, GL_LIST_CLEAR_DEPTH, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->clear.depth = depth;
 }
 
@@ -29,11 +61,54 @@ void glClear(GLbitfield mask) {
     int r = (int)(c->clear.color.X * 65535);
     int g = (int)(c->clear.color.Y * 65535);
     int b = (int)(c->clear.color.Z * 65535);
+    /* glDepthMask() also masks the clear of the z buffer */
+    int clear_z = (mask & GL_DEPTH_BUFFER_BIT) && c->depth_mask;
 
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].ui = mask;
+        gl_compile_state(c, GL_LIST_CLEAR, p);
+        if (!c->exec_flag)
+            return;
+    }
     /* TODO : correct value of Z */
 
-    ZB_clear(c->zb, mask & GL_DEPTH_BUFFER_BIT, z,
-             mask & GL_COLOR_BUFFER_BIT, r, g, b);
+    /*
+     * the next frame goes to the other half of the z buffer, really cleared
+     * every depth_parity frames. The bands keep no z between the frames.
+     */
+    if (clear_z && c->depth_parity > 0 && c->zb->band_rows == 0) {
+        gl_flip_depth(c);
+        if (++c->depth_parity_frame < c->depth_parity)
+            clear_z = 0;
+        else
+            c->depth_parity_frame = 0;
+        /* the farthest z of the reversed half */
+        if (c->zb->depth_flip)
+            z = (1 << ZB_Z_BITS) - 1;
+    }
+
+    ZB_clear(c->zb, clear_z, z, mask & GL_COLOR_BUFFER_BIT, r, g, b);
+}
+
+/*
+ * Non standard: skip the depth clears of frames covering the whole z
+ * buffer, by alternating the depth range between its two halves (see
+ * ZB_flipDepth()). One glClear(GL_DEPTH_BUFFER_BIT) out of frames really
+ * clears the z buffer, 0 turns it off.
+ */
+void glDepthParity(int frames) {
+    GLContext *c = gl_get_context();
+
+    c->depth_parity = frames > 0 ? frames : 0;
+    /* the next depth clear is a real one */
+    c->depth_parity_frame = c->depth_parity - 1;
+    if (c->depth_parity == 0 && c->zb->depth_flip) {
+        /* the z buffer holds reversed z until the next clear */
+        gl_flip_depth(c);
+        ZB_hizClear(c->zb, 0);
+    }
+    c->viewport.updated = 1;
 }
 
 } // namespace fp
@@ -1,4 +1,6 @@
 #include "zgl.hpp"
+#include "ztile.hpp"
+#include "zjit.hpp"
 
 /* fill triangle profile */
 /* #define PROFILE */
@@ -13,23 +15,39 @@
 namespace fp {
 
 void gl_transform_to_viewport(GLContext *c, GLVertex *v) {
-    tGLfixed winv;
+    tGLfixed winv, zn;
+    int z;
 
     /* coordinates */
     winv = 1.0 / v->pc.W;
     v->zp.x = (int)(v->pc.X * winv * c->viewport.scale.X + c->viewport.trans.X);
     v->zp.y = (int)(v->pc.Y * winv * c->viewport.scale.Y + c->viewport.trans.Y);
-    v->zp.z = (int)(v->pc.Z * winv * c->viewport.scale.Z + c->viewport.trans.Z);
+    /* the z buffer range [0, 2^30[ does not fit in a tGLfixed, see gl_eval_viewport() */
+    zn = v->pc.Z * winv;
+    z = c->viewport.ztrans + zn.data() * c->viewport.zscale;
+    if (z < c->viewport.zmin)
+        z = c->viewport.zmin;
+    else if (z > c->viewport.zmax)
+        z = c->viewport.zmax;
+    v->zp.z = z;
+
+    gl_attribs_to_viewport(c, v);
+}
+
+/* color and texture coordinates of a vertex in the window */
+void gl_attribs_to_viewport(GLContext *c, GLVertex *v) {
     /* color */
     if (c->light.enabled) {
         v->zp.r = (int)(v->color.X * (ZB_POINT_RED_MAX - ZB_POINT_RED_MIN) + ZB_POINT_RED_MIN);
         v->zp.g = (int)(v->color.Y * (ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN) + ZB_POINT_GREEN_MIN);
         v->zp.b = (int)(v->color.Z * (ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN) + ZB_POINT_BLUE_MIN);
+        v->zp.a = (int)(v->color.W * (ZB_POINT_ALPHA_MAX - ZB_POINT_ALPHA_MIN) + ZB_POINT_ALPHA_MIN);
     } else {
         /* no need to convert to integer if no lighting : take current color */
         v->zp.r = c->current.longcolor[0];
         v->zp.g = c->current.longcolor[1];
         v->zp.b = c->current.longcolor[2];
+        v->zp.a = c->current.longcolor[3];
     }
 
     /* texture */
@@ -184,10 +202,12 @@ static inline void updateTmp(GLContext *c, GLVertex *q, GLVertex *p0, GLVertex *
         q->color.X = p0->color.X + (p1->color.X - p0->color.X) * t;
         q->color.Y = p0->color.Y + (p1->color.Y - p0->color.Y) * t;
         q->color.Z = p0->color.Z + (p1->color.Z - p0->color.Z) * t;
+        q->color.W = p0->color.W + (p1->color.W - p0->color.W) * t;
     } else {
         q->color.X = p0->color.X;
         q->color.Y = p0->color.Y;
         q->color.Z = p0->color.Z;
+        q->color.W = p0->color.W;
     }
 
     if (c->texture.enabled_2d) {
@@ -333,6 +353,13 @@ int count_triangles, count_triangles_textured, count_pixels;
 #endif
 
 void gl_draw_triangle_fill(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2) {
+    ZB_fillTriangleFunc fill;
+
+    if (c->fragment_state_updated)
+        gl_update_fragment_state(c);
+    if (c->zb->jit)
+        ZB_jitSpans(c->zb->state);
+
 #ifdef PROFILE
     {
         int norm;
@@ -354,11 +381,20 @@ void gl_draw_triangle_fill(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p
         count_triangles_textured++;
 #endif
         ZB_setTexture(c->zb, (PIXEL*)c->texture.current->images[0].pixmap);
-        ZB_fillTriangleMappingPerspective(c->zb, &p0->zp, &p1->zp, &p2->zp);
+        fill = ZB_fillTriangleMappingPerspective;
     } else if (c->current_shade_model == GL_SMOOTH) {
-        ZB_fillTriangleSmooth(c->zb, &p0->zp, &p1->zp, &p2->zp);
+        fill = ZB_fillTriangleSmooth;
+    } else {
+        fill = ZB_fillTriangleFlat;
+    }
+
+    ZB_damage(c->zb, MIN(MIN(p0->zp.x, p1->zp.x), p2->zp.x), MIN(MIN(p0->zp.y, p1->zp.y), p2->zp.y),
+              MAX(MAX(p0->zp.x, p1->zp.x), p2->zp.x), MAX(MAX(p0->zp.y, p1->zp.y), p2->zp.y));
+
+    if (c->zb->tiler != NULL) {
+        ZB_tileTriangle(c->zb, fill, &p0->zp, &p1->zp, &p2->zp);
     } else {
-        ZB_fillTriangleFlat(c->zb, &p0->zp, &p1->zp, &p2->zp);
+        fill(c->zb, &p0->zp, &p1->zp, &p2->zp);
     }
 }
 
@@ -1,4 +1,5 @@
 #include "zgl.hpp"
+#include "ztile.hpp"
 
 namespace fp {
 
@@ -20,12 +21,18 @@ static void gl_enable_disable_light(GLContext *c, int light, int v) {
 static int *gl_bit_pointer(GLContext *c, GLenum cap) {
 #define map(magic, attr) case magic: return &attr
     switch (cap) {
+        map(GL_ALPHA_TEST, c->alpha.enabled);
         map(GL_BLEND, c->blend.enabled);
         map(GL_COLOR_MATERIAL, c->material.color.enabled);
         map(GL_CULL_FACE, c->cull_face_enabled);
+        map(GL_DITHER, c->zb->dither);
         map(GL_DEPTH_TEST, c->depth_test);
         map(GL_LIGHTING, c->light.enabled);
         map(GL_TEXTURE_2D, c->texture.enabled_2d);
+        map(GL_HALF_SPACE_RASTER_TGL, c->zb->half_space);
+        map(GL_DEPTH_PREPASS_TGL, c->zb->depth_prepass);
+        map(GL_JIT_TGL, c->zb->jit);
+        map(GL_TILED_LAYOUT_TGL, c->zb->tiled);
         default:
             return NULL;
     }
@@ -41,6 +48,27 @@ static void gl_enable_disable(GLenum cap, int v) {
     GLContext *c = gl_get_context();
     int *bit;
     switch(cap) {
+        case GL_HALF_SPACE_RASTER_TGL:
+            /* the binned triangles are drawn with the rasterizer they were sent to */
+            ZB_tileFlush(c->zb);
+            c->zb->half_space = v;
+            break;
+        case GL_DEPTH_PREPASS_TGL:
+            /* the pending triangles are drawn in the mode they were sent in */
+            ZB_tileFlush(c->zb);
+            c->zb->depth_prepass = v;
+            if (gl_update_tiler(c) != 0) {
+                c->zb->depth_prepass = 0;
+                gl_error(GL_OUT_OF_MEMORY, "glEnable: out of memory");
+            }
+            break;
+        case GL_TILED_LAYOUT_TGL:
+            /* the frame is moved to the other layout, not available to the bands and the indexes */
+            if (ZB_setLayout(c->zb, v) != 0)
+                gl_error(GL_INVALID_OPERATION, "glEnable: no tiled layout");
+            else if (gl_update_tiler(c) != 0)
+                gl_error(GL_OUT_OF_MEMORY, "glEnable: out of memory");
+            break;
         offset_bit(GL_POLYGON_OFFSET_FILL, TGL_OFFSET_FILL);
                 // todo: undef
 //        offset_bit(GL_POLYGON_OFFSET_POINT, TGL_OFFSET_POINT);
@@ -50,6 +78,7 @@ static void gl_enable_disable(GLenum cap, int v) {
                 gl_enable_disable_light(c, cap - GL_LIGHT0, v);
             } else if ((bit = gl_bit_pointer(c, cap)) != NULL) {
                 *bit = v;
+                c->fragment_state_updated = 1;
             } else {
                 fprintf(stderr, "gl_enable_disable(): 0x%04X not supported\n", cap);
             }
@@ -59,10 +88,22 @@ static void gl_enable_disable(GLenum cap, int v) {
 }
 
 void glEnable(GLenum cap) {
+    GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_call(c, GL_LIST_ENABLE, cap, 0);
+        if (!c->exec_flag)
+            return;
+    }
     gl_enable_disable(cap, 1);
 }
 
 void glDisable(GLenum cap) {
+    GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_call(c, GL_LIST_DISABLE, cap, 0);
+        if (!c->exec_flag)
+            return;
+    }
     gl_enable_disable(cap, 0);
 }
 
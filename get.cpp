@@ -32,6 +32,12 @@ void glGetIntegerx(GLenum pname, GLint *params) {
         case GL_MAX_TEXTURE_STACK_DEPTH:
             *params = MAX_TEXTURE_STACK_DEPTH;
             break;
+        case GL_ARRAY_BUFFER_BINDING:
+            *params = c->array.array_buffer != NULL ? c->array.array_buffer->handle : 0;
+            break;
+        case GL_ELEMENT_ARRAY_BUFFER_BINDING:
+            *params = c->array.element_buffer != NULL ? c->array.element_buffer->handle : 0;
+            break;
         default:
             *params = 0;
             fprintf(stderr, "glGet: option not implemented: %x\n", pname);
@@ -15,6 +15,10 @@ extern "C" {
 
 /* Polygons */
 #define GL_FILL					0x1B02
+
+/* Display lists */
+#define GL_COMPILE				0x1300
+#define GL_COMPILE_AND_EXECUTE			0x1301
 /////////////////////////////////////
 /////////////////////////////////////
 
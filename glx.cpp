@@ -6,6 +6,7 @@
 #include <X11/extensions/XShm.h>
 
 #include "zgl.hpp"
+#include "ztile.hpp"
 
 namespace fp {
 
@@ -49,18 +50,30 @@ GLXContext glXCreateContext(Display *dpy, XVisualInfo *vis, GLXContext shareList
     if (shareList != NULL) {
         fprintf(stderr, "No sharing available in TinyGL");
     }
-    ctx = (TinyGLXContext*)malloc(sizeof(TinyGLXContext));
+    ctx = (TinyGLXContext*)calloc(1, sizeof(TinyGLXContext));
     ctx->gl_context = NULL;
     ctx->visual_info = *vis;
+    ctx->nb_images = 1;
+    ctx->present_display = NULL;
+    ctx->scale = 1.0f;
+    ctx->scale_min = 1.0f;
+    pthread_mutex_init(&ctx->present_lock, NULL);
+    pthread_cond_init(&ctx->present_cond, NULL);
     return (GLXContext) ctx;
 }
 
+static void glx_free_images(TinyGLXContext *ctx);
+static void glx_present_stop(TinyGLXContext *ctx);
 
 void glXDestroyContext(Display *dpy, GLXContext ctx1) {
     TinyGLXContext *ctx = (TinyGLXContext *) ctx1;
     if (ctx->gl_context != NULL) {
+        glx_free_images(ctx);
+        glx_present_stop(ctx);
         glClose();
     }
+    pthread_mutex_destroy(&ctx->present_lock);
+    pthread_cond_destroy(&ctx->present_cond);
     free(ctx);
 }
 
@@ -91,98 +104,200 @@ static int bits_per_pixel(Display *dpy, XVisualInfo *visinfo) {
     return bpp;
 }
 
-static int create_ximage(TinyGLXContext *ctx, int xsize, int ysize, int depth) {
+static int create_ximage(TinyGLXContext *ctx, Display *dpy, GC gc, TinyGLXImage *img, int xsize, int ysize, int depth) {
     int major, minor;
     Bool pixmaps;
     char *framebuffer;
+    XShmSegmentInfo *shm_info;
     int (*old_handler)(Display *, XErrorEvent *);
 
-    if (XShmQueryVersion(ctx->display, &major, &minor, &pixmaps))
-        ctx->shm_use = 1;
-    else
-        ctx->shm_use = 0;
+    img->shm_info = NULL;
+    img->busy = 0;
 
-    if (!ctx->shm_use) goto no_shm;
+    if (!ctx->shm_use || !XShmQueryVersion(dpy, &major, &minor, &pixmaps)) {
+        ctx->shm_use = 0;
+        goto no_shm;
+    }
 
-    ctx->shm_info = (XShmSegmentInfo*)malloc(sizeof(XShmSegmentInfo));
-    ctx->ximage = XShmCreateImage(ctx->display, None, depth, ZPixmap, NULL, ctx->shm_info, xsize, ysize);
-    if (ctx->ximage == NULL) {
+    shm_info = (XShmSegmentInfo*)malloc(sizeof(XShmSegmentInfo));
+    img->ximage = XShmCreateImage(dpy, None, depth, ZPixmap, NULL, shm_info, xsize, ysize);
+    if (img->ximage == NULL) {
         fprintf(stderr, "XShm: error: XShmCreateImage\n");
         ctx->shm_use = 0;
-        free(ctx->shm_info);
+        free(shm_info);
         goto no_shm;
     }
-    ctx->shm_info->shmid = shmget(IPC_PRIVATE, ctx->ysize*ctx->ximage->bytes_per_line, IPC_CREAT | 0777);
-    if (ctx->shm_info->shmid < 0) {
+    shm_info->shmid = shmget(IPC_PRIVATE, ysize*img->ximage->bytes_per_line, IPC_CREAT | 0777);
+    if (shm_info->shmid < 0) {
         fprintf(stderr, "XShm: error: shmget\n");
 no_shm1:
         ctx->shm_use = 0;
-        XDestroyImage(ctx->ximage);
+        XDestroyImage(img->ximage);
+        free(shm_info);
         goto no_shm;
     }
-    ctx->ximage->data = (char*)shmat(ctx->shm_info->shmid, 0, 0);
-    if (ctx->ximage->data == (char *) -1) {
+    img->ximage->data = (char*)shmat(shm_info->shmid, 0, 0);
+    if (img->ximage->data == (char *) -1) {
         fprintf(stderr, "XShm: error: shmat\n");
 no_shm2:
-        shmctl(ctx->shm_info->shmid, IPC_RMID, 0);
+        img->ximage->data = NULL;
+        shmctl(shm_info->shmid, IPC_RMID, 0);
         goto no_shm1;
     }
-    ctx->shm_info->shmaddr = ctx->ximage->data;
+    shm_info->shmaddr = img->ximage->data;
 
-    ctx->shm_info->readOnly = False;
+    shm_info->readOnly = False;
 
     /* attach & test X errors */
 
     glxXErrorFlag = 0;
     old_handler = XSetErrorHandler(glxHandleXError);
-    XShmAttach(ctx->display, ctx->shm_info);
-    XSync(ctx->display, False);
+    XShmAttach(dpy, shm_info);
+    XSync(dpy, False);
 
     if (glxXErrorFlag) {
-        XFlush(ctx->display);
-        shmdt(ctx->shm_info->shmaddr);
+        XFlush(dpy);
+        shmdt(shm_info->shmaddr);
         XSetErrorHandler(old_handler);
         goto no_shm2;
     }
 
     /* the shared memory will be automatically deleted */
-    shmctl(ctx->shm_info->shmid, IPC_RMID, 0);
+    shmctl(shm_info->shmid, IPC_RMID, 0);
 
     /* test with a dummy XShmPutImage */
-    XShmPutImage(ctx->display, ctx->drawable, ctx->gc, ctx->ximage, 0, 0, 0, 0, 1, 1, False);
+    XShmPutImage(dpy, ctx->drawable, gc, img->ximage, 0, 0, 0, 0, 1, 1, False);
 
-    XSync(ctx->display, False);
+    XSync(dpy, False);
     XSetErrorHandler(old_handler);
 
     if (glxXErrorFlag) {
         fprintf(stderr, "XShm: error: XShmPutImage\n");
-        XFlush(ctx->display);
-        shmdt(ctx->shm_info->shmaddr);
+        XFlush(dpy);
+        shmdt(shm_info->shmaddr);
         goto no_shm2;
     }
 
-    ctx->CompletionType = XShmGetEventBase(ctx->display) + ShmCompletion;
+    img->shm_info = shm_info;
     /* shared memory is OK !! */
 
     return 0;
 
 no_shm:
-    ctx->ximage = XCreateImage(ctx->display, None, depth, ZPixmap, 0, NULL, xsize, ysize, 8, 0);
-    framebuffer = (char*)malloc(ysize * ctx->ximage->bytes_per_line);
-    free(ctx->ximage->data);
-    ctx->ximage->data = framebuffer;
+    img->ximage = XCreateImage(dpy, None, depth, ZPixmap, 0, NULL, xsize, ysize, 8, 0);
+    framebuffer = (char*)malloc(ysize * img->ximage->bytes_per_line);
+    free(img->ximage->data);
+    img->ximage->data = framebuffer;
     return 0;
 }
 
-static void free_ximage(TinyGLXContext *ctx) {
-    if (ctx->shm_use) {
-        XShmDetach(ctx->display, ctx->shm_info);
-        XDestroyImage(ctx->ximage);
-        shmdt(ctx->shm_info->shmaddr);
-        free(ctx->shm_info);
+static void free_ximage(Display *dpy, TinyGLXImage *img) {
+    if (img->shm_info != NULL) {
+        XShmDetach(dpy, img->shm_info);
+        shmdt(img->shm_info->shmaddr);
+        img->ximage->data = NULL;
+        XDestroyImage(img->ximage);
+        free(img->shm_info);
     } else {
-        XDestroyImage(ctx->ximage);
+        XDestroyImage(img->ximage);
+    }
+    img->ximage = NULL;
+}
+
+static unsigned long long glx_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* wait for the present thread to show all the queued images */
+static void glx_present_drain(TinyGLXContext *ctx) {
+    if (ctx->present_display == NULL) return;
+    pthread_mutex_lock(&ctx->present_lock);
+    while (ctx->nb_queued > 0)
+        pthread_cond_wait(&ctx->present_cond, &ctx->present_lock);
+    pthread_mutex_unlock(&ctx->present_lock);
+}
+
+static void glx_free_images(TinyGLXContext *ctx) {
+    Display *dpy = ctx->present_display != NULL ? ctx->present_display : ctx->display;
+    int i;
+
+    glx_present_drain(ctx);
+    for (i = 0; i < GLX_MAX_IMAGES; i++) {
+        if (ctx->images[i].ximage != NULL)
+            free_ximage(dpy, &ctx->images[i]);
+        ZB_damageFree(&ctx->images[i].damage);
+    }
+    ctx->ximage = NULL;
+}
+
+/* the images of the present thread belong to its connection */
+static int glx_create_images(TinyGLXContext *ctx) {
+    Display *dpy = ctx->present_display != NULL ? ctx->present_display : ctx->display;
+    GC gc = ctx->present_display != NULL ? ctx->present_gc : ctx->gc;
+    int i;
+
+    for (i = 0; i < ctx->nb_images; i++) {
+        if (create_ximage(ctx, dpy, gc, &ctx->images[i], ctx->xsize, ctx->ysize, ctx->visual_info.depth) != 0 ||
+            ZB_damageResize(&ctx->images[i].damage, ctx->xsize, ctx->ysize) != 0)
+            return -1;
     }
+    ctx->image = 0;
+    ctx->ximage = ctx->images[0].ximage;
+    return 0;
+}
+
+/* the zbuffer is smaller than the window, the frames are scaled up */
+static int glx_scaled(TinyGLXContext *ctx) {
+    ZBuffer *zb = ctx->gl_context->zb;
+
+    return zb->xsize != ctx->xsize || zb->ysize != ctx->ysize;
+}
+
+/* the zbuffer draws in the ximage, no frame is copied to it */
+static int glx_draws_in_image(TinyGLXContext *ctx) {
+    return !ctx->do_convert && !glx_scaled(ctx) && !ctx->gl_context->zb->tiled;
+}
+
+/* the zbuffer draws in the current ximage, or goes back to it from the tiles */
+static void glx_image_buffer(TinyGLXContext *ctx) {
+    ZBuffer *zb = ctx->gl_context->zb;
+
+    if (glx_draws_in_image(ctx))
+        zb->pbuf = (PIXEL *)ctx->ximage->data;
+    else if (zb->tiled && !ctx->do_convert && !glx_scaled(ctx))
+        zb->linear_buffer = ctx->ximage->data;
+}
+
+/* size the zbuffer at scale of the window */
+static void glx_set_scale(TinyGLXContext *ctx, float scale) {
+    GLContext *c = ctx->gl_context;
+    ZBuffer *zb = c->zb;
+    int xsize = ctx->xsize, ysize = ctx->ysize;
+
+    if (scale < 1.0f) {
+        xsize = ((int)(xsize * scale) & ~3);
+        ysize = ((int)(ysize * scale) & ~3);
+        if (xsize < 4) xsize = 4;
+        if (ysize < 4) ysize = 4;
+    }
+    ctx->scale = scale;
+
+    /* the zbuffer draws in the ximage only at the size of the window */
+    if (ctx->do_convert || xsize != ctx->xsize || ysize != ctx->ysize) {
+        ZB_resize(zb, NULL, xsize, ysize);
+    } else {
+        ZB_resize(zb, ctx->ximage->data, xsize, ysize);
+        ZB_setFrameBuffer(zb, ctx->ximage->data, ctx->ximage->bytes_per_line);
+    }
+
+    c->viewport.xratio = (int)(((long long)xsize << 16) / ctx->xsize);
+    c->viewport.yratio = (int)(((long long)ysize << 16) / ctx->ysize);
+    c->viewport.updated = 1;
+    /* the new z buffer holds nothing of the frames before */
+    c->depth_parity_frame = c->depth_parity - 1;
 }
 
 /* resize the glx viewport : we try to use the xsize and ysize
@@ -207,20 +322,16 @@ int glX_resize_viewport(GLContext *c, int *xsize_ptr, int *ysize_ptr) {
     *xsize_ptr = xsize;
     *ysize_ptr = ysize;
 
-    if (ctx->ximage != NULL) free_ximage(ctx);
+    glx_free_images(ctx);
 
     ctx->xsize = xsize;
     ctx->ysize = ysize;
 
-    if (create_ximage(ctx, ctx->xsize, ctx->ysize, ctx->visual_info.depth) != 0)
+    if (glx_create_images(ctx) != 0)
         return -1;
 
     /* resize the Z buffer */
-    if (ctx->do_convert) {
-        ZB_resize(c->zb, NULL, xsize, ysize);
-    } else {
-        ZB_resize(c->zb, ctx->ximage->data, xsize, ysize);
-    }
+    glx_set_scale(ctx, ctx->scale);
     return 0;
 }
 
@@ -251,6 +362,7 @@ Bool glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx1) {
         /* ximage structure */
         ctx->ximage = NULL;
         ctx->shm_use = 1; /* use shm */
+        ctx->CompletionType = XShmGetEventBase(ctx->display) + ShmCompletion;
 
         if (attr.depth == 8) {
             /* get the colormap from the window */
@@ -296,8 +408,9 @@ Bool glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx1) {
                     ctx->do_convert = 0;
                     break;
                 default:
+                    /* drawn in 5R6G5B straight into the ximage */
                     mode = ZB_MODE_5R6G5B;
-                    ctx->do_convert = 1;
+                    ctx->do_convert = bpp != 16;
                     break;
             }
             zb = ZB_open(xsize, ysize, mode, 0, NULL, NULL, NULL);
@@ -328,35 +441,319 @@ Bool glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx1) {
 
 static Bool WaitForShmCompletion(Display *dpy, XEvent *event, char *arg) {
     TinyGLXContext *ctx = (TinyGLXContext *) arg;
+    int type = dpy == ctx->present_display ? ctx->present_completion : ctx->CompletionType;
+
+    return (event->type == type) && (((XShmCompletionEvent *)event)->drawable == (Window)ctx->drawable);
+}
+
+/* draw the damage of the ximage and wait for the server to be done with it */
+static void glx_put_image(TinyGLXContext *ctx, Display *dpy, Drawable drawable, GC gc, TinyGLXImage *img) {
+    int i;
+
+    for (i = 0; i < img->nb_rects; i++) {
+        ZBRect *r = &img->rects[i];
+
+        if (img->shm_info != NULL) {
+            /* the server handles them in order, the last one completes all of them */
+            XShmPutImage(dpy, drawable, gc, img->ximage, r->xmin, r->ymin, r->xmin, r->ymin,
+                         r->xmax - r->xmin, r->ymax - r->ymin, i == img->nb_rects - 1);
+        } else {
+            XPutImage(dpy, drawable, gc, img->ximage, r->xmin, r->ymin, r->xmin, r->ymin,
+                      r->xmax - r->xmin, r->ymax - r->ymin);
+        }
+    }
+    if (img->shm_info != NULL && img->nb_rects > 0) {
+        XEvent event;
+
+        XIfEvent(dpy, &event, WaitForShmCompletion, (char*)ctx);
+    }
+    XFlush(dpy);
+}
+
+/* an image queued at swap_time was shown from start to end */
+static void glx_present_count(TinyGLXContext *ctx, unsigned long long swap_time,
+                              unsigned long long start, unsigned long long end) {
+    TinyGLXPresentStats *stats = &ctx->stats;
+    unsigned long long latency = end - swap_time;
+
+    if (stats->frames == 0) ctx->first_time = end;
+    ctx->last_time = end;
+    stats->frames++;
+    stats->latency_ns += latency;
+    if (latency > stats->latency_max_ns) stats->latency_max_ns = latency;
+    stats->busy_ns += end - start;
+}
+
+/*
+ * Shows the queued images in order. Only this thread uses present_display
+ * while it runs, glXSwapBuffers() waits for the queue to be empty before
+ * the images are created or freed on it.
+ */
+static void *glx_present_thread(void *arg) {
+    TinyGLXContext *ctx = (TinyGLXContext *)arg;
+    unsigned long long start, end;
+    TinyGLXImage *img;
+
+    pthread_mutex_lock(&ctx->present_lock);
+    for (;;) {
+        while (ctx->nb_queued == 0 && !ctx->present_quit)
+            pthread_cond_wait(&ctx->present_cond, &ctx->present_lock);
+        if (ctx->nb_queued == 0) break;
+        img = &ctx->images[ctx->queue[ctx->queue_head]];
+        pthread_mutex_unlock(&ctx->present_lock);
+
+        start = glx_time();
+        glx_put_image(ctx, ctx->present_display, ctx->drawable, ctx->present_gc, img);
+        end = glx_time();
+
+        pthread_mutex_lock(&ctx->present_lock);
+        ctx->queue_head = (ctx->queue_head + 1) % GLX_MAX_IMAGES;
+        ctx->nb_queued--;
+        img->busy = 0;
+
+        glx_present_count(ctx, img->swap_time, start, end);
+        pthread_cond_broadcast(&ctx->present_cond);
+    }
+    pthread_mutex_unlock(&ctx->present_lock);
+    return NULL;
+}
+
+/* a second connection, Xlib is not called from two threads on one */
+static int glx_present_start(TinyGLXContext *ctx) {
+    ctx->present_display = XOpenDisplay(DisplayString(ctx->display));
+    if (ctx->present_display == NULL) return -1;
+    ctx->present_gc = XCreateGC(ctx->present_display, ctx->drawable, 0, 0);
+    ctx->present_completion = XShmGetEventBase(ctx->present_display) + ShmCompletion;
+    ctx->present_quit = 0;
+    ctx->queue_head = 0;
+    ctx->nb_queued = 0;
+    if (pthread_create(&ctx->present_thread, NULL, glx_present_thread, ctx) != 0) {
+        XFreeGC(ctx->present_display, ctx->present_gc);
+        XCloseDisplay(ctx->present_display);
+        ctx->present_display = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* the images of the present thread must be freed before */
+static void glx_present_stop(TinyGLXContext *ctx) {
+    if (ctx->present_display == NULL) return;
+    pthread_mutex_lock(&ctx->present_lock);
+    ctx->present_quit = 1;
+    pthread_cond_broadcast(&ctx->present_cond);
+    pthread_mutex_unlock(&ctx->present_lock);
+    pthread_join(ctx->present_thread, NULL);
+    XFreeGC(ctx->present_display, ctx->present_gc);
+    XCloseDisplay(ctx->present_display);
+    ctx->present_display = NULL;
+}
+
+/* pixels of the rectangles from src to dst, ximages of the same size */
+static void glx_copy_rects(XImage *dst, XImage *src, const ZBRect *rects, int nb_rects) {
+    int i, y, bytes = src->bits_per_pixel / 8;
+
+    for (i = 0; i < nb_rects; i++) {
+        const ZBRect *r = &rects[i];
+
+        for (y = r->ymin; y < r->ymax; y++) {
+            memcpy(dst->data + y * dst->bytes_per_line + r->xmin * bytes,
+                   src->data + y * src->bytes_per_line + r->xmin * bytes, (r->xmax - r->xmin) * bytes);
+        }
+    }
+}
 
-    return (event->type == ctx->CompletionType) && (((XShmCompletionEvent *)event)->drawable == (Window)ctx->drawable);
+/* queue the image drawn and switch to a free one */
+static void glx_present_queue(TinyGLXContext *ctx) {
+    TinyGLXImage *img = &ctx->images[ctx->image];
+    unsigned long long start;
+    int i;
+
+    pthread_mutex_lock(&ctx->present_lock);
+    img->busy = 1;
+    img->swap_time = glx_time();
+    ctx->queue[(ctx->queue_head + ctx->nb_queued) % GLX_MAX_IMAGES] = ctx->image;
+    ctx->nb_queued++;
+    pthread_cond_broadcast(&ctx->present_cond);
+
+    start = glx_time();
+    for (;;) {
+        for (i = 0; i < ctx->nb_images; i++) {
+            if (!ctx->images[i].busy) break;
+        }
+        if (i < ctx->nb_images) break;
+        pthread_cond_wait(&ctx->present_cond, &ctx->present_lock);
+    }
+    ctx->stats.wait_ns += glx_time() - start;
+    pthread_mutex_unlock(&ctx->present_lock);
+
+    ctx->image = i;
+    ctx->ximage = ctx->images[i].ximage;
+
+    /*
+     * the zbuffer draws in the images: the next one gets the frames it
+     * missed from the one just queued, only read by the server
+     */
+    if (glx_draws_in_image(ctx)) {
+        ZBRect rects[GLX_MAX_RECTS];
+        int nb_rects;
+
+        nb_rects = ZB_damageRects(ctx->gl_context->zb, &ctx->images[i].damage, rects, GLX_MAX_RECTS);
+        glx_copy_rects(ctx->ximage, img->ximage, rects, nb_rects);
+        ZB_damageReset(&ctx->images[i].damage);
+    }
+}
+
+/*
+ * The time of the frames goes with their pixels, the square of the scale:
+ * it goes down at once to the scale expected to draw them in target_ms and
+ * up by steps when the next one is expected to stay under it.
+ */
+static void glx_update_scale(TinyGLXContext *ctx, unsigned long long now) {
+    float frame_ms, scale, step = 1.0f / 16, up;
+
+    if (ctx->target_ms <= 0.0f || ctx->frame_start == 0)
+        return;
+    frame_ms = (now - ctx->frame_start) / 1e6f;
+    ctx->frame_ms = ctx->frame_ms == 0.0f ? frame_ms : ctx->frame_ms * 0.75f + frame_ms * 0.25f;
+
+    scale = ctx->scale;
+    if (ctx->frame_ms > ctx->target_ms) {
+        scale = floorf(scale * sqrtf(ctx->target_ms / ctx->frame_ms) / step) * step;
+    } else {
+        up = (scale + step) / scale;
+        if (ctx->frame_ms * up * up < 0.9f * ctx->target_ms)
+            scale += step;
+    }
+    if (scale < ctx->scale_min) scale = ctx->scale_min;
+    if (scale > 1.0f) scale = 1.0f;
+    if (scale != ctx->scale) {
+        glx_set_scale(ctx, scale);
+        ctx->frame_ms = 0.0f;
+    }
 }
 
 void glXSwapBuffers(Display *dpy, GLXDrawable drawable) {
     GLContext *gl_context;
     TinyGLXContext *ctx;
+    ZBuffer *zb;
+    TinyGLXImage *img;
+    ZBRect rects[GLX_MAX_RECTS];
+    unsigned long long now = glx_time();
+    int i, nb_rects;
 
     /* retrieve the current GLXContext */
     gl_context = gl_get_context();
     ctx = (TinyGLXContext *)gl_context->opaque;
-
-    /* for non 16 bits visuals, a conversion is required */
-    if (ctx->do_convert) {
-        ZB_copyFrameBuffer(ctx->gl_context->zb, ctx->ximage->data, ctx->ximage->bytes_per_line);
+    zb = gl_context->zb;
+    img = &ctx->images[ctx->image];
+
+    /* the binned triangles must be drawn before the image is shown */
+    ZB_tileFlush(zb);
+
+    /* the damage of the frame is missing from all the images */
+    for (i = 0; i < ctx->nb_images; i++)
+        ZB_damageAdd(&ctx->images[i].damage, &zb->damage);
+    img->nb_rects = ZB_damageRects(zb, &zb->damage, img->rects, GLX_MAX_RECTS);
+    ZB_damageReset(&zb->damage);
+
+    if (glx_scaled(ctx)) {
+        /* the whole window is shown, the frame is in none of the images */
+        ZBRect *r = &img->rects[0];
+
+        ZB_scaleFrameBuffer(zb, ctx->ximage->data, ctx->ximage->bytes_per_line, ctx->xsize, ctx->ysize, ctx->filter);
+        r->xmin = r->ymin = 0;
+        r->xmax = ctx->xsize;
+        r->ymax = ctx->ysize;
+        img->nb_rects = 1;
+        for (i = 0; i < ctx->nb_images; i++)
+            ZB_damageAll(&ctx->images[i].damage);
+    } else if (ctx->do_convert || zb->tiled) {
+        /* for the visuals the zbuffer does not draw in and the tiles, a conversion is required */
+        nb_rects = ZB_damageRects(zb, &img->damage, rects, GLX_MAX_RECTS);
+        ZB_copyFrameBufferRects(zb, ctx->ximage->data, ctx->ximage->bytes_per_line, rects, nb_rects);
+    } else {
+        /* the zbuffer draws in the ximage, the tiles not drawn since the clear are still to clear */
+        ZB_clearResolve(zb, 0, 0, ctx->xsize - 1, ctx->ysize - 1);
     }
+    ZB_damageReset(&img->damage);
 
-    /* draw the ximage */
-    if (ctx->shm_use) {
-        XEvent event;
+    if (ctx->present_display == NULL) {
+        unsigned long long start = glx_time();
 
-        XShmPutImage(dpy, drawable, ctx->gc, ctx->ximage, 0, 0, 0, 0, ctx->ximage->width, ctx->ximage->height, True);
-        XIfEvent(dpy, &event, WaitForShmCompletion, (char*)ctx);
+        glx_put_image(ctx, dpy, drawable, ctx->gc, &ctx->images[0]);
+        glx_present_count(ctx, start, start, glx_time());
     } else {
-        XPutImage(dpy, drawable, ctx->gc, ctx->ximage, 0, 0, 0, 0, ctx->ximage->width, ctx->ximage->height);
+        /* the next frame is drawn while the present thread shows this one */
+        glx_present_queue(ctx);
+        glx_image_buffer(ctx);
     }
-    XFlush(dpy);
+
+    /* the size of the next frame, with the ximage to draw in */
+    glx_update_scale(ctx, now);
+    ctx->frame_start = glx_time();
 }
 
+int glXPresentQueue(int nb_images) {
+    GLContext *gl_context = gl_get_context();
+    TinyGLXContext *ctx = (TinyGLXContext *)gl_context->opaque;
+
+    if (nb_images < 1) nb_images = 1;
+    if (nb_images > GLX_MAX_IMAGES) nb_images = GLX_MAX_IMAGES;
+    if (nb_images == ctx->nb_images) return nb_images;
+
+    /* the image drawn so far is lost, as after a swap */
+    ZB_tileFlush(gl_context->zb);
+    glx_free_images(ctx);
+    if (nb_images == 1) {
+        glx_present_stop(ctx);
+    } else if (ctx->present_display == NULL && glx_present_start(ctx) != 0) {
+        fprintf(stderr, "glXPresentQueue: cannot open a second connection to the server\n");
+        nb_images = 1;
+    }
+    ctx->nb_images = nb_images;
+    ctx->stats.nb_images = nb_images;
+
+    if (glx_create_images(ctx) != 0) {
+        fprintf(stderr, "glXPresentQueue: cannot create the images\n");
+        exit(1);
+    }
+    glx_image_buffer(ctx);
+    ZB_damageAll(&gl_context->zb->damage);
+    return nb_images;
+}
+
+void glXPresentStats(TinyGLXPresentStats *stats) {
+    TinyGLXContext *ctx = (TinyGLXContext *)gl_get_context()->opaque;
+
+    pthread_mutex_lock(&ctx->present_lock);
+    *stats = ctx->stats;
+    stats->nb_images = ctx->nb_images;
+    stats->time_ns = ctx->last_time - ctx->first_time;
+    pthread_mutex_unlock(&ctx->present_lock);
+}
+
+void glXDynamicResolution(float target_ms, float min_scale, int filter) {
+    TinyGLXContext *ctx = (TinyGLXContext *)gl_get_context()->opaque;
+
+    if (ctx->gl_context->zb->mode == ZB_MODE_INDEX)
+        target_ms = 0.0f;
+    if (min_scale > 1.0f) min_scale = 1.0f;
+    if (min_scale < 1.0f / 16) min_scale = 1.0f / 16;
+    ctx->target_ms = target_ms;
+    ctx->scale_min = min_scale;
+    ctx->filter = filter == ZB_FILTER_BILINEAR ? ZB_FILTER_BILINEAR : ZB_FILTER_NEAREST;
+    ctx->frame_ms = 0.0f;
+    ctx->frame_start = 0;
+
+    /* the image drawn so far is lost, as after a swap */
+    if (target_ms <= 0.0f && ctx->scale != 1.0f)
+        glx_set_scale(ctx, 1.0f);
+}
+
+float glXResolutionScale(void) {
+    return ((TinyGLXContext *)gl_get_context()->opaque)->scale;
+}
 
 void glXWaitGL() {}
 
@@ -3,25 +3,74 @@
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <X11/extensions/XShm.h>
+#include <pthread.h>
 
 #include "zgl.hpp"
 
 namespace fp {
 
+/* color buffers of the context, see glXPresentQueue() */
+#define GLX_MAX_IMAGES 3
+
+/* rectangles of the damage shown by glXSwapBuffers(), beyond it their bounding rectangle */
+#define GLX_MAX_RECTS 16
+
+typedef struct {
+    XImage *ximage;
+    XShmSegmentInfo *shm_info; /* NULL without shared memory */
+    int busy; /* queued or being shown */
+    unsigned long long swap_time; /* when glXSwapBuffers() queued it */
+    /* the frames drawn since it was last written, to update before it is shown */
+    ZBDamage damage;
+    /* the damage of its frame, which is all that is sent to the server */
+    ZBRect rects[GLX_MAX_RECTS];
+    int nb_rects;
+} TinyGLXImage;
+
+typedef struct {
+    int nb_images;        /* 1 when glXSwapBuffers() shows the image itself */
+    unsigned int frames;  /* images shown */
+    unsigned long long latency_ns, latency_max_ns; /* from glXSwapBuffers() to the image shown */
+    unsigned long long wait_ns; /* glXSwapBuffers() waiting for a free color buffer */
+    unsigned long long busy_ns; /* showing the images */
+    unsigned long long time_ns; /* from the first image shown to the last one */
+} TinyGLXPresentStats;
+
 typedef struct {
     GLContext *gl_context;
     Display *display;
     XVisualInfo visual_info;
     int xsize, ysize;
-    XImage *ximage;
+    XImage *ximage; /* of the color buffer drawn */
     GC gc;
     Colormap cmap;
     Drawable drawable;
     int do_convert; /* true if must do convertion to X11 format */
     /* shared memory */
     int shm_use;
-    XShmSegmentInfo *shm_info;
     int CompletionType;
+    /*
+     * color buffers: with more than one, the present thread shows them
+     * through its own connection to the server while the next frame is
+     * drawn in a free one
+     */
+    TinyGLXImage images[GLX_MAX_IMAGES];
+    int nb_images, image; /* image is the one drawn */
+    Display *present_display;
+    GC present_gc;
+    int present_completion;
+    pthread_t present_thread;
+    pthread_mutex_t present_lock;
+    pthread_cond_t present_cond;
+    int queue[GLX_MAX_IMAGES], queue_head, nb_queued;
+    int present_quit;
+    unsigned long long first_time, last_time;
+    TinyGLXPresentStats stats;
+    /* dynamic resolution, see glXDynamicResolution() */
+    float scale, scale_min;
+    float target_ms, frame_ms; /* frame_ms is the average, 0 after a change of scale */
+    int filter;
+    unsigned long long frame_start; /* end of the last glXSwapBuffers() */
 } TinyGLXContext;
 
 Bool glXQueryExtension(Display *dpy, int *errorb, int *event);
@@ -41,9 +90,9 @@ static int glxXErrorFlag = 0;
 static int glxHandleXError(Display *dpy, XErrorEvent *event);
 
 static int bits_per_pixel(Display *dpy, XVisualInfo *visinfo);
-static int create_ximage(TinyGLXContext *ctx, int xsize, int ysize, int depth);
+static int create_ximage(TinyGLXContext *ctx, Display *dpy, GC gc, TinyGLXImage *img, int xsize, int ysize, int depth);
 
-static void free_ximage(TinyGLXContext *ctx);
+static void free_ximage(Display *dpy, TinyGLXImage *img);
 
 /* resize the glx viewport : we try to use the xsize and ysize
    given. We return the effective size which is guaranted to be smaller */
@@ -56,6 +105,29 @@ Bool glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx1);
 static Bool WaitForShmCompletion(Display *dpy, XEvent *event, char *arg) ;
 void glXSwapBuffers(Display *dpy, GLXDrawable drawable) ;
 
+/*
+ * Number of color buffers of the current context, 1 to GLX_MAX_IMAGES.
+ * With 1 (the default) glXSwapBuffers() returns once the X server has
+ * copied the image. With more, it queues the image to a present thread
+ * and returns as soon as a color buffer is free to draw the next frame
+ * in. Returns the number of buffers in use.
+ */
+int glXPresentQueue(int nb_images);
+
+void glXPresentStats(TinyGLXPresentStats *stats);
+
+/*
+ * Draws the frames of the current context at a lower resolution when
+ * they take more than target_ms, down to min_scale of the window size,
+ * and scales them up to the window with filter (ZB_FILTER_NEAREST or
+ * ZB_FILTER_BILINEAR) when they are shown. target_ms <= 0 draws them at
+ * the size of the window again. Not available with a 8 bit visual.
+ */
+void glXDynamicResolution(float target_ms, float min_scale, int filter);
+
+/* size of the frames drawn per size of the window */
+float glXResolutionScale(void);
+
 void glXWaitGL();
 
 void glXWaitX();
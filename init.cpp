@@ -1,5 +1,6 @@
 #include "zgl.hpp"
 #include "matrix.hpp"
+#include "zsurface.hpp"
 #include <memory.h>
 
 namespace fp {
@@ -15,7 +16,20 @@ void initSharedState(GLContext *c) {
 
 void endSharedState(GLContext *c) {
     GLSharedState *s = &c->shared_state;
-    free(s->texture_hash_table);
+    GLTexture *t, *next;
+
+    /* the table is part of the context, only the textures are allocated */
+    for (int i = 0; i < TEXTURE_HASH_TABLE_SIZE; i++) {
+        for (t = s->texture_hash_table[i]; t != NULL; t = next) {
+            next = t->next;
+            for (int j = 0; j < MAX_TEXTURE_LEVELS; j++)
+                ZB_surfaceFree(t->images[j].pixmap);
+            free(t);
+        }
+        s->texture_hash_table[i] = NULL;
+    }
+    gl_free_buffers(c);
+    gl_free_lists(c);
 }
 
 void initLights(GLContext *c) {
@@ -90,6 +104,7 @@ void initState(GLContext *c) {
     c->current.longcolor[0] = 65535;
     c->current.longcolor[1] = 65535;
     c->current.longcolor[2] = 65535;
+    c->current.longcolor[3] = 65535;
 
     c->current.normal = {1.0, 0.0, 0.0, 0.0};
     c->current.edge_flag = 1;
@@ -124,6 +139,7 @@ void glInit(void *zbuffer1) {
         free(c);
         exit(1);  // Handle error appropriately
     }
+    c->vertex_cache.entries = new GLCachedVertex[VERTEX_HASH_SIZE];
 
     // Initialize shared state, lights, materials, and matrices
     initSharedState(c);
@@ -140,6 +156,9 @@ void glInit(void *zbuffer1) {
     c->specbuf_used_counter = 0;
     c->specbuf_num_buffers = 0;
     c->depth_test = 0;
+    c->depth_func = GL_LESS;
+    c->depth_mask = 1;
+    c->fragment_state_updated = 1;
     c->textsize = 1;
 }
 
@@ -153,6 +172,8 @@ void glClose() {
     // Delete vertex array
     delete[] c->vertex;
     c->vertex = nullptr;
+    delete[] c->vertex_cache.entries;
+    c->vertex_cache.entries = nullptr;
 
     // Delete GLContext
     delete c;
@@ -0,0 +1,264 @@
+/*
+ * Vertex transforms generated for the matrices of glBegin()
+ */
+#include "zgl.hpp"
+#include "zjit.hpp"
+#include "api.hpp"
+
+namespace fp {
+
+/* direct mapped table of the generated transforms, by hash of their key */
+#define GL_JIT_PROGRAMS 64
+/* code of one transform */
+#define GL_JIT_VERTEX_MAX 2048
+
+static struct {
+    GLJitVertexKey key;
+    GLJitVertexFunc func;
+    unsigned int generation;
+} gl_jit_programs[GL_JIT_PROGRAMS];
+
+void gl_jit_begin(GLContext *c) {
+    GLJitVertexKey key;
+    const tGLfixed *m[3];
+    int i, j, n;
+
+    memset(&key, 0, sizeof(key));
+    key.light = c->light.enabled;
+    if (key.light) {
+        key.normalize = c->normalize_enabled;
+        m[0] = &c->matrix.stack_ptr[0]->m[0][0];
+        m[1] = &c->matrix.stack_ptr[1]->m[0][0];
+        m[2] = &c->matrix.model_view_inv.m[0][0];
+        n = 3;
+    } else {
+        key.no_w_transform = c->matrix.model_projection_no_w_transform;
+        m[0] = &c->matrix.model_projection.m[0][0];
+        n = 1;
+    }
+    for (i = 0; i < n; i++)
+        for (j = 0; j < 16; j++)
+            key.m[i][j] = m[i][j].data();
+    key.scale[0] = c->viewport.scale.X.data();
+    key.scale[1] = c->viewport.scale.Y.data();
+    key.trans[0] = c->viewport.trans.X.data();
+    key.trans[1] = c->viewport.trans.Y.data();
+    key.zscale = c->viewport.zscale;
+    key.ztrans = c->viewport.ztrans;
+    key.zmin = c->viewport.zmin;
+    key.zmax = c->viewport.zmax;
+
+    /* the count goes on across glBegin() while the matrices stay the same */
+    if (memcmp(&key, &c->jit.key, sizeof(key)) != 0) {
+        c->jit.key = key;
+        c->jit.vertex = NULL;
+        c->jit.count = 0;
+    }
+}
+
+/*
+ * Code of the transform: the same values as gl_vertex_transform() and
+ * gl_transform_to_viewport() with the matrix and viewport entries as
+ * immediates. rbx holds the vertex and rsi the current normal.
+ */
+
+#define GL_JIT_V(member, i) zj_mem(ZJ_RBX, (int32_t)(offsetof(GLVertex, member) + 4 * (i)))
+
+/* eax = the tGLfixed product held in rax, that is rax << 16 divided by 2^32 rounding toward zero */
+static void gl_jit_fixed(ZBJitAsm *a) {
+    zj_shift(a, ZJ_SHL, 1, ZJ_RAX, 16);
+    zj_alu(a, ZJ_ALU_MOV, 1, ZJ_RDX, ZJ_RAX);
+    zj_shift(a, ZJ_SAR, 1, ZJ_RDX, 63);
+    zj_shift(a, ZJ_SHR, 1, ZJ_RDX, 32);
+    zj_alu(a, ZJ_ALU_ADD, 1, ZJ_RAX, ZJ_RDX);
+    zj_shift(a, ZJ_SAR, 1, ZJ_RAX, 32);
+}
+
+/* [dst] = sum of the values at [base + src + 4 * i] times m[i] for i < n, plus add */
+static void gl_jit_dot(ZBJitAsm *a, ZBJitMem dst, int base, int32_t src, const int32_t *m, int n, int32_t add) {
+    int i;
+
+    zj_alu(a, ZJ_ALU_XOR, 0, ZJ_R9, ZJ_R9);
+    for (i = 0; i < n; i++) {
+        if (m[i] == 0)
+            continue;
+        if (m[i] == 1 << 16) {
+            zj_load32(a, ZJ_RAX, zj_mem(base, src + 4 * i));
+        } else {
+            zj_loadsx32(a, ZJ_RAX, zj_mem(base, src + 4 * i));
+            zj_imuli(a, 1, ZJ_RAX, ZJ_RAX, m[i]);
+            gl_jit_fixed(a);
+        }
+        zj_alu(a, ZJ_ALU_ADD, 0, ZJ_R9, ZJ_RAX);
+    }
+    if (add != 0)
+        zj_alui(a, ZJ_ALUI_ADD, 0, ZJ_R9, add);
+    zj_store32(a, dst, ZJ_R9);
+}
+
+/* [dst] = (int)(pc[i] * winv * scale + trans), winv in r11 */
+static void gl_jit_window(ZBJitAsm *a, ZBJitMem dst, int i, int32_t scale, int32_t trans) {
+    zj_loadsx32(a, ZJ_RAX, GL_JIT_V(pc, i));
+    zj_imul(a, 1, ZJ_RAX, ZJ_R11);
+    gl_jit_fixed(a);
+    zj_op_reg(a, 1, 0x63, ZJ_RAX, ZJ_RAX); /* movsxd rax, eax */
+    zj_imuli(a, 1, ZJ_RAX, ZJ_RAX, scale);
+    gl_jit_fixed(a);
+    if (trans != 0)
+        zj_alui(a, ZJ_ALUI_ADD, 0, ZJ_RAX, trans);
+    zj_alu(a, ZJ_ALU_MOV, 0, ZJ_RDX, ZJ_RAX);
+    zj_shift(a, ZJ_SAR, 0, ZJ_RDX, 31);
+    zj_shift(a, ZJ_SHR, 0, ZJ_RDX, 16);
+    zj_alu(a, ZJ_ALU_ADD, 0, ZJ_RAX, ZJ_RDX);
+    zj_shift(a, ZJ_SAR, 0, ZJ_RAX, 16);
+    zj_store32(a, dst, ZJ_RAX);
+}
+
+static void gl_jit_emit_vertex(ZBJitAsm *a, const GLJitVertexKey *key) {
+    const int32_t *m;
+    uint8_t *done, *zero;
+    int i;
+
+    zj_push(a, ZJ_RBX);
+    zj_alu(a, ZJ_ALU_MOV, 1, ZJ_RBX, ZJ_RDI);
+
+    if (key->light) {
+        m = key->m[0];
+        for (i = 0; i < 4; i++)
+            gl_jit_dot(a, GL_JIT_V(ec, i), ZJ_RBX, offsetof(GLVertex, coord), &m[4 * i], 3, m[4 * i + 3]);
+        m = key->m[1];
+        for (i = 0; i < 4; i++)
+            gl_jit_dot(a, GL_JIT_V(pc, i), ZJ_RBX, offsetof(GLVertex, ec), &m[4 * i], 4, 0);
+        m = key->m[2];
+        for (i = 0; i < 3; i++)
+            gl_jit_dot(a, GL_JIT_V(normal, i), ZJ_RSI, 0, &m[4 * i], 3, 0);
+        if (key->normalize) {
+            zj_lea(a, ZJ_RDI, GL_JIT_V(normal, 0));
+            zj_mov64i(a, ZJ_RAX, (uint64_t)(uintptr_t)&gl_V3_Norm);
+            zj_call(a, ZJ_RAX);
+        }
+    } else {
+        m = key->m[0];
+        for (i = 0; i < 3; i++)
+            gl_jit_dot(a, GL_JIT_V(pc, i), ZJ_RBX, offsetof(GLVertex, coord), &m[4 * i], 3, m[4 * i + 3]);
+        if (key->no_w_transform)
+            zj_store32i(a, GL_JIT_V(pc, 3), m[15]);
+        else
+            gl_jit_dot(a, GL_JIT_V(pc, 3), ZJ_RBX, offsetof(GLVertex, coord), &m[12], 3, m[15]);
+    }
+
+    /* clip code, see gl_clipcode() */
+    zj_load32(a, ZJ_R8, GL_JIT_V(pc, 3));
+    zj_alu(a, ZJ_ALU_MOV, 0, ZJ_R10, ZJ_R8);
+    zj_neg(a, 0, ZJ_R10);
+    zj_alu(a, ZJ_ALU_XOR, 0, ZJ_R9, ZJ_R9);
+    for (i = 0; i < 3; i++) {
+        zj_load32(a, ZJ_RAX, GL_JIT_V(pc, i));
+        zj_alu(a, ZJ_ALU_XOR, 0, ZJ_RCX, ZJ_RCX);
+        zj_alu(a, ZJ_ALU_CMP, 0, ZJ_RAX, ZJ_R10);
+        zj_setcc(a, ZJ_CC_L, ZJ_RCX);
+        if (i > 0)
+            zj_shift(a, ZJ_SHL, 0, ZJ_RCX, 2 * i);
+        zj_alu(a, ZJ_ALU_OR, 0, ZJ_R9, ZJ_RCX);
+        zj_alu(a, ZJ_ALU_XOR, 0, ZJ_RCX, ZJ_RCX);
+        zj_alu(a, ZJ_ALU_CMP, 0, ZJ_RAX, ZJ_R8);
+        zj_setcc(a, ZJ_CC_G, ZJ_RCX);
+        zj_shift(a, ZJ_SHL, 0, ZJ_RCX, 2 * i + 1);
+        zj_alu(a, ZJ_ALU_OR, 0, ZJ_R9, ZJ_RCX);
+    }
+    zj_store32(a, zj_mem(ZJ_RBX, offsetof(GLVertex, clip_code)), ZJ_R9);
+    zj_alu(a, ZJ_ALU_TEST, 0, ZJ_R9, ZJ_R9);
+    done = zj_jcc(a, ZJ_CC_NE);
+
+    /* window coordinates, see gl_transform_to_viewport(): winv = 1 / w, 0 when w is */
+    zj_op_reg(a, 1, 0x63, ZJ_R8, ZJ_R8); /* movsxd r8, r8d */
+    zj_alu(a, ZJ_ALU_XOR, 0, ZJ_R11, ZJ_R11);
+    zj_alu(a, ZJ_ALU_TEST, 1, ZJ_R8, ZJ_R8);
+    zero = zj_jcc(a, ZJ_CC_E);
+    zj_mov64i(a, ZJ_RAX, (uint64_t)1 << 32);
+    zj_cqo(a);
+    zj_idiv(a, ZJ_R8);
+    zj_op_reg(a, 1, 0x63, ZJ_R11, ZJ_RAX);
+    zj_bind(a, zero);
+
+    gl_jit_window(a, zj_mem(ZJ_RBX, offsetof(GLVertex, zp) + offsetof(ZBufferPoint, x)), 0, key->scale[0], key->trans[0]);
+    gl_jit_window(a, zj_mem(ZJ_RBX, offsetof(GLVertex, zp) + offsetof(ZBufferPoint, y)), 1, key->scale[1], key->trans[1]);
+
+    zj_loadsx32(a, ZJ_RAX, GL_JIT_V(pc, 2));
+    zj_imul(a, 1, ZJ_RAX, ZJ_R11);
+    gl_jit_fixed(a);
+    zj_imuli(a, 0, ZJ_RAX, ZJ_RAX, key->zscale);
+    zj_alui(a, ZJ_ALUI_ADD, 0, ZJ_RAX, key->ztrans);
+    zj_mov32i(a, ZJ_RCX, key->zmin);
+    zj_alu(a, ZJ_ALU_CMP, 0, ZJ_RAX, ZJ_RCX);
+    zj_cmov(a, ZJ_CC_L, 0, ZJ_RAX, ZJ_RCX);
+    zj_mov32i(a, ZJ_RCX, key->zmax);
+    zj_alu(a, ZJ_ALU_CMP, 0, ZJ_RAX, ZJ_RCX);
+    zj_cmov(a, ZJ_CC_G, 0, ZJ_RAX, ZJ_RCX);
+    zj_store32(a, zj_mem(ZJ_RBX, offsetof(GLVertex, zp) + offsetof(ZBufferPoint, z)), ZJ_RAX);
+
+    zj_bind(a, done);
+    zj_pop(a, ZJ_RBX);
+    zj_ret(a);
+}
+
+static unsigned int gl_jit_hash(const GLJitVertexKey *key) {
+    const unsigned char *p = (const unsigned char *)key;
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+/* called when GL_JIT_HOT_VERTICES went through the C transform */
+void gl_jit_vertex(GLContext *c) {
+    const GLJitVertexKey *key = &c->jit.key;
+    GLJitVertexFunc func = NULL;
+    ZBJitAsm a;
+    int i = gl_jit_hash(key) & (GL_JIT_PROGRAMS - 1);
+
+    c->jit.count = 0;
+    if (gl_jit_programs[i].func != NULL && gl_jit_programs[i].generation == ZB_jitGeneration &&
+        memcmp(&gl_jit_programs[i].key, key, sizeof(*key)) == 0) {
+        ZB_jitStats.vertex_hits++;
+        c->jit.vertex = gl_jit_programs[i].func;
+        c->jit.generation = ZB_jitGeneration;
+        return;
+    }
+    ZB_jitStats.vertex_misses++;
+
+    if (ZB_jitBegin(&a, GL_JIT_VERTEX_MAX) == 0) {
+        func = (GLJitVertexFunc)a.p;
+        gl_jit_emit_vertex(&a, key);
+        if (ZB_jitEnd(&a) == NULL)
+            func = NULL;
+    }
+    if (func == NULL) {
+        /* tried again after GL_JIT_HOT_VERTICES more */
+        ZB_jitStats.fallbacks++;
+        return;
+    }
+    gl_jit_programs[i].key = *key;
+    gl_jit_programs[i].func = func;
+    gl_jit_programs[i].generation = ZB_jitGeneration;
+    c->jit.vertex = func;
+    c->jit.generation = ZB_jitGeneration;
+}
+
+/* Non standard functions */
+
+void glJitCodeLimit(GLsizei bytes) {
+    if (bytes < 0) {
+        gl_error(GL_INVALID_VALUE, "glJitCodeLimit: negative size");
+        return;
+    }
+    ZB_jitSetLimit(bytes);
+}
+
+void glJitStats(ZBJitStats *stats) {
+    *stats = ZB_jitStats;
+}
+
+} // namespace fp
@@ -27,11 +27,23 @@ namespace fp
     void glMaterialxv(GLenum face, GLenum pname, const tGLfixed *v)
     {
         GLContext *c = gl_get_context();
+
+        if (c->compile_flag)
+        {
+            gl_compile_material(c, face, pname, v);
+            if (!c->exec_flag)
+                return;
+        }
+        gl_material(c, face, pname, v);
+    }
+
+    void gl_material(GLContext *c, GLenum face, GLenum pname, const tGLfixed *v)
+    {
         GLMaterial *m = (face == GL_FRONT) ? &c->material.materials[0] : &c->material.materials[1];
 
         if (face == GL_FRONT_AND_BACK)
         {
-            glMaterialxv(GL_FRONT, pname, v);
+            gl_material(c, GL_FRONT, pname, v);
             face = GL_BACK;
         }
 
@@ -59,6 +71,16 @@ namespace fp
     void glColorMaterial(GLenum face, GLenum mode)
     {
         GLContext *c = gl_get_context();
+
+        if (c->compile_flag)
+        {
+            GLParam p[2];
+            p[0].i = face;
+            p[1].i = mode;
+            gl_compile_state(c, GL_LIST_COLOR_MATERIAL, p);
+            if (!c->exec_flag)
+                return;
+        }
         c->material.color.current_mode = face;
         c->material.color.current_type = mode;
     }
@@ -74,6 +96,18 @@ namespace fp
         GLContext *c = gl_get_context();
         GLLight *l = &c->light.lights[light - GL_LIGHT0];
 
+        if (c->compile_flag)
+        {
+            GLParam p[6];
+            p[0].i = light;
+            p[1].i = pname;
+            for (int i = 0; i < 4; i++)
+                p[2 + i].i = param[i].data();
+            gl_compile_state(c, GL_LIST_LIGHT, p);
+            if (!c->exec_flag)
+                return;
+        }
+
         switch (pname)
         {
         case GL_AMBIENT:
@@ -143,6 +177,17 @@ namespace fp
         GLContext *c = gl_get_context();
         V4 v = *(V4 *)param;
 
+        if (c->compile_flag)
+        {
+            GLParam p[5];
+            p[0].i = pname;
+            for (int i = 0; i < 4; i++)
+                p[1 + i].i = param[i].data();
+            gl_compile_state(c, GL_LIST_LIGHT_MODEL, p);
+            if (!c->exec_flag)
+                return;
+        }
+
         switch (pname)
         {
         case GL_LIGHT_MODEL_AMBIENT:
@@ -5,6 +5,8 @@ namespace fp {
 void glMaterialx(GLenum face, GLenum pname, tGLfixed param);
 
 void glMaterialxv(GLenum face, GLenum pname, const tGLfixed *v);
+/* glMaterialxv() of the context, not recorded in the lists */
+void gl_material(GLContext *c, GLenum face, GLenum pname, const tGLfixed *v);
 
 void glColorMaterial(GLenum face, GLenum mode);
 void glLightx(GLenum light, GLenum pname, tGLfixed param);
@@ -0,0 +1,944 @@
+#include "list.hpp"
+#include "arrays.hpp"
+#include "api.hpp"
+
+namespace fp {
+
+/* enable.cpp, those of gl.h being the system ones */
+void glEnable(GLenum cap);
+void glDisable(GLenum cap);
+/* blend.cpp */
+void glAlphaFunc(GLenum func, GLclampf ref);
+void glBlendFunc(GLenum sfactor, GLenum dfactor);
+void glLogicOp(GLenum opcode);
+void glDepthFunc(GLenum func);
+void glDepthMask(GLboolean flag);
+
+/* ops of the lists, each followed by its parameters */
+enum {
+    OP_EndList,
+    OP_NextBuffer, /* the next GLParamBuffer */
+    OP_Draw,       /* mode, arrays, geometry, first index, count */
+    OP_Color,      /* 4 tGLfixed, as data */
+    OP_Normal,
+    OP_TexCoord,
+    OP_Enable,     /* cap */
+    OP_Disable,
+    OP_ShadeModel, /* mode */
+    OP_CullFace,
+    OP_FrontFace,
+    OP_MatrixMode,
+    OP_BindTexture, /* target, texture */
+    OP_PushMatrix,
+    OP_PopMatrix,
+    OP_LoadMatrix, /* 16 tGLfixed by rows */
+    OP_MultMatrix,
+    OP_Material,   /* face, pname, 4 tGLfixed */
+    OP_CallList,   /* list */
+    /* those of gl_compile_state(), in the same order */
+    OP_AlphaFunc,
+    OP_BlendFunc,
+    OP_LogicOp,
+    OP_DepthFunc,
+    OP_DepthMask,
+    OP_Clear,
+    OP_ClearColor,
+    OP_ClearDepth,
+    OP_ColorMaterial,
+    OP_Light,
+    OP_LightModel,
+    OP_PolygonMode,
+    OP_PolygonOffset,
+    OP_Viewport,
+    OP_TexEnvx,
+    OP_TexEnvi,
+    OP_TexParameter,
+    OP_EdgeFlag,
+    OP_Count
+};
+
+static const int gl_op_params[OP_Count] = {0, 1, 5, 4, 4, 4, 1, 1, 1, 1, 1, 1, 2, 0, 0, 16, 16, 6, 1,
+                                           2, 2, 1, 1, 1, 1, 4, 1, 2, 6, 5, 2, 2, 4, 3, 3, 3, 1};
+
+/* the vertices: position, normal, color and texture coordinates */
+#define GL_LIST_NORMAL   4
+#define GL_LIST_COLOR    7
+#define GL_LIST_TEXCOORD 11
+#define GL_LIST_VERTEX   15
+#define GL_LIST_STRIDE   (GL_LIST_VERTEX * (int)sizeof(tGLfixed))
+
+#define GL_LIST_CAPS 32
+
+/* the state set by the ops recorded, if known */
+#define GL_LIST_SHADE_MODEL_STATE 0
+#define GL_LIST_CULL_FACE_STATE   1
+#define GL_LIST_FRONT_FACE_STATE  2
+#define GL_LIST_TEXTURE_STATE     3
+#define GL_LIST_MATRIX_MODE_STATE 4
+#define GL_LIST_BLEND_FUNC_STATE  5
+#define GL_LIST_LOGIC_OP_STATE    6
+#define GL_LIST_DEPTH_FUNC_STATE  7
+#define GL_LIST_DEPTH_MASK_STATE  8
+#define GL_LIST_STATES            9
+
+struct GLListCompile {
+    GLuint name;
+    GLList *list;
+    GLListGeometry *geometry;
+    /*
+     * The last op, while nothing has read the state it sets: the next op
+     * of the same key replaces it.
+     */
+    GLParam *last;
+    int last_key;
+    GLuint last_arg;
+
+    /*
+     * The current color, normal and texture coordinates. Those set in the
+     * list are the arrays of its draws, the others are current at the
+     * call. dirty are those which the ops don't give yet.
+     */
+    tGLfixed attribs[3][4];
+    int defined, dirty;
+
+    /* the primitive in glBegin(), as gl_assemble_vertex() */
+    int in_begin;
+    GLenum begin_type;
+    int v[3], n, cnt;
+
+    /* the draw open */
+    int draw_open;
+    GLenum draw_mode;
+    int draw_arrays, draw_first;
+    GLListGeometry *draw_geometry;
+
+    struct {
+        GLenum cap;
+        int on;
+    } caps[GL_LIST_CAPS];
+    int nb_caps;
+    GLuint state[GL_LIST_STATES];
+    int known; /* bits of state */
+};
+
+static GLList *find_list(GLContext *c, GLuint list) {
+    return list < MAX_DISPLAY_LISTS ? c->shared_state.lists[list] : NULL;
+}
+
+static GLList *alloc_list(void) {
+    GLList *l = (GLList *)calloc(1, sizeof(GLList));
+
+    if (l == NULL)
+        return NULL;
+    l->first_op_buffer = new GLParamBuffer;
+    return l;
+}
+
+static void free_list(GLList *l) {
+    GLParamBuffer *b, *next_buffer;
+    GLListGeometry *g, *next;
+
+    for (b = l->first_op_buffer; b != NULL; b = next_buffer) {
+        next_buffer = b->next;
+        delete b;
+    }
+    for (g = l->geometry; g != NULL; g = next) {
+        next = g->next;
+        gl_buffer_drop_arrays(&g->buffer);
+        free(g->buffer.data);
+        free(g->indices);
+        free(g);
+    }
+    free(l);
+}
+
+static void free_list_compile(GLContext *c) {
+    free_list(c->list_compile->list);
+    free(c->list_compile);
+    c->list_compile = NULL;
+    c->current_op_buffer = NULL;
+    c->current_op_buffer_index = 0;
+    c->compile_flag = 0;
+    c->exec_flag = 1;
+}
+
+void gl_free_lists(GLContext *c) {
+    if (c->list_compile != NULL)
+        free_list_compile(c);
+    for (int i = 0; i < MAX_DISPLAY_LISTS; i++) {
+        if (c->shared_state.lists[i] != NULL)
+            free_list(c->shared_state.lists[i]);
+        c->shared_state.lists[i] = NULL;
+    }
+}
+
+/* room for op and its n parameters, the list still ending after them */
+static GLParam *gl_list_op(GLContext *c, int op) {
+    GLParamBuffer *b = c->current_op_buffer;
+    int i = c->current_op_buffer_index, n = gl_op_params[op];
+    GLParam *p;
+
+    /* OP_NextBuffer always fits after */
+    if (i + n + 1 + 2 > OP_BUFFER_MAX_SIZE) {
+        GLParamBuffer *next = new GLParamBuffer;
+
+        b->ops[i + 1].p = next;
+        b->ops[i].op = OP_NextBuffer;
+        b->next = next;
+        c->current_op_buffer = b = next;
+        i = 0;
+    }
+    p = &b->ops[i];
+    p[n + 1].op = OP_EndList;
+    p[0].op = op;
+    c->current_op_buffer_index = i + n + 1;
+    return p;
+}
+
+/* the indices since the draw was opened, drawn by one op */
+static void gl_list_draw_end(GLContext *c) {
+    GLListCompile *lc = c->list_compile;
+    GLListGeometry *g = lc->draw_geometry;
+    GLParam *p;
+
+    if (!lc->draw_open)
+        return;
+    lc->draw_open = 0;
+    if (g->nb_indices == lc->draw_first)
+        return;
+    p = gl_list_op(c, OP_Draw);
+    p[1].i = lc->draw_mode;
+    p[2].i = lc->draw_arrays;
+    p[3].p = g;
+    p[4].i = lc->draw_first;
+    p[5].i = g->nb_indices - lc->draw_first;
+    lc->last = NULL;
+}
+
+/* the current attributes not given by the draws, before an op which may read them */
+static void gl_list_attribs(GLContext *c) {
+    static const int ops[3] = {OP_Color, OP_Normal, OP_TexCoord};
+    static const int bits[3] = {COLOR_ARRAY, NORMAL_ARRAY, TEXCOORD_ARRAY};
+    GLListCompile *lc = c->list_compile;
+
+    gl_list_draw_end(c);
+    for (int i = 0; i < 3; i++) {
+        if (lc->dirty & bits[i]) {
+            GLParam *p = gl_list_op(c, ops[i]);
+
+            for (int j = 0; j < 4; j++)
+                p[1 + j].i = lc->attribs[i][j].data();
+            lc->last = NULL;
+        }
+    }
+    lc->dirty = 0;
+}
+
+/* Enable and Disable of a cap set the same state, as both TexEnv */
+static int gl_list_key(int op) {
+    return op == OP_Disable ? OP_Enable : op == OP_TexEnvi ? OP_TexEnvx : op;
+}
+
+/* a state op, replacing the last one of the same key */
+static GLParam *gl_list_state_op(GLContext *c, int op, GLuint arg) {
+    GLListCompile *lc = c->list_compile;
+    GLParam *p;
+
+    gl_list_draw_end(c);
+    if (lc->last != NULL && lc->last_key == gl_list_key(op) && lc->last_arg == arg) {
+        p = lc->last;
+        p[0].op = op;
+        return p;
+    }
+    p = gl_list_op(c, op);
+    lc->last = p;
+    lc->last_key = gl_list_key(op);
+    lc->last_arg = arg;
+    return p;
+}
+
+void gl_compile_call(GLContext *c, int op, GLenum a, GLuint b) {
+    GLListCompile *lc = c->list_compile;
+    GLParam *p;
+    int i, s;
+
+    switch (op) {
+    case GL_LIST_ENABLE:
+    case GL_LIST_DISABLE:
+        for (i = 0; i < lc->nb_caps && lc->caps[i].cap != a; i++)
+            ;
+        if (i < lc->nb_caps && lc->caps[i].on == (op == GL_LIST_ENABLE))
+            return;
+        if (i == lc->nb_caps && i < GL_LIST_CAPS) {
+            lc->caps[i].cap = a;
+            lc->nb_caps++;
+        }
+        if (i < GL_LIST_CAPS)
+            lc->caps[i].on = op == GL_LIST_ENABLE;
+        /* GL_COLOR_MATERIAL reads the current color */
+        gl_list_attribs(c);
+        p = gl_list_state_op(c, op == GL_LIST_ENABLE ? OP_Enable : OP_Disable, a);
+        p[1].i = a;
+        return;
+    case GL_LIST_SHADE_MODEL:
+    case GL_LIST_CULL_FACE:
+    case GL_LIST_FRONT_FACE:
+    case GL_LIST_MATRIX_MODE:
+    case GL_LIST_BIND_TEXTURE:
+        s = op == GL_LIST_SHADE_MODEL ? GL_LIST_SHADE_MODEL_STATE :
+            op == GL_LIST_CULL_FACE ? GL_LIST_CULL_FACE_STATE :
+            op == GL_LIST_FRONT_FACE ? GL_LIST_FRONT_FACE_STATE :
+            op == GL_LIST_MATRIX_MODE ? GL_LIST_MATRIX_MODE_STATE : GL_LIST_TEXTURE_STATE;
+        if (op == GL_LIST_BIND_TEXTURE) {
+            if ((lc->known & (1 << s)) && lc->state[s] == b)
+                return;
+            lc->state[s] = b;
+        } else {
+            if ((lc->known & (1 << s)) && lc->state[s] == a)
+                return;
+            lc->state[s] = a;
+        }
+        lc->known |= 1 << s;
+        switch (op) {
+        case GL_LIST_SHADE_MODEL:
+            p = gl_list_state_op(c, OP_ShadeModel, 0);
+            break;
+        case GL_LIST_CULL_FACE:
+            p = gl_list_state_op(c, OP_CullFace, 0);
+            break;
+        case GL_LIST_FRONT_FACE:
+            p = gl_list_state_op(c, OP_FrontFace, 0);
+            break;
+        case GL_LIST_MATRIX_MODE:
+            p = gl_list_state_op(c, OP_MatrixMode, 0);
+            break;
+        default:
+            p = gl_list_state_op(c, OP_BindTexture, a);
+            p[2].ui = b;
+            break;
+        }
+        p[1].i = a;
+        return;
+    case GL_LIST_PUSH_MATRIX:
+    case GL_LIST_POP_MATRIX:
+        gl_list_draw_end(c);
+        gl_list_op(c, op == GL_LIST_PUSH_MATRIX ? OP_PushMatrix : OP_PopMatrix);
+        lc->last = NULL;
+        return;
+    case GL_LIST_CALL_LIST:
+        /* nothing is known after it */
+        gl_list_attribs(c);
+        p = gl_list_op(c, OP_CallList);
+        p[1].ui = b;
+        lc->last = NULL;
+        lc->defined = 0;
+        lc->nb_caps = 0;
+        lc->known = 0;
+        return;
+    default:
+        assert(0);
+    }
+}
+
+void gl_compile_matrix(GLContext *c, const M4 *m, int load) {
+    GLListCompile *lc = c->list_compile;
+    GLParam *p;
+    M4 a, b;
+    int i, j;
+
+    gl_list_draw_end(c);
+    p = lc->last;
+    if (p != NULL && (p[0].op == OP_LoadMatrix || p[0].op == OP_MultMatrix)) {
+        /* the matrix of the last op times m, or m */
+        b = *m;
+        if (!load) {
+            for (i = 0; i < 4; i++) {
+                for (j = 0; j < 4; j++)
+                    a.m[i][j] = tGLfixed::from_data(p[1 + i * 4 + j].i);
+            }
+            gl_M4_MulLeft(&a, &b);
+            b = a;
+        } else {
+            p[0].op = OP_LoadMatrix;
+        }
+    } else {
+        b = *m;
+        p = gl_list_op(c, load ? OP_LoadMatrix : OP_MultMatrix);
+        lc->last = p;
+        lc->last_key = -1;
+    }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++)
+            p[1 + i * 4 + j].i = b.m[i][j].data();
+    }
+}
+
+void gl_compile_material(GLContext *c, GLenum face, GLenum pname, const tGLfixed *v) {
+    GLParam *p;
+
+    gl_list_attribs(c);
+    p = gl_list_state_op(c, OP_Material, face << 16 | pname);
+    p[1].i = face;
+    p[2].i = pname;
+    for (int j = 0; j < 4; j++)
+        p[3 + j].i = j == 0 || pname != GL_SHININESS ? v[j].data() : 0;
+}
+
+void gl_compile_state(GLContext *c, int op, const GLParam *params) {
+    GLListCompile *lc = c->list_compile;
+    int code = OP_AlphaFunc + op - GL_LIST_ALPHA_FUNC, s = -1, i;
+    GLuint arg = 0, value = params[0].ui;
+    GLParam *p;
+
+    switch (op) {
+    case GL_LIST_CLEAR:
+        /* not a state, never replaced */
+        gl_list_draw_end(c);
+        p = gl_list_op(c, code);
+        p[1] = params[0];
+        lc->last = NULL;
+        return;
+    case GL_LIST_COLOR_MATERIAL:
+        /* the current color goes to the material of the mode */
+        gl_list_attribs(c);
+        break;
+    case GL_LIST_BLEND_FUNC:
+        s = GL_LIST_BLEND_FUNC_STATE;
+        value = params[0].ui << 16 | params[1].ui;
+        break;
+    case GL_LIST_LOGIC_OP:
+        s = GL_LIST_LOGIC_OP_STATE;
+        break;
+    case GL_LIST_DEPTH_FUNC:
+        s = GL_LIST_DEPTH_FUNC_STATE;
+        break;
+    case GL_LIST_DEPTH_MASK:
+        s = GL_LIST_DEPTH_MASK_STATE;
+        break;
+    case GL_LIST_LIGHT:
+        arg = params[0].ui << 16 | params[1].ui;
+        break;
+    case GL_LIST_LIGHT_MODEL:
+    case GL_LIST_POLYGON_MODE:
+        arg = params[0].ui;
+        break;
+    case GL_LIST_TEX_ENVX:
+    case GL_LIST_TEX_ENVI:
+    case GL_LIST_TEX_PARAMETER:
+        arg = params[1].ui;
+        break;
+    }
+    if (s >= 0) {
+        if ((lc->known & (1 << s)) && lc->state[s] == value)
+            return;
+        lc->state[s] = value;
+        lc->known |= 1 << s;
+    }
+    p = gl_list_state_op(c, code, arg);
+    for (i = 0; i < gl_op_params[code]; i++)
+        p[1 + i] = params[i];
+}
+
+void gl_compile_attrib(GLContext *c, GLenum attrib, tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
+    GLListCompile *lc = c->list_compile;
+    int i = attrib == GL_COLOR_ARRAY ? 0 : attrib == GL_NORMAL_ARRAY ? 1 : 2;
+    int bit = attrib == GL_COLOR_ARRAY ? COLOR_ARRAY : attrib == GL_NORMAL_ARRAY ? NORMAL_ARRAY : TEXCOORD_ARRAY;
+
+    lc->attribs[i][0] = x;
+    lc->attribs[i][1] = y;
+    lc->attribs[i][2] = z;
+    lc->attribs[i][3] = w;
+    lc->defined |= bit;
+    lc->dirty |= bit;
+}
+
+void gl_compile_begin(GLContext *c, GLenum type) {
+    GLListCompile *lc = c->list_compile;
+
+    lc->in_begin = 1;
+    lc->begin_type = type;
+    lc->v[0] = lc->v[1] = lc->v[2] = -1;
+    lc->n = 0;
+    lc->cnt = 0;
+}
+
+/* the geometry with room for a vertex, a new one when the indices are out */
+static GLListGeometry *gl_list_geometry(GLContext *c) {
+    GLListCompile *lc = c->list_compile;
+    GLListGeometry *g = lc->geometry, *old = g;
+    GLubyte *data;
+    int max_vertices, i;
+
+    if (g != NULL && g->nb_vertices < g->max_vertices)
+        return g;
+    if (g == NULL || g->nb_vertices == 0x10000) {
+        g = (GLListGeometry *)calloc(1, sizeof(GLListGeometry));
+        if (g == NULL) {
+            gl_error(GL_OUT_OF_MEMORY, "glVertex: failed to allocate the list");
+            return NULL;
+        }
+        g->buffer.usage = GL_STATIC_DRAW;
+    }
+    max_vertices = g->max_vertices != 0 ? 2 * g->max_vertices : 256;
+    data = (GLubyte *)realloc(g->buffer.data, max_vertices * GL_LIST_STRIDE);
+    if (data == NULL) {
+        if (g != old)
+            free(g);
+        gl_error(GL_OUT_OF_MEMORY, "glVertex: failed to allocate the list");
+        return NULL;
+    }
+    g->buffer.data = data;
+    g->max_vertices = max_vertices;
+    if (g != old) {
+        g->next = lc->list->geometry;
+        lc->list->geometry = g;
+        lc->geometry = g;
+    }
+    /* the vertices of the primitive still open follow it */
+    if (g != old && old != NULL) {
+        for (i = 0; i < 3; i++) {
+            if (lc->v[i] >= 0) {
+                memcpy(g->buffer.data + g->nb_vertices * GL_LIST_STRIDE,
+                       old->buffer.data + lc->v[i] * GL_LIST_STRIDE, GL_LIST_STRIDE);
+                lc->v[i] = g->nb_vertices++;
+            }
+        }
+    }
+    return g;
+}
+
+/* nb indices of a primitive */
+static void gl_list_emit(GLContext *c, GLenum mode, int a, int b, int d, int nb) {
+    GLListCompile *lc = c->list_compile;
+    GLListGeometry *g = lc->geometry;
+    int i = g->nb_indices;
+
+    if (lc->draw_open && (lc->draw_mode != mode || lc->draw_arrays != lc->defined || lc->draw_geometry != g))
+        gl_list_draw_end(c);
+    if (!lc->draw_open) {
+        lc->draw_open = 1;
+        lc->draw_mode = mode;
+        lc->draw_arrays = lc->defined;
+        lc->draw_first = g->nb_indices;
+        lc->draw_geometry = g;
+    }
+    if (i + 3 > g->max_indices) {
+        int max_indices = g->max_indices != 0 ? 2 * g->max_indices : 768;
+        GLushort *indices = (GLushort *)realloc(g->indices, max_indices * sizeof(GLushort));
+
+        if (indices == NULL) {
+            gl_error(GL_OUT_OF_MEMORY, "glVertex: failed to allocate the list");
+            return;
+        }
+        g->indices = indices;
+        g->max_indices = max_indices;
+    }
+    g->indices[i] = a;
+    if (nb > 1)
+        g->indices[i + 1] = b;
+    if (nb > 2)
+        g->indices[i + 2] = d;
+    g->nb_indices = i + nb;
+}
+
+void gl_compile_vertex(GLContext *c, tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
+    GLListCompile *lc = c->list_compile;
+    GLListGeometry *g;
+    tGLfixed *p;
+    int *v = lc->v, n, cnt, k, j;
+
+    if (!lc->in_begin)
+        return;
+    g = gl_list_geometry(c);
+    if (g == NULL)
+        return;
+    k = g->nb_vertices++;
+    p = (tGLfixed *)(g->buffer.data + k * GL_LIST_STRIDE);
+    p[0] = x;
+    p[1] = y;
+    p[2] = z;
+    p[3] = w;
+    for (j = 0; j < 3; j++)
+        p[GL_LIST_NORMAL + j] = lc->attribs[1][j];
+    for (j = 0; j < 4; j++) {
+        p[GL_LIST_COLOR + j] = lc->attribs[0][j];
+        p[GL_LIST_TEXCOORD + j] = lc->attribs[2][j];
+    }
+
+    /* the primitives of gl_assemble_vertex(), in the same order */
+    n = lc->n;
+    v[n++] = k;
+    cnt = ++lc->cnt;
+    switch (lc->begin_type) {
+    case GL_POINTS:
+        gl_list_emit(c, GL_POINTS, v[0], 0, 0, 1);
+        n = 0;
+        break;
+    case GL_LINES:
+        if (n == 2) {
+            gl_list_emit(c, GL_LINES, v[0], v[1], 0, 2);
+            n = 0;
+        }
+        break;
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+        if (n == 1) {
+            v[2] = v[0];
+        } else if (n == 2) {
+            gl_list_emit(c, GL_LINES, v[0], v[1], 0, 2);
+            v[0] = v[1];
+            n = 1;
+        }
+        break;
+    case GL_TRIANGLES:
+        if (n == 3) {
+            gl_list_emit(c, GL_TRIANGLES, v[0], v[1], v[2], 3);
+            n = 0;
+        }
+        break;
+    case GL_TRIANGLE_STRIP:
+        if (cnt >= 3) {
+            if (n == 3)
+                n = 0;
+            if (cnt & 1)
+                gl_list_emit(c, GL_TRIANGLES, v[0], v[1], v[2], 3);
+            else
+                gl_list_emit(c, GL_TRIANGLES, v[2], v[1], v[0], 3);
+        }
+        break;
+    case GL_TRIANGLE_FAN:
+        if (n == 3) {
+            gl_list_emit(c, GL_TRIANGLES, v[0], v[1], v[2], 3);
+            v[1] = v[2];
+            n = 2;
+        }
+        break;
+    default:
+        n = 0;
+        break;
+    }
+    lc->n = n;
+}
+
+void gl_compile_end(GLContext *c) {
+    GLListCompile *lc = c->list_compile;
+
+    if (lc->begin_type == GL_LINE_LOOP && lc->cnt >= 3)
+        gl_list_emit(c, GL_LINES, lc->v[0], lc->v[2], 0, 2);
+    lc->in_begin = 0;
+    lc->v[0] = lc->v[1] = lc->v[2] = -1;
+    /* the draws leave the attributes of their last index */
+    lc->dirty |= lc->defined;
+}
+
+/* the arrays of the draws of g */
+static void gl_list_arrays(GLContext *c, GLListGeometry *g) {
+    c->array.array_buffer = &g->buffer;
+    glVertexPointer(4, GL_FIXED, GL_LIST_STRIDE, (const GLvoid *)0);
+    glNormalPointer(GL_FIXED, GL_LIST_STRIDE, (const GLvoid *)(GL_LIST_NORMAL * sizeof(tGLfixed)));
+    glColorPointer(4, GL_FIXED, GL_LIST_STRIDE, (const GLvoid *)(GL_LIST_COLOR * sizeof(tGLfixed)));
+    glTexCoordPointer(4, GL_FIXED, GL_LIST_STRIDE, (const GLvoid *)(GL_LIST_TEXCOORD * sizeof(tGLfixed)));
+}
+
+static void gl_list_execute(GLContext *c, GLList *l, int depth) {
+    GLParam *p = l->first_op_buffer->ops;
+    GLListGeometry *bound = NULL, *g;
+    GLContext::ArrayState array;
+    int states = c->client_states;
+    tGLfixed m[16], v[4];
+    GLList *called;
+    int i, j;
+
+    for (;;) {
+        switch (p[0].op) {
+        case OP_EndList:
+            if (bound != NULL) {
+                c->array = array;
+                c->client_states = states;
+            }
+            return;
+        case OP_NextBuffer:
+            p = ((GLParamBuffer *)p[1].p)->ops;
+            continue;
+        case OP_Draw:
+            g = (GLListGeometry *)p[3].p;
+            if (bound == NULL)
+                array = c->array;
+            if (g != bound) {
+                gl_list_arrays(c, g);
+                bound = g;
+            }
+            c->client_states = VERTEX_ARRAY | p[2].i;
+            gl_draw_batches(c, p[1].i, 0, g->indices + p[4].i, p[5].i);
+            break;
+        case OP_Color:
+        case OP_Normal:
+        case OP_TexCoord:
+            for (j = 0; j < 4; j++)
+                v[j] = tGLfixed::from_data(p[1 + j].i);
+            if (p[0].op == OP_Color)
+                glColor4x(v[0], v[1], v[2], v[3]);
+            else if (p[0].op == OP_Normal)
+                glNormal3x(v[0], v[1], v[2]);
+            else
+                glTexCoord4x(v[0], v[1], v[2], v[3]);
+            break;
+        case OP_Enable:
+            glEnable(p[1].i);
+            break;
+        case OP_Disable:
+            glDisable(p[1].i);
+            break;
+        case OP_ShadeModel:
+            glShadeModel(p[1].i);
+            break;
+        case OP_CullFace:
+            glCullFace(p[1].i);
+            break;
+        case OP_FrontFace:
+            glFrontFace(p[1].i);
+            break;
+        case OP_MatrixMode:
+            glMatrixMode(p[1].i);
+            break;
+        case OP_BindTexture:
+            glBindTexture(p[1].i, p[2].ui);
+            break;
+        case OP_PushMatrix:
+            glPushMatrix();
+            break;
+        case OP_PopMatrix:
+            glPopMatrix();
+            break;
+        case OP_LoadMatrix:
+        case OP_MultMatrix:
+            /* by columns */
+            for (i = 0; i < 4; i++) {
+                for (j = 0; j < 4; j++)
+                    m[j * 4 + i] = tGLfixed::from_data(p[1 + i * 4 + j].i);
+            }
+            if (p[0].op == OP_LoadMatrix)
+                glLoadMatrixx(m);
+            else
+                glMultMatrixx(m);
+            break;
+        case OP_Material:
+            for (j = 0; j < 4; j++)
+                v[j] = tGLfixed::from_data(p[3 + j].i);
+            glMaterialxv(p[1].i, p[2].i, v);
+            break;
+        case OP_CallList:
+            called = find_list(c, p[1].ui);
+            if (called != NULL && depth + 1 < MAX_LIST_NESTING)
+                gl_list_execute(c, called, depth + 1);
+            break;
+        case OP_AlphaFunc:
+            glAlphaFunc(p[1].i, p[2].f);
+            break;
+        case OP_BlendFunc:
+            glBlendFunc(p[1].i, p[2].i);
+            break;
+        case OP_LogicOp:
+            glLogicOp(p[1].i);
+            break;
+        case OP_DepthFunc:
+            glDepthFunc(p[1].i);
+            break;
+        case OP_DepthMask:
+            glDepthMask(p[1].i);
+            break;
+        case OP_Clear:
+            glClear(p[1].ui);
+            break;
+        case OP_ClearColor:
+            for (j = 0; j < 4; j++)
+                v[j] = tGLfixed::from_data(p[1 + j].i);
+            glClearColor4xv(v);
+            break;
+        case OP_ClearDepth:
+            glClearDepth((double)tGLfixed::from_data(p[1].i));
+            break;
+        case OP_ColorMaterial:
+            glColorMaterial(p[1].i, p[2].i);
+            break;
+        case OP_Light:
+            for (j = 0; j < 4; j++)
+                v[j] = tGLfixed::from_data(p[3 + j].i);
+            glLightxv(p[1].i, p[2].i, v);
+            break;
+        case OP_LightModel:
+            for (j = 0; j < 4; j++)
+                v[j] = tGLfixed::from_data(p[2 + j].i);
+            glLightModelxv(p[1].i, v);
+            break;
+        case OP_PolygonMode:
+            glPolygonMode(p[1].i, p[2].i);
+            break;
+        case OP_PolygonOffset:
+            glPolygonOffset(tGLfixed::from_data(p[1].i), tGLfixed::from_data(p[2].i));
+            break;
+        case OP_Viewport:
+            glViewport(p[1].i, p[2].i, p[3].i, p[4].i);
+            break;
+        case OP_TexEnvx:
+            glTexEnvx(p[1].i, p[2].i, p[3].i);
+            break;
+        case OP_TexEnvi:
+            glTexEnvi(p[1].i, p[2].i, p[3].i);
+            break;
+        case OP_TexParameter:
+            glTexParameteri(p[1].i, p[2].i, p[3].i);
+            break;
+        case OP_EdgeFlag:
+            glEdgeFlag(p[1].i);
+            break;
+        default:
+            assert(0);
+        }
+        p += gl_op_params[p[0].op] + 1;
+    }
+}
+
+GLuint glGenLists(GLsizei range) {
+    GLContext *c = gl_get_context();
+    GLuint first, i;
+
+    if (range < 0) {
+        gl_error(GL_INVALID_VALUE, "glGenLists: range < 0");
+        return 0;
+    }
+    if (range == 0)
+        return 0;
+    /* the first range free names */
+    for (first = 1; first + range <= MAX_DISPLAY_LISTS; first = i + 1) {
+        for (i = first; i < first + range && c->shared_state.lists[i] == NULL; i++)
+            ;
+        if (i == first + range)
+            break;
+    }
+    if (first + range > MAX_DISPLAY_LISTS)
+        return 0;
+    for (i = first; i < first + range; i++) {
+        c->shared_state.lists[i] = alloc_list();
+        if (c->shared_state.lists[i] == NULL) {
+            gl_error(GL_OUT_OF_MEMORY, "glGenLists: failed to allocate the lists");
+            return 0;
+        }
+    }
+    return first;
+}
+
+GLboolean glIsList(GLuint list) {
+    return find_list(gl_get_context(), list) != NULL ? GL_TRUE : GL_FALSE;
+}
+
+void glNewList(GLuint list, GLenum mode) {
+    GLContext *c = gl_get_context();
+    GLListCompile *lc;
+
+    if (list == 0 || list >= MAX_DISPLAY_LISTS) {
+        gl_error(GL_INVALID_VALUE, "glNewList: bad list");
+        return;
+    }
+    if (mode != GL_COMPILE && mode != GL_COMPILE_AND_EXECUTE) {
+        gl_error(GL_INVALID_ENUM, "glNewList: bad mode");
+        return;
+    }
+    if (c->list_compile != NULL || c->in_begin) {
+        gl_error(GL_INVALID_OPERATION, "glNewList: already in a list");
+        return;
+    }
+    lc = (GLListCompile *)calloc(1, sizeof(GLListCompile));
+    if (lc == NULL || (lc->list = alloc_list()) == NULL) {
+        free(lc);
+        gl_error(GL_OUT_OF_MEMORY, "glNewList: failed to allocate the list");
+        return;
+    }
+    lc->name = list;
+    /* the values of the attributes not set in the list don't matter */
+    for (int i = 0; i < 3; i++)
+        lc->attribs[i][3] = 1;
+    lc->attribs[1][2] = 1;
+    lc->v[0] = lc->v[1] = lc->v[2] = -1;
+
+    c->list_compile = lc;
+    c->current_op_buffer = lc->list->first_op_buffer;
+    c->current_op_buffer_index = 0;
+    c->compile_flag = 1;
+    c->exec_flag = mode == GL_COMPILE_AND_EXECUTE;
+}
+
+void glEndList() {
+    GLContext *c = gl_get_context();
+    GLListCompile *lc = c->list_compile;
+    GLListGeometry *g;
+    GLContext::ArrayState array;
+    int states = c->client_states;
+    GLList *l;
+
+    if (lc == NULL) {
+        gl_error(GL_INVALID_OPERATION, "glEndList: not in a list");
+        return;
+    }
+    gl_list_attribs(c);
+    l = lc->list;
+
+    /* the vertices converted to columns at once */
+    array = c->array;
+    for (g = l->geometry; g != NULL; g = g->next) {
+        g->buffer.size = g->nb_vertices * GL_LIST_STRIDE;
+        gl_list_arrays(c, g);
+        c->client_states = VERTEX_ARRAY | COLOR_ARRAY | NORMAL_ARRAY | TEXCOORD_ARRAY;
+        gl_arrays_prepare(c);
+    }
+    c->array = array;
+    c->client_states = states;
+
+    lc->list = NULL;
+    if (c->shared_state.lists[lc->name] != NULL)
+        free_list(c->shared_state.lists[lc->name]);
+    c->shared_state.lists[lc->name] = l;
+
+    free(lc);
+    c->list_compile = NULL;
+    c->current_op_buffer = NULL;
+    c->current_op_buffer_index = 0;
+    c->compile_flag = 0;
+    c->exec_flag = 1;
+}
+
+void glCallList(GLuint list) {
+    GLContext *c = gl_get_context();
+    GLList *l;
+    int compile_flag = c->compile_flag;
+
+    if (compile_flag) {
+        gl_compile_call(c, GL_LIST_CALL_LIST, 0, list);
+        if (!c->exec_flag)
+            return;
+    }
+    l = find_list(c, list);
+    if (l == NULL)
+        return;
+    /* the calls of the list are not recorded in the one compiled */
+    c->compile_flag = 0;
+    gl_list_execute(c, l, 0);
+    c->compile_flag = compile_flag;
+}
+
+void glDeleteLists(GLuint list, GLsizei range) {
+    GLContext *c = gl_get_context();
+
+    if (range < 0) {
+        gl_error(GL_INVALID_VALUE, "glDeleteLists: range < 0");
+        return;
+    }
+    for (GLuint i = list; i < list + range && i < MAX_DISPLAY_LISTS; i++) {
+        if (c->shared_state.lists[i] != NULL) {
+            free_list(c->shared_state.lists[i]);
+            c->shared_state.lists[i] = NULL;
+        }
+    }
+}
+
+} // namespace fp
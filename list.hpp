@@ -0,0 +1,98 @@
+#pragma once
+
+#include "mygl.h"
+#include "fixed_point_type.hpp"
+#include "buffer.hpp"
+
+/*
+ * Display lists, compiled. The geometry of a list is assembled at
+ * compile time into points, lines and triangles indexing its vertices,
+ * which are kept in an internal buffer converted once to columns: a call
+ * draws them through the vertex cache of glDrawElements() with no
+ * assembly or conversion. The state changes are recorded as ops between
+ * the draws, those without effect being dropped, and the consecutive
+ * matrix operations are multiplied into one.
+ */
+
+#define MAX_DISPLAY_LISTS 1024
+#define MAX_LIST_NESTING  64
+
+namespace fp {
+
+struct GLContext;
+struct GLListCompile;
+union GLParam;
+struct GLParamBuffer;
+struct M4;
+
+/* vertices of a list and the indices of its primitives */
+struct GLListGeometry {
+    GLListGeometry *next;
+    GLBuffer buffer; /* not shared: handle 0 */
+    int nb_vertices;
+    GLushort *indices;
+    int nb_indices;
+    int max_vertices, max_indices;
+};
+
+struct GLList {
+    GLParamBuffer *first_op_buffer;
+    GLListGeometry *geometry;
+};
+
+GLuint glGenLists(GLsizei range);
+GLboolean glIsList(GLuint list);
+void glNewList(GLuint list, GLenum mode);
+void glEndList();
+void glCallList(GLuint list);
+void glDeleteLists(GLuint list, GLsizei range);
+
+/* recording, while c->compile_flag */
+void gl_compile_begin(GLContext *c, GLenum type);
+void gl_compile_vertex(GLContext *c, tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w);
+void gl_compile_end(GLContext *c);
+/* of GL_COLOR_ARRAY, GL_NORMAL_ARRAY or GL_TEXTURE_COORD_ARRAY */
+void gl_compile_attrib(GLContext *c, GLenum attrib, tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w);
+/* the matrix multiplied, or loaded if load */
+void gl_compile_matrix(GLContext *c, const M4 *m, int load);
+/* the calls with up to two enums: glEnable(), glBindTexture()... */
+void gl_compile_call(GLContext *c, int op, GLenum a, GLuint b);
+void gl_compile_material(GLContext *c, GLenum face, GLenum pname, const tGLfixed *v);
+/* the other calls, with their parameters */
+void gl_compile_state(GLContext *c, int op, const GLParam *params);
+
+/* ops of gl_compile_call() */
+#define GL_LIST_ENABLE       1
+#define GL_LIST_DISABLE      2
+#define GL_LIST_SHADE_MODEL  3
+#define GL_LIST_CULL_FACE    4
+#define GL_LIST_FRONT_FACE   5
+#define GL_LIST_BIND_TEXTURE 6
+#define GL_LIST_MATRIX_MODE  7
+#define GL_LIST_PUSH_MATRIX  8
+#define GL_LIST_POP_MATRIX   9
+#define GL_LIST_CALL_LIST    10
+
+/* ops of gl_compile_state(), the tGLfixed given as data */
+#define GL_LIST_ALPHA_FUNC     11 /* func, ref as f */
+#define GL_LIST_BLEND_FUNC     12 /* sfactor, dfactor */
+#define GL_LIST_LOGIC_OP       13 /* opcode */
+#define GL_LIST_DEPTH_FUNC     14 /* func */
+#define GL_LIST_DEPTH_MASK     15 /* flag */
+#define GL_LIST_CLEAR          16 /* mask */
+#define GL_LIST_CLEAR_COLOR    17 /* 4 tGLfixed */
+#define GL_LIST_CLEAR_DEPTH    18 /* tGLfixed */
+#define GL_LIST_COLOR_MATERIAL 19 /* face, mode */
+#define GL_LIST_LIGHT          20 /* light, pname, 4 tGLfixed */
+#define GL_LIST_LIGHT_MODEL    21 /* pname, 4 tGLfixed */
+#define GL_LIST_POLYGON_MODE   22 /* face, mode */
+#define GL_LIST_POLYGON_OFFSET 23 /* 2 tGLfixed */
+#define GL_LIST_VIEWPORT       24 /* x, y, width, height */
+#define GL_LIST_TEX_ENVX       25 /* target, pname, param */
+#define GL_LIST_TEX_ENVI       26
+#define GL_LIST_TEX_PARAMETER  27 /* target, pname, param */
+#define GL_LIST_EDGE_FLAG      28 /* flag */
+
+void gl_free_lists(GLContext *c);
+
+} // namespace fp
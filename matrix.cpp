@@ -44,6 +44,12 @@ namespace fp
     void glMatrixMode(GLenum mode)
     {
         GLContext *c = gl_get_context();
+        if (c->compile_flag)
+        {
+            gl_compile_call(c, GL_LIST_MATRIX_MODE, mode, 0);
+            if (!c->exec_flag)
+                return;
+        }
         switch (mode)
         {
         case GL_MODELVIEW:
@@ -63,8 +69,8 @@ namespace fp
     void glLoadMatrixx(const tGLfixed *matrix)
     {
         GLContext *c = gl_get_context();
-        M4 *m;
-        m = c->matrix.stack_ptr[c->matrix.mode];
+        M4 *m, tmp;
+        m = c->compile_flag ? &tmp : c->matrix.stack_ptr[c->matrix.mode];
 
         int q = 0;
         for (int i = 0; i < 4; i++)
@@ -76,12 +82,28 @@ namespace fp
             q += 4;
         }
 
+        if (c->compile_flag)
+        {
+            gl_compile_matrix(c, &tmp, 1);
+            if (!c->exec_flag)
+                return;
+            *c->matrix.stack_ptr[c->matrix.mode] = tmp;
+        }
         gl_matrix_update(c);
     }
 
     void glLoadIdentity()
     {
         GLContext *c = gl_get_context();
+        if (c->compile_flag)
+        {
+            M4 m;
+
+            gl_M4_Id(&m);
+            gl_compile_matrix(c, &m, 1);
+            if (!c->exec_flag)
+                return;
+        }
         gl_M4_Id(c->matrix.stack_ptr[c->matrix.mode]);
         gl_matrix_update(c);
     }
@@ -101,6 +123,12 @@ namespace fp
             q += 4;
         }
 
+        if (c->compile_flag)
+        {
+            gl_compile_matrix(c, &m, 0);
+            if (!c->exec_flag)
+                return;
+        }
         gl_M4_MulLeft(c->matrix.stack_ptr[c->matrix.mode], &m);
         gl_matrix_update(c);
     }
@@ -111,6 +139,13 @@ namespace fp
         int n = c->matrix.mode;
         M4 *m;
 
+        if (c->compile_flag)
+        {
+            gl_compile_call(c, GL_LIST_PUSH_MATRIX, 0, 0);
+            if (!c->exec_flag)
+                return;
+        }
+
         assert((c->matrix.stack_ptr[n] - c->matrix.stack[n] + 1) < c->matrix.stack_depth_max[n]);
 
         m = ++c->matrix.stack_ptr[n];
@@ -125,6 +160,13 @@ namespace fp
         GLContext *c = gl_get_context();
         int n = c->matrix.mode;
 
+        if (c->compile_flag)
+        {
+            gl_compile_call(c, GL_LIST_POP_MATRIX, 0, 0);
+            if (!c->exec_flag)
+                return;
+        }
+
         assert(c->matrix.stack_ptr[n] > c->matrix.stack[n]);
         c->matrix.stack_ptr[n]--;
         gl_matrix_update(c);
@@ -199,6 +241,12 @@ namespace fp
         }
         }
 
+        if (c->compile_flag)
+        {
+            gl_compile_matrix(c, &m, 0);
+            if (!c->exec_flag)
+                return;
+        }
         gl_M4_MulLeft(c->matrix.stack_ptr[c->matrix.mode], &m);
 
         gl_matrix_update(c);
@@ -208,6 +256,19 @@ namespace fp
     {
         GLContext *c = gl_get_context();
         tGLfixed *m;
+
+        if (c->compile_flag)
+        {
+            M4 s;
+
+            gl_M4_Id(&s);
+            s.m[0][0] = x;
+            s.m[1][1] = y;
+            s.m[2][2] = z;
+            gl_compile_matrix(c, &s, 0);
+            if (!c->exec_flag)
+                return;
+        }
         m = &c->matrix.stack_ptr[c->matrix.mode]->m[0][0];
 
         m[0] = fp::multiply(m[0], x);
@@ -229,6 +290,19 @@ namespace fp
     {
         GLContext *c = gl_get_context();
         tGLfixed *m;
+
+        if (c->compile_flag)
+        {
+            M4 t;
+
+            gl_M4_Id(&t);
+            t.m[0][3] = x;
+            t.m[1][3] = y;
+            t.m[2][3] = z;
+            gl_compile_matrix(c, &t, 0);
+            if (!c->exec_flag)
+                return;
+        }
         m = &c->matrix.stack_ptr[c->matrix.mode]->m[0][0];
 
         m[3] = m[0] * x + m[1] * y + m[2] * z + m[3];
@@ -271,6 +345,12 @@ namespace fp
         r[14] = -1;
         r[15] = 0;
 
+        if (c->compile_flag)
+        {
+            gl_compile_matrix(c, &m, 0);
+            if (!c->exec_flag)
+                return;
+        }
         gl_M4_MulLeft(c->matrix.stack_ptr[c->matrix.mode], &m);
 
         gl_matrix_update(c);
@@ -321,6 +401,13 @@ namespace fp
         r[11] = zero;
         r[15] = one;
 
+        if (c->compile_flag)
+        {
+            gl_compile_matrix(c, (M4 *)&r, 0);
+            if (!c->exec_flag)
+                return;
+        }
+
         // Multiply the current matrix by the orthographic projection matrix
         gl_M4_MulLeft(c->matrix.stack_ptr[c->matrix.mode], (M4 *)&r);
 
@@ -6,6 +6,17 @@ void glViewport(GLint x, GLint y, GLint width, GLint height) {
     GLContext *c = gl_get_context();
     int xsize, ysize, xmin, ymin, xsize_req, ysize_req;
 
+    if (c->compile_flag) {
+        GLParam p[4];
+        p[0].i = x;
+        p[1].i = y;
+        p[2].i = width;
+        p[3].i = height;
+        gl_compile_state(c, GL_LIST_VIEWPORT, p);
+        if (!c->exec_flag)
+            return;
+    }
+
     xmin = x;
     ymin = y;
     xsize = width;
@@ -43,24 +54,47 @@ void glViewport(GLint x, GLint y, GLint width, GLint height) {
 
 void glShadeModel(GLenum mode) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_call(c, GL_LIST_SHADE_MODEL, mode, 0);
+        if (!c->exec_flag)
+            return;
+    }
     assert(mode == GL_FLAT || mode == GL_SMOOTH);
     c->current_shade_model = mode;
 }
 
 void glCullFace(GLenum mode) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_call(c, GL_LIST_CULL_FACE, mode, 0);
+        if (!c->exec_flag)
+            return;
+    }
     assert(mode == GL_BACK || mode == GL_FRONT || mode == GL_FRONT_AND_BACK);
     c->current_cull_face = mode;
 }
 
 void glFrontFace(GLenum mode) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_call(c, GL_LIST_FRONT_FACE, mode, 0);
+        if (!c->exec_flag)
+            return;
+    }
     assert(mode == GL_CCW || mode == GL_CW);
     c->current_front_face = (mode != GL_CCW);
 }
 
 void glPolygonMode(GLenum face, GLenum mode) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[2];
+        p[0].i = face;
+        p[1].i = mode;
+        gl_compile_state(c, GL_LIST_POLYGON_MODE, p);
+        if (!c->exec_flag)
+            return;
+    }
     assert(face == GL_BACK || face == GL_FRONT || face == GL_FRONT_AND_BACK);
     // todo(alpi): GL_POINTS instead GL_POINT? GL_LINES instead of GL_LINE?
 //    assert(mode == GL_POINT || mode == GL_LINE || mode == GL_FILL);
@@ -92,6 +126,14 @@ void glHint(GLenum target, GLenum mode) {
 
 void glPolygonOffset(tGLfixed factor, tGLfixed units) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[2];
+        p[0].i = factor.data();
+        p[1].i = units.data();
+        gl_compile_state(c, GL_LIST_POLYGON_OFFSET, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->offset.factor = factor;
     c->offset.units = units;
 }
@@ -28,6 +28,12 @@ const GLTEXTSIZE GL_TEXT_SIZE120x120 = 15;
 const GLTEXTSIZE GL_TEXT_SIZE128x128 = 16;
 const GLTEXTSIZE GL_MAX_TEXT_SIZE = 16;
 
+// Non standard capabilities for glEnable / glDisable
+const GLenum GL_HALF_SPACE_RASTER_TGL = 0x10000; // 8x8 block edge function rasterizer
+const GLenum GL_DEPTH_PREPASS_TGL = 0x10001;     // z of the frame first, then shade the visible pixels
+const GLenum GL_JIT_TGL = 0x10002;               // span kernels and vertex transforms generated at runtime
+const GLenum GL_TILED_LAYOUT_TGL = 0x10003;      // frame stored by tiles, copied to rows on present
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,162 @@
+/* offscreen driver for TinyGL */
+#include "offscreen.hpp"
+#include "misc.hpp"
+#include "ztile.hpp"
+
+namespace fp {
+
+TinyOSContext *glOSCreateContext(int format) {
+    TinyOSContext *ctx;
+
+    if (format != ZB_FORMAT_B8G8R8X8 && format != ZB_FORMAT_R5G6B5) {
+        fprintf(stderr, "glOSCreateContext: format %d cannot be drawn\n", format);
+        return NULL;
+    }
+    ctx = (TinyOSContext *)malloc(sizeof(TinyOSContext));
+    if (ctx == NULL)
+        return NULL;
+    ctx->gl_context = NULL;
+    ctx->format = format;
+    ctx->buffer = NULL;
+    ctx->xsize = 0;
+    ctx->ysize = 0;
+    ctx->linesize = 0;
+    ctx->stream = NULL;
+    return ctx;
+}
+
+void glOSDestroyContext(TinyOSContext *ctx) {
+    if (ctx->stream != NULL)
+        ZB_streamClose(ctx->stream);
+    if (ctx->gl_context != NULL) {
+        ZBuffer *zb = ctx->gl_context->zb;
+
+        glClose();
+        ZB_close(zb);
+    }
+    free(ctx);
+}
+
+/* the buffer is not resized by glViewport(), only clamped to it */
+static int glOS_resize_viewport(GLContext *c, int *xsize_ptr, int *ysize_ptr) {
+    TinyOSContext *ctx = (TinyOSContext *)c->opaque;
+
+    if (*xsize_ptr > ctx->xsize) *xsize_ptr = ctx->xsize;
+    if (*ysize_ptr > ctx->ysize) *ysize_ptr = ctx->ysize;
+    return 0;
+}
+
+TinyOSContext *glOSCreateBandContext(int format, int xsize, int ysize, int band_rows,
+                                     ZB_bandFunc func, void *arg) {
+    int mode = format == ZB_FORMAT_R5G6B5 ? ZB_MODE_5R6G5B : ZB_MODE_RGBA;
+    TinyOSContext *ctx;
+    ZBuffer *zb;
+
+    xsize &= ~3;
+    if (xsize <= 0 || ysize <= 0)
+        return NULL;
+    ctx = glOSCreateContext(format);
+    if (ctx == NULL)
+        return NULL;
+    zb = ZB_openBands(xsize, ysize, mode, band_rows, func, arg);
+    if (zb == NULL) {
+        free(ctx);
+        return NULL;
+    }
+
+    glInit(zb);
+    ctx->gl_context = gl_get_context();
+    ctx->gl_context->opaque = (void *)ctx;
+    ctx->gl_context->gl_resize_viewport = glOS_resize_viewport;
+    ctx->linesize = zb->linesize;
+    ctx->xsize = xsize;
+    ctx->ysize = ysize;
+    glViewport(0, 0, xsize, ysize);
+    return ctx;
+}
+
+GLboolean glOSMakeCurrent(TinyOSContext *ctx, void *buffer, int xsize, int ysize, int linesize) {
+    int mode = ctx->format == ZB_FORMAT_R5G6B5 ? ZB_MODE_5R6G5B : ZB_MODE_RGBA;
+    ZBuffer *zb;
+
+    xsize &= ~3;
+    if (buffer == NULL || xsize <= 0 || ysize <= 0)
+        return GL_FALSE;
+
+    /* the bands have no buffer of the frame */
+    if (ctx->gl_context != NULL && ctx->gl_context->zb->band_rows > 0)
+        return GL_FALSE;
+
+    if (ctx->gl_context == NULL) {
+        zb = ZB_open(xsize, ysize, mode, 0, NULL, NULL, buffer);
+        if (zb == NULL)
+            return GL_FALSE;
+        if (ZB_setFrameBuffer(zb, buffer, linesize) != 0) {
+            ZB_close(zb);
+            return GL_FALSE;
+        }
+
+        /* initialisation of the TinyGL interpreter */
+        glInit(zb);
+        ctx->gl_context = gl_get_context();
+        ctx->gl_context->opaque = (void *)ctx;
+        ctx->gl_context->gl_resize_viewport = glOS_resize_viewport;
+    } else {
+        zb = ctx->gl_context->zb;
+        if (xsize != zb->xsize || ysize != zb->ysize)
+            ZB_resize(zb, buffer, xsize, ysize);
+        if (ZB_setFrameBuffer(zb, buffer, linesize) != 0)
+            return GL_FALSE;
+    }
+
+    ctx->buffer = buffer;
+    ctx->linesize = zb->tiled ? zb->linear_linesize : zb->linesize;
+    if (xsize != ctx->xsize || ysize != ctx->ysize) {
+        ctx->xsize = xsize;
+        ctx->ysize = ysize;
+        glViewport(0, 0, xsize, ysize);
+    }
+    return GL_TRUE;
+}
+
+void glOSFinish(TinyOSContext *ctx) {
+    ZBuffer *zb = ctx->gl_context->zb;
+
+    if (zb->band_rows > 0) {
+        ZB_tileBands(zb);
+        return;
+    }
+    ZB_tileFlush(zb);
+    ZB_clearResolve(zb, 0, 0, zb->xsize - 1, zb->ysize - 1);
+    /* the tiles are only copied to the buffer of the caller here */
+    if (zb->tiled)
+        ZB_copyFrameBuffer(zb, ctx->buffer, ctx->linesize);
+
+    /* the damage of the frame, as glXSwapBuffers() */
+    if (ctx->stream != NULL) {
+        if (ZB_streamFrame(zb, ctx->stream, &zb->damage) != 0)
+            fprintf(stderr, "glOSFinish: the stream failed\n");
+        ZB_damageReset(&zb->damage);
+    }
+}
+
+int glOSStream(TinyOSContext *ctx, int fd, int ring_size) {
+    if (ctx->stream != NULL)
+        ZB_streamClose(ctx->stream);
+    ctx->stream = NULL;
+    if (fd < 0)
+        return 0;
+    if (ctx->gl_context == NULL || ctx->gl_context->zb->band_rows > 0)
+        return -1;
+    ctx->stream = ZB_streamOpen(fd, ring_size);
+    return ctx->stream != NULL ? 0 : -1;
+}
+
+void glOSStreamStats(TinyOSContext *ctx, ZBStreamStats *stats) {
+    if (ctx->stream != NULL)
+        ZB_streamStats(ctx->stream, stats);
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+} // namespace fp
@@ -0,0 +1,60 @@
+/* offscreen driver for TinyGL, drawing in memory owned by the caller */
+#pragma once
+
+#include "zgl.hpp"
+#include "zstream.hpp"
+
+namespace fp {
+
+typedef struct {
+    GLContext *gl_context;
+    int format; /* ZB_FORMAT_* of zsimd.hpp */
+    void *buffer;
+    int xsize, ysize;
+    int linesize; /* in bytes */
+    ZBStream *stream; /* see glOSStream() */
+} TinyOSContext;
+
+/*
+ * A context drawing straight in buffers of format, without any copy.
+ * The formats are the ones the rasterizer draws: ZB_FORMAT_B8G8R8X8 and
+ * ZB_FORMAT_R5G6B5. Returns NULL for the others.
+ */
+TinyOSContext *glOSCreateContext(int format);
+
+/*
+ * A current context drawing xsize x ysize frames of format in bands of
+ * band_rows rows, only allocating the buffers of one band: glOSFinish()
+ * draws the frame and sends its bands to func (see ZB_openBands() for
+ * what is not drawn). glOSMakeCurrent() does not apply to it.
+ */
+TinyOSContext *glOSCreateBandContext(int format, int xsize, int ysize, int band_rows,
+                                     ZB_bandFunc func, void *arg);
+
+void glOSDestroyContext(TinyOSContext *ctx);
+
+/*
+ * Draw in buffer, xsize x ysize pixels of rows of linesize bytes (0 for
+ * packed rows). The caller keeps the buffer until the next call or the
+ * destruction of the context. As with the glx driver, xsize is rounded
+ * down to a multiple of 4 and glViewport() is clamped to the buffer.
+ */
+GLboolean glOSMakeCurrent(TinyOSContext *ctx, void *buffer, int xsize, int ysize, int linesize);
+
+/*
+ * the triangles sent and the pending clears are in the buffer on return,
+ * or sent to the function of the bands
+ */
+void glOSFinish(TinyOSContext *ctx);
+
+/*
+ * Stream the frames to fd, usually a Unix socket from ZB_streamConnect():
+ * glOSFinish() then sends the tiles damaged since the previous call which
+ * changed, see zstream.hpp, through a ring of ring_size bytes. fd < 0
+ * stops it. Not available with the bands.
+ */
+int glOSStream(TinyOSContext *ctx, int fd, int ring_size);
+
+void glOSStreamStats(TinyOSContext *ctx, ZBStreamStats *stats);
+
+} // namespace fp
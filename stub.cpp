@@ -12,18 +12,10 @@ void glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha
     fprintf(stderr, "STUB: glColorMask()\n");
 }
 
-void glDepthFunc(GLenum func) {
-    fprintf(stderr, "STUB: glDepthFunc()\n");
-}
-
 void glClearDepthx(GLclampx depth) {
     fprintf(stderr, "STUB: glClearDepthf()\n");
 }
 
-void glDepthMask(GLboolean flag) {
-    fprintf(stderr, "STUB: glDepthMask()\n");
-}
-
 void glLineWidth(tGLfixed width) {
     fprintf(stderr, "STUB: glLineWidth\n");
 }
@@ -32,8 +24,4 @@ void glPointSize(tGLfixed size) {
     fprintf(stderr, "STUB: glPointSize\n");
 }
 
-void glFinish() {
-    fprintf(stderr, "STUB: glFinish()\n");
-}
-
 } // namespace fp
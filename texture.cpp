@@ -8,6 +8,8 @@
 #include <cassert> // For assert (used sparingly)
 #include <cmath>   // For floorf, fmodf, fabsf, etc.
 #include "mygl.h"  // Include OpenGL context and helper functions
+#include "ztile.hpp" // For ZB_tileFlush
+#include "zsurface.hpp" // For ZB_surfaceAlloc
 
 // Define maximum number of texture levels (e.g., for mipmapping)
 #define MAX_TEXTURE_LEVELS 10
@@ -50,11 +52,14 @@ namespace fp
             t->next->prev = t->prev;
         }
 
+        // Binned triangles may still sample this texture
+        ZB_tileFlush(c->zb);
+
         for (int i = 0; i < MAX_TEXTURE_LEVELS; i++)
         {
             if (t->images[i].pixmap != NULL)
             {
-                free(t->images[i].pixmap);
+                ZB_surfaceFree(t->images[i].pixmap);
                 t->images[i].pixmap = NULL;
             }
         }
@@ -130,7 +135,7 @@ namespace fp
             {
                 if (t == c->texture.current)
                 {
-                    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture if it's currently bound
+                    c->texture.current = NULL; // Unbind the texture if it's currently bound
                 }
                 free_texture(c, texture);
             }
@@ -141,6 +146,12 @@ namespace fp
     {
         GLContext *c = gl_get_context();
 
+        if (c->compile_flag)
+        {
+            gl_compile_call(c, GL_LIST_BIND_TEXTURE, target, texture);
+            if (!c->exec_flag)
+                return;
+        }
         if (target != GL_TEXTURE_2D)
         {
             gl_error(GL_INVALID_ENUM, "glBindTexture: target must be GL_TEXTURE_2D");
@@ -180,6 +191,10 @@ namespace fp
     {
         GLContext *c = gl_get_context();
 
+        /* not recorded in the lists */
+        if (c->compile_flag && !c->exec_flag)
+            return;
+
         if (target != GL_TEXTURE_2D)
         {
             gl_error(GL_INVALID_ENUM, "glTexImage2D: target must be GL_TEXTURE_2D");
@@ -279,15 +294,16 @@ namespace fp
 
         if (image->pixmap != NULL)
         {
-            free(image->pixmap); // Free the existing texture if necessary
+            ZB_tileFlush(c->zb); // Binned triangles may still sample the old image
+            ZB_surfaceFree(image->pixmap); // Free the existing texture if necessary
             image->pixmap = NULL;
         }
 
-        // Allocate memory for the texture image data
+        // Allocate memory for the texture image data, aligned and faulted in before it is sampled
         size_t dataSize = width * height * bytesPerPixel;
         if (pixels != NULL)
         {
-            image->pixmap = (unsigned char *)malloc(dataSize);
+            image->pixmap = (unsigned char *)ZB_surfaceAlloc(dataSize);
             if (image->pixmap == NULL)
             {
                 gl_error(GL_OUT_OF_MEMORY, "glTexImage2D: failed to allocate texture memory");
@@ -314,6 +330,17 @@ namespace fp
     {
         GLContext *c = gl_get_context();
 
+        if (c->compile_flag)
+        {
+            GLParam p[3];
+            p[0].i = target;
+            p[1].i = pname;
+            p[2].i = param;
+            gl_compile_state(c, GL_LIST_TEX_ENVX, p);
+            if (!c->exec_flag)
+                return;
+        }
+
         if (target != GL_TEXTURE_ENV || pname != GL_TEXTURE_ENV_MODE)
         {
             gl_error(GL_INVALID_ENUM, "glTexEnvx: unsupported target or pname");
@@ -338,6 +365,17 @@ namespace fp
     {
         GLContext *c = gl_get_context();
 
+        if (c->compile_flag)
+        {
+            GLParam p[3];
+            p[0].i = target;
+            p[1].i = pname;
+            p[2].i = param;
+            gl_compile_state(c, GL_LIST_TEX_ENVI, p);
+            if (!c->exec_flag)
+                return;
+        }
+
         if (target != GL_TEXTURE_ENV || pname != GL_TEXTURE_ENV_MODE)
         {
             gl_error(GL_INVALID_ENUM, "glTexEnvi: unsupported target or pname");
@@ -359,6 +397,17 @@ namespace fp
         GLContext *c = gl_get_context();
         GLTexture *t = c->texture.current;
 
+        if (c->compile_flag)
+        {
+            GLParam p[3];
+            p[0].i = target;
+            p[1].i = pname;
+            p[2].i = param;
+            gl_compile_state(c, GL_LIST_TEX_PARAMETER, p);
+            if (!c->exec_flag)
+                return;
+        }
+
         if (target != GL_TEXTURE_2D)
         {
             gl_error(GL_INVALID_ENUM, "glTexParameteri: unsupported target");
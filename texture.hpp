@@ -4,6 +4,8 @@
 
 #include "mygl.h"     // Include OpenGL ES 1.1 headers for types like GLenum, GLuint, etc.
 #include <cstddef>    // For size_t
+#include "buffer.hpp"  // For GLBuffer, shared like the textures
+#include "list.hpp"    // For GLList, shared too
 
 namespace fp {
 
@@ -47,11 +49,19 @@ struct GLTexture {
 
 struct GLSharedState {
     GLTexture *texture_hash_table[TEXTURE_HASH_TABLE_SIZE];
+    GLBuffer *buffer_hash_table[BUFFER_HASH_TABLE_SIZE];
+    GLList *lists[MAX_DISPLAY_LISTS]; /* by name, 0 unused */
 
     GLSharedState() {
         for (int i = 0; i < TEXTURE_HASH_TABLE_SIZE; ++i) {
             texture_hash_table[i] = nullptr;
         }
+        for (int i = 0; i < BUFFER_HASH_TABLE_SIZE; ++i) {
+            buffer_hash_table[i] = nullptr;
+        }
+        for (int i = 0; i < MAX_DISPLAY_LISTS; ++i) {
+            lists[i] = nullptr;
+        }
     }
 };
 
@@ -61,7 +71,7 @@ struct GLTextureState {
     GLenum env_mode;          // Texture environment mode (e.g., GL_MODULATE)
     int enabled_2d;
 
-    GLTextureState() : current(nullptr), env_mode(GL_MODULATE) {}
+    GLTextureState() : current(nullptr), env_mode(GL_MODULATE), enabled_2d(0) {}
 };
 
 // Function declarations
@@ -75,7 +85,7 @@ void glTexImage2D(GLenum target, GLint level, GLint internalFormat,
                   GLsizei width, GLsizei height, GLint border,
                   GLenum format, GLenum type, const GLvoid *pixels);
 
-void glTexEnvx(GLenum target, GLenum pname, GLenum param);
+void glTexEnvx(GLenum target, GLenum pname, GLint param);
 void glTexEnvi(GLenum target, GLenum pname, GLint param);
 
 void glTexParameteri(GLenum target, GLenum pname, GLint param);
@@ -1,11 +1,17 @@
 #include "vertex.hpp"
 #include "matrix.hpp" // to print matrix
 #include "light.hpp"
+#include "zjit.hpp"
 
 namespace fp {
 
 void glNormal3x(tGLfixed x, tGLfixed y, tGLfixed z) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_attrib(c, GL_NORMAL_ARRAY, x, y, z, 0);
+        if (!c->exec_flag)
+            return;
+    }
     c->current.normal.X = x;
     c->current.normal.Y = y;
     c->current.normal.Z = z;
@@ -14,6 +20,11 @@ void glNormal3x(tGLfixed x, tGLfixed y, tGLfixed z) {
 
 void glTexCoord4x(tGLfixed s, tGLfixed t, tGLfixed r, tGLfixed q) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_attrib(c, GL_TEXTURE_COORD_ARRAY, s, t, r, q);
+        if (!c->exec_flag)
+            return;
+    }
     c->current.tex_coord.X = s;
     c->current.tex_coord.Y = t;
     c->current.tex_coord.Z = r;
@@ -22,11 +33,23 @@ void glTexCoord4x(tGLfixed s, tGLfixed t, tGLfixed r, tGLfixed q) {
 
 void glEdgeFlag(GLboolean flag) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        GLParam p[1];
+        p[0].i = flag;
+        gl_compile_state(c, GL_LIST_EDGE_FLAG, p);
+        if (!c->exec_flag)
+            return;
+    }
     c->current.edge_flag = flag;
 }
 
 void glColor4x(tGLfixed r, tGLfixed g, tGLfixed b, tGLfixed a) {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_attrib(c, GL_COLOR_ARRAY, r, g, b, a);
+        if (!c->exec_flag)
+            return;
+    }
     c->current.color.X = r;
     c->current.color.Y = g;
     c->current.color.Z = b;
@@ -35,33 +58,66 @@ void glColor4x(tGLfixed r, tGLfixed g, tGLfixed b, tGLfixed a) {
     c->current.longcolor[0] = (unsigned int) (r * (ZB_POINT_RED_MAX - ZB_POINT_RED_MIN) + ZB_POINT_RED_MIN);
     c->current.longcolor[1] = (unsigned int) (g * (ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN) + ZB_POINT_GREEN_MIN);
     c->current.longcolor[2] = (unsigned int) (b * (ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN) + ZB_POINT_BLUE_MIN);
+    c->current.longcolor[3] = (unsigned int) (a * (ZB_POINT_ALPHA_MAX - ZB_POINT_ALPHA_MIN) + ZB_POINT_ALPHA_MIN);
 
     if (c->material.color.enabled) {
         tGLfixed color[4] = {0.5, 0.5, 0.5, 0.5};
-        glMaterialxv(c->material.color.current_mode, c->material.color.current_type, color);
+        gl_material(c, c->material.color.current_mode, c->material.color.current_type, color);
     }
 }
 
 
 void gl_eval_viewport(GLContext * c) {
     GLViewport *v;
-    tGLfixed zsize = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS));
+    int xmin, ymin, xsize, ysize;
 
     v = &c->viewport;
 
-    v->trans.X = ((v->xsize - 0.5) / 2.0) + v->xmin;
-    v->trans.Y = ((v->ysize - 0.5) / 2.0) + v->ymin;
-    v->trans.Z = ((zsize - 0.5) / 2.0) + ((1 << ZB_POINT_Z_FRAC_BITS)) / 2;
-
-    v->scale.X = (v->xsize - 0.5) / 2.0;
-    v->scale.Y = -(v->ysize - 0.5) / 2.0;
-    v->scale.Z = -((zsize - 0.5) / 2.0);
+    /* the viewport is given in pixels of the window */
+    xmin = (int)(((long long)v->xmin * v->xratio) >> 16);
+    ymin = (int)(((long long)v->ymin * v->yratio) >> 16);
+    xsize = (int)(((long long)(v->xmin + v->xsize) * v->xratio) >> 16) - xmin;
+    ysize = (int)(((long long)(v->ymin + v->ysize) * v->yratio) >> 16) - ymin;
+
+    v->trans.X = ((xsize - 0.5) / 2.0) + xmin;
+    v->trans.Y = ((ysize - 0.5) / 2.0) + ymin;
+
+    v->scale.X = (xsize - 0.5) / 2.0;
+    v->scale.Y = -(ysize - 0.5) / 2.0;
+
+    /*
+     * the z scale does not fit in a tGLfixed: z is mapped from [-1, 1] to
+     * [2^30, 0[ with integers on the raw 16.16 value, or to a half of it
+     * with glDepthParity(), see ZB_flipDepth()
+     */
+    if (c->depth_parity == 0) {
+        v->zscale = -(1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 1 - 16));
+        v->ztrans = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 1)) + (1 << (ZB_POINT_Z_FRAC_BITS - 1));
+        v->zmin = 0;
+        v->zmax = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS)) - 1;
+    } else if (!c->zb->depth_flip) {
+        v->zscale = -(1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 2 - 16));
+        v->ztrans = (3 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 2)) + (1 << (ZB_POINT_Z_FRAC_BITS - 1));
+        v->zmin = 1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 1);
+        v->zmax = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS)) - 1;
+    } else {
+        v->zscale = 1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 2 - 16);
+        v->ztrans = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 2)) + (1 << (ZB_POINT_Z_FRAC_BITS - 1));
+        v->zmin = 0;
+        v->zmax = (1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS - 1)) - 1;
+    }
 }
 
 void glBegin(GLenum type) {
     GLContext *c = gl_get_context();
     M4 tmp;
 
+    if (c->compile_flag) {
+        gl_compile_begin(c, type);
+        if (!c->exec_flag)
+            return;
+    }
+
     assert(c->in_begin == 0);
 
     c->begin_type = type;
@@ -130,6 +186,10 @@ void glBegin(GLenum type) {
             c->draw_triangle_back = gl_draw_triangle_fill;
             break;
     }
+
+    /* generated vertex transform */
+    if (c->zb->jit)
+        gl_jit_begin(c);
 }
 
 /* coords, tranformation , clip code and projection */
@@ -194,14 +254,17 @@ static inline void gl_vertex_transform(GLContext *c, GLVertex *v) {
 void glVertex4x(tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
     GLContext *c = gl_get_context();
     GLVertex *v;
-    int n, i, cnt;
+    int n, jit;
+
+    if (c->compile_flag) {
+        gl_compile_vertex(c, x, y, z, w);
+        if (!c->exec_flag)
+            return;
+    }
 
     assert(c->in_begin != 0);
 
     n = c->vertex_n;
-    cnt = c->vertex_cnt;
-    cnt++;
-    c->vertex_cnt = cnt;
 
     /* quick fix to avoid crashes on large polygons */
     if (n >= c->vertex_max) {
@@ -217,14 +280,20 @@ void glVertex4x(tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
     }
     /* new vertex entry */
     v = &c->vertex[n];
-    n++;
 
     v->coord.X = x;
     v->coord.Y = y;
     v->coord.Z = z;
     v->coord.W = w;
 
-    gl_vertex_transform(c, v);
+    jit = c->zb->jit && c->jit.vertex != NULL && c->jit.generation == ZB_jitGeneration;
+    if (jit) {
+        c->jit.vertex(v, &c->current.normal);
+    } else {
+        gl_vertex_transform(c, v);
+        if (c->zb->jit && ++c->jit.count >= GL_JIT_HOT_VERTICES)
+            gl_jit_vertex(c);
+    }
 
     /* color */
 
@@ -244,13 +313,24 @@ void glVertex4x(tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
     }
 
     /* precompute the mapping to the viewport */
-    if (v->clip_code == 0)
-        gl_transform_to_viewport(c, v);
+    if (v->clip_code == 0) {
+        if (jit)
+            gl_attribs_to_viewport(c, v);
+        else
+            gl_transform_to_viewport(c, v);
+    }
 
     /* edge flag */
 
     v->edge_flag = c->current.edge_flag;
 
+    gl_assemble_vertex(c);
+}
+
+/* the primitives of begin_type ended by c->vertex[c->vertex_n], just filled */
+void gl_assemble_vertex(GLContext *c) {
+    int n = c->vertex_n + 1, cnt = ++c->vertex_cnt;
+
     switch (c->begin_type) {
         case GL_POINTS:
             gl_draw_point(c, &c->vertex[0]);
@@ -334,6 +414,11 @@ void glVertex4x(tGLfixed x, tGLfixed y, tGLfixed z, tGLfixed w) {
 
 void glEnd() {
     GLContext *c = gl_get_context();
+    if (c->compile_flag) {
+        gl_compile_end(c);
+        if (!c->exec_flag)
+            return;
+    }
     assert(c->in_begin == 1);
 
     if (c->begin_type == GL_LINE_LOOP) {
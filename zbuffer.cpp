@@ -2,21 +2,50 @@
  * Z buffer: 16 bits Z / 16 bits color
  *
  */
-#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
-#include <unistd.h>  // For sysconf to get the number of cores
+#include <unistd.h>
 #include "zbuffer.hpp"
+#include "ztile.hpp"
+#include "zthread.hpp"
+#include "zsimd.hpp"
+#include "zsurface.hpp"
 
 namespace fp {
 
-ZBuffer *ZB_open(int xsize, int ysize, int mode,
-                 int nb_colors,
-                 unsigned char *color_indexes,
-                 int *color_table,
-                 void *frame_buffer) {
+/* rows of tiles from which ZB_clearResolve() runs on the worker threads */
+#define ZB_CLEAR_THREAD_TILES 4
+
+/* pixels from which ZB_convertRect() runs on the worker threads */
+#define ZB_CONVERT_THREAD_PIXELS (4 * ZB_TILE_SIZE * ZB_TILE_SIZE)
+
+/* no pending clear, the buffers start with undefined pixels */
+static int ZB_clearResize(ZBuffer *zb) {
+    free(zb->cleared);
+    zb->cleared_xsize = (zb->xsize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT;
+    zb->cleared_ysize = (zb->ysize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT;
+    zb->cleared = (unsigned char *)calloc(zb->cleared_xsize * zb->cleared_ysize, 1);
+    return zb->cleared == NULL ? -1 : 0;
+}
+
+/* rows of zbuf and pbuf */
+static int ZB_bufferRows(ZBuffer *zb) {
+    return zb->band_rows > 0 && zb->band_rows < zb->ysize ? zb->band_rows : zb->ysize;
+}
+
+/* pixels of the tiled buffers, whole tiles */
+static int ZB_tiledPixels(ZBuffer *zb) {
+    return ((zb->xsize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT) * ((zb->ysize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT) *
+           ZB_TILE_SIZE * ZB_TILE_SIZE;
+}
+
+static ZBuffer *ZB_openRows(int xsize, int ysize, int mode,
+                            int nb_colors,
+                            unsigned char *color_indexes,
+                            int *color_table,
+                            void *frame_buffer, int band_rows) {
     ZBuffer *zb;
     int size;
 
@@ -26,13 +55,22 @@ ZBuffer *ZB_open(int xsize, int ysize, int mode,
 
     zb->xsize = xsize;
     zb->ysize = ysize;
+    zb->zlinesize = xsize;
+    zb->tiled = 0;
+    zb->linear_buffer = NULL;
+    zb->linear_linesize = 0;
+    zb->band_rows = band_rows;
+    zb->band_func = NULL;
+    zb->band_arg = NULL;
     zb->mode = mode;
-    zb->linesize = (xsize * PSZB + 3) & ~3;
+    zb->pixel_size = ZB_PIXEL_SIZE(mode);
+    zb->linesize = (xsize * zb->pixel_size + 3) & ~3;
     switch (mode) {
         case ZB_MODE_INDEX:
             ZB_initDither(zb, nb_colors, color_indexes, color_table);
             break;
         case ZB_MODE_RGBA:
+        case ZB_MODE_RGB24:
         case ZB_MODE_5R6G5B:
             zb->nb_colors = 0;
             break;
@@ -40,16 +78,16 @@ ZBuffer *ZB_open(int xsize, int ysize, int mode,
             goto error;
     }
 
-    size = zb->xsize * zb->ysize * sizeof(unsigned short);
+    size = zb->xsize * ZB_bufferRows(zb) * sizeof(unsigned short);
 
-    zb->zbuf = (short unsigned int*)malloc(size);
+    zb->zbuf = (unsigned short *)ZB_surfaceAlloc(size);
     if (zb->zbuf == NULL)
         goto error;
 
     if (frame_buffer == NULL) {
-        zb->pbuf = (PIXEL*)malloc(zb->ysize * zb->linesize);
+        zb->pbuf = (PIXEL *)ZB_surfaceAlloc(ZB_bufferRows(zb) * zb->linesize);
         if (zb->pbuf == NULL) {
-            free(zb->zbuf);
+            ZB_surfaceFree(zb->zbuf);
             goto error;
         }
         zb->frame_buffer_allocated = 1;
@@ -58,176 +96,662 @@ ZBuffer *ZB_open(int xsize, int ysize, int mode,
         zb->pbuf = (PIXEL*)frame_buffer;
     }
 
+    zb->hiz = NULL;
+    zb->cleared = NULL;
+    zb->damage.tiles = NULL;
+    if (ZB_hizResize(zb) != 0 || ZB_clearResize(zb) != 0 ||
+        ZB_damageResize(&zb->damage, xsize, ysize) != 0) {
+        if (zb->frame_buffer_allocated)
+            ZB_surfaceFree(zb->pbuf);
+        ZB_surfaceFree(zb->zbuf);
+        free(zb->hiz);
+        free(zb->cleared);
+        goto error;
+    }
+    zb->clear_z = 0;
+    zb->clear_color = 0;
+
     zb->current_texture = NULL;
+    zb->clip_xmin = 0;
+    zb->clip_ymin = 0;
+    zb->clip_xmax = xsize;
+    zb->clip_ymax = ysize;
+    zb->half_space = 0;
+    zb->depth_prepass = 0;
+    zb->jit = 0;
+    zb->depth_flip = 0;
+    zb->dither = 0;
+    /* the depth test of the rasterizers before they had a state */
+    zb->state = (ZB_DEPTH_LEQUAL << ZB_STATE_DEPTH_SHIFT) | ZB_STATE_ZWRITE;
+    if (zb->pixel_size == 2)
+        zb->state |= ZB_STATE_COLOR16;
+    zb->alpha_lo = 0;
+    zb->alpha_range = 255;
+    zb->blend = 0;
+    zb->tiler = NULL;
+    zb->pool = NULL;
+    zb->nb_threads = 0;
+
+    ZB_initSpans();
     return zb;
 error:
     free(zb);
     return NULL;
 }
 
+ZBuffer *ZB_open(int xsize, int ysize, int mode,
+                 int nb_colors,
+                 unsigned char *color_indexes,
+                 int *color_table,
+                 void *frame_buffer) {
+    return ZB_openRows(xsize, ysize, mode, nb_colors, color_indexes, color_table, frame_buffer, 0);
+}
+
+ZBuffer *ZB_openBands(int xsize, int ysize, int mode, int band_rows, ZB_bandFunc func, void *arg) {
+    ZBuffer *zb;
+
+    if (mode == ZB_MODE_INDEX || band_rows <= 0 || func == NULL)
+        return NULL;
+    /* the bands are made of whole rows of tiles */
+    band_rows = (band_rows + ZB_TILE_SIZE - 1) & ~(ZB_TILE_SIZE - 1);
+    zb = ZB_openRows(xsize, ysize, mode, 0, NULL, NULL, NULL, band_rows);
+    if (zb == NULL)
+        return NULL;
+    zb->band_func = func;
+    zb->band_arg = arg;
+    /* the triangles of the frame wait in the tiler */
+    if (ZB_tileOpen(zb, 1) != 0) {
+        ZB_close(zb);
+        return NULL;
+    }
+    return zb;
+}
+
 void ZB_close(ZBuffer * zb) {
+    ZB_tileClose(zb);
+    if (zb->pool != NULL)
+        ZB_poolClose(zb->pool);
+
     if (zb->mode == ZB_MODE_INDEX)
         ZB_closeDither(zb);
 
     if (zb->frame_buffer_allocated)
-        free(zb->pbuf);
+        ZB_surfaceFree(zb->pbuf);
 
-    free(zb->zbuf);
+    ZB_surfaceFree(zb->zbuf);
+    free(zb->hiz);
+    free(zb->cleared);
+    ZB_damageFree(&zb->damage);
     free(zb);
 }
 
 void ZB_resize(ZBuffer * zb, void *frame_buffer, int xsize, int ysize) {
     int size;
 
+    /* the pending triangles are lost with the old buffers */
+    ZB_tileDiscard(zb);
+
     /* xsize must be a multiple of 4 */
     xsize = xsize & ~3;
 
     zb->xsize = xsize;
     zb->ysize = ysize;
-    zb->linesize = (xsize * PSZB + 3) & ~3;
-    size = zb->xsize * zb->ysize * sizeof(unsigned short);
+    zb->linesize = (xsize * zb->pixel_size + 3) & ~3;
+    zb->zlinesize = xsize;
+    size = (zb->tiled ? ZB_tiledPixels(zb) : zb->xsize * ZB_bufferRows(zb)) * sizeof(unsigned short);
 
-    free(zb->zbuf);
-    zb->zbuf = (short unsigned int*)malloc(size);
+    ZB_surfaceFree(zb->zbuf);
+    zb->zbuf = (unsigned short *)ZB_surfaceAlloc(size);
 
     if (zb->frame_buffer_allocated)
-        free(zb->pbuf);
+        ZB_surfaceFree(zb->pbuf);
 
-    if (frame_buffer == NULL) {
-        zb->pbuf = (PIXEL*)malloc(zb->ysize * zb->linesize);
+    if (zb->tiled) {
+        zb->pbuf = (PIXEL *)ZB_surfaceAlloc(ZB_tiledPixels(zb) * zb->pixel_size);
+        zb->frame_buffer_allocated = 1;
+        zb->linear_buffer = frame_buffer;
+        zb->linear_linesize = zb->linesize;
+    } else if (frame_buffer == NULL || zb->band_rows > 0) {
+        zb->pbuf = (PIXEL *)ZB_surfaceAlloc(ZB_bufferRows(zb) * zb->linesize);
         zb->frame_buffer_allocated = 1;
     } else {
         zb->pbuf = (PIXEL*)frame_buffer;
         zb->frame_buffer_allocated = 0;
     }
-}
 
-// Structure to pass arguments to each thread
-typedef struct {
-    ZBuffer *zb;
-    uint8_t *buf;  // Use uint8_t for byte-level access
-    int linesize;
-    int startY;  // Starting line for this thread
-    int endY;    // Ending line for this thread
-} ThreadData;
+    ZB_hizResize(zb);
+    ZB_clearResize(zb);
+    ZB_damageResize(&zb->damage, xsize, ysize);
 
-// Thread function for copying RGBA framebuffer
-static void* ZB_copy_FrameBufferRGBA_thread(void* arg) {
-    ThreadData *data = (ThreadData*)arg;
-    ZBuffer *zb = data->zb;
-    uint8_t *p1 = data->buf + data->startY * data->linesize;  // Buffer for each thread
-    PIXEL *q = (PIXEL*)((uint8_t*)zb->pbuf + data->startY * zb->linesize); // Pointer to the zbuffer's pixel buffer
-
-    int n = zb->xsize * PSZB;  // Number of bytes per scanline
+    zb->clip_xmin = 0;
+    zb->clip_ymin = 0;
+    zb->clip_xmax = xsize;
+    zb->clip_ymax = ysize;
+    ZB_tileResize(zb);
+}
 
-    for (int y = data->startY; y < data->endY; y++) {
-        memcpy(p1, q, n);  // Copy each scanline
-        p1 += data->linesize;  // Move to the next line in the destination buffer
-        q = (PIXEL*)((uint8_t*)q + zb->linesize);  // Move to the next line in the source buffer
+int ZB_setFrameBuffer(ZBuffer *zb, void *frame_buffer, int linesize) {
+    int packed = (zb->xsize * zb->pixel_size + 3) & ~3;
+
+    if (linesize == 0)
+        linesize = packed;
+    if (frame_buffer == NULL || zb->band_rows > 0 || linesize < zb->xsize * zb->pixel_size || (linesize % zb->pixel_size) != 0)
+        return -1;
+
+    /* the pending triangles and clears are drawn in the buffer they were sent for */
+    ZB_tileFlush(zb);
+    if (zb->tiled) {
+        /* the frames are copied to it */
+        if (zb->linear_buffer != frame_buffer)
+            ZB_damageAll(&zb->damage);
+        zb->linear_buffer = frame_buffer;
+        zb->linear_linesize = linesize;
+        return 0;
+    }
+    if ((void *)zb->pbuf != frame_buffer) {
+        ZB_clearResolve(zb, 0, 0, zb->xsize - 1, zb->ysize - 1);
+        ZB_damageAll(&zb->damage);
     }
 
-    return NULL;
+    if (zb->frame_buffer_allocated)
+        ZB_surfaceFree(zb->pbuf);
+    zb->pbuf = (PIXEL *)frame_buffer;
+    zb->frame_buffer_allocated = 0;
+    zb->linesize = linesize;
+    return 0;
 }
 
-void ZB_copy_FrameBufferRGBA(ZBuffer *zb, void *buf, int linesize) {
-    int numCores = sysconf(_SC_NPROCESSORS_ONLN);  // Get number of CPU cores
-    int numThreads = numCores - 1;  // Leave 1 core for the main thread
+/* the z of the pixel x, y, whatever the layout */
+static unsigned short *ZB_depthAddress(const ZBuffer *zb, int x, int y) {
+    if (zb->tiled) {
+        int tile = (y >> ZB_TILE_SHIFT) * ((zb->xsize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT) + (x >> ZB_TILE_SHIFT);
 
-    if (numThreads <= 0) {
-        numThreads = 1;  // Use at least 1 thread
+        return zb->zbuf + (tile << (2 * ZB_TILE_SHIFT)) +
+               ((y & (ZB_TILE_SIZE - 1)) << ZB_TILE_SHIFT) + (x & (ZB_TILE_SIZE - 1));
     }
+    return zb->zbuf + y * zb->zlinesize + x;
+}
 
-    pthread_t threads[numThreads];
-    ThreadData threadData[numThreads];
+/*
+ * The rasterizers address the tile as a buffer of rows of ZB_TILE_SIZE
+ * pixels holding the whole screen, of which they only touch the tile.
+ */
+void ZB_tileView(const ZBuffer *zb, ZBuffer *view, int tx, int ty) {
+    int x = tx << ZB_TILE_SHIFT, y = ty << ZB_TILE_SHIFT;
+
+    *view = *zb;
+    view->linesize = ZB_TILE_SIZE * zb->pixel_size;
+    view->pbuf = (PIXEL *)(ZB_pixelAddress(zb, x, y) - y * view->linesize - x * zb->pixel_size);
+    view->zlinesize = ZB_TILE_SIZE;
+    view->zbuf = ZB_depthAddress(zb, x, y) - y * ZB_TILE_SIZE - x;
+    view->tiled = 0;
+}
 
-    int linesPerThread = zb->ysize / numThreads;  // Divide the work among threads
-    int remainingLines = zb->ysize % numThreads;  // Handle any remaining lines
+void ZB_tileCopy(ZBuffer *zb, const ZBRect *rect, void *pixels, int linesize,
+                 unsigned short *z, int zlinesize, int store) {
+    int x, y, n, ps = zb->pixel_size;
+
+    for (y = rect->ymin; y < rect->ymax; y++) {
+        for (x = rect->xmin; x < rect->xmax; x += n) {
+            unsigned char *p = (unsigned char *)pixels + (y - rect->ymin) * linesize + (x - rect->xmin) * ps;
+            unsigned short *pz = z + (y - rect->ymin) * zlinesize + (x - rect->xmin);
+
+            n = ZB_TILE_SIZE - (x & (ZB_TILE_SIZE - 1));
+            if (n > rect->xmax - x) n = rect->xmax - x;
+            if (store) {
+                memcpy(ZB_pixelAddress(zb, x, y), p, n * ps);
+                memcpy(ZB_depthAddress(zb, x, y), pz, n * sizeof(unsigned short));
+            } else {
+                memcpy(p, ZB_pixelAddress(zb, x, y), n * ps);
+                memcpy(pz, ZB_depthAddress(zb, x, y), n * sizeof(unsigned short));
+            }
+        }
+    }
+}
 
-    // Launch threads
-    for (int i = 0; i < numThreads; i++) {
-        threadData[i].zb = zb;
-        threadData[i].buf = (uint8_t*)buf;
-        threadData[i].linesize = linesize;
-        threadData[i].startY = i * linesPerThread;
-        threadData[i].endY = threadData[i].startY + linesPerThread;
+/* the pixels and z are kept, the pending clears still apply */
+int ZB_setLayout(ZBuffer *zb, int tiled) {
+    ZBRect rect = {0, 0, zb->xsize, zb->ysize};
+    unsigned short *zbuf;
+    PIXEL *pbuf;
+    int linesize;
 
-        if (i == numThreads - 1) {
-            threadData[i].endY += remainingLines;  // Last thread handles remaining lines
+    tiled = tiled != 0;
+    if (tiled == zb->tiled)
+        return 0;
+    if (zb->mode == ZB_MODE_INDEX || zb->band_rows > 0)
+        return -1;
+    /* only the tiler draws in the tiles */
+    if (tiled && zb->tiler == NULL && ZB_tileOpen(zb, 1) != 0)
+        return -1;
+    ZB_tileFlush(zb);
+
+    if (tiled) {
+        zbuf = (unsigned short *)ZB_surfaceAlloc(ZB_tiledPixels(zb) * sizeof(unsigned short));
+        pbuf = (PIXEL *)ZB_surfaceAlloc(ZB_tiledPixels(zb) * zb->pixel_size);
+        if (zbuf == NULL || pbuf == NULL) {
+            ZB_surfaceFree(zbuf);
+            ZB_surfaceFree(pbuf);
+            return -1;
         }
+        {
+            ZBuffer linear = *zb;
+
+            zb->zbuf = zbuf;
+            zb->pbuf = pbuf;
+            zb->tiled = 1;
+            ZB_tileCopy(zb, &rect, linear.pbuf, linear.linesize, linear.zbuf, linear.zlinesize, 1);
+            ZB_surfaceFree(linear.zbuf);
+            if (linear.frame_buffer_allocated) {
+                ZB_surfaceFree(linear.pbuf);
+                zb->linear_buffer = NULL;
+            } else {
+                zb->linear_buffer = linear.pbuf;
+                zb->linear_linesize = linear.linesize;
+            }
+        }
+        zb->frame_buffer_allocated = 1;
+        return 0;
+    }
 
-        pthread_create(&threads[i], NULL, ZB_copy_FrameBufferRGBA_thread, &threadData[i]);
+    /* back to the buffer of the caller, if any */
+    linesize = zb->linear_buffer != NULL ? zb->linear_linesize : (zb->xsize * zb->pixel_size + 3) & ~3;
+    zbuf = (unsigned short *)ZB_surfaceAlloc(zb->xsize * zb->ysize * sizeof(unsigned short));
+    pbuf = zb->linear_buffer != NULL ? (PIXEL *)zb->linear_buffer : (PIXEL *)ZB_surfaceAlloc(zb->ysize * linesize);
+    if (zbuf == NULL || pbuf == NULL) {
+        ZB_surfaceFree(zbuf);
+        if (zb->linear_buffer == NULL)
+            ZB_surfaceFree(pbuf);
+        return -1;
     }
+    ZB_tileCopy(zb, &rect, pbuf, linesize, zbuf, zb->xsize, 0);
+    ZB_surfaceFree(zb->zbuf);
+    ZB_surfaceFree(zb->pbuf);
+    zb->frame_buffer_allocated = zb->linear_buffer == NULL;
+    zb->zbuf = zbuf;
+    zb->zlinesize = zb->xsize;
+    zb->pbuf = pbuf;
+    zb->linesize = linesize;
+    zb->tiled = 0;
+    zb->linear_buffer = NULL;
+    return 0;
+}
 
-    // Wait for all threads to finish
-    for (int i = 0; i < numThreads; i++) {
-        pthread_join(threads[i], NULL);
+ZBThreadPool *ZB_threadPool(ZBuffer *zb) {
+    if (zb->pool == NULL)
+        zb->pool = ZB_poolOpen(zb->nb_threads > 0 ? zb->nb_threads : ZB_poolCpus());
+    return zb->pool;
+}
+
+void ZB_setThreads(ZBuffer *zb, int nb_threads) {
+    if (nb_threads == zb->nb_threads)
+        return;
+    if (zb->pool != NULL)
+        ZB_poolClose(zb->pool);
+    zb->pool = NULL;
+    zb->nb_threads = nb_threads;
+}
+
+typedef struct {
+    ZBuffer *zb;
+    unsigned char *buf;
+    int linesize;
+    ZB_convertFunc convert;
+    int size; /* bytes per pixel of buf */
+    int copy; /* 5R6G5B to 5R6G5B */
+    int xmin, xmax, ymin, ymax; /* the rectangle, the rows start on ymin rounded down */
+    int y0;
+} ZBConvert;
+
+/* a run of pixels of a 5R6G5B color buffer */
+static void ZB_convertRun16(ZBConvert *cv, unsigned char *p, const unsigned short *q, int n, int x, int y) {
+    PIXEL row[ZB_TILE_SIZE];
+    int i, m;
+
+    if (cv->copy) {
+        memcpy(p, q, n * 2);
+        return;
+    }
+    for (; n > 0; n -= m) {
+        m = n < ZB_TILE_SIZE ? n : ZB_TILE_SIZE;
+        for (i = 0; i < m; i++)
+            row[i] = RGB16_TO_RGB32(q[i]);
+        cv->convert(p, row, m, x, y);
+        p += m * cv->size;
+        q += m;
+        x += m;
     }
 }
 
-// Thread function for 5R6G5B framebuffer copy
-static void* copy_FrameBuffer5R6G5B_thread(void* arg) {
-    ThreadData *data = (ThreadData*)arg;
-    ZBuffer *zb = data->zb;
-    uint16_t *p1 = (uint16_t*)(data->buf + data->startY * data->linesize);  // Use uint16_t for 16-bit RGB buffer
-    PIXEL *q = (PIXEL*)((uint8_t*)zb->pbuf + data->startY * zb->linesize);  // Pointer to ZBuffer's pixel data
+/* the pixels [x, x1[ of row y, by tile in the tiled layout */
+static void ZB_convertSpan(ZBConvert *cv, unsigned char *p, int x, int x1, int y) {
+    ZBuffer *zb = cv->zb;
+    int n;
+
+    for (; x < x1; x += n) {
+        const unsigned char *q = ZB_pixelAddress(zb, x, y);
+
+        n = zb->tiled ? ZB_TILE_SIZE - (x & (ZB_TILE_SIZE - 1)) : x1 - x;
+        if (n > x1 - x) n = x1 - x;
+        if (zb->pixel_size == 2)
+            ZB_convertRun16(cv, p, (const unsigned short *)q, n, x, y);
+        else
+            cv->convert(p, (const PIXEL *)q, n, x, y);
+        p += n * cv->size;
+    }
+}
 
-    for (int y = data->startY; y < data->endY; y++) {
-        for (int x = 0; x < zb->xsize; x++) {
-            p1[x] = RGB32_TO_RGB16(q[x]);  // Convert from RGB32 to RGB16
+static void ZB_convertRows(void *arg, int y0, int y1, int thread) {
+    ZBConvert *cv = (ZBConvert *)arg;
+    ZBuffer *zb = cv->zb;
+    PIXEL clear_row[ZB_TILE_SIZE];
+    unsigned char *p;
+    int x, y;
+
+    (void)thread;
+
+    y0 += cv->y0;
+    y1 += cv->y0;
+    if (y0 < cv->ymin) y0 = cv->ymin;
+    if (y1 > cv->ymax) y1 = cv->ymax;
+    p = cv->buf + y0 * cv->linesize;
+
+    /* as it is written in the color buffer */
+    for (x = 0; x < ZB_TILE_SIZE; x++)
+        clear_row[x] = zb->pixel_size == 2 ? RGB16_TO_RGB32(RGB32_TO_RGB16(zb->clear_color)) : zb->clear_color;
+
+    for (y = y0; y < y1; y++) {
+        unsigned char *cleared = zb->cleared + (y >> ZB_TILE_SHIFT) * zb->cleared_xsize;
+
+        /* the tiles not drawn since the clear get the clear color, the others are converted in runs */
+        x = cv->xmin;
+        while (x < cv->xmax) {
+            int tx = x >> ZB_TILE_SHIFT, x1;
+
+            if (cleared[tx] & ZB_CLEARED_COLOR) {
+                x1 = (tx + 1) << ZB_TILE_SHIFT;
+                if (x1 > cv->xmax) x1 = cv->xmax;
+                cv->convert(p + x * cv->size, clear_row, x1 - x, x, y);
+            } else {
+                while (tx < zb->cleared_xsize && !(cleared[tx] & ZB_CLEARED_COLOR))
+                    tx++;
+                x1 = tx << ZB_TILE_SHIFT;
+                if (x1 > cv->xmax) x1 = cv->xmax;
+                ZB_convertSpan(cv, p + x * cv->size, x, x1, y);
+            }
+            x = x1;
         }
-        p1 = (uint16_t*)((uint8_t*)p1 + data->linesize);  // Move to the next line in the destination buffer
-        q += zb->xsize;  // Move to the next line in the source buffer
+        p += cv->linesize;
     }
+}
 
-    return NULL;
+/*
+ * The rows are shared between the workers in bands starting on a cache
+ * line of both buffers, none of them writes a line of another one. The
+ * small rectangles are converted by the caller.
+ */
+void ZB_convertRect(ZBuffer *zb, void *buf, int linesize, int format, const ZBRect *rect) {
+    ZBConvert cv;
+    int align = ZB_poolAlign(linesize), src_align = ZB_poolAlign(zb->linesize);
+
+    ZB_tileFlush(zb);
+
+    /* the bands were sent to zb->band_func */
+    if (zb->band_rows > 0)
+        return;
+    if (src_align > align) align = src_align;
+    cv.xmin = rect->xmin > 0 ? rect->xmin : 0;
+    cv.ymin = rect->ymin > 0 ? rect->ymin : 0;
+    cv.xmax = rect->xmax < zb->xsize ? rect->xmax : zb->xsize;
+    cv.ymax = rect->ymax < zb->ysize ? rect->ymax : zb->ysize;
+    if (cv.xmin >= cv.xmax || cv.ymin >= cv.ymax)
+        return;
+    cv.y0 = cv.ymin - cv.ymin % align;
+
+    cv.zb = zb;
+    cv.buf = (unsigned char *)buf;
+    cv.linesize = linesize;
+    cv.convert = ZB_converts->func[format];
+    cv.size = ZB_FORMAT_SIZE(format);
+    cv.copy = zb->pixel_size == 2 && (format == ZB_FORMAT_R5G6B5 || format == ZB_FORMAT_R5G6B5_DITHER);
+    /* the clear color only, already rounded */
+    if (cv.copy)
+        cv.convert = ZB_converts->func[ZB_FORMAT_R5G6B5];
+    if ((cv.xmax - cv.xmin) * (cv.ymax - cv.ymin) < ZB_CONVERT_THREAD_PIXELS)
+        ZB_convertRows(&cv, cv.ymin - cv.y0, cv.ymax - cv.y0, 0);
+    else
+        ZB_poolRows(ZB_threadPool(zb), ZB_convertRows, &cv, cv.ymax - cv.y0, align);
 }
 
-void ZB_copy_FrameBuffer5R6G5B(ZBuffer *zb, void *buf, int linesize) {
-    int numCores = sysconf(_SC_NPROCESSORS_ONLN);  // Get the number of CPU cores
-    int numThreads = numCores - 1;  // Leave 1 core for the main thread
+void ZB_convertFrameBuffer(ZBuffer *zb, void *buf, int linesize, int format) {
+    ZBRect rect = {0, 0, zb->xsize, zb->ysize};
 
-    if (numThreads <= 0) {
-        numThreads = 1;  // Use at least 1 thread
+    ZB_convertRect(zb, buf, linesize, format, &rect);
+}
+
+/* format of the display of the mode, -1 for the indexes */
+static int ZB_copyFormat(ZBuffer *zb) {
+    switch (zb->mode) {
+        case ZB_MODE_5R6G5B:
+            return zb->dither ? ZB_FORMAT_R5G6B5_DITHER : ZB_FORMAT_R5G6B5;
+        case ZB_MODE_RGBA:
+            return ZB_FORMAT_B8G8R8X8;
+        case ZB_MODE_RGB24:
+            return ZB_FORMAT_B8G8R8;
+        case ZB_MODE_INDEX:
+            return -1;
+        default:
+            assert(0);  // Invalid mode
+            return -1;
+    }
+}
+
+void ZB_copyFrameBufferRects(ZBuffer *zb, void *buf, int linesize, const ZBRect *rects, int nb_rects) {
+    int i, format = ZB_copyFormat(zb);
+
+    if (format < 0) {
+        ZB_tileFlush(zb);
+        ZB_ditherFrameBuffer(zb, (unsigned char *)buf, linesize);
+        return;
     }
+    for (i = 0; i < nb_rects; i++)
+        ZB_convertRect(zb, buf, linesize, format, &rects[i]);
+}
 
-    pthread_t threads[numThreads];
-    ThreadData threadData[numThreads];
+void ZB_copyFrameBuffer(ZBuffer * zb, void *buf, int linesize) {
+    ZBRect rect = {0, 0, zb->xsize, zb->ysize};
 
-    int linesPerThread = zb->ysize / numThreads;  // Distribute lines evenly across threads
-    int remainingLines = zb->ysize % numThreads;  // Handle remaining lines
+    ZB_copyFrameBufferRects(zb, buf, linesize, &rect, 1);
+}
 
-    // Launch threads
-    for (int i = 0; i < numThreads; i++) {
-        threadData[i].zb = zb;
-        threadData[i].buf = (uint8_t*)buf;
-        threadData[i].linesize = linesize;
-        threadData[i].startY = i * linesPerThread;
-        threadData[i].endY = threadData[i].startY + linesPerThread;
+typedef struct {
+    ZBuffer *zb;
+    unsigned char *buf;
+    int linesize, xsize, ysize;
+    int format, filter;
+    int fx, dx, fy, dy; /* 16.16 source position of the first pixel and steps */
+} ZBScale;
+
+/* source row y as PIXEL, unpacked in row for a 5R6G5B buffer */
+static const uint32_t *ZB_scaleSource(ZBuffer *zb, int y, uint32_t *row) {
+    int x, i, n;
+
+    if (zb->pixel_size != 2 && !zb->tiled)
+        return (const uint32_t *)ZB_pixelAddress(zb, 0, y);
+    for (x = 0; x < zb->xsize; x += n) {
+        const unsigned char *p = ZB_pixelAddress(zb, x, y);
+
+        n = zb->tiled ? ZB_TILE_SIZE - (x & (ZB_TILE_SIZE - 1)) : zb->xsize;
+        if (n > zb->xsize - x) n = zb->xsize - x;
+        for (i = 0; i < n; i++)
+            row[x + i] = zb->pixel_size == 2 ? RGB16_TO_RGB32(((const unsigned short *)p)[i]) : ((const PIXEL *)p)[i];
+    }
+    return row;
+}
 
-        if (i == numThreads - 1) {
-            threadData[i].endY += remainingLines;  // Last thread handles extra lines
+static void ZB_scaleRows(void *arg, int y0, int y1, int thread) {
+    ZBScale *sc = (ZBScale *)arg;
+    ZBuffer *zb = sc->zb;
+    int max_fx = (zb->xsize - 1) << 16, max_fy = (zb->ysize - 1) << 16;
+    uint32_t *row, *src;
+    int y, fy, sy, last = -1;
+    const uint32_t *a = NULL, *b = NULL;
+
+    (void)thread;
+
+    /* the scaled row then the two unpacked source rows */
+    row = (uint32_t *)malloc((sc->xsize + 2 * zb->xsize) * sizeof(uint32_t));
+    if (row == NULL)
+        return;
+    src = row + sc->xsize;
+
+    for (y = y0; y < y1; y++) {
+        fy = sc->fy + y * sc->dy;
+        fy = fy < 0 ? 0 : fy > max_fy ? max_fy : fy;
+        sy = fy >> 16;
+        if (sy != last) {
+            a = ZB_scaleSource(zb, sy, src);
+            b = ZB_scaleSource(zb, sy < zb->ysize - 1 ? sy + 1 : sy, src + zb->xsize);
+            last = sy;
         }
+        ZB_converts->scale[sc->filter](row, a, b, (fy >> 8) & 0xff, sc->fx, sc->dx, max_fx, sc->xsize);
+        ZB_converts->func[sc->format](sc->buf + y * sc->linesize, row, sc->xsize, 0, y);
+    }
+    free(row);
+}
 
-        pthread_create(&threads[i], NULL, copy_FrameBuffer5R6G5B_thread, &threadData[i]);
+/*
+ * The source position of the pixels is their center: the nearest filter
+ * takes the pixel under it, the bilinear one the 4 pixels around it.
+ */
+int ZB_scaleFrameBuffer(ZBuffer *zb, void *buf, int linesize, int xsize, int ysize, int filter) {
+    ZBScale sc;
+
+    sc.format = ZB_copyFormat(zb);
+    if (sc.format < 0 || zb->band_rows > 0 || xsize <= 0 || ysize <= 0)
+        return -1;
+
+    /* the source pixels are all read */
+    ZB_tileFlush(zb);
+    ZB_clearResolve(zb, 0, 0, zb->xsize - 1, zb->ysize - 1);
+
+    sc.zb = zb;
+    sc.buf = (unsigned char *)buf;
+    sc.linesize = linesize;
+    sc.xsize = xsize;
+    sc.ysize = ysize;
+    sc.filter = filter == ZB_FILTER_BILINEAR ? ZB_FILTER_BILINEAR : ZB_FILTER_NEAREST;
+    sc.dx = (int)(((long long)zb->xsize << 16) / xsize);
+    sc.dy = (int)(((long long)zb->ysize << 16) / ysize);
+    sc.fx = sc.dx / 2;
+    sc.fy = sc.dy / 2;
+    if (sc.filter == ZB_FILTER_BILINEAR) {
+        sc.fx -= 1 << 15;
+        sc.fy -= 1 << 15;
     }
+    ZB_poolRows(ZB_threadPool(zb), ZB_scaleRows, &sc, ysize, ZB_poolAlign(linesize));
+    return 0;
+}
+
+int ZB_damageResize(ZBDamage *d, int xsize, int ysize) {
+    free(d->tiles);
+    d->xsize = (xsize + ZB_DAMAGE_SIZE - 1) >> ZB_DAMAGE_SHIFT;
+    d->ysize = (ysize + ZB_DAMAGE_SIZE - 1) >> ZB_DAMAGE_SHIFT;
+    d->tiles = (unsigned char *)malloc(d->xsize * d->ysize);
+    if (d->tiles == NULL)
+        return -1;
+    ZB_damageAll(d);
+    return 0;
+}
+
+void ZB_damageFree(ZBDamage *d) {
+    free(d->tiles);
+    d->tiles = NULL;
+}
+
+void ZB_damageAll(ZBDamage *d) {
+    memset(d->tiles, 1, d->xsize * d->ysize);
+}
+
+void ZB_damageReset(ZBDamage *d) {
+    memset(d->tiles, 0, d->xsize * d->ysize);
+}
+
+void ZB_damageAdd(ZBDamage *d, const ZBDamage *s) {
+    int i, n = d->xsize * d->ysize;
+
+    for (i = 0; i < n; i++)
+        d->tiles[i] |= s->tiles[i];
+}
 
-    // Join threads
-    for (int i = 0; i < numThreads; i++) {
-        pthread_join(threads[i], NULL);
+void ZB_damage(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax) {
+    ZBDamage *d = &zb->damage;
+    int tx, ty;
+
+    if (xmin < 0) xmin = 0;
+    if (ymin < 0) ymin = 0;
+    if (xmax >= zb->xsize) xmax = zb->xsize - 1;
+    if (ymax >= zb->ysize) ymax = zb->ysize - 1;
+    if (xmin > xmax || ymin > ymax)
+        return;
+    for (ty = ymin >> ZB_DAMAGE_SHIFT; ty <= ymax >> ZB_DAMAGE_SHIFT; ty++) {
+        for (tx = xmin >> ZB_DAMAGE_SHIFT; tx <= xmax >> ZB_DAMAGE_SHIFT; tx++)
+            d->tiles[ty * d->xsize + tx] = 1;
     }
 }
 
-void ZB_copyFrameBuffer(ZBuffer * zb, void *buf, int linesize) {
-    switch (zb->mode) {
-        case ZB_MODE_5R6G5B:
-            ZB_copy_FrameBuffer5R6G5B(zb, buf, linesize);
-            break;
-        case ZB_MODE_RGBA:
-            ZB_copy_FrameBufferRGBA(zb, buf, linesize);
-            break;
-        default:
-            assert(0);  // Invalid mode
+int ZB_damageRects(ZBuffer *zb, const ZBDamage *d, ZBRect *rects, int max_rects) {
+    ZBRect all = {d->xsize, d->ysize, 0, 0};
+    int nb_rects = 0, overflow = 0, tx, tx1, ty, i;
+
+    for (ty = 0; ty < d->ysize; ty++) {
+        const unsigned char *tiles = d->tiles + ty * d->xsize;
+
+        for (tx = 0; tx < d->xsize; tx = tx1) {
+            if (!tiles[tx]) {
+                tx1 = tx + 1;
+                continue;
+            }
+            for (tx1 = tx + 1; tx1 < d->xsize && tiles[tx1]; tx1++)
+                ;
+            if (tx < all.xmin) all.xmin = tx;
+            if (ty < all.ymin) all.ymin = ty;
+            if (tx1 > all.xmax) all.xmax = tx1;
+            all.ymax = ty + 1;
+
+            /* the same run on the row above */
+            for (i = nb_rects - 1; i >= 0; i--) {
+                if (rects[i].ymax == ty && rects[i].xmin == tx && rects[i].xmax == tx1)
+                    break;
+            }
+            if (i >= 0) {
+                rects[i].ymax = ty + 1;
+            } else if (nb_rects < max_rects) {
+                rects[nb_rects].xmin = tx;
+                rects[nb_rects].ymin = ty;
+                rects[nb_rects].xmax = tx1;
+                rects[nb_rects].ymax = ty + 1;
+                nb_rects++;
+            } else {
+                overflow = 1;
+            }
+        }
     }
+    if (overflow) {
+        if (max_rects == 0)
+            return 0;
+        rects[0] = all;
+        nb_rects = 1;
+    }
+
+    /* in pixels */
+    for (i = 0; i < nb_rects; i++) {
+        rects[i].xmin <<= ZB_DAMAGE_SHIFT;
+        rects[i].ymin <<= ZB_DAMAGE_SHIFT;
+        rects[i].xmax = rects[i].xmax << ZB_DAMAGE_SHIFT < zb->xsize ? rects[i].xmax << ZB_DAMAGE_SHIFT : zb->xsize;
+        rects[i].ymax = rects[i].ymax << ZB_DAMAGE_SHIFT < zb->ysize ? rects[i].ymax << ZB_DAMAGE_SHIFT : zb->ysize;
+    }
+    return nb_rects;
 }
 
 /*
@@ -306,22 +830,117 @@ void memset_RGB24(void *adr, int r, int v, int b, long count) {
     }
 }
 
+/*
+ * Fast clear: only the clear values and the flags of the tiles are set.
+ * The first triangle, line or point drawn on a tile writes its clear with
+ * ZB_clearResolve(), and ZB_copyFrameBuffer() sends the clear color of the
+ * tiles never drawn without reading them. The hierarchical z buffer holds
+ * the clear z of the tiles, so the hidden triangles do not write them.
+ */
 void ZB_clear(ZBuffer * zb, int clear_z, int z, int clear_color, int r, int g, int b) {
-    int color;
-    int y;
-    PIXEL *pp;
+    int i, n, flags;
+
+    /* the pending triangles would be entirely overwritten */
+    if (clear_z && clear_color) {
+        ZB_tileDiscard(zb);
+    } else if (zb->band_rows > 0 &&
+               ZB_tileClear(zb, clear_z, z, clear_color, RGB_TO_PIXEL(r, g, b)) == 0) {
+        /* drawn in order with the triangles of the bands */
+        if (clear_color)
+            ZB_damageAll(&zb->damage);
+        return;
+    } else {
+        ZB_tileFlush(zb);
+    }
 
+    flags = 0;
     if (clear_z) {
-        memset_short(zb->zbuf, z, zb->xsize * zb->ysize);
+        zb->clear_z = z;
+        ZB_hizClear(zb, z);
+        flags |= ZB_CLEARED_Z;
     }
     if (clear_color) {
-        pp = zb->pbuf;
-        for (y = 0; y < zb->ysize; y++) {
-            color = RGB_TO_PIXEL(r, g, b);
-            memset_long(pp, color, zb->xsize);
-            pp = (PIXEL *) ((char *)pp + zb->linesize);
+        zb->clear_color = RGB_TO_PIXEL(r, g, b);
+        flags |= ZB_CLEARED_COLOR;
+        ZB_damageAll(&zb->damage);
+    }
+    n = zb->cleared_xsize * zb->cleared_ysize;
+    for (i = 0; i < n; i++)
+        zb->cleared[i] |= flags;
+}
+
+/*
+ * Depth parity: the frames alternate between the upper half of the z
+ * buffer and its lower half with the z reversed, where the depth tests
+ * are mirrored. The content left by the previous frame is then behind
+ * all the z of the next one, which does not need a depth clear as long
+ * as each frame covers the whole buffer.
+ */
+void ZB_flipDepth(ZBuffer *zb) {
+    ZB_tileFlush(zb);
+    zb->depth_flip ^= 1;
+    /*
+     * the z of the upper half frame are all above its lower bound, the
+     * reversed z only lower the z buffer
+     */
+    ZB_hizClear(zb, zb->depth_flip ? 0 : 1 << (ZB_Z_BITS - 1));
+}
+
+static void ZB_clearTiles(ZBuffer *zb, int tx0, int tx1, int ty) {
+    unsigned char *cleared = zb->cleared + ty * zb->cleared_xsize;
+    int tx, x, y, w, y1;
+
+    for (tx = tx0; tx <= tx1; tx++) {
+        if (cleared[tx] == 0)
+            continue;
+        x = tx << ZB_TILE_SHIFT;
+        w = zb->xsize - x < ZB_TILE_SIZE ? zb->xsize - x : ZB_TILE_SIZE;
+        y1 = zb->ysize < (ty + 1) << ZB_TILE_SHIFT ? zb->ysize : (ty + 1) << ZB_TILE_SHIFT;
+        for (y = ty << ZB_TILE_SHIFT; y < y1; y++) {
+            if (cleared[tx] & ZB_CLEARED_Z)
+                memset_short(ZB_depthAddress(zb, x, y), zb->clear_z, w);
+            if ((cleared[tx] & ZB_CLEARED_COLOR) && zb->pixel_size == 2)
+                memset_short(ZB_pixelAddress(zb, x, y), RGB32_TO_RGB16(zb->clear_color), w);
+            else if (cleared[tx] & ZB_CLEARED_COLOR)
+                memset_long(ZB_pixelAddress(zb, x, y), zb->clear_color, w);
         }
+        cleared[tx] = 0;
+    }
+}
+
+typedef struct {
+    ZBuffer *zb;
+    int tx0, tx1, ty0;
+} ZBClearRows;
+
+static void ZB_clearJob(void *arg, int job, int thread) {
+    ZBClearRows *rows = (ZBClearRows *)arg;
+
+    (void)thread;
+    ZB_clearTiles(rows->zb, rows->tx0, rows->tx1, rows->ty0 + job);
+}
+
+/*
+ * The tiler calls it from the worker threads on the tile they draw: each
+ * flag is only read and written by the thread owning the tile. Larger
+ * areas, which only come from the submitting thread, are written by the
+ * workers one row of tiles each.
+ */
+void ZB_clearResolve(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax) {
+    ZBClearRows rows;
+    int ty, ty1;
+
+    rows.zb = zb;
+    rows.tx0 = xmin >> ZB_TILE_SHIFT;
+    rows.tx1 = xmax >> ZB_TILE_SHIFT;
+    rows.ty0 = ymin >> ZB_TILE_SHIFT;
+    ty1 = ymax >> ZB_TILE_SHIFT;
+    if (ty1 - rows.ty0 >= ZB_CLEAR_THREAD_TILES) {
+        ZB_poolRun(ZB_threadPool(zb), ZB_clearJob, &rows, ty1 - rows.ty0 + 1);
+        return;
     }
+    for (ty = rows.ty0; ty <= ty1; ty++)
+        ZB_clearTiles(zb, rows.tx0, rows.tx1, ty);
 }
 
 } // namespace fp
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fixed_point_type.hpp"
+#include "zsimd.hpp"
 
 /*
  * Z buffer
@@ -10,6 +11,22 @@
 
 #define ZB_POINT_Z_FRAC_BITS 14
 
+/* tiles of the tiler and of the fast clear */
+#define ZB_TILE_SHIFT 6
+#define ZB_TILE_SIZE (1 << ZB_TILE_SHIFT)
+
+/* flags of the tiles still holding the clear values, see ZB_clear() */
+#define ZB_CLEARED_Z     1
+#define ZB_CLEARED_COLOR 2
+
+/* the damage is kept per ZB_DAMAGE_SIZE tile, see ZBDamage */
+#define ZB_DAMAGE_SHIFT 4
+#define ZB_DAMAGE_SIZE (1 << ZB_DAMAGE_SHIFT)
+
+/* the hierarchical z buffer keeps one value per 8x8 tile */
+#define ZB_HIZ_SHIFT 3
+#define ZB_HIZ_SIZE (1 << ZB_HIZ_SHIFT)
+
 #define ZB_POINT_S_MIN ( (1<<13) )
 #define ZB_POINT_S_MAX ( (1<<22)-(1<<13) )
 #define ZB_POINT_T_MIN ( (1<<21) )
@@ -21,6 +38,9 @@
 #define ZB_POINT_GREEN_MAX ( (1<<16)-(1<<9) )
 #define ZB_POINT_BLUE_MIN ( (1<<10) )
 #define ZB_POINT_BLUE_MAX ( (1<<16)-(1<<10) )
+/* the alpha test and blending use the 8 bits above, all 256 values are needed */
+#define ZB_POINT_ALPHA_MIN ( (1<<7) )
+#define ZB_POINT_ALPHA_MAX ( (1<<16)-(1<<8)+(1<<7) )
 
 /* display modes */
 #define ZB_MODE_5R6G5B  1  /* true color 16 bits */
@@ -35,32 +55,119 @@
 #define RGB32_TO_RGB16(v) \
   (((v >> 8) & 0xf800) | (((v) >> 5) & 0x07e0) | (((v) & 0xff) >> 3))
 
+/* the high bits of each channel are repeated in the low ones */
+#define RGB16_TO_RGB32(v) \
+  ((((v) << 8) & 0xf80000) | (((v) << 3) & 0x070000) | \
+   (((v) << 5) & 0x00fc00) | (((v) >> 1) & 0x000300) | \
+   (((v) << 3) & 0x0000f8) | (((v) >> 2) & 0x000007))
+
 typedef uint32_t PIXEL;
 
 #define PSZB 4
 #define PSZSH 5
 
+/*
+ * The color buffer of ZB_MODE_5R6G5B holds 16 bit 5R6G5B pixels, drawn
+ * with the ZB_STATE_COLOR16 kernels, the other modes PIXEL ones.
+ */
+#define ZB_PIXEL_SIZE(mode) ((mode) == ZB_MODE_5R6G5B ? 2 : PSZB)
+
 namespace fp {
 
+struct ZBTiler;
+struct ZBThreadPool;
+
+/* pixels in [xmin, xmax[ x [ymin, ymax[ */
+typedef struct {
+    int xmin, ymin, xmax, ymax;
+} ZBRect;
+
+/* a band of nb_rows finished rows from row y of the screen, see ZB_openBands() */
+typedef void (*ZB_bandFunc)(void *arg, const void *pixels, int linesize, int y, int nb_rows);
+
+/* ZB_DAMAGE_SIZE tiles of a color buffer whose pixels changed, set to 1 */
+typedef struct {
+    unsigned char *tiles;
+    int xsize, ysize;
+} ZBDamage;
+
 typedef struct {
     int xsize, ysize;
     int linesize; /* line size, in bytes */
     int mode;
+    int pixel_size; /* bytes per pixel of pbuf, see ZB_PIXEL_SIZE() */
 
     unsigned short *zbuf;
+    int zlinesize; /* z values per row of zbuf */
     PIXEL *pbuf;
     int frame_buffer_allocated;
 
+    /*
+     * zbuf and pbuf hold tiles, see ZB_setLayout(): the buffer of the
+     * caller only gets the pixels when they are copied
+     */
+    int tiled;
+    void *linear_buffer;
+    int linear_linesize;
+
+    /* with band rendering, zbuf and pbuf only hold band_rows rows, see ZB_openBands() */
+    int band_rows;
+    ZB_bandFunc band_func;
+    void *band_arg;
+
+    /* lower bound of the z values of each tile of zbuf */
+    unsigned short *hiz;
+    int hiz_xsize, hiz_ysize;
+
+    /* ZB_CLEARED_* flags of each ZB_TILE_SIZE tile, whose pixels are not written yet */
+    unsigned char *cleared;
+    int cleared_xsize, cleared_ysize;
+    int clear_z;
+    PIXEL clear_color;
+
+    /* tiles of the color buffer written since the last ZB_damageReset() */
+    ZBDamage damage;
+
     int nb_colors;
     unsigned char *dctable;
     int *ctable;
     PIXEL *current_texture;
+
+    /* the rasterizers only touch the pixels inside [xmin, xmax[ x [ymin, ymax[ */
+    int clip_xmin, clip_ymin, clip_xmax, clip_ymax;
+
+    int half_space; /* rasterize the triangles with edge functions on 8x8 blocks */
+
+    int depth_prepass; /* the tiler draws the z of its triangles before their colors */
+
+    int jit; /* draw with the span kernels generated for the state, see zjit.hpp */
+
+    int depth_flip; /* the z of the frame grow away from the viewer, see ZB_flipDepth() */
+
+    int dither; /* ordered dither of the copies to 5R6G5B */
+
+    /* pipeline state word of the triangles (ZB_STATE_* of zsimd.hpp), without the shading */
+    unsigned int state;
+    int alpha_lo, alpha_range; /* alpha test, see ZBSpan */
+    int blend; /* factors of ZB_BLEND_FACTORS, see ZBSpan */
+
+    struct ZBTiler *tiler; /* tile binned rasterization, NULL when drawing directly */
+
+    /* workers of the tiler and of the whole buffer operations, started by ZB_threadPool() */
+    struct ZBThreadPool *pool;
+    int nb_threads; /* size of the pool, <= 0 for one thread per cpu of ZB_poolCpus() */
 } ZBuffer;
 
+/* pixel of the color buffer with pixels of type P */
+template <typename P>
+static inline P ZB_pixel(PIXEL c) {
+    return sizeof(P) == 2 ? (P)RGB32_TO_RGB16(c) : (P)c;
+}
+
 typedef struct {
     int x, y, z;     /* integer coordinates in the zbuffer */
     int s, t;       /* coordinates for the mapping */
-    int r, g, b;     /* color indexes */
+    int r, g, b, a;  /* color indexes */
 
     tGLfixed sz, tz;   /* temporary coordinates for mapping */
 } ZBufferPoint;
@@ -74,13 +181,111 @@ ZBuffer *ZB_open(int xsize, int ysize, int mode,
                  void *frame_buffer);
 
 
+/*
+ * Band rendering, for the targets without the memory of a whole frame:
+ * the color and z buffers only hold band_rows rows, rounded up to a
+ * multiple of ZB_TILE_SIZE. The tiler keeps the triangles and clears of
+ * the frame until ZB_tileBands(), which draws the screen one band after
+ * the other and sends each of them to func. Lines and points are not
+ * drawn, the frames must start with a clear of both buffers and the
+ * copies of the frame buffer do nothing. ZB_MODE_INDEX is not available.
+ */
+ZBuffer *ZB_openBands(int xsize, int ysize, int mode, int band_rows, ZB_bandFunc func, void *arg);
+
 void ZB_close(ZBuffer *zb);
 
 void ZB_resize(ZBuffer *zb, void *frame_buffer, int xsize, int ysize);
+/*
+ * draw in frame_buffer, owned by the caller, with rows of linesize bytes
+ * (0 for the packed rows of ZB_open()) until the next ZB_resize(). What
+ * was sent before is finished in the previous buffer.
+ */
+int ZB_setFrameBuffer(ZBuffer *zb, void *frame_buffer, int linesize);
+
+/*
+ * Tiled layout: zbuf and pbuf hold ZB_TILE_SIZE x ZB_TILE_SIZE tiles of
+ * contiguous rows, in rows of tiles, so that the spans of a tile stay in
+ * a few pages. The tiler draws each tile through ZB_tileView() and the
+ * copies and conversions read the tiles; lines and points are drawn in a
+ * linear copy of their pixels. The buffers are allocated by the zbuffer,
+ * the one of the caller gets the frame from ZB_copyFrameBuffer() or when
+ * the layout goes back to linear. Not available with ZB_MODE_INDEX and
+ * the bands. Returns -1 on error, the layout being unchanged.
+ */
+int ZB_setLayout(ZBuffer *zb, int tiled);
+/* a copy of zb addressing the tile tx, ty of its tiled buffers with the coordinates of the screen */
+void ZB_tileView(const ZBuffer *zb, ZBuffer *view, int tx, int ty);
+/*
+ * copy the pixels and z of the rectangle between the tiles and linear
+ * buffers starting at its first pixel: to the tiles with store, from
+ * them otherwise
+ */
+void ZB_tileCopy(ZBuffer *zb, const ZBRect *rect, void *pixels, int linesize,
+                 unsigned short *z, int zlinesize, int store);
+
+/* the pixel x, y of the color buffer, whatever the layout */
+static inline unsigned char *ZB_pixelAddress(const ZBuffer *zb, int x, int y) {
+    if (zb->tiled) {
+        int tile = (y >> ZB_TILE_SHIFT) * ((zb->xsize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT) + (x >> ZB_TILE_SHIFT);
+
+        return (unsigned char *)zb->pbuf + ((tile << (2 * ZB_TILE_SHIFT)) +
+               ((y & (ZB_TILE_SIZE - 1)) << ZB_TILE_SHIFT) + (x & (ZB_TILE_SIZE - 1))) * zb->pixel_size;
+    }
+    return (unsigned char *)zb->pbuf + y * zb->linesize + x * zb->pixel_size;
+}
 void ZB_clear(ZBuffer *zb, int clear_z, int z, int clear_color, int r, int g, int b);
+/* write the pending clear of the tiles touched by [xmin, xmax] x [ymin, ymax] */
+void ZB_clearResolve(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax);
+void ZB_flipDepth(ZBuffer *zb);
+
+/* the worker threads, started on the first call */
+struct ZBThreadPool *ZB_threadPool(ZBuffer *zb);
+/* stop the workers if their number changes, the next ZB_threadPool() starts nb_threads of them */
+void ZB_setThreads(ZBuffer *zb, int nb_threads);
 
 /* linesize is in BYTES */
 void ZB_copyFrameBuffer(ZBuffer *zb, void *buf, int linesize);
+/* only the pixels of the rectangles, except for ZB_MODE_INDEX */
+void ZB_copyFrameBufferRects(ZBuffer *zb, void *buf, int linesize, const ZBRect *rects, int nb_rects);
+/* copy to buf in a ZB_FORMAT_* of zsimd.hpp, whatever the mode */
+void ZB_convertFrameBuffer(ZBuffer *zb, void *buf, int linesize, int format);
+void ZB_convertRect(ZBuffer *zb, void *buf, int linesize, int format, const ZBRect *rect);
+/*
+ * copy to buf, xsize x ysize pixels, with the ZB_FILTER_* of zsimd.hpp.
+ * Returns -1 for ZB_MODE_INDEX, which is not scaled, and the bands.
+ */
+int ZB_scaleFrameBuffer(ZBuffer *zb, void *buf, int linesize, int xsize, int ysize, int filter);
+
+/*
+ * Damage: the triangles, lines, points and color clears mark the tiles
+ * they may write in zb->damage when they are sent, so that the copies
+ * and the presentation of a frame can be limited to what changed.
+ */
+
+/* tiles of a xsize x ysize color buffer, all damaged */
+int ZB_damageResize(ZBDamage *d, int xsize, int ysize);
+void ZB_damageFree(ZBDamage *d);
+void ZB_damageAll(ZBDamage *d);
+void ZB_damageReset(ZBDamage *d);
+/* d |= s, of the same size */
+void ZB_damageAdd(ZBDamage *d, const ZBDamage *s);
+/* the pixels in [xmin, xmax] x [ymin, ymax] may change */
+void ZB_damage(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax);
+/*
+ * Rectangles of the damaged tiles of d, clipped to the buffer. The runs
+ * of tiles of the rows are merged with the same run of the rows above,
+ * and everything into one bounding rectangle if there are more than
+ * max_rects. Returns the number of rectangles.
+ */
+int ZB_damageRects(ZBuffer *zb, const ZBDamage *d, ZBRect *rects, int max_rects);
+
+/* zhiz.c */
+
+int ZB_hizResize(ZBuffer *zb);
+void ZB_hizClear(ZBuffer *zb, int z);
+void ZB_hizUpdate(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax);
+int ZB_hizTriangle(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2,
+                   int dzdx, int dzdy, unsigned int *zmax);
 
 /* zdither.c */
 
@@ -98,6 +303,8 @@ void ZB_line_z(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2);
 
 void ZB_setTexture(ZBuffer *zb, PIXEL *texture);
 
+void ZB_fillTriangleDepth(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2, ZBufferPoint *p3);
+
 void ZB_fillTriangleFlat(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2, ZBufferPoint *p3);
 
 void ZB_fillTriangleSmooth(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2, ZBufferPoint *p3);
@@ -1,11 +1,13 @@
 /*
- * Highly optimised dithering 16 bits -> 8 bits.
+ * Highly optimised dithering 16 bits -> 8 bits, of the framebuffer converted to 16 bits.
  * The formulas were taken in Mesa (Bob Mercier mercier@hollywood.cinenet.net).
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "zbuffer.hpp"
+#include "zthread.hpp"
 #include <assert.h>
 
 namespace fp {
@@ -97,18 +99,33 @@ int ZDither_lookupColor(int r, int g, int b) {
    linesize are not multiple of 2, it cannot work efficiently (or
    hang!) */
 
-void ZB_ditherFrameBuffer(ZBuffer *zb,  unsigned char *buf, int linesize) {
+typedef struct {
+    ZBuffer *zb;
+    unsigned char *buf;
+    int linesize;
+} ZBDither;
+
+/* the rows are first converted to 5R6G5B, which the table is indexed with */
+static void ZB_ditherRows(void *arg, int y0, int y1, int thread) {
+    ZBDither *dither = (ZBDither *)arg;
+    ZBuffer *zb = dither->zb;
     int xk, yk, x, y, c1, c2;
-    unsigned char *dest1;
-    unsigned short *pp1;
     int r_d, g_d, b_d;
     unsigned char *ctable = zb->dctable;
-    unsigned char *dest;
-    unsigned short *pp;
+    unsigned char *dest, *out;
+    unsigned short *pp, *row;
 
-    assert( ((long)buf & 1) == 0 && (linesize & 1) == 0);
+    (void)thread;
 
-    for(yk = 0; yk < 4; yk++) {
+    /* the pixels are read and written 16 at a time, past the end of the rows */
+    row = (unsigned short *)calloc(zb->xsize + 16, sizeof(unsigned short) + 1);
+    if (row == NULL)
+        return;
+    out = (unsigned char *)(row + zb->xsize + 16);
+
+    for (y = y0; y < y1; y++) {
+        ZB_converts->func[ZB_FORMAT_R5G6B5](row, (PIXEL *)((char *)zb->pbuf + y * zb->linesize), zb->xsize, 0, y);
+        yk = y & 3;
         for(xk = 0; xk < 4; xk += 2) {
 #if BYTE_ORDER == BIG_ENDIAN
             c1 = kernel8[yk *4 + xk + 1];
@@ -126,27 +143,39 @@ void ZB_ditherFrameBuffer(ZBuffer *zb,  unsigned char *buf, int linesize) {
             b_d |= ((c2 >> 9) & 0x001F) << 16;
             g_d = b_d | g_d;
 
-            dest1 = buf + (yk * linesize) + xk;
-            pp1 = (unsigned short int*)zb->pbuf + (yk * zb->xsize) + xk;
-
-            for (y = yk; y < zb->ysize; y += 4) {
-                dest = dest1;
-                pp = pp1;
-                for (x = xk; x < zb->xsize; x += 16) {
+            dest = out + xk;
+            pp = row + xk;
+            for (x = xk; x < zb->xsize; x += 16) {
 
-                    DITHER_PIXEL2(0);
-                    DITHER_PIXEL2(1 * 4);
-                    DITHER_PIXEL2(2 * 4);
-                    DITHER_PIXEL2(3 * 4);
+                DITHER_PIXEL2(0);
+                DITHER_PIXEL2(1 * 4);
+                DITHER_PIXEL2(2 * 4);
+                DITHER_PIXEL2(3 * 4);
 
-                    pp += 16;
-                    dest += 16;
-                }
-                dest1 += linesize * 4;
-                pp1 += zb->xsize * 4;
+                pp += 16;
+                dest += 16;
             }
         }
+        memcpy(dither->buf + y * dither->linesize, out, zb->xsize);
     }
+    free(row);
+}
+
+void ZB_ditherFrameBuffer(ZBuffer *zb,  unsigned char *buf, int linesize) {
+    ZBDither dither;
+    int align = ZB_poolAlign(linesize), src_align = ZB_poolAlign(zb->linesize);
+
+    assert( ((long)buf & 1) == 0 && (linesize & 1) == 0);
+
+    ZB_clearResolve(zb, 0, 0, zb->xsize - 1, zb->ysize - 1);
+
+    /* the bands start on a cache line of both buffers */
+    if (align < src_align)
+        align = src_align;
+    dither.zb = zb;
+    dither.buf = buf;
+    dither.linesize = linesize;
+    ZB_poolRows(ZB_threadPool(zb), ZB_ditherRows, &dither, zb->ysize, align);
 }
 
 } // namespace fp
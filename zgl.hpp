@@ -193,7 +193,7 @@ namespace fp
     struct GLCurrentState
     {
         V4 color;
-        unsigned int longcolor[3]; // Precomputed integer color
+        unsigned int longcolor[4]; // Precomputed integer color
         V4 normal;
         V4 tex_coord;
         int edge_flag;
@@ -207,6 +207,7 @@ namespace fp
             longcolor[0] = 65535;
             longcolor[1] = 65535;
             longcolor[2] = 65535;
+            longcolor[3] = 65535;
         }
     };
 
@@ -215,12 +216,18 @@ namespace fp
         int xmin, ymin, xsize, ysize;
         V3 scale;
         V3 trans;
+        /* z of the z buffer from the raw normalized z, clamped to [zmin, zmax] */
+        int zscale, ztrans, zmin, zmax;
+        /* 16.16 size of the z buffer per size of the window, below 1 when drawn at a lower resolution */
+        int xratio, yratio;
         int updated;
 
         GLViewport()
             : xmin(0), ymin(0), xsize(0), ysize(0),
               scale(tGLfixed(1.0f), tGLfixed(1.0f), tGLfixed(1.0f)),
               trans(tGLfixed(0.0f), tGLfixed(0.0f), tGLfixed(0.0f)),
+              zscale(0), ztrans(0), zmin(0), zmax(0),
+              xratio(1 << 16), yratio(1 << 16),
               updated(0)
         {
         }
@@ -278,6 +285,44 @@ namespace fp
         }
     };
 
+    /* transformed vertex of glDrawElements(), by index */
+    struct GLCachedVertex
+    {
+        unsigned int stamp; /* batch which used it last, see GLVertexCache */
+        int index;
+        V4 tex_coord;
+        V4 color;
+        V4 pc;
+        int clip_code;
+        ZBufferPoint zp;
+
+        GLCachedVertex()
+            : stamp(0),
+              index(-1),
+              clip_code(0),
+              zp()
+        {
+        }
+    };
+
+    typedef struct {
+        unsigned long long hits, misses; /* lookups of the indices */
+        unsigned int draws;
+    } GLVertexCacheStats;
+
+    /*
+     * Vertices transformed by glDrawElements(), direct mapped on their
+     * index. The entries of the current draw have a stamp of at least
+     * draw_stamp, those used by the current batch have its stamp and
+     * are kept until it is assembled.
+     */
+    struct GLVertexCache
+    {
+        GLCachedVertex *entries; /* VERTEX_HASH_SIZE */
+        unsigned int stamp, draw_stamp;
+        GLVertexCacheStats stats;
+    };
+
     struct GLRasterPos
     {
         tGLfixed x, y, z;
@@ -292,20 +337,44 @@ namespace fp
 
     struct GLArray
     {
-        tGLfixed *p;
+        const GLvoid *pointer;  /* offset in buffer if not NULL */
+        const GLubyte *p;       /* of the data, in buffer or at pointer */
         int size;
-        int stride;
+        GLenum type;
+        int stride;             /* in bytes */
+        GLArrayFetch fetch;     /* for its type and size */
+        GLArrayFetch fetch_raw; /* GL_BYTE and GL_SHORT as 2^-16 per unit, else NULL */
+        GLBuffer *buffer;
+        GLBufferArray *converted; /* of buffer, for the current draw */
 
         GLArray()
-            : p(nullptr),
+            : pointer(nullptr),
+              p(nullptr),
               size(0),
-              stride(0)
+              type(GL_FIXED),
+              stride(0),
+              fetch(nullptr),
+              fetch_raw(nullptr),
+              buffer(nullptr),
+              converted(nullptr)
         {
         }
     };
 
     typedef void (*gl_draw_triangle_func)(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
 
+    /* what the vertex transform generated by jit.cpp depends on, compared bytewise */
+    struct GLJitVertexKey
+    {
+        int light, normalize, no_w_transform;
+        int32_t m[3][16]; /* model_projection, or modelview, projection and inverse modelview */
+        int32_t scale[2], trans[2];
+        int zscale, ztrans, zmin, zmax;
+    };
+
+    /* position, normal, clip code and window coordinates of v */
+    typedef void (*GLJitVertexFunc)(GLVertex *v, const V4 *normal);
+
     /* Display context */
     struct GLContext
     {
@@ -358,6 +427,7 @@ namespace fp
         GLParamBuffer *current_op_buffer;
         int current_op_buffer_index;
         int exec_flag, compile_flag, print_flag;
+        GLListCompile *list_compile; /* of the list in glNewList() */
 
         /* Matrix */
         GLMatrixState matrix;
@@ -396,6 +466,7 @@ namespace fp
         int vertex_n, vertex_cnt;
         int vertex_max;
         GLVertex *vertex;
+        GLVertexCache vertex_cache;
 
         /* OpenGL 1.1 arrays */
         struct ArrayState
@@ -404,8 +475,17 @@ namespace fp
             GLArray normal;
             GLArray color;
             GLArray tex_coord;
+            /* the positions of the GL_BYTE and GL_SHORT vertex arrays are x * scale + bias */
+            GLfloat scale[3];
+            GLfloat bias[3];
+            GLBuffer *array_buffer;   /* GL_ARRAY_BUFFER */
+            GLBuffer *element_buffer; /* GL_ELEMENT_ARRAY_BUFFER */
 
             ArrayState()
+                : scale{1.0f, 1.0f, 1.0f},
+                  bias{0.0f, 0.0f, 0.0f},
+                  array_buffer(nullptr),
+                  element_buffer(nullptr)
             {
                 // Arrays are initialized by their constructors
             }
@@ -440,6 +520,35 @@ namespace fp
 
         /* Depth test */
         int depth_test;
+        int depth_func;
+        int depth_mask;
+
+        /* the fragment state changed: zb->state must be computed again */
+        int fragment_state_updated;
+
+        /* threads asked with glRasterThreads(), 0 when drawing directly */
+        int raster_threads;
+
+        /* glDepthParity(): frames between two real depth clears, 0 when off */
+        int depth_parity;
+        int depth_parity_frame; /* depth clears skipped since the last real one */
+
+        /* vertex transform generated for the matrices of glBegin(), see jit.cpp */
+        struct GLJitState
+        {
+            GLJitVertexKey key;
+            GLJitVertexFunc vertex;
+            unsigned int generation; /* of the code cache, vertex is gone when it changed */
+            int count;               /* vertices transformed without it */
+
+            GLJitState()
+                : key(),
+                  vertex(nullptr),
+                  generation(0),
+                  count(0)
+            {
+            }
+        } jit;
 
         /* Blending */
         struct GLBlend
@@ -460,11 +569,13 @@ namespace fp
         struct GLAlphaTest
         {
             int func;
-            int ref;
+            int ref; /* in [0, 255] */
+            int enabled;
 
             GLAlphaTest()
                 : func(GL_ALWAYS),
-                  ref(0)
+                  ref(0),
+                  enabled(0)
             {
             }
         } alpha;
@@ -500,6 +611,7 @@ namespace fp
               exec_flag(1),
               compile_flag(0),
               print_flag(0),
+              list_compile(nullptr),
               matrix(),
               current(),
               polygon_mode_back(GL_FILL),
@@ -518,6 +630,7 @@ namespace fp
               vertex_cnt(0),
               vertex_max(0),
               vertex(nullptr),
+              vertex_cache(),
               array(),
               client_states(0),
               offset(),
@@ -527,6 +640,13 @@ namespace fp
               opaque(nullptr),
               gl_resize_viewport(nullptr),
               depth_test(0),
+              depth_func(GL_LESS),
+              depth_mask(1),
+              fragment_state_updated(1),
+              raster_threads(0),
+              depth_parity(0),
+              depth_parity_frame(0),
+              jit(),
               blend(),
               alpha(),
               logic(),
@@ -543,6 +663,7 @@ namespace fp
 
     /* clip.c */
     void gl_transform_to_viewport(GLContext *c, GLVertex *v);
+    void gl_attribs_to_viewport(GLContext *c, GLVertex *v);
     void gl_draw_triangle(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
     void gl_draw_line(GLContext *c, GLVertex *p0, GLVertex *p1);
     void gl_draw_point(GLContext *c, GLVertex *p0);
@@ -551,6 +672,25 @@ namespace fp
     void gl_draw_triangle_line(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
     void gl_draw_triangle_fill(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
 
+    /* vertex.c */
+    void gl_assemble_vertex(GLContext *c);
+
+    /* arrays.c */
+    void gl_arrays_prepare(GLContext *c);
+    void gl_draw_batches(GLContext *c, GLenum mode, GLint first, const GLushort *indices, int count);
+
+    /* api.c */
+    int gl_update_tiler(GLContext *c);
+
+    /* jit.c */
+    /* vertices sent with the same matrices before their transform is generated */
+#define GL_JIT_HOT_VERTICES 64
+    void gl_jit_begin(GLContext *c);
+    void gl_jit_vertex(GLContext *c);
+
+    /* blend.c */
+    void gl_update_fragment_state(GLContext *c);
+
     /* matrix.c */
     void gl_print_matrix(const tGLfixed *m);
 
@@ -0,0 +1,235 @@
+/*
+ * Hierarchical z buffer: a lower bound of the z values of each 8x8 tile
+ * of the z buffer. The GL_LESS and GL_LEQUAL depth tests only let the z
+ * values grow, so the bound stays valid between two clears. It is raised
+ * by the triangles covering a whole tile, and a triangle whose z is below
+ * the bound of every tile it touches is hidden. The triangles which may
+ * lower the z buffer reset the bounds of the tiles they touch.
+ */
+#include <stdlib.h>
+#include <math.h>
+#include "zbuffer.hpp"
+
+namespace fp {
+
+/* the largest z a point can have without overflowing the 16 bits z buffer */
+#define ZB_HIZ_Z_MAX ((1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS)) - 1)
+
+int ZB_hizResize(ZBuffer *zb) {
+    free(zb->hiz);
+    zb->hiz_xsize = (zb->xsize + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT;
+    zb->hiz_ysize = (zb->ysize + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT;
+    /* 0 is a valid bound for any content of the z buffer */
+    zb->hiz = (unsigned short *)calloc(zb->hiz_xsize * zb->hiz_ysize, sizeof(unsigned short));
+    return zb->hiz == NULL ? -1 : 0;
+}
+
+void ZB_hizClear(ZBuffer *zb, int z) {
+    int i, n;
+
+    n = zb->hiz_xsize * zb->hiz_ysize;
+    for (i = 0; i < n; i++)
+        zb->hiz[i] = z;
+}
+
+/* forget the bounds of the tiles touched by the pixels [xmin, xmax] x [ymin, ymax] */
+static void ZB_hizReset(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax) {
+    unsigned short *hiz;
+    int tx, ty;
+
+    for (ty = ymin >> ZB_HIZ_SHIFT; ty <= ymax >> ZB_HIZ_SHIFT; ty++) {
+        hiz = zb->hiz + ty * zb->hiz_xsize;
+        for (tx = xmin >> ZB_HIZ_SHIFT; tx <= xmax >> ZB_HIZ_SHIFT; tx++)
+            hiz[tx] = 0;
+    }
+}
+
+/*
+ * Exact bounds of the tiles inside [xmin, xmax[ x [ymin, ymax[, which must
+ * be aligned on the tiles or end on the buffer edges.
+ */
+void ZB_hizUpdate(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax) {
+    int tx, ty, x, y, x1, y1;
+    unsigned short *pz;
+    unsigned int zmin;
+
+    for (ty = ymin >> ZB_HIZ_SHIFT; ty < (ymax + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT; ty++) {
+        y1 = (ty + 1) << ZB_HIZ_SHIFT;
+        if (y1 > ymax) y1 = ymax;
+        for (tx = xmin >> ZB_HIZ_SHIFT; tx < (xmax + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT; tx++) {
+            x1 = (tx + 1) << ZB_HIZ_SHIFT;
+            if (x1 > xmax) x1 = xmax;
+            zmin = 0xffff;
+            for (y = ty << ZB_HIZ_SHIFT; y < y1; y++) {
+                pz = zb->zbuf + y * zb->zlinesize;
+                for (x = tx << ZB_HIZ_SHIFT; x < x1; x++) {
+                    if (pz[x] < zmin)
+                        zmin = pz[x];
+                }
+            }
+            zb->hiz[ty * zb->hiz_xsize + tx] = zmin;
+        }
+    }
+}
+
+/*
+ * Called by the rasterizers before drawing a triangle. Returns 1 if the
+ * triangle is hidden inside the clip rectangle. Otherwise the bounds of
+ * the tiles it fully covers are raised and *zmax gets the largest z
+ * value (z buffer precision) of its pixels, so that the rasterizer can
+ * skip the tiles whose bound is above it.
+ *
+ * Only the GL_LESS, GL_LEQUAL and GL_EQUAL depth tests can skip hidden
+ * triangles, and only the first two raise the bounds, when the triangle
+ * writes its z on all its pixels.
+ *
+ * dzdx and dzdy are the gradients used by the rasterizer. Its z values
+ * are bounded by the exact plane of the triangle, widened by the error
+ * on these gradients across the triangle and by the pixels drawn up to
+ * one pixel outside of its edges.
+ */
+int ZB_hizTriangle(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2,
+                   int dzdx, int dzdy, unsigned int *zmax) {
+    ZBufferPoint *v[3];
+    int ea[3], eb[3], ec[3], emin[3], e0, e1, e2;
+    int xmin, xmax, ymin, ymax, bxmin, bxmax, bymin, bymax, txmin, txmax, tymin, tymax;
+    int tx, ty, x0, y0, x1, y1, i, area, depth;
+    double gx, gy, margin, zvmin, zvmax, z, dz;
+    unsigned short *hiz;
+
+    *zmax = ~0u;
+
+    v[0] = p0;
+    v[1] = p1;
+    v[2] = p2;
+    xmin = xmax = p0->x;
+    ymin = ymax = p0->y;
+    zvmin = zvmax = p0->z;
+    for (i = 1; i < 3; i++) {
+        if (v[i]->x < xmin) xmin = v[i]->x;
+        if (v[i]->x > xmax) xmax = v[i]->x;
+        if (v[i]->y < ymin) ymin = v[i]->y;
+        if (v[i]->y > ymax) ymax = v[i]->y;
+        if (v[i]->z < zvmin) zvmin = v[i]->z;
+        if (v[i]->z > zvmax) zvmax = v[i]->z;
+    }
+
+    /* pixels the rasterizers may touch */
+    bxmin = xmin - 1 < zb->clip_xmin ? zb->clip_xmin : xmin - 1;
+    bymin = ymin - 1 < zb->clip_ymin ? zb->clip_ymin : ymin - 1;
+    bxmax = xmax + 1 >= zb->clip_xmax ? zb->clip_xmax - 1 : xmax + 1;
+    bymax = ymax + 1 >= zb->clip_ymax ? zb->clip_ymax - 1 : ymax + 1;
+    if (bxmin > bxmax || bymin > bymax)
+        return 0;
+
+    depth = ZB_STATE_DEPTH(zb->state);
+    if (depth != ZB_DEPTH_LESS && depth != ZB_DEPTH_LEQUAL && depth != ZB_DEPTH_EQUAL) {
+        if ((zb->state & ZB_STATE_ZWRITE) && depth != ZB_DEPTH_NEVER)
+            ZB_hizReset(zb, bxmin, bymin, bxmax, bymax);
+        return 0;
+    }
+
+    area = (p1->x - p0->x) * (p2->y - p0->y) - (p2->x - p0->x) * (p1->y - p0->y);
+    if (area == 0)
+        return 0;
+    gx = ((double)(p1->z - p0->z) * (p2->y - p0->y) - (double)(p2->z - p0->z) * (p1->y - p0->y)) / area;
+    gy = ((double)(p2->z - p0->z) * (p1->x - p0->x) - (double)(p1->z - p0->z) * (p2->x - p0->x)) / area;
+
+    margin = (fabs(dzdx - gx) + 1) * (xmax - xmin + 10) +
+             (fabs(dzdy - gy) + 1) * (ymax - ymin + 2) +
+             fabs(gx) + fabs(gy) + 2;
+    zvmin -= margin;
+    zvmax += margin;
+
+    if (zvmin < 0 || zvmax > ZB_HIZ_Z_MAX) {
+        /*
+         * the z values of the rasterizer may wrap and be stored below
+         * the bounds: forget them
+         */
+        ZB_hizReset(zb, bxmin, bymin, bxmax, bymax);
+        return 0;
+    }
+
+    /* hidden if no tile has a bound below the z of the triangle */
+    for (ty = bymin >> ZB_HIZ_SHIFT; ty <= bymax >> ZB_HIZ_SHIFT; ty++) {
+        hiz = zb->hiz + ty * zb->hiz_xsize;
+        y0 = ty << ZB_HIZ_SHIFT;
+        y1 = y0 + ZB_HIZ_SIZE - 1;
+        if (y0 < bymin) y0 = bymin;
+        if (y1 > bymax) y1 = bymax;
+        for (tx = bxmin >> ZB_HIZ_SHIFT; tx <= bxmax >> ZB_HIZ_SHIFT; tx++) {
+            x0 = tx << ZB_HIZ_SHIFT;
+            x1 = x0 + ZB_HIZ_SIZE - 1;
+            if (x0 < bxmin) x0 = bxmin;
+            if (x1 > bxmax) x1 = bxmax;
+            z = p0->z + gx * ((gx > 0 ? x1 : x0) - p0->x) + gy * ((gy > 0 ? y1 : y0) - p0->y) + margin;
+            if (z > zvmax) z = zvmax;
+            if (z < 0) z = 0;
+            if (hiz[tx] <= ((unsigned int)z >> ZB_POINT_Z_FRAC_BITS))
+                goto visible;
+        }
+    }
+    return 1;
+
+visible:
+    *zmax = (unsigned int)zvmax >> ZB_POINT_Z_FRAC_BITS;
+
+    if (depth == ZB_DEPTH_EQUAL || (zb->state & (ZB_STATE_ZWRITE | ZB_STATE_ALPHA_TEST)) != ZB_STATE_ZWRITE)
+        return 0;
+
+    /* whole tiles inside the clip rectangle and the bounding box */
+    txmin = ((xmin > zb->clip_xmin ? xmin : zb->clip_xmin) + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT;
+    tymin = ((ymin > zb->clip_ymin ? ymin : zb->clip_ymin) + ZB_HIZ_SIZE - 1) >> ZB_HIZ_SHIFT;
+    txmax = (((xmax < zb->clip_xmax - 1 ? xmax : zb->clip_xmax - 1) + 1) >> ZB_HIZ_SHIFT) - 1;
+    tymax = (((ymax < zb->clip_ymax - 1 ? ymax : zb->clip_ymax - 1) + 1) >> ZB_HIZ_SHIFT) - 1;
+    if (txmin > txmax || tymin > tymax)
+        return 0;
+
+    /*
+     * edge functions, >= 0 inside, offset to the min corner of a tile. The
+     * rasterizers may miss the pixels up to one pixel inside an edge.
+     */
+    for (i = 0; i < 3; i++) {
+        ea[i] = v[i]->y - v[(i + 1) % 3]->y;
+        eb[i] = v[(i + 1) % 3]->x - v[i]->x;
+        ec[i] = v[i]->x * v[(i + 1) % 3]->y - v[(i + 1) % 3]->x * v[i]->y;
+        if (area < 0) {
+            ea[i] = -ea[i];
+            eb[i] = -eb[i];
+            ec[i] = -ec[i];
+        }
+        emin[i] = (ea[i] < 0 ? (ZB_HIZ_SIZE - 1) * ea[i] : 0) +
+                  (eb[i] < 0 ? (ZB_HIZ_SIZE - 1) * eb[i] : 0) - abs(ea[i]) - abs(eb[i]);
+    }
+    dz = (gx < 0 ? (ZB_HIZ_SIZE - 1) * gx : 0) + (gy < 0 ? (ZB_HIZ_SIZE - 1) * gy : 0) - margin;
+
+    /*
+     * raise the bound of the tiles inside the triangle: all their pixels
+     * end up with at least the z of the triangle
+     */
+    for (ty = tymin; ty <= tymax; ty++) {
+        hiz = zb->hiz + ty * zb->hiz_xsize;
+        x0 = txmin << ZB_HIZ_SHIFT;
+        y0 = ty << ZB_HIZ_SHIFT;
+        e0 = ea[0] * x0 + eb[0] * y0 + ec[0] + emin[0];
+        e1 = ea[1] * x0 + eb[1] * y0 + ec[1] + emin[1];
+        e2 = ea[2] * x0 + eb[2] * y0 + ec[2] + emin[2];
+        z = p0->z + gx * (x0 - p0->x) + gy * (y0 - p0->y) + dz;
+        for (tx = txmin; tx <= txmax; tx++) {
+            if ((e0 | e1 | e2) >= 0) {
+                unsigned int zz;
+
+                zz = (unsigned int)(z < zvmin ? zvmin : z) >> ZB_POINT_Z_FRAC_BITS;
+                if (zz > hiz[tx])
+                    hiz[tx] = zz;
+            }
+            e0 += ea[0] * ZB_HIZ_SIZE;
+            e1 += ea[1] * ZB_HIZ_SIZE;
+            e2 += ea[2] * ZB_HIZ_SIZE;
+            z += gx * ZB_HIZ_SIZE;
+        }
+    }
+    return 0;
+}
+
+} // namespace fp
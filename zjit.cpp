@@ -0,0 +1,518 @@
+/*
+ * Code cache and generated span kernels
+ */
+#include <stddef.h>
+#include <string.h>
+#include "zjit.hpp"
+
+#ifdef ZB_JIT_X64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fp {
+
+ZBJitStats ZB_jitStats = {0, 0, 0, 0, 0, 0, 0, ZB_JIT_LIMIT};
+unsigned int ZB_jitGeneration = 1;
+ZB_spanFunc ZB_jitSpanFuncs[ZB_STATE_COUNT];
+
+#ifdef ZB_JIT_X64
+
+/* constants of the span kernels, 8 lanes each at the start of the cache */
+enum {
+    ZJ_C_ONE, ZJ_C_FF, ZJ_C_FF00, ZJ_C_FF0000, ZJ_C_FF00FF, ZJ_C_00FF00, ZJ_C_FFFF,
+    ZJ_C_128, ZJ_C_256, ZJ_C_TEX_S, ZJ_C_TEX_T, ZJ_C_RAMP, ZJ_C_COUNT
+};
+
+static const int32_t ZB_jitConstValues[ZJ_C_RAMP] = {
+    1, 0xff, 0xff00, 0xff0000, 0xff00ff, 0x00ff00, 0xffff, 128, 256, 0x003FC000, 0x3FC00000
+};
+
+#define ZJ_CONSTS_SIZE (ZJ_C_COUNT * 32)
+
+static uint8_t *ZB_jitCode; /* the cache, constants first */
+static size_t ZB_jitSize, ZB_jitUsed;
+static uint8_t *ZB_jitBlock, *ZB_jitBlockEnd; /* being written */
+
+/* generation of the kernels of each state word, without its shading */
+static unsigned int ZB_jitSpanGeneration[ZB_STATE_COUNT >> 2];
+
+static int ZB_jitOpen(void) {
+    long page = sysconf(_SC_PAGESIZE);
+    int32_t *consts;
+    int i, j;
+
+    ZB_jitSize = (ZB_jitStats.code_limit + page - 1) & ~(size_t)(page - 1);
+    if (ZB_jitSize < ZJ_CONSTS_SIZE)
+        return -1;
+    ZB_jitCode = (uint8_t *)mmap(NULL, ZB_jitSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ZB_jitCode == MAP_FAILED) {
+        ZB_jitCode = NULL;
+        return -1;
+    }
+    consts = (int32_t *)ZB_jitCode;
+    for (i = 0; i < ZJ_C_RAMP; i++)
+        for (j = 0; j < 8; j++)
+            consts[i * 8 + j] = ZB_jitConstValues[i];
+    for (j = 0; j < 8; j++)
+        consts[ZJ_C_RAMP * 8 + j] = j;
+    mprotect(ZB_jitCode, ZB_jitSize, PROT_READ | PROT_EXEC);
+    ZB_jitUsed = ZJ_CONSTS_SIZE;
+    ZB_jitStats.code_size = ZB_jitUsed;
+    return 0;
+}
+
+static void ZB_jitFlush(void) {
+    ZB_jitGeneration++;
+    memset(ZB_jitSpanFuncs, 0, sizeof(ZB_jitSpanFuncs));
+    ZB_jitUsed = ZJ_CONSTS_SIZE;
+    ZB_jitStats.code_size = ZB_jitUsed;
+}
+
+/* pages holding [ZB_jitBlock, ZB_jitBlockEnd[ */
+static void ZB_jitProtect(int prot) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)(ZB_jitBlock - ZB_jitCode) & ~(page - 1);
+    size_t end = (size_t)(ZB_jitBlockEnd - ZB_jitCode + page - 1) & ~(page - 1);
+
+    mprotect(ZB_jitCode + start, end - start, prot);
+}
+
+int ZB_jitBegin(ZBJitAsm *a, size_t max_size) {
+    if (ZB_jitCode == NULL && ZB_jitOpen() != 0)
+        return -1;
+    if (ZJ_CONSTS_SIZE + max_size > ZB_jitSize)
+        return -1;
+    if (ZB_jitUsed + max_size > ZB_jitSize) {
+        ZB_jitFlush();
+        ZB_jitStats.flushes++;
+    }
+
+    ZB_jitBlock = ZB_jitCode + ZB_jitUsed;
+    ZB_jitBlockEnd = ZB_jitBlock + max_size;
+    ZB_jitProtect(PROT_READ | PROT_WRITE);
+    a->p = ZB_jitBlock;
+    a->end = ZB_jitBlockEnd;
+    a->overflow = 0;
+    return 0;
+}
+
+void *ZB_jitEnd(ZBJitAsm *a) {
+    ZB_jitProtect(PROT_READ | PROT_EXEC);
+    if (a->overflow)
+        return NULL;
+    /* the next block starts on a cache line */
+    ZB_jitUsed = ((size_t)(a->p - ZB_jitCode) + 63) & ~(size_t)63;
+    ZB_jitStats.code_size = ZB_jitUsed;
+    return ZB_jitBlock;
+}
+
+void ZB_jitSetLimit(size_t limit) {
+    if (ZB_jitCode != NULL) {
+        munmap(ZB_jitCode, ZB_jitSize);
+        ZB_jitCode = NULL;
+        ZB_jitFlush();
+        ZB_jitStats.code_size = 0;
+    }
+    ZB_jitStats.code_limit = limit;
+}
+
+/*
+ * Span kernels: the same pixels as ZB_span<S>() of zsimd.in with 8 lanes,
+ * the state tested while generating the code. rdi holds the ZBSpan, rsi
+ * the pixels, rdx their z and ecx the number of pixels left.
+ */
+
+/* ymm registers holding the interpolated values, the others are temporaries */
+#define ZJ_YZ 8
+#define ZJ_YA 9
+#define ZJ_YR 10
+#define ZJ_YG 11
+#define ZJ_YB 12
+#define ZJ_YS 10
+#define ZJ_YT 11
+
+/* stack frame: steps of the interpolated values, span constants and a copy of the last pixels */
+#define ZJ_F_DZ     0
+#define ZJ_F_DA     32
+#define ZJ_F_D1     64
+#define ZJ_F_D2     96
+#define ZJ_F_D3     128
+#define ZJ_F_ALO    160
+#define ZJ_F_ARANGE 192
+#define ZJ_F_COLOR  224
+#define ZJ_F_P      256
+#define ZJ_F_Z      288
+#define ZJ_FRAME    320
+
+/* upper bound of the size of a kernel */
+#define ZJ_SPAN_MAX 2048
+
+#define ZJ_SPAN(field) zj_mem(ZJ_RDI, offsetof(ZBSpan, field))
+#define ZJ_FRAME_AT(off) zj_mem(ZJ_RSP, off)
+
+static inline ZBJitMem zj_const(int c) {
+    return zj_rip(ZB_jitCode + c * 32);
+}
+
+/* y = v + ramp(d), and the step d * 8 on the stack */
+static void ZB_jitInterp(ZBJitAsm *a, int y, ZBJitMem v, ZBJitMem d, int step) {
+    zj_vrm(a, ZJ_VPBROADCASTD, 1, 0, 0, d);
+    zj_vrm(a, ZJ_VPMULLD, 1, 1, 0, zj_const(ZJ_C_RAMP));
+    zj_vrm(a, ZJ_VPBROADCASTD, 1, y, 0, v);
+    zj_vrr(a, ZJ_VPADDD, y, y, 1);
+    zj_vsll(a, 0, 0, 3);
+    zj_vstore(a, 1, ZJ_FRAME_AT(step), 0);
+}
+
+/* out = c * a / 256 on each channel, clobbers t1 and t2 */
+static void ZB_jitScale(ZBJitAsm *a, int out, int c, int alpha, int t1, int t2) {
+    zj_vrm(a, ZJ_VPAND, 1, t1, c, zj_const(ZJ_C_FF00FF));
+    zj_vrr(a, ZJ_VPMULLD, t1, t1, alpha);
+    zj_vsrl(a, t1, t1, 8);
+    zj_vrm(a, ZJ_VPAND, 1, t1, t1, zj_const(ZJ_C_FF00FF));
+    zj_vrm(a, ZJ_VPAND, 1, t2, c, zj_const(ZJ_C_00FF00));
+    zj_vrr(a, ZJ_VPMULLD, t2, t2, alpha);
+    zj_vsrl(a, t2, t2, 8);
+    zj_vrm(a, ZJ_VPAND, 1, t2, t2, zj_const(ZJ_C_00FF00));
+    zj_vrr(a, ZJ_VPOR, out, t1, t2);
+}
+
+/* y = 256 - alpha */
+static void ZB_jitInvAlpha(ZBJitAsm *a, int y, int alpha) {
+    zj_vrm(a, ZJ_VMOVDQU, 1, y, 0, zj_const(ZJ_C_256));
+    zj_vrr(a, ZJ_VPSUBD, y, y, alpha);
+}
+
+/*
+ * 8 pixels at [rsi] and their z at [rdx], as ZB_spanPixels<S>(): ymm0 is
+ * the z, ymm1 the old z, ymm2 the failing lanes, ymm3 the alpha, ymm4 the
+ * color and ymm5 the destination pixels.
+ */
+static void ZB_jitPixels(ZBJitAsm *a, unsigned int s) {
+    unsigned int shade = ZB_STATE_SHADE(s), depth = ZB_STATE_DEPTH(s), blend = ZB_STATE_BLEND(s);
+    int zwrite = (s & ZB_STATE_ZWRITE) != 0, atest = (s & ZB_STATE_ALPHA_TEST) != 0;
+    int fails = depth != ZB_DEPTH_ALWAYS || atest;
+    int zread = depth != ZB_DEPTH_ALWAYS || (zwrite && atest);
+    int color = shade != ZB_SHADE_DEPTH && blend != ZB_BLEND_KEEP;
+    int alpha = atest || (color && (blend == ZB_BLEND_ALPHA || blend == ZB_BLEND_ADD_ALPHA ||
+                                    blend == ZB_BLEND_PREMUL));
+    uint8_t *skip = NULL;
+    int i;
+
+    zj_vsrl(a, 0, ZJ_YZ, ZB_SPAN_Z_FRAC_BITS);
+    if (zread)
+        zj_vrm(a, ZJ_VPMOVZXWD, 1, 1, 0, zj_mem(ZJ_RDX, 0));
+
+    switch (depth) {
+        case ZB_DEPTH_LESS:
+            zj_vrm(a, ZJ_VPADDD, 1, 2, 1, zj_const(ZJ_C_ONE));
+            zj_vrr(a, ZJ_VPCMPGTD, 2, 2, 0);
+            break;
+        case ZB_DEPTH_LEQUAL:
+            zj_vrr(a, ZJ_VPCMPGTD, 2, 1, 0);
+            break;
+        case ZB_DEPTH_EQUAL:
+            zj_vrr(a, ZJ_VPCMPGTD, 2, 1, 0);
+            zj_vrr(a, ZJ_VPCMPGTD, 7, 0, 1);
+            zj_vrr(a, ZJ_VPOR, 2, 2, 7);
+            break;
+        case ZB_DEPTH_GREATER:
+            zj_vrm(a, ZJ_VPADDD, 1, 2, 0, zj_const(ZJ_C_ONE));
+            zj_vrr(a, ZJ_VPCMPGTD, 2, 2, 1);
+            break;
+        case ZB_DEPTH_GEQUAL:
+            zj_vrr(a, ZJ_VPCMPGTD, 2, 0, 1);
+            break;
+        case ZB_DEPTH_NOTEQUAL:
+            zj_vrr(a, ZJ_VPCMPEQD, 2, 0, 1);
+            break;
+        default:
+            if (atest)
+                zj_vrr(a, ZJ_VPXOR, 2, 2, 2);
+            break;
+    }
+
+    if (alpha) {
+        zj_vsrl(a, 3, ZJ_YA, 8);
+        zj_vrm(a, ZJ_VPAND, 1, 3, 3, zj_const(ZJ_C_FF));
+    }
+    if (atest) {
+        zj_vrm(a, ZJ_VPSUBD, 1, 7, 3, ZJ_FRAME_AT(ZJ_F_ALO));
+        zj_vrm(a, ZJ_VPAND, 1, 7, 7, zj_const(ZJ_C_FF));
+        zj_vrm(a, ZJ_VPCMPGTD, 1, 7, 7, ZJ_FRAME_AT(ZJ_F_ARANGE));
+        zj_vrr(a, ZJ_VPOR, 2, 2, 7);
+    }
+    if (fails) {
+        zj_vmovmsk(a, ZJ_RAX, 2);
+        zj_alui(a, ZJ_ALUI_CMP, 0, ZJ_RAX, -1);
+        skip = zj_jcc(a, ZJ_CC_E);
+    }
+
+    if (color) {
+        if (shade == ZB_SHADE_FLAT) {
+            zj_vrm(a, ZJ_VMOVDQU, 1, 4, 0, ZJ_FRAME_AT(ZJ_F_COLOR));
+        } else if (shade == ZB_SHADE_SMOOTH) {
+            zj_vsll(a, 4, ZJ_YR, 8);
+            zj_vrm(a, ZJ_VPAND, 1, 4, 4, zj_const(ZJ_C_FF0000));
+            zj_vrm(a, ZJ_VPAND, 1, 5, ZJ_YG, zj_const(ZJ_C_FF00));
+            zj_vrr(a, ZJ_VPOR, 4, 4, 5);
+            zj_vsrl(a, 5, ZJ_YB, 8);
+            zj_vrr(a, ZJ_VPOR, 4, 4, 5);
+        } else {
+            zj_vrm(a, ZJ_VPAND, 1, 6, ZJ_YT, zj_const(ZJ_C_TEX_T));
+            zj_vrm(a, ZJ_VPAND, 1, 7, ZJ_YS, zj_const(ZJ_C_TEX_S));
+            zj_vrr(a, ZJ_VPOR, 6, 6, 7);
+            zj_vsrl(a, 6, 6, 14);
+            zj_vrr(a, ZJ_VPCMPEQD, 15, 15, 15);
+            zj_vgather(a, 4, ZJ_R8, 6, 15);
+        }
+
+        if (blend != ZB_BLEND_NONE || fails)
+            zj_vrm(a, ZJ_VMOVDQU, 1, 5, 0, zj_mem(ZJ_RSI, 0));
+        if (alpha) {
+            /* alpha in [0, 256] */
+            zj_vsrl(a, 7, 3, 7);
+            zj_vrr(a, ZJ_VPADDD, 3, 3, 7);
+        }
+        switch (blend) {
+            case ZB_BLEND_ALPHA:
+                ZB_jitInvAlpha(a, 6, 3);
+                zj_vrm(a, ZJ_VPAND, 1, 7, 4, zj_const(ZJ_C_FF00FF));
+                zj_vrr(a, ZJ_VPMULLD, 7, 7, 3);
+                zj_vrm(a, ZJ_VPAND, 1, 13, 5, zj_const(ZJ_C_FF00FF));
+                zj_vrr(a, ZJ_VPMULLD, 13, 13, 6);
+                zj_vrr(a, ZJ_VPADDD, 7, 7, 13);
+                zj_vrm(a, ZJ_VPAND, 1, 13, 4, zj_const(ZJ_C_00FF00));
+                zj_vrr(a, ZJ_VPMULLD, 13, 13, 3);
+                zj_vrm(a, ZJ_VPAND, 1, 14, 5, zj_const(ZJ_C_00FF00));
+                zj_vrr(a, ZJ_VPMULLD, 14, 14, 6);
+                zj_vrr(a, ZJ_VPADDD, 13, 13, 14);
+                zj_vsrl(a, 7, 7, 8);
+                zj_vrm(a, ZJ_VPAND, 1, 7, 7, zj_const(ZJ_C_FF00FF));
+                zj_vsrl(a, 13, 13, 8);
+                zj_vrm(a, ZJ_VPAND, 1, 13, 13, zj_const(ZJ_C_00FF00));
+                zj_vrr(a, ZJ_VPOR, 4, 7, 13);
+                break;
+            case ZB_BLEND_ADD:
+                zj_vrr(a, ZJ_VPADDUSB, 4, 4, 5);
+                break;
+            case ZB_BLEND_ADD_ALPHA:
+                ZB_jitScale(a, 4, 4, 3, 7, 13);
+                zj_vrr(a, ZJ_VPADDUSB, 4, 4, 5);
+                break;
+            case ZB_BLEND_MODULATE:
+                /* r, g, b in ymm6, ymm7, ymm13, multiplied then divided by 255 */
+                for (i = 0; i < 3; i++) {
+                    int y = i == 0 ? 6 : i == 1 ? 7 : 13, shift = 16 - 8 * i;
+
+                    if (shift) {
+                        zj_vsrl(a, y, 4, shift);
+                        zj_vrm(a, ZJ_VPAND, 1, y, y, zj_const(ZJ_C_FF));
+                        zj_vsrl(a, 14, 5, shift);
+                        zj_vrm(a, ZJ_VPAND, 1, 14, 14, zj_const(ZJ_C_FF));
+                    } else {
+                        zj_vrm(a, ZJ_VPAND, 1, y, 4, zj_const(ZJ_C_FF));
+                        zj_vrm(a, ZJ_VPAND, 1, 14, 5, zj_const(ZJ_C_FF));
+                    }
+                    zj_vrr(a, ZJ_VPMULLD, y, y, 14);
+                    zj_vrm(a, ZJ_VPADDD, 1, y, y, zj_const(ZJ_C_128));
+                    zj_vsrl(a, 14, y, 8);
+                    zj_vrr(a, ZJ_VPADDD, y, y, 14);
+                    zj_vsrl(a, y, y, 8);
+                }
+                zj_vsll(a, 6, 6, 16);
+                zj_vsll(a, 7, 7, 8);
+                zj_vrr(a, ZJ_VPOR, 4, 6, 7);
+                zj_vrr(a, ZJ_VPOR, 4, 4, 13);
+                break;
+            case ZB_BLEND_PREMUL:
+                ZB_jitInvAlpha(a, 6, 3);
+                ZB_jitScale(a, 7, 5, 6, 13, 14);
+                zj_vrr(a, ZJ_VPADDUSB, 4, 4, 7);
+                break;
+        }
+
+        if (fails)
+            zj_vblend(a, 4, 4, 5, 2);
+        zj_vstore(a, 1, zj_mem(ZJ_RSI, 0), 4);
+    }
+
+    if (zwrite) {
+        if (fails && zread)
+            zj_vblend(a, 0, 0, 1, 2);
+        zj_vrm(a, ZJ_VPAND, 1, 0, 0, zj_const(ZJ_C_FFFF));
+        zj_vextracthi(a, 7, 0);
+        zj_vrrx(a, ZJ_VPACKUSDW, 0, 0, 7);
+        zj_vstore(a, 0, zj_mem(ZJ_RDX, 0), 0);
+    }
+    zj_bind(a, skip);
+}
+
+/* copy n = ecx pixels and z from [src] to [dst], with the index in r9 */
+static void ZB_jitCopy(ZBJitAsm *a, int psrc, int zsrc, int32_t sdisp, int pdst, int zdst, int32_t ddisp) {
+    const uint8_t *loop;
+
+    zj_alu(a, ZJ_ALU_XOR, 0, ZJ_R9, ZJ_R9);
+    loop = a->p;
+    zj_load32(a, ZJ_RAX, zj_memi(psrc, ZJ_R9, 2, sdisp));
+    zj_store32(a, zj_memi(pdst, ZJ_R9, 2, ddisp), ZJ_RAX);
+    zj_load16(a, ZJ_RAX, zj_memi(zsrc, ZJ_R9, 1, sdisp ? sdisp + ZJ_F_Z - ZJ_F_P : 0));
+    zj_store16(a, zj_memi(zdst, ZJ_R9, 1, ddisp ? ddisp + ZJ_F_Z - ZJ_F_P : 0), ZJ_RAX);
+    zj_alui(a, ZJ_ALUI_ADD, 0, ZJ_R9, 1);
+    zj_alu(a, ZJ_ALU_CMP, 0, ZJ_R9, ZJ_RCX);
+    zj_jccto(a, ZJ_CC_L, loop);
+}
+
+static void ZB_jitSpan(ZBJitAsm *a, unsigned int s) {
+    unsigned int shade = ZB_STATE_SHADE(s);
+    int color = shade != ZB_SHADE_DEPTH && ZB_STATE_BLEND(s) != ZB_BLEND_KEEP;
+    uint8_t *tail, *done;
+    const uint8_t *loop;
+
+    if (ZB_STATE_DEPTH(s) == ZB_DEPTH_NEVER) {
+        zj_ret(a);
+        return;
+    }
+
+    zj_alui(a, ZJ_ALUI_SUB, 1, ZJ_RSP, ZJ_FRAME);
+    zj_load64(a, ZJ_RSI, ZJ_SPAN(pp));
+    zj_load64(a, ZJ_RDX, ZJ_SPAN(pz));
+    zj_load32(a, ZJ_RCX, ZJ_SPAN(n));
+    ZB_jitInterp(a, ZJ_YZ, ZJ_SPAN(z), ZJ_SPAN(dzdx), ZJ_F_DZ);
+    if (shade == ZB_SHADE_SMOOTH) {
+        ZB_jitInterp(a, ZJ_YA, ZJ_SPAN(a), ZJ_SPAN(dadx), ZJ_F_DA);
+        ZB_jitInterp(a, ZJ_YR, ZJ_SPAN(r), ZJ_SPAN(drdx), ZJ_F_D1);
+        ZB_jitInterp(a, ZJ_YG, ZJ_SPAN(g), ZJ_SPAN(dgdx), ZJ_F_D2);
+        ZB_jitInterp(a, ZJ_YB, ZJ_SPAN(b), ZJ_SPAN(dbdx), ZJ_F_D3);
+    } else {
+        zj_vrm(a, ZJ_VPBROADCASTD, 1, ZJ_YA, 0, ZJ_SPAN(a));
+    }
+    if (shade == ZB_SHADE_MAPPING) {
+        zj_load64(a, ZJ_R8, ZJ_SPAN(texture));
+        ZB_jitInterp(a, ZJ_YS, ZJ_SPAN(s), ZJ_SPAN(dsdx), ZJ_F_D1);
+        ZB_jitInterp(a, ZJ_YT, ZJ_SPAN(t), ZJ_SPAN(dtdx), ZJ_F_D2);
+    }
+    if (shade == ZB_SHADE_FLAT && color) {
+        zj_vrm(a, ZJ_VPBROADCASTD, 1, 0, 0, ZJ_SPAN(color));
+        zj_vstore(a, 1, ZJ_FRAME_AT(ZJ_F_COLOR), 0);
+    }
+    if (s & ZB_STATE_ALPHA_TEST) {
+        zj_vrm(a, ZJ_VPBROADCASTD, 1, 0, 0, ZJ_SPAN(alpha_lo));
+        zj_vstore(a, 1, ZJ_FRAME_AT(ZJ_F_ALO), 0);
+        zj_vrm(a, ZJ_VPBROADCASTD, 1, 0, 0, ZJ_SPAN(alpha_range));
+        zj_vstore(a, 1, ZJ_FRAME_AT(ZJ_F_ARANGE), 0);
+    }
+
+    zj_alui(a, ZJ_ALUI_CMP, 0, ZJ_RCX, 8);
+    tail = zj_jcc(a, ZJ_CC_L);
+    loop = a->p;
+    ZB_jitPixels(a, s);
+    zj_vrm(a, ZJ_VPADDD, 1, ZJ_YZ, ZJ_YZ, ZJ_FRAME_AT(ZJ_F_DZ));
+    if (shade == ZB_SHADE_SMOOTH) {
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YA, ZJ_YA, ZJ_FRAME_AT(ZJ_F_DA));
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YR, ZJ_YR, ZJ_FRAME_AT(ZJ_F_D1));
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YG, ZJ_YG, ZJ_FRAME_AT(ZJ_F_D2));
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YB, ZJ_YB, ZJ_FRAME_AT(ZJ_F_D3));
+    } else if (shade == ZB_SHADE_MAPPING) {
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YS, ZJ_YS, ZJ_FRAME_AT(ZJ_F_D1));
+        zj_vrm(a, ZJ_VPADDD, 1, ZJ_YT, ZJ_YT, ZJ_FRAME_AT(ZJ_F_D2));
+    }
+    zj_alui(a, ZJ_ALUI_ADD, 1, ZJ_RSI, 32);
+    zj_alui(a, ZJ_ALUI_ADD, 1, ZJ_RDX, 16);
+    zj_alui(a, ZJ_ALUI_SUB, 0, ZJ_RCX, 8);
+    zj_alui(a, ZJ_ALUI_CMP, 0, ZJ_RCX, 8);
+    zj_jccto(a, ZJ_CC_GE, loop);
+
+    /* the last pixels are drawn on a copy, as in zsimd.in */
+    zj_bind(a, tail);
+    zj_alu(a, ZJ_ALU_TEST, 0, ZJ_RCX, ZJ_RCX);
+    done = zj_jcc(a, ZJ_CC_LE);
+    zj_vrr(a, ZJ_VPXOR, 0, 0, 0);
+    zj_vstore(a, 1, ZJ_FRAME_AT(ZJ_F_P), 0);
+    zj_vstore(a, 0, ZJ_FRAME_AT(ZJ_F_Z), 0);
+    ZB_jitCopy(a, ZJ_RSI, ZJ_RDX, 0, ZJ_RSP, ZJ_RSP, ZJ_F_P);
+    zj_alu(a, ZJ_ALU_MOV, 1, ZJ_R10, ZJ_RSI);
+    zj_alu(a, ZJ_ALU_MOV, 1, ZJ_R11, ZJ_RDX);
+    zj_lea(a, ZJ_RSI, ZJ_FRAME_AT(ZJ_F_P));
+    zj_lea(a, ZJ_RDX, ZJ_FRAME_AT(ZJ_F_Z));
+    ZB_jitPixels(a, s);
+    ZB_jitCopy(a, ZJ_RSP, ZJ_RSP, ZJ_F_P, ZJ_R10, ZJ_R11, 0);
+
+    zj_bind(a, done);
+    zj_vzeroupper(a);
+    zj_alui(a, ZJ_ALUI_ADD, 1, ZJ_RSP, ZJ_FRAME);
+    zj_ret(a);
+}
+
+void ZB_jitSpans(unsigned int state) {
+    ZB_spanFunc func[4];
+    int generated[4];
+    unsigned int shade, s;
+    ZBJitAsm a;
+
+    if (ZB_jitSpanGeneration[state >> 2] == ZB_jitGeneration) {
+        ZB_jitStats.span_hits++;
+        return;
+    }
+    ZB_jitStats.span_misses++;
+
+    __builtin_cpu_init();
+    /* the generated kernels only write 32 bit pixels, with the blend equations */
+    if (!__builtin_cpu_supports("avx2") || (state & ZB_STATE_COLOR16) ||
+        ZB_STATE_BLEND(state) == ZB_BLEND_FACTORS ||
+        ZB_jitBegin(&a, 4 * ZJ_SPAN_MAX) != 0) {
+        /* the template kernels until the cache is flushed */
+        ZB_jitStats.fallbacks++;
+        ZB_jitSpanGeneration[state >> 2] = ZB_jitGeneration;
+        return;
+    }
+    for (shade = 0; shade < 4; shade++) {
+        s = ZB_spanState(state | shade);
+        generated[shade] = ZB_jitSpanFuncs[s] == NULL;
+        if (!generated[shade]) {
+            func[shade] = ZB_jitSpanFuncs[s];
+            continue;
+        }
+        while ((uintptr_t)a.p & 15)
+            zj_byte(&a, 0xcc);
+        func[shade] = (ZB_spanFunc)a.p;
+        ZB_jitSpan(&a, s);
+        ZB_jitSpanFuncs[s] = func[shade];
+    }
+    if (ZB_jitEnd(&a) == NULL) {
+        ZB_jitStats.fallbacks++;
+        for (shade = 0; shade < 4; shade++)
+            if (generated[shade])
+                ZB_jitSpanFuncs[ZB_spanState(state | shade)] = NULL;
+    } else {
+        for (shade = 0; shade < 4; shade++)
+            ZB_jitSpanFuncs[state | shade] = func[shade];
+    }
+    ZB_jitSpanGeneration[state >> 2] = ZB_jitGeneration;
+}
+
+#else
+
+int ZB_jitBegin(ZBJitAsm *a, size_t max_size) {
+    (void)a;
+    (void)max_size;
+    return -1;
+}
+
+void *ZB_jitEnd(ZBJitAsm *a) {
+    (void)a;
+    return NULL;
+}
+
+void ZB_jitSetLimit(size_t limit) {
+    ZB_jitStats.code_limit = limit;
+}
+
+void ZB_jitSpans(unsigned int state) {
+    (void)state;
+}
+
+#endif
+
+} // namespace fp
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include "zsimd.hpp"
+#include "zjit_x64.hpp"
+
+/*
+ * Code generated at runtime.
+ *
+ * The span kernels of a pipeline state word and the vertex transform of a
+ * matrix configuration (see jit.cpp) can be generated on their first use
+ * instead of going through the kernels of zsimd.in and the generic C code.
+ * The code lives in one executable cache of at most ZB_jitLimit() bytes:
+ * when it is full, everything in it is dropped and generated again when
+ * used. The generators only exist for x86-64 with AVX2, elsewhere nothing
+ * is generated and the template kernels are used.
+ *
+ * The cache is shared by all the contexts. It is only written from the
+ * thread submitting the triangles, never while the tiler runs.
+ */
+
+/* default size of the code cache */
+#define ZB_JIT_LIMIT (1 << 20)
+
+#if defined(__x86_64__) && defined(__unix__)
+#define ZB_JIT_X64
+#endif
+
+namespace fp {
+
+typedef struct {
+    unsigned int span_hits, span_misses;     /* lookups of the kernels of a state */
+    unsigned int vertex_hits, vertex_misses; /* lookups of the transform of a matrix */
+    unsigned int fallbacks; /* code which could not be generated */
+    unsigned int flushes;   /* times the cache was full */
+    size_t code_size, code_limit;
+} ZBJitStats;
+
+extern ZBJitStats ZB_jitStats;
+
+/* changed each time the cache is flushed, the code generated before is gone */
+extern unsigned int ZB_jitGeneration;
+
+/* generated span kernels by state word, NULL for the template kernel */
+extern ZB_spanFunc ZB_jitSpanFuncs[ZB_STATE_COUNT];
+
+/* generate the kernels of the state word, without its shading */
+void ZB_jitSpans(unsigned int state);
+
+/*
+ * Room for max_size bytes of code, written through a. ZB_jitEnd() makes
+ * it executable and returns its first byte, or NULL if it overflowed.
+ * Returns -1 when there is no cache: generation is not supported or the
+ * cache is too small.
+ */
+int ZB_jitBegin(ZBJitAsm *a, size_t max_size);
+void *ZB_jitEnd(ZBJitAsm *a);
+
+/* drop all the code and set the size of the cache */
+void ZB_jitSetLimit(size_t limit);
+
+} // namespace fp
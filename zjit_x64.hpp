@@ -0,0 +1,365 @@
+#pragma once
+
+/*
+ * x86-64 instruction encoder for the code generators of zjit.cpp and
+ * jit.cpp. Only the forms they use are supported: the general purpose
+ * registers through legacy encodings and the AVX2 integer instructions
+ * on ymm registers through 3 byte VEX prefixes.
+ *
+ * The instructions are written at a->p. Past a->end nothing more is
+ * written and a->overflow is set, the caller checks it once at the end.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+namespace fp {
+
+typedef struct {
+    uint8_t *p, *end;
+    int overflow;
+} ZBJitAsm;
+
+/* general purpose registers */
+enum {
+    ZJ_RAX, ZJ_RCX, ZJ_RDX, ZJ_RBX, ZJ_RSP, ZJ_RBP, ZJ_RSI, ZJ_RDI,
+    ZJ_R8, ZJ_R9, ZJ_R10, ZJ_R11, ZJ_R12, ZJ_R13, ZJ_R14, ZJ_R15
+};
+
+/* base of the rip relative operands */
+#define ZJ_RIP (-1)
+
+/* condition codes */
+enum {
+    ZJ_CC_E = 0x4, ZJ_CC_NE = 0x5, ZJ_CC_L = 0xc, ZJ_CC_GE = 0xd, ZJ_CC_LE = 0xe, ZJ_CC_G = 0xf
+};
+
+/* memory operand [base + index * (1 << scale) + disp], or [rip + target] */
+typedef struct {
+    int base, index, scale;
+    int32_t disp;
+    const void *target;
+} ZBJitMem;
+
+static inline ZBJitMem zj_mem(int base, int32_t disp) {
+    ZBJitMem m = {base, -1, 0, disp, NULL};
+    return m;
+}
+
+static inline ZBJitMem zj_memi(int base, int index, int scale, int32_t disp) {
+    ZBJitMem m = {base, index, scale, disp, NULL};
+    return m;
+}
+
+static inline ZBJitMem zj_rip(const void *target) {
+    ZBJitMem m = {ZJ_RIP, -1, 0, 0, target};
+    return m;
+}
+
+static inline void zj_byte(ZBJitAsm *a, int b) {
+    if (a->p < a->end)
+        *a->p++ = (uint8_t)b;
+    else
+        a->overflow = 1;
+}
+
+static inline void zj_u32(ZBJitAsm *a, uint32_t v) {
+    zj_byte(a, v);
+    zj_byte(a, v >> 8);
+    zj_byte(a, v >> 16);
+    zj_byte(a, v >> 24);
+}
+
+/*
+ * ModRM, SIB and displacement of a memory operand. imm is the number of
+ * immediate bytes following them, needed by the rip relative operands.
+ */
+static inline void zj_modrm_mem(ZBJitAsm *a, int reg, ZBJitMem m, int imm) {
+    int mod;
+
+    if (m.base == ZJ_RIP) {
+        zj_byte(a, ((reg & 7) << 3) | 5);
+        zj_u32(a, (uint32_t)((const uint8_t *)m.target - (a->p + 4 + imm)));
+        return;
+    }
+    if (m.disp == 0 && (m.base & 7) != ZJ_RBP)
+        mod = 0;
+    else if (m.disp >= -128 && m.disp < 128)
+        mod = 1;
+    else
+        mod = 2;
+    if (m.index >= 0 || (m.base & 7) == ZJ_RSP) {
+        zj_byte(a, (mod << 6) | ((reg & 7) << 3) | 4);
+        zj_byte(a, (m.scale << 6) | (((m.index >= 0 ? m.index : ZJ_RSP) & 7) << 3) | (m.base & 7));
+    } else {
+        zj_byte(a, (mod << 6) | ((reg & 7) << 3) | (m.base & 7));
+    }
+    if (mod == 1)
+        zj_byte(a, m.disp);
+    else if (mod == 2)
+        zj_u32(a, (uint32_t)m.disp);
+}
+
+static inline void zj_modrm_reg(ZBJitAsm *a, int reg, int rm) {
+    zj_byte(a, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* REX prefix, left out when not needed */
+static inline void zj_rex(ZBJitAsm *a, int w, int reg, int index, int base) {
+    int rex = (w << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+
+    if (rex)
+        zj_byte(a, 0x40 | rex);
+}
+
+static inline void zj_rex_mem(ZBJitAsm *a, int w, int reg, ZBJitMem m) {
+    zj_rex(a, w, reg, m.index >= 0 ? m.index : 0, m.base == ZJ_RIP ? 0 : m.base);
+}
+
+/* op reg, [mem] or op [mem], reg, with a one or two byte opcode */
+static inline void zj_op_mem(ZBJitAsm *a, int w, int op, int reg, ZBJitMem m) {
+    zj_rex_mem(a, w, reg, m);
+    if (op > 0xff)
+        zj_byte(a, op >> 8);
+    zj_byte(a, op);
+    zj_modrm_mem(a, reg, m, 0);
+}
+
+/* op reg, rm with registers */
+static inline void zj_op_reg(ZBJitAsm *a, int w, int op, int reg, int rm) {
+    zj_rex(a, w, reg, 0, rm);
+    if (op > 0xff)
+        zj_byte(a, op >> 8);
+    zj_byte(a, op);
+    zj_modrm_reg(a, reg, rm);
+}
+
+/* mov r32, [m] / mov r64, [m] / mov [m], r32 */
+static inline void zj_load32(ZBJitAsm *a, int r, ZBJitMem m) { zj_op_mem(a, 0, 0x8b, r, m); }
+static inline void zj_load64(ZBJitAsm *a, int r, ZBJitMem m) { zj_op_mem(a, 1, 0x8b, r, m); }
+static inline void zj_store32(ZBJitAsm *a, ZBJitMem m, int r) { zj_op_mem(a, 0, 0x89, r, m); }
+/* movsxd r64, dword [m] */
+static inline void zj_loadsx32(ZBJitAsm *a, int r, ZBJitMem m) { zj_op_mem(a, 1, 0x63, r, m); }
+/* movzx r32, word [m] / mov [m], r16 */
+static inline void zj_load16(ZBJitAsm *a, int r, ZBJitMem m) { zj_op_mem(a, 0, 0x0fb7, r, m); }
+static inline void zj_store16(ZBJitAsm *a, ZBJitMem m, int r) {
+    zj_byte(a, 0x66);
+    zj_op_mem(a, 0, 0x89, r, m);
+}
+/* mov dword [m], imm32 */
+static inline void zj_store32i(ZBJitAsm *a, ZBJitMem m, int32_t imm) {
+    zj_rex_mem(a, 0, 0, m);
+    zj_byte(a, 0xc7);
+    zj_modrm_mem(a, 0, m, 4);
+    zj_u32(a, (uint32_t)imm);
+}
+/* lea r64, [m] */
+static inline void zj_lea(ZBJitAsm *a, int r, ZBJitMem m) { zj_op_mem(a, 1, 0x8d, r, m); }
+
+/* mov r32, imm32, zero extended */
+static inline void zj_mov32i(ZBJitAsm *a, int r, int32_t imm) {
+    zj_rex(a, 0, 0, 0, r);
+    zj_byte(a, 0xb8 + (r & 7));
+    zj_u32(a, (uint32_t)imm);
+}
+
+/* mov r64, imm64 */
+static inline void zj_mov64i(ZBJitAsm *a, int r, uint64_t imm) {
+    zj_rex(a, 1, 0, 0, r);
+    zj_byte(a, 0xb8 + (r & 7));
+    zj_u32(a, (uint32_t)imm);
+    zj_u32(a, (uint32_t)(imm >> 32));
+}
+
+/* op dst, src with the ZJ_ALU_* opcodes, on 32 or 64 bits (w) */
+#define ZJ_ALU_ADD  0x01
+#define ZJ_ALU_OR   0x09
+#define ZJ_ALU_AND  0x21
+#define ZJ_ALU_SUB  0x29
+#define ZJ_ALU_XOR  0x31
+#define ZJ_ALU_CMP  0x39
+#define ZJ_ALU_TEST 0x85
+#define ZJ_ALU_MOV  0x89
+
+static inline void zj_alu(ZBJitAsm *a, int op, int w, int dst, int src) { zj_op_reg(a, w, op, src, dst); }
+
+/* op dst, imm32 with the ModRM extensions of opcode 0x81 */
+#define ZJ_ALUI_ADD 0
+#define ZJ_ALUI_OR  1
+#define ZJ_ALUI_AND 4
+#define ZJ_ALUI_SUB 5
+#define ZJ_ALUI_CMP 7
+
+static inline void zj_alui(ZBJitAsm *a, int ext, int w, int dst, int32_t imm) {
+    zj_rex(a, w, 0, 0, dst);
+    if (imm >= -128 && imm < 128) {
+        zj_byte(a, 0x83);
+        zj_modrm_reg(a, ext, dst);
+        zj_byte(a, imm);
+    } else {
+        zj_byte(a, 0x81);
+        zj_modrm_reg(a, ext, dst);
+        zj_u32(a, (uint32_t)imm);
+    }
+}
+
+/* shifts by an immediate, with the ModRM extensions of opcode 0xc1 */
+#define ZJ_SHL 4
+#define ZJ_SHR 5
+#define ZJ_SAR 7
+
+static inline void zj_shift(ZBJitAsm *a, int ext, int w, int r, int n) {
+    zj_rex(a, w, 0, 0, r);
+    zj_byte(a, 0xc1);
+    zj_modrm_reg(a, ext, r);
+    zj_byte(a, n);
+}
+
+/* imul dst, src / imul dst, src, imm32 */
+static inline void zj_imul(ZBJitAsm *a, int w, int dst, int src) { zj_op_reg(a, w, 0x0faf, dst, src); }
+static inline void zj_imuli(ZBJitAsm *a, int w, int dst, int src, int32_t imm) {
+    zj_op_reg(a, w, 0x69, dst, src);
+    zj_u32(a, (uint32_t)imm);
+}
+
+/* neg r / cqo / idiv r64 */
+static inline void zj_neg(ZBJitAsm *a, int w, int r) { zj_op_reg(a, w, 0xf7, 3, r); }
+static inline void zj_cqo(ZBJitAsm *a) { zj_byte(a, 0x48); zj_byte(a, 0x99); }
+static inline void zj_idiv(ZBJitAsm *a, int r) { zj_op_reg(a, 1, 0xf7, 7, r); }
+
+/* setcc of the low byte of rax, rcx, rdx or rbx / cmovcc dst, src */
+static inline void zj_setcc(ZBJitAsm *a, int cc, int r) { zj_op_reg(a, 0, 0x0f90 + cc, 0, r); }
+static inline void zj_cmov(ZBJitAsm *a, int cc, int w, int dst, int src) { zj_op_reg(a, w, 0x0f40 + cc, dst, src); }
+
+static inline void zj_push(ZBJitAsm *a, int r) { zj_rex(a, 0, 0, 0, r); zj_byte(a, 0x50 + (r & 7)); }
+static inline void zj_pop(ZBJitAsm *a, int r) { zj_rex(a, 0, 0, 0, r); zj_byte(a, 0x58 + (r & 7)); }
+static inline void zj_call(ZBJitAsm *a, int r) { zj_op_reg(a, 0, 0xff, 2, r); }
+static inline void zj_ret(ZBJitAsm *a) { zj_byte(a, 0xc3); }
+
+/*
+ * Jumps: zj_jcc() and zj_jmp() return the displacement to fill with
+ * zj_bind() once the target is known, zj_jccto() jumps backward.
+ */
+static inline uint8_t *zj_jcc(ZBJitAsm *a, int cc) {
+    zj_byte(a, 0x0f);
+    zj_byte(a, 0x80 + cc);
+    zj_u32(a, 0);
+    return a->overflow ? NULL : a->p - 4;
+}
+
+static inline uint8_t *zj_jmp(ZBJitAsm *a) {
+    zj_byte(a, 0xe9);
+    zj_u32(a, 0);
+    return a->overflow ? NULL : a->p - 4;
+}
+
+static inline void zj_bind(ZBJitAsm *a, uint8_t *disp) {
+    int32_t d = (int32_t)(a->p - (disp + 4));
+
+    if (disp != NULL)
+        memcpy(disp, &d, 4);
+}
+
+static inline void zj_jccto(ZBJitAsm *a, int cc, const uint8_t *target) {
+    zj_byte(a, 0x0f);
+    zj_byte(a, 0x80 + cc);
+    zj_u32(a, (uint32_t)(target - (a->p + 4)));
+}
+
+/*
+ * AVX2 instructions: ZJ_VOP(map, pp, opcode) with map 1 for 0F, 2 for
+ * 0F38 and 3 for 0F3A, pp 1 for the 66 prefix and 2 for F3.
+ */
+#define ZJ_VOP(map, pp, op) (((map) << 10) | ((pp) << 8) | (op))
+
+#define ZJ_VPADDD       ZJ_VOP(1, 1, 0xfe)
+#define ZJ_VPSUBD       ZJ_VOP(1, 1, 0xfa)
+#define ZJ_VPMULLD      ZJ_VOP(2, 1, 0x40)
+#define ZJ_VPAND        ZJ_VOP(1, 1, 0xdb)
+#define ZJ_VPOR         ZJ_VOP(1, 1, 0xeb)
+#define ZJ_VPXOR        ZJ_VOP(1, 1, 0xef)
+#define ZJ_VPADDUSB     ZJ_VOP(1, 1, 0xdc)
+#define ZJ_VPCMPGTD     ZJ_VOP(1, 1, 0x66)
+#define ZJ_VPCMPEQD     ZJ_VOP(1, 1, 0x76)
+#define ZJ_VPACKUSDW    ZJ_VOP(2, 1, 0x2b)
+#define ZJ_VPMOVZXWD    ZJ_VOP(2, 1, 0x33)
+#define ZJ_VPBROADCASTD ZJ_VOP(2, 1, 0x58)
+#define ZJ_VMOVDQU      ZJ_VOP(1, 2, 0x6f)
+#define ZJ_VMOVDQU_ST   ZJ_VOP(1, 2, 0x7f)
+#define ZJ_VPMOVMSKB    ZJ_VOP(1, 1, 0xd7)
+#define ZJ_VPSHIFTD     ZJ_VOP(1, 1, 0x72)
+#define ZJ_VPBLENDVB    ZJ_VOP(3, 1, 0x4c)
+#define ZJ_VEXTRACTI128 ZJ_VOP(3, 1, 0x39)
+#define ZJ_VPGATHERDD   ZJ_VOP(2, 1, 0x90)
+
+/* 3 byte VEX prefix and opcode, l selects the 256 bit registers */
+static inline void zj_vex(ZBJitAsm *a, int op, int l, int reg, int vvvv, int index, int base) {
+    zj_byte(a, 0xc4);
+    zj_byte(a, ((~reg & 8) << 4) | ((~index & 8) << 3) | ((~base & 8) << 2) | (op >> 10));
+    zj_byte(a, ((~vvvv & 15) << 3) | (l << 2) | ((op >> 8) & 3));
+    zj_byte(a, op);
+}
+
+/* op dst, src1, src2 on ymm registers, or xmm ones for zj_vrrx() */
+static inline void zj_vrrl(ZBJitAsm *a, int op, int l, int dst, int src1, int src2) {
+    zj_vex(a, op, l, dst, src1, 0, src2);
+    zj_modrm_reg(a, dst, src2);
+}
+
+static inline void zj_vrr(ZBJitAsm *a, int op, int dst, int src1, int src2) { zj_vrrl(a, op, 1, dst, src1, src2); }
+static inline void zj_vrrx(ZBJitAsm *a, int op, int dst, int src1, int src2) { zj_vrrl(a, op, 0, dst, src1, src2); }
+
+/* op dst, src1, [m] on ymm registers, with l = 0 for xmm */
+static inline void zj_vrm(ZBJitAsm *a, int op, int l, int dst, int src1, ZBJitMem m) {
+    zj_vex(a, op, l, dst, src1, m.index >= 0 ? m.index : 0, m.base == ZJ_RIP ? 0 : m.base);
+    zj_modrm_mem(a, dst, m, 0);
+}
+
+/* vmovdqu [m], src */
+static inline void zj_vstore(ZBJitAsm *a, int l, ZBJitMem m, int src) { zj_vrm(a, ZJ_VMOVDQU_ST, l, src, 0, m); }
+
+/* vpsrld / vpslld dst, src, n */
+static inline void zj_vsrl(ZBJitAsm *a, int dst, int src, int n) {
+    zj_vex(a, ZJ_VPSHIFTD, 1, 0, dst, 0, src);
+    zj_modrm_reg(a, 2, src);
+    zj_byte(a, n);
+}
+
+static inline void zj_vsll(ZBJitAsm *a, int dst, int src, int n) {
+    zj_vex(a, ZJ_VPSHIFTD, 1, 0, dst, 0, src);
+    zj_modrm_reg(a, 6, src);
+    zj_byte(a, n);
+}
+
+/* vpblendvb dst, src1, src2, mask: mask ? src2 : src1 on each byte */
+static inline void zj_vblend(ZBJitAsm *a, int dst, int src1, int src2, int mask) {
+    zj_vrr(a, ZJ_VPBLENDVB, dst, src1, src2);
+    zj_byte(a, mask << 4);
+}
+
+/* vpmovmskb r32, src */
+static inline void zj_vmovmsk(ZBJitAsm *a, int r, int src) {
+    zj_vex(a, ZJ_VPMOVMSKB, 1, r, 0, 0, src);
+    zj_modrm_reg(a, r, src);
+}
+
+/* vextracti128 xmm dst, src, 1 */
+static inline void zj_vextracthi(ZBJitAsm *a, int dst, int src) {
+    zj_vex(a, ZJ_VEXTRACTI128, 1, src, 0, 0, dst);
+    zj_modrm_reg(a, src, dst);
+    zj_byte(a, 1);
+}
+
+/* vpgatherdd dst, [base + index * 4], mask: the mask is cleared */
+static inline void zj_vgather(ZBJitAsm *a, int dst, int base, int index, int mask) {
+    zj_vex(a, ZJ_VPGATHERDD, 1, dst, mask, index, base);
+    zj_modrm_mem(a, dst, zj_memi(base, index, 2, 0), 0);
+}
+
+static inline void zj_vzeroupper(ZBJitAsm *a) {
+    zj_byte(a, 0xc5);
+    zj_byte(a, 0xf8);
+    zj_byte(a, 0x77);
+}
+
+} // namespace fp
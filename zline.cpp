@@ -1,25 +1,116 @@
 #include <stdlib.h>
 #include "zbuffer.hpp"
+#include "ztile.hpp"
 
-#define ZCMP(z, zpix) ((z) >= (zpix))
+/* GL_LEQUAL, mirrored on the reversed z of ZB_flipDepth() */
+#define ZCMP(z, zpix) (zb->depth_flip ? (z) <= (zpix) : (z) >= (zpix))
 
 namespace fp {
 
-void ZB_plot(ZBuffer *zb, ZBufferPoint *p) {
+/*
+ * The tiled layout is drawn through a copy of the rows of the bounding
+ * box [xmin, xmax] x [ymin, ymax], stored back by ZB_linearEnd().
+ */
+static void *ZB_linearBegin(ZBuffer *zb, ZBuffer *view, ZBRect *rect, int xmin, int ymin, int xmax, int ymax) {
+    int w = xmax - xmin + 1, h = ymax - ymin + 1;
+    unsigned char *buf;
+
+    buf = (unsigned char *)malloc(w * h * (zb->pixel_size + sizeof(unsigned short)));
+    if (buf == NULL)
+        return NULL;
+    rect->xmin = xmin;
+    rect->ymin = ymin;
+    rect->xmax = xmax + 1;
+    rect->ymax = ymax + 1;
+    *view = *zb;
+    view->tiled = 0;
+    view->linesize = w * zb->pixel_size;
+    view->zlinesize = w;
+    view->pbuf = (PIXEL *)(buf - ymin * view->linesize - xmin * zb->pixel_size);
+    view->zbuf = (unsigned short *)(buf + h * view->linesize) - ymin * w - xmin;
+    ZB_tileCopy(zb, rect, buf, view->linesize, (unsigned short *)(buf + h * view->linesize), w, 0);
+    return buf;
+}
+
+static void ZB_linearEnd(ZBuffer *zb, ZBuffer *view, const ZBRect *rect, void *buf) {
+    int h = rect->ymax - rect->ymin;
+
+    ZB_tileCopy(zb, rect, buf, view->linesize, (unsigned short *)((unsigned char *)buf + h * view->linesize),
+                view->zlinesize, 1);
+    free(buf);
+}
+
+static void ZB_plotPixel(ZBuffer *zb, ZBufferPoint *p) {
     unsigned short *pz;
-    PIXEL *pp;
+    char *pp;
     int zz;
 
-    pz = zb->zbuf + (p->y * zb->xsize + p->x);
-    pp = (PIXEL *) ((char *) zb->pbuf + zb->linesize * p->y + p->x * PSZB);
+    pz = zb->zbuf + (p->y * zb->zlinesize + p->x);
+    pp = (char *) zb->pbuf + zb->linesize * p->y + p->x * zb->pixel_size;
     zz = p->z >> ZB_POINT_Z_FRAC_BITS;
     if (ZCMP(zz, *pz)) {
-        *pp = RGB_TO_PIXEL(p->r, p->g, p->b);
+        if (zb->pixel_size == 2)
+            *(unsigned short *)pp = ZB_pixel<unsigned short>(RGB_TO_PIXEL(p->r, p->g, p->b));
+        else
+            *(PIXEL *)pp = RGB_TO_PIXEL(p->r, p->g, p->b);
         *pz = zz;
     }
 }
 
+void ZB_plot(ZBuffer *zb, ZBufferPoint *p) {
+    /* lines and points are drawn directly, after the binned triangles, but not in bands */
+    if (zb->band_rows > 0)
+        return;
+    ZB_tileFlush(zb);
+    ZB_clearResolve(zb, p->x, p->y, p->x, p->y);
+    ZB_damage(zb, p->x, p->y, p->x, p->y);
+
+    if (zb->tiled) {
+        ZBuffer view;
+        ZBRect rect;
+        void *buf = ZB_linearBegin(zb, &view, &rect, p->x, p->y, p->x, p->y);
+
+        if (buf != NULL) {
+            ZB_plotPixel(&view, p);
+            ZB_linearEnd(zb, &view, &rect, buf);
+        }
+        return;
+    }
+    ZB_plotPixel(zb, p);
+}
+
+/* pending clear and damage of the tiles under the line */
+static void ZB_clearLine(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2) {
+    int xmin = p1->x < p2->x ? p1->x : p2->x, xmax = p1->x < p2->x ? p2->x : p1->x;
+    int ymin = p1->y < p2->y ? p1->y : p2->y, ymax = p1->y < p2->y ? p2->y : p1->y;
+
+    ZB_clearResolve(zb, xmin, ymin, xmax, ymax);
+    ZB_damage(zb, xmin, ymin, xmax, ymax);
+}
+
+typedef void (*ZB_lineFunc)(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2);
+
+static void ZB_lineLayout(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2, ZB_lineFunc draw) {
+    ZBuffer view;
+    ZBRect rect;
+    void *buf;
+
+    if (!zb->tiled) {
+        draw(zb, p1, p2);
+        return;
+    }
+    buf = ZB_linearBegin(zb, &view, &rect, p1->x < p2->x ? p1->x : p2->x, p1->y < p2->y ? p1->y : p2->y,
+                         p1->x < p2->x ? p2->x : p1->x, p1->y < p2->y ? p2->y : p1->y);
+    if (buf == NULL)
+        return;
+    draw(&view, p1, p2);
+    ZB_linearEnd(zb, &view, &rect, buf);
+}
+
+/* the lines are drawn on pixels of type P, color being one of them */
+
 #define INTERP_Z
+template <typename P>
 static void ZB_line_flat_z(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2, int color) {
 #include "zline.in"
 }
@@ -27,47 +118,78 @@ static void ZB_line_flat_z(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2, i
 /* line with color interpolation */
 #define INTERP_Z
 #define INTERP_RGB
+template <typename P>
 static void ZB_line_interp_z(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
 #include "zline.in"
 }
 
 /* no Z interpolation */
 
+template <typename P>
 static void ZB_line_flat(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2, int color) {
 #include "zline.in"
 }
 
 #define INTERP_RGB
+template <typename P>
 static void ZB_line_interp(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
 #include "zline.in"
 }
 
-void ZB_line_z(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
+static void ZB_drawLineZ(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
     int color1, color2;
 
     color1 = RGB_TO_PIXEL(p1->r, p1->g, p1->b);
     color2 = RGB_TO_PIXEL(p2->r, p2->g, p2->b);
 
     /* choose if the line should have its color interpolated or not */
-    if (color1 == color2) {
-        ZB_line_flat_z(zb, p1, p2, color1);
+    if (zb->pixel_size == 2) {
+        if (color1 == color2)
+            ZB_line_flat_z<unsigned short>(zb, p1, p2, RGB32_TO_RGB16(color1));
+        else
+            ZB_line_interp_z<unsigned short>(zb, p1, p2);
     } else {
-        ZB_line_interp_z(zb, p1, p2);
+        if (color1 == color2)
+            ZB_line_flat_z<PIXEL>(zb, p1, p2, color1);
+        else
+            ZB_line_interp_z<PIXEL>(zb, p1, p2);
     }
 }
 
-void ZB_line(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
+static void ZB_drawLine(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
     int color1, color2;
 
     color1 = RGB_TO_PIXEL(p1->r, p1->g, p1->b);
     color2 = RGB_TO_PIXEL(p2->r, p2->g, p2->b);
 
     /* choose if the line should have its color interpolated or not */
-    if (color1 == color2) {
-        ZB_line_flat(zb, p1, p2, color1);
+    if (zb->pixel_size == 2) {
+        if (color1 == color2)
+            ZB_line_flat<unsigned short>(zb, p1, p2, RGB32_TO_RGB16(color1));
+        else
+            ZB_line_interp<unsigned short>(zb, p1, p2);
     } else {
-        ZB_line_interp(zb, p1, p2);
+        if (color1 == color2)
+            ZB_line_flat<PIXEL>(zb, p1, p2, color1);
+        else
+            ZB_line_interp<PIXEL>(zb, p1, p2);
     }
 }
 
+void ZB_line_z(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
+    if (zb->band_rows > 0)
+        return;
+    ZB_tileFlush(zb);
+    ZB_clearLine(zb, p1, p2);
+    ZB_lineLayout(zb, p1, p2, ZB_drawLineZ);
+}
+
+void ZB_line(ZBuffer * zb, ZBufferPoint * p1, ZBufferPoint * p2) {
+    if (zb->band_rows > 0)
+        return;
+    ZB_tileFlush(zb);
+    ZB_clearLine(zb, p1, p2);
+    ZB_lineLayout(zb, p1, p2, ZB_drawLine);
+}
+
 } // namespace fp
@@ -0,0 +1,88 @@
+/*
+ * Scalar span and conversion kernels and selection of the SIMD backend
+ */
+#include <string.h>
+#include <utility>
+#include "zsimd.hpp"
+#include "zsimd_ops.hpp"
+#include "zbuffer.hpp"
+
+static_assert(ZB_SPAN_Z_FRAC_BITS == ZB_POINT_Z_FRAC_BITS, "span kernels z precision");
+
+namespace fp {
+
+#include "zsimd.in"
+#include "zconvert.in"
+
+static const ZBSpanFuncs ZB_spansScalar = ZB_SPAN_FUNCS("scalar");
+static const ZBConvertFuncs ZB_convertsScalar = ZB_CONVERT_FUNCS("scalar");
+
+#if defined(__x86_64__) || defined(__i386__)
+extern const ZBSpanFuncs ZB_spansSSE41;
+extern const ZBSpanFuncs ZB_spansAVX2;
+extern const ZBConvertFuncs ZB_convertsSSE41;
+extern const ZBConvertFuncs ZB_convertsAVX2;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+extern const ZBSpanFuncs ZB_spansNEON;
+extern const ZBConvertFuncs ZB_convertsNEON;
+#endif
+
+const ZBSpanFuncs *ZB_spans = &ZB_spansScalar;
+const ZBConvertFuncs *ZB_converts = &ZB_convertsScalar;
+static int ZB_spansSelected = 0;
+
+/* the backends supported by this cpu, best first */
+static int ZB_spanBackends(const ZBSpanFuncs **list, const ZBConvertFuncs **converts) {
+    int n = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        converts[n] = &ZB_convertsAVX2;
+        list[n++] = &ZB_spansAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        converts[n] = &ZB_convertsSSE41;
+        list[n++] = &ZB_spansSSE41;
+    }
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    converts[n] = &ZB_convertsNEON;
+    list[n++] = &ZB_spansNEON;
+#endif
+    converts[n] = &ZB_convertsScalar;
+    list[n++] = &ZB_spansScalar;
+    return n;
+}
+
+void ZB_initSpans(void) {
+    const ZBSpanFuncs *list[4];
+    const ZBConvertFuncs *converts[4];
+
+    if (ZB_spansSelected)
+        return;
+    ZB_spanBackends(list, converts);
+    ZB_spans = list[0];
+    ZB_converts = converts[0];
+    ZB_spansSelected = 1;
+}
+
+int ZB_setSpans(const char *name) {
+    const ZBSpanFuncs *list[4];
+    const ZBConvertFuncs *converts[4];
+    int i, n;
+
+    n = ZB_spanBackends(list, converts);
+    for (i = 0; i < n; i++) {
+        if (strcmp(list[i]->name, name) == 0) {
+            ZB_spans = list[i];
+            ZB_converts = converts[i];
+            ZB_spansSelected = 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+} // namespace fp
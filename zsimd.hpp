@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * SIMD span kernels.
+ *
+ * The spans are written once in zsimd.in against the vector operations
+ * of zsimd_ops.hpp and compiled for each backend: scalar, SSE4.1, AVX2
+ * and NEON. The best one supported by the cpu is selected at the first
+ * ZB_open().
+ *
+ * Each backend instantiates one kernel per pipeline state word: the
+ * shading, depth test, depth writes, blending, alpha test and color
+ * buffer format of a span are template parameters, so that a kernel has no test of the state in
+ * its pixel loop. The rasterizers pick the kernel from the table of the
+ * backend with the state word of the triangle.
+ *
+ * The conversions of the framebuffer to the pixel formats of the display
+ * are written in zconvert.in and built the same way.
+ *
+ * This header does not include zbuffer.hpp: the backends are built with
+ * their own instruction set flags and must not instantiate any inline
+ * code shared with the rest of the library.
+ */
+
+/* same as ZB_POINT_Z_FRAC_BITS */
+#define ZB_SPAN_Z_FRAC_BITS 14
+
+/* pipeline state word */
+#define ZB_STATE_SHADE_MASK   0x003 /* ZB_SHADE_*, set by the rasterizer */
+#define ZB_STATE_DEPTH_SHIFT  2
+#define ZB_STATE_DEPTH_MASK   0x01c /* ZB_DEPTH_* */
+#define ZB_STATE_ZWRITE       0x020 /* the pixels passing the tests write their z */
+#define ZB_STATE_BLEND_SHIFT  6
+#define ZB_STATE_BLEND_MASK   0x1c0 /* ZB_BLEND_* */
+#define ZB_STATE_ALPHA_TEST   0x200 /* see ZBSpan::alpha_lo */
+#define ZB_STATE_COLOR16      0x400 /* 5R6G5B color buffer, 32 bit pixels otherwise */
+#define ZB_STATE_COUNT        0x800
+
+#define ZB_STATE_SHADE(s) ((s) & ZB_STATE_SHADE_MASK)
+#define ZB_STATE_DEPTH(s) (((s) & ZB_STATE_DEPTH_MASK) >> ZB_STATE_DEPTH_SHIFT)
+#define ZB_STATE_BLEND(s) (((s) & ZB_STATE_BLEND_MASK) >> ZB_STATE_BLEND_SHIFT)
+
+#define ZB_SHADE_DEPTH   0 /* z only */
+#define ZB_SHADE_FLAT    1
+#define ZB_SHADE_SMOOTH  2
+#define ZB_SHADE_MAPPING 3
+
+/*
+ * depth functions, named after the GL ones: the z buffer stores the
+ * nearest fragments with the largest z, so that GL_LESS passes when the
+ * z of the fragment is above the z buffer. ZB_DEPTH_ALWAYS does not read
+ * the z buffer.
+ */
+#define ZB_DEPTH_ALWAYS   0
+#define ZB_DEPTH_NEVER    1
+#define ZB_DEPTH_LESS     2
+#define ZB_DEPTH_LEQUAL   3
+#define ZB_DEPTH_EQUAL    4
+#define ZB_DEPTH_GREATER  5
+#define ZB_DEPTH_GEQUAL   6
+#define ZB_DEPTH_NOTEQUAL 7
+
+/*
+ * pixel formats of the framebuffer conversions, by their bytes in memory
+ * from the first one of a little endian word: the framebuffer is B8G8R8X8
+ */
+#define ZB_FORMAT_B8G8R8X8      0 /* copy */
+#define ZB_FORMAT_B8G8R8A8      1 /* alpha set to 0xff */
+#define ZB_FORMAT_R8G8B8A8      2 /* red and blue swapped, alpha set to 0xff */
+#define ZB_FORMAT_B8G8R8        3 /* 24 bits packed */
+#define ZB_FORMAT_R5G6B5        4 /* 16 bits words */
+#define ZB_FORMAT_R5G6B5_DITHER 5 /* with a 4x4 ordered dither */
+#define ZB_FORMAT_COUNT         6
+
+/* bytes per pixel of a format */
+#define ZB_FORMAT_SIZE(f) ((f) <= ZB_FORMAT_R8G8B8A8 ? 4 : (f) == ZB_FORMAT_B8G8R8 ? 3 : 2)
+
+/* blend equations, by their GL source and destination factors */
+#define ZB_BLEND_NONE      0 /* GL_ONE, GL_ZERO */
+#define ZB_BLEND_ALPHA     1 /* GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA */
+#define ZB_BLEND_ADD       2 /* GL_ONE, GL_ONE */
+#define ZB_BLEND_ADD_ALPHA 3 /* GL_SRC_ALPHA, GL_ONE */
+#define ZB_BLEND_MODULATE  4 /* GL_DST_COLOR, GL_ZERO */
+#define ZB_BLEND_PREMUL    5 /* GL_ONE, GL_ONE_MINUS_SRC_ALPHA */
+#define ZB_BLEND_KEEP      6 /* GL_ZERO, GL_ONE */
+#define ZB_BLEND_FACTORS   7 /* the other factors, see ZBSpan::blend */
+
+/*
+ * blend factors of ZB_BLEND_FACTORS. The color buffer has no alpha: the
+ * GL destination alpha factors are ONE or ZERO.
+ */
+#define ZB_FACTOR_ZERO                0
+#define ZB_FACTOR_ONE                 1
+#define ZB_FACTOR_SRC_COLOR           2
+#define ZB_FACTOR_ONE_MINUS_SRC_COLOR 3
+#define ZB_FACTOR_DST_COLOR           4
+#define ZB_FACTOR_ONE_MINUS_DST_COLOR 5
+#define ZB_FACTOR_SRC_ALPHA           6
+#define ZB_FACTOR_ONE_MINUS_SRC_ALPHA 7
+#define ZB_FACTOR_COUNT               8
+
+/* ZBSpan::blend of the source and destination factors */
+#define ZB_BLEND_FACTORS_INDEX(sfactor, dfactor) ((sfactor) * ZB_FACTOR_COUNT + (dfactor))
+
+namespace fp {
+
+typedef struct {
+    void *pp;              /* first pixel, 32 or 16 bits by ZB_STATE_COLOR16 */
+    unsigned short *pz;    /* first z */
+    int n;                 /* number of pixels */
+
+    unsigned int z, r, g, b, a, s, t;
+    int dzdx, drdx, dgdx, dbdx, dadx, dsdx, dtdx;
+
+    uint32_t color;        /* flat spans, their alpha is a */
+    const uint32_t *texture; /* 256x256 texture of the mapped spans */
+
+    /* the alpha test passes when ((alpha - alpha_lo) & 0xff) <= alpha_range */
+    int alpha_lo, alpha_range;
+
+    /* ZB_BLEND_FACTORS_INDEX() of the factors of ZB_BLEND_FACTORS */
+    int blend;
+} ZBSpan;
+
+/*
+ * state word of the kernel drawing the same pixels as s: the states which
+ * draw nothing or differ only by unused bits share one instance
+ */
+static constexpr unsigned int ZB_spanState(unsigned int s) {
+    return ZB_STATE_DEPTH(s) == ZB_DEPTH_NEVER ? ZB_DEPTH_NEVER << ZB_STATE_DEPTH_SHIFT :
+           ZB_STATE_SHADE(s) == ZB_SHADE_DEPTH ?
+               ((s & ZB_STATE_ZWRITE) ? s & (ZB_STATE_DEPTH_MASK | ZB_STATE_ZWRITE) :
+                                        ZB_DEPTH_NEVER << ZB_STATE_DEPTH_SHIFT) :
+           ZB_STATE_BLEND(s) == ZB_BLEND_KEEP && !(s & ZB_STATE_ZWRITE) ? ZB_DEPTH_NEVER << ZB_STATE_DEPTH_SHIFT :
+           s;
+}
+
+typedef void (*ZB_spanFunc)(const ZBSpan *span);
+
+typedef struct {
+    const char *name;
+    ZB_spanFunc func[ZB_STATE_COUNT]; /* indexed by the state word */
+} ZBSpanFuncs;
+
+/*
+ * convert the n pixels of src to dst in a format, the first one being at
+ * (x, y) in the framebuffer for the dither
+ */
+typedef void (*ZB_convertFunc)(void *dst, const uint32_t *src, int n, int x, int y);
+
+/* filters of the scaled copies */
+#define ZB_FILTER_NEAREST  0
+#define ZB_FILTER_BILINEAR 1
+#define ZB_FILTER_COUNT    2
+
+/*
+ * n pixels of a row scaled from the source rows a and b, weighted by
+ * fy / 256 for b. Pixel i is at the 16.16 source x fx + i * dx, clamped
+ * to [0, max_fx].
+ */
+typedef void (*ZB_scaleFunc)(uint32_t *dst, const uint32_t *a, const uint32_t *b, int fy,
+                             int fx, int dx, int max_fx, int n);
+
+typedef struct {
+    const char *name;
+    ZB_convertFunc func[ZB_FORMAT_COUNT];
+    ZB_scaleFunc scale[ZB_FILTER_COUNT];
+} ZBConvertFuncs;
+
+/* kernels in use, never NULL */
+extern const ZBSpanFuncs *ZB_spans;
+extern const ZBConvertFuncs *ZB_converts;
+
+/* select the best backend for this cpu, for the spans and the conversions */
+void ZB_initSpans(void);
+
+/* force a backend by name ("scalar", "sse4.1", "avx2", "neon"), -1 if unsupported */
+int ZB_setSpans(const char *name);
+
+} // namespace fp
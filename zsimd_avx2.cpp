@@ -0,0 +1,22 @@
+/*
+ * AVX2 span and conversion kernels, built with -mavx2
+ */
+#include <utility>
+#include "zsimd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define ZB_SIMD_AVX2
+#include "zsimd_ops.hpp"
+
+namespace fp {
+
+#include "zsimd.in"
+#include "zconvert.in"
+
+extern const ZBSpanFuncs ZB_spansAVX2 = ZB_SPAN_FUNCS("avx2");
+extern const ZBConvertFuncs ZB_convertsAVX2 = ZB_CONVERT_FUNCS("avx2");
+
+} // namespace fp
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * NEON span and conversion kernels
+ */
+#include <utility>
+#include "zsimd.hpp"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#define ZB_SIMD_NEON
+#include "zsimd_ops.hpp"
+
+namespace fp {
+
+#include "zsimd.in"
+#include "zconvert.in"
+
+extern const ZBSpanFuncs ZB_spansNEON = ZB_SPAN_FUNCS("neon");
+extern const ZBConvertFuncs ZB_convertsNEON = ZB_CONVERT_FUNCS("neon");
+
+} // namespace fp
+
+#endif
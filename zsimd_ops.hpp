@@ -0,0 +1,212 @@
+#pragma once
+
+/*
+ * Vector of ZV_LANES 32 bit integers for the span kernels. The including
+ * file selects the backend by defining ZB_SIMD_SSE41, ZB_SIMD_AVX2 or
+ * ZB_SIMD_NEON, otherwise the vector is a single scalar.
+ *
+ * All the arithmetic wraps like unsigned ints, as the scalar rasterizer.
+ * zv_store24() writes the 3 low bytes of each lane, in little endian order.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ZB_SIMD_AVX2)
+
+#include <immintrin.h>
+
+typedef __m256i zvec;
+#define ZV_LANES 8
+
+static inline zvec zv_set1(int v) { return _mm256_set1_epi32(v); }
+static inline zvec zv_ramp(int d) {
+    return _mm256_mullo_epi32(_mm256_set1_epi32(d), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+static inline zvec zv_add(zvec a, zvec b) { return _mm256_add_epi32(a, b); }
+static inline zvec zv_sub(zvec a, zvec b) { return _mm256_sub_epi32(a, b); }
+static inline zvec zv_mul(zvec a, zvec b) { return _mm256_mullo_epi32(a, b); }
+/* unsigned saturated add of each byte */
+static inline zvec zv_addsat8(zvec a, zvec b) { return _mm256_adds_epu8(a, b); }
+static inline zvec zv_and(zvec a, zvec b) { return _mm256_and_si256(a, b); }
+static inline zvec zv_or(zvec a, zvec b) { return _mm256_or_si256(a, b); }
+#define zv_srl(a, n) _mm256_srli_epi32(a, n)
+#define zv_sll(a, n) _mm256_slli_epi32(a, n)
+static inline zvec zv_cmpgt(zvec a, zvec b) { return _mm256_cmpgt_epi32(a, b); }
+static inline zvec zv_cmpeq(zvec a, zvec b) { return _mm256_cmpeq_epi32(a, b); }
+/* m ? a : b, m being all ones or zeros in each lane */
+static inline zvec zv_select(zvec m, zvec a, zvec b) { return _mm256_blendv_epi8(b, a, m); }
+static inline int zv_none(zvec m) { return _mm256_testz_si256(m, m); }
+static inline int zv_all(zvec m) { return _mm256_movemask_epi8(m) == -1; }
+
+static inline zvec zv_loadz(const unsigned short *p) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+static inline void zv_storez(unsigned short *p, zvec v) {
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0xffff));
+    _mm_storeu_si128((__m128i *)p, _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+static inline zvec zv_loadp(const uint32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void zv_storep(uint32_t *p, zvec v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline zvec zv_gather(const uint32_t *base, zvec index) {
+    return _mm256_i32gather_epi32((const int *)base, index, 4);
+}
+static inline void zv_store24(uint8_t *p, zvec v) {
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128i lo, hi;
+    int32_t w;
+
+    v = _mm256_shuffle_epi8(v, pack);
+    lo = _mm256_castsi256_si128(v);
+    hi = _mm256_extracti128_si256(v, 1);
+    _mm_storel_epi64((__m128i *)p, lo);
+    w = _mm_extract_epi32(lo, 2);
+    memcpy(p + 8, &w, 4);
+    _mm_storel_epi64((__m128i *)(p + 12), hi);
+    w = _mm_extract_epi32(hi, 2);
+    memcpy(p + 20, &w, 4);
+}
+
+#elif defined(ZB_SIMD_SSE41)
+
+#include <smmintrin.h>
+
+typedef __m128i zvec;
+#define ZV_LANES 4
+
+static inline zvec zv_set1(int v) { return _mm_set1_epi32(v); }
+static inline zvec zv_ramp(int d) { return _mm_mullo_epi32(_mm_set1_epi32(d), _mm_setr_epi32(0, 1, 2, 3)); }
+static inline zvec zv_add(zvec a, zvec b) { return _mm_add_epi32(a, b); }
+static inline zvec zv_sub(zvec a, zvec b) { return _mm_sub_epi32(a, b); }
+static inline zvec zv_mul(zvec a, zvec b) { return _mm_mullo_epi32(a, b); }
+static inline zvec zv_addsat8(zvec a, zvec b) { return _mm_adds_epu8(a, b); }
+static inline zvec zv_and(zvec a, zvec b) { return _mm_and_si128(a, b); }
+static inline zvec zv_or(zvec a, zvec b) { return _mm_or_si128(a, b); }
+#define zv_srl(a, n) _mm_srli_epi32(a, n)
+#define zv_sll(a, n) _mm_slli_epi32(a, n)
+static inline zvec zv_cmpgt(zvec a, zvec b) { return _mm_cmpgt_epi32(a, b); }
+static inline zvec zv_cmpeq(zvec a, zvec b) { return _mm_cmpeq_epi32(a, b); }
+static inline zvec zv_select(zvec m, zvec a, zvec b) { return _mm_blendv_epi8(b, a, m); }
+static inline int zv_none(zvec m) { return _mm_testz_si128(m, m); }
+static inline int zv_all(zvec m) { return _mm_movemask_epi8(m) == 0xffff; }
+
+static inline zvec zv_loadz(const unsigned short *p) {
+    return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+static inline void zv_storez(unsigned short *p, zvec v) {
+    v = _mm_and_si128(v, _mm_set1_epi32(0xffff));
+    _mm_storel_epi64((__m128i *)p, _mm_packus_epi32(v, v));
+}
+static inline zvec zv_loadp(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void zv_storep(uint32_t *p, zvec v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline zvec zv_gather(const uint32_t *base, zvec index) {
+    return _mm_setr_epi32(base[_mm_extract_epi32(index, 0)], base[_mm_extract_epi32(index, 1)],
+                          base[_mm_extract_epi32(index, 2)], base[_mm_extract_epi32(index, 3)]);
+}
+static inline void zv_store24(uint8_t *p, zvec v) {
+    int32_t w;
+
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    _mm_storel_epi64((__m128i *)p, v);
+    w = _mm_extract_epi32(v, 2);
+    memcpy(p + 8, &w, 4);
+}
+
+#elif defined(ZB_SIMD_NEON)
+
+#include <arm_neon.h>
+
+typedef int32x4_t zvec;
+#define ZV_LANES 4
+
+static inline zvec zv_set1(int v) { return vdupq_n_s32(v); }
+static inline zvec zv_ramp(int d) {
+    static const int32_t ramp[4] = {0, 1, 2, 3};
+    return vmulq_s32(vdupq_n_s32(d), vld1q_s32(ramp));
+}
+static inline zvec zv_add(zvec a, zvec b) { return vaddq_s32(a, b); }
+static inline zvec zv_sub(zvec a, zvec b) { return vsubq_s32(a, b); }
+static inline zvec zv_mul(zvec a, zvec b) { return vmulq_s32(a, b); }
+static inline zvec zv_addsat8(zvec a, zvec b) {
+    return vreinterpretq_s32_u8(vqaddq_u8(vreinterpretq_u8_s32(a), vreinterpretq_u8_s32(b)));
+}
+static inline zvec zv_and(zvec a, zvec b) { return vandq_s32(a, b); }
+static inline zvec zv_or(zvec a, zvec b) { return vorrq_s32(a, b); }
+#define zv_srl(a, n) vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), n))
+#define zv_sll(a, n) vshlq_n_s32(a, n)
+static inline zvec zv_cmpgt(zvec a, zvec b) { return vreinterpretq_s32_u32(vcgtq_s32(a, b)); }
+static inline zvec zv_cmpeq(zvec a, zvec b) { return vreinterpretq_s32_u32(vceqq_s32(a, b)); }
+static inline zvec zv_select(zvec m, zvec a, zvec b) { return vbslq_s32(vreinterpretq_u32_s32(m), a, b); }
+static inline int zv_none(zvec m) {
+    uint32x2_t v = vorr_u32(vget_low_u32(vreinterpretq_u32_s32(m)), vget_high_u32(vreinterpretq_u32_s32(m)));
+    return (vget_lane_u32(v, 0) | vget_lane_u32(v, 1)) == 0;
+}
+static inline int zv_all(zvec m) {
+    uint32x2_t v = vand_u32(vget_low_u32(vreinterpretq_u32_s32(m)), vget_high_u32(vreinterpretq_u32_s32(m)));
+    return (vget_lane_u32(v, 0) & vget_lane_u32(v, 1)) == 0xffffffff;
+}
+
+static inline zvec zv_loadz(const unsigned short *p) { return vreinterpretq_s32_u32(vmovl_u16(vld1_u16(p))); }
+static inline void zv_storez(unsigned short *p, zvec v) { vst1_u16(p, vmovn_u32(vreinterpretq_u32_s32(v))); }
+static inline zvec zv_loadp(const uint32_t *p) { return vreinterpretq_s32_u32(vld1q_u32(p)); }
+static inline void zv_storep(uint32_t *p, zvec v) { vst1q_u32(p, vreinterpretq_u32_s32(v)); }
+static inline zvec zv_gather(const uint32_t *base, zvec index) {
+    int32_t v[4];
+    v[0] = base[vgetq_lane_s32(index, 0)];
+    v[1] = base[vgetq_lane_s32(index, 1)];
+    v[2] = base[vgetq_lane_s32(index, 2)];
+    v[3] = base[vgetq_lane_s32(index, 3)];
+    return vld1q_s32(v);
+}
+static inline void zv_store24(uint8_t *p, zvec v) {
+    uint32_t a = vgetq_lane_s32(v, 0), b = vgetq_lane_s32(v, 1), c = vgetq_lane_s32(v, 2), d = vgetq_lane_s32(v, 3);
+    uint32_t w[3];
+
+    w[0] = (a & 0xffffff) | (b << 24);
+    w[1] = ((b >> 8) & 0xffff) | (c << 16);
+    w[2] = ((c >> 16) & 0xff) | (d << 8);
+    memcpy(p, w, 12);
+}
+
+#else
+
+typedef int32_t zvec;
+#define ZV_LANES 1
+
+static inline zvec zv_set1(int v) { return v; }
+static inline zvec zv_ramp(int d) { (void)d; return 0; }
+static inline zvec zv_add(zvec a, zvec b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+static inline zvec zv_sub(zvec a, zvec b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+static inline zvec zv_mul(zvec a, zvec b) { return (int32_t)((uint32_t)a * (uint32_t)b); }
+static inline zvec zv_addsat8(zvec a, zvec b) {
+    uint32_t s, c;
+
+    /* sum of the low 7 bits of each byte, then the carry out of each byte */
+    s = ((uint32_t)a & 0x7f7f7f7f) + ((uint32_t)b & 0x7f7f7f7f);
+    c = (((uint32_t)a & (uint32_t)b) | (((uint32_t)a | (uint32_t)b) & s)) & 0x80808080;
+    s ^= ((uint32_t)a ^ (uint32_t)b) & 0x80808080;
+    return (int32_t)(s | ((c >> 7) * 0xff));
+}
+static inline zvec zv_and(zvec a, zvec b) { return a & b; }
+static inline zvec zv_or(zvec a, zvec b) { return a | b; }
+#define zv_srl(a, n) ((int32_t)((uint32_t)(a) >> (n)))
+#define zv_sll(a, n) ((int32_t)((uint32_t)(a) << (n)))
+static inline zvec zv_cmpgt(zvec a, zvec b) { return a > b ? -1 : 0; }
+static inline zvec zv_cmpeq(zvec a, zvec b) { return a == b ? -1 : 0; }
+static inline zvec zv_select(zvec m, zvec a, zvec b) { return m ? a : b; }
+static inline int zv_none(zvec m) { return m == 0; }
+static inline int zv_all(zvec m) { return m != 0; }
+
+static inline zvec zv_loadz(const unsigned short *p) { return *p; }
+static inline void zv_storez(unsigned short *p, zvec v) { *p = (unsigned short)v; }
+static inline zvec zv_loadp(const uint32_t *p) { return (int32_t)*p; }
+static inline void zv_storep(uint32_t *p, zvec v) { *p = (uint32_t)v; }
+static inline zvec zv_gather(const uint32_t *base, zvec index) { return (int32_t)base[index]; }
+static inline void zv_store24(uint8_t *p, zvec v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+}
+
+#endif
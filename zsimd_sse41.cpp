@@ -0,0 +1,22 @@
+/*
+ * SSE4.1 span and conversion kernels, built with -msse4.1
+ */
+#include <utility>
+#include "zsimd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define ZB_SIMD_SSE41
+#include "zsimd_ops.hpp"
+
+namespace fp {
+
+#include "zsimd.in"
+#include "zconvert.in"
+
+extern const ZBSpanFuncs ZB_spansSSE41 = ZB_SPAN_FUNCS("sse4.1");
+extern const ZBConvertFuncs ZB_convertsSSE41 = ZB_CONVERT_FUNCS("sse4.1");
+
+} // namespace fp
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Frame streaming: damaged tiles, encoded without loss
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "zstream.hpp"
+#include "ztile.hpp"
+
+namespace fp {
+
+#define ZB_STREAM_HEADER 21
+#define ZB_STREAM_TILE_HEADER 7
+#define ZB_STREAM_TILE_PIXELS (ZB_DAMAGE_SIZE * ZB_DAMAGE_SIZE)
+/* largest tile, all runs of 1 pixel */
+#define ZB_STREAM_TILE_MAX (ZB_STREAM_TILE_HEADER + 4 * ZB_STREAM_TILE_PIXELS)
+
+static unsigned long long ZB_streamTime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned char *ZB_put16(unsigned char *p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static unsigned char *ZB_put32(unsigned char *p, unsigned int v) {
+    p = ZB_put16(p, v);
+    return ZB_put16(p, v >> 16);
+}
+
+static unsigned char *ZB_putColor(unsigned char *p, uint32_t c) {
+    p[0] = c;
+    p[1] = c >> 8;
+    p[2] = c >> 16;
+    return p + 3;
+}
+
+ZBStream *ZB_streamOpen(int fd, int ring_size) {
+    ZBStream *s;
+
+    if (fd < 0 || ring_size <= 0)
+        return NULL;
+    s = (ZBStream *)calloc(1, sizeof(ZBStream));
+    if (s == NULL)
+        return NULL;
+    s->ring = (unsigned char *)malloc(ring_size);
+    if (s->ring == NULL) {
+        free(s);
+        return NULL;
+    }
+    s->fd = fd;
+    s->ring_size = ring_size;
+    s->resync = 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return s;
+}
+
+void ZB_streamClose(ZBStream *s) {
+    free(s->prev);
+    free(s->frame);
+    free(s->ring);
+    free(s);
+}
+
+int ZB_streamConnect(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* the buffers of a xsize x ysize frame, all sent again */
+static int ZB_streamResize(ZBStream *s, int xsize, int ysize) {
+    int tiles = ((xsize + ZB_DAMAGE_SIZE - 1) >> ZB_DAMAGE_SHIFT) * ((ysize + ZB_DAMAGE_SIZE - 1) >> ZB_DAMAGE_SHIFT);
+
+    free(s->prev);
+    free(s->frame);
+    s->max_frame = ZB_STREAM_HEADER + tiles * ZB_STREAM_TILE_MAX;
+    s->prev = (uint32_t *)malloc(xsize * ysize * sizeof(uint32_t));
+    s->frame = (unsigned char *)malloc(s->max_frame);
+    if (s->prev == NULL || s->frame == NULL) {
+        free(s->prev);
+        free(s->frame);
+        s->prev = NULL;
+        s->frame = NULL;
+        s->xsize = s->ysize = 0;
+        return -1;
+    }
+    s->xsize = xsize;
+    s->ysize = ysize;
+    s->resync = 1;
+    return 0;
+}
+
+/* the pixels of the w x h tile at x, y of the color buffer, as B8G8R8 */
+static void ZB_streamRead(ZBuffer *zb, uint32_t *pixels, int x, int y, int w, int h) {
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        const unsigned char *p = ZB_pixelAddress(zb, x, y + j);
+
+        for (i = 0; i < w; i++) {
+            if (zb->pixel_size == 2)
+                pixels[j * w + i] = RGB16_TO_RGB32(((const unsigned short *)p)[i]);
+            else
+                pixels[j * w + i] = ((const PIXEL *)p)[i] & 0xffffff;
+        }
+    }
+}
+
+/* the smallest of the encodings of the n pixels, returns the end of the data */
+static unsigned char *ZB_streamEncode(unsigned char *p, int *mode, const uint32_t *pixels, int n) {
+    uint32_t colors[ZB_STREAM_COLORS];
+    int i, j, nb_colors, runs, rle, palette;
+
+    runs = 0;
+    for (i = 0; i < n; i += j) {
+        for (j = 1; i + j < n && j < 256 && pixels[i + j] == pixels[i]; j++)
+            ;
+        runs++;
+    }
+    rle = 4 * runs;
+
+    nb_colors = 0;
+    for (i = 0; i < n && nb_colors <= ZB_STREAM_COLORS; i++) {
+        for (j = 0; j < nb_colors && colors[j] != pixels[i]; j++)
+            ;
+        if (j == nb_colors && nb_colors++ < ZB_STREAM_COLORS)
+            colors[j] = pixels[i];
+    }
+    palette = nb_colors <= ZB_STREAM_COLORS ? 1 + 3 * nb_colors + (n + 1) / 2 : 3 * n + 1;
+
+    if (rle < 3 * n && rle <= palette) {
+        *mode = ZB_STREAM_RLE;
+        for (i = 0; i < n; i += j) {
+            for (j = 1; i + j < n && j < 256 && pixels[i + j] == pixels[i]; j++)
+                ;
+            *p++ = j - 1;
+            p = ZB_putColor(p, pixels[i]);
+        }
+    } else if (palette < 3 * n) {
+        *mode = ZB_STREAM_PALETTE;
+        *p++ = nb_colors - 1;
+        for (i = 0; i < nb_colors; i++)
+            p = ZB_putColor(p, colors[i]);
+        memset(p, 0, (n + 1) / 2);
+        for (i = 0; i < n; i++) {
+            for (j = 0; colors[j] != pixels[i]; j++)
+                ;
+            p[i >> 1] |= j << ((i & 1) * 4);
+        }
+        p += (n + 1) / 2;
+    } else {
+        *mode = ZB_STREAM_RAW;
+        for (i = 0; i < n; i++)
+            p = ZB_putColor(p, pixels[i]);
+    }
+    return p;
+}
+
+/* the bytes of the ring in one or two writes, until the reader is full */
+int ZB_streamFlush(ZBStream *s) {
+    while (s->ring_len > 0) {
+        int n = s->ring_size - s->ring_head < s->ring_len ? s->ring_size - s->ring_head : s->ring_len;
+        ssize_t r = send(s->fd, s->ring + s->ring_head, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (r < 0 && errno == ENOTSOCK)
+            r = write(s->fd, s->ring + s->ring_head, n);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        if (r < 0)
+            return -1;
+        s->ring_head = (s->ring_head + r) % s->ring_size;
+        s->ring_len -= r;
+        s->stats.sent += r;
+    }
+    return s->ring_len;
+}
+
+static int ZB_streamPush(ZBStream *s, const unsigned char *data, int n) {
+    int tail, first;
+
+    if (n > s->ring_size - s->ring_len)
+        return -1;
+    tail = (s->ring_head + s->ring_len) % s->ring_size;
+    first = s->ring_size - tail < n ? s->ring_size - tail : n;
+    memcpy(s->ring + tail, data, first);
+    memcpy(s->ring, data + first, n - first);
+    s->ring_len += n;
+    return 0;
+}
+
+int ZB_streamFrame(ZBuffer *zb, ZBStream *s, const ZBDamage *damage) {
+    uint32_t pixels[ZB_STREAM_TILE_PIXELS];
+    unsigned long long start = ZB_streamTime();
+    unsigned char *p;
+    int tx, ty, x, y, w, h, j, mode, nb_tiles, all, size;
+
+    if (zb->band_rows > 0)
+        return -1;
+    if ((zb->xsize != s->xsize || zb->ysize != s->ysize) && ZB_streamResize(s, zb->xsize, zb->ysize) != 0)
+        return -1;
+
+    /* the room of the frame in the ring, written by the reader since the last one */
+    if (ZB_streamFlush(s) < 0)
+        return -1;
+
+    ZB_tileFlush(zb);
+    all = s->resync;
+    nb_tiles = 0;
+    p = s->frame + ZB_STREAM_HEADER;
+    for (ty = 0; ty < damage->ysize; ty++) {
+        for (tx = 0; tx < damage->xsize; tx++) {
+            unsigned char *tile = p;
+            uint32_t *prev;
+            int same = 1;
+
+            if (!all && !damage->tiles[ty * damage->xsize + tx])
+                continue;
+            s->stats.damaged++;
+            x = tx << ZB_DAMAGE_SHIFT;
+            y = ty << ZB_DAMAGE_SHIFT;
+            w = s->xsize - x < ZB_DAMAGE_SIZE ? s->xsize - x : ZB_DAMAGE_SIZE;
+            h = s->ysize - y < ZB_DAMAGE_SIZE ? s->ysize - y : ZB_DAMAGE_SIZE;
+            ZB_clearResolve(zb, x, y, x + w - 1, y + h - 1);
+            ZB_streamRead(zb, pixels, x, y, w, h);
+
+            /* the tiles rendered again with the same pixels are not sent */
+            prev = s->prev + y * s->xsize + x;
+            for (j = 0; j < h; j++) {
+                if (memcmp(prev + j * s->xsize, pixels + j * w, w * sizeof(uint32_t)) != 0) {
+                    same = 0;
+                    memcpy(prev + j * s->xsize, pixels + j * w, w * sizeof(uint32_t));
+                }
+            }
+            if (same && !all)
+                continue;
+
+            p = ZB_streamEncode(tile + ZB_STREAM_TILE_HEADER, &mode, pixels, w * h);
+            tile = ZB_put16(tile, tx);
+            tile = ZB_put16(tile, ty);
+            *tile++ = mode;
+            ZB_put16(tile, p - tile - 2);
+            nb_tiles++;
+        }
+    }
+
+    size = p - s->frame;
+    p = ZB_put32(s->frame, ZB_STREAM_MAGIC);
+    p = ZB_put32(p, s->stats.frames + s->stats.dropped);
+    p = ZB_put16(p, s->xsize);
+    p = ZB_put16(p, s->ysize);
+    *p++ = ZB_DAMAGE_SIZE;
+    p = ZB_put32(p, nb_tiles);
+    ZB_put32(p, size - ZB_STREAM_HEADER);
+
+    /* the reader misses the tiles of a dropped frame, all are sent again */
+    if (ZB_streamPush(s, s->frame, size) != 0) {
+        s->stats.dropped++;
+        s->resync = 1;
+    } else {
+        if (s->stats.frames == 0)
+            s->first_time = start;
+        s->last_time = start;
+        s->stats.frames++;
+        s->stats.tiles += nb_tiles;
+        s->stats.bytes += size;
+        s->stats.raw_bytes += (unsigned long long)s->xsize * s->ysize * 4;
+        s->resync = 0;
+    }
+    s->stats.encode_ns += ZB_streamTime() - start;
+    return ZB_streamFlush(s) < 0 ? -1 : 0;
+}
+
+void ZB_streamStats(ZBStream *s, ZBStreamStats *stats) {
+    *stats = s->stats;
+    stats->time_ns = s->last_time - s->first_time;
+}
+
+} // namespace fp
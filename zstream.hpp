@@ -0,0 +1,83 @@
+#pragma once
+
+#include "zbuffer.hpp"
+
+/*
+ * Frame streaming, for a viewer of a headless renderer.
+ *
+ * ZB_streamFrame() reads the ZB_DAMAGE_SIZE tiles of a damage map, keeps
+ * those that differ from the previous frame sent and encodes them without
+ * loss in a ring buffer, written to a file descriptor (usually a Unix
+ * socket, see ZB_streamConnect()) as fast as the reader takes it. A frame
+ * that does not fit in the ring is dropped and the next one sends all of
+ * its tiles.
+ *
+ * A frame is a header followed by its tiles, little endian:
+ *   u32 ZB_STREAM_MAGIC, u32 frame, u16 xsize, u16 ysize, u8 tile size,
+ *   u32 nb_tiles, u32 bytes of the tiles
+ * each tile being:
+ *   u16 tx, u16 ty (in tiles), u8 ZB_STREAM_*, u16 bytes of the data
+ * then the data of its pixels, clipped to the frame, in rows:
+ *   ZB_STREAM_RAW: the B, G, R bytes of each pixel
+ *   ZB_STREAM_RLE: runs of a u8 length - 1 and the B, G, R bytes of their pixel
+ *   ZB_STREAM_PALETTE: u8 colors - 1, their B, G, R bytes, then a 4 bit
+ *     index per pixel, the first one in the low bits
+ * The first frame and the ones after a drop hold all the tiles.
+ */
+
+#define ZB_STREAM_MAGIC 0x53474c54 /* "TLGS" */
+
+#define ZB_STREAM_RAW     0
+#define ZB_STREAM_RLE     1
+#define ZB_STREAM_PALETTE 2
+
+/* the colors of a ZB_STREAM_PALETTE tile */
+#define ZB_STREAM_COLORS 16
+
+namespace fp {
+
+typedef struct {
+    unsigned int frames;       /* encoded */
+    unsigned int dropped;      /* not encoded, the ring being full */
+    unsigned long long tiles;  /* encoded, out of the damaged ones */
+    unsigned long long damaged;
+    unsigned long long bytes;  /* encoded */
+    unsigned long long sent;   /* written to the file descriptor */
+    unsigned long long raw_bytes; /* of the frames as 32 bit pixels */
+    unsigned long long encode_ns;
+    unsigned long long time_ns; /* from the first frame to the last one */
+} ZBStreamStats;
+
+typedef struct ZBStream {
+    int fd;
+    int xsize, ysize;
+    uint32_t *prev; /* pixels of the frame sent, without their 8 unused bits */
+    unsigned char *frame; /* encoded frame, of the worst size */
+    int max_frame;
+    unsigned char *ring;
+    int ring_size, ring_head, ring_len;
+    int resync; /* the next frame holds all the tiles */
+    unsigned long long first_time, last_time;
+    ZBStreamStats stats;
+} ZBStream;
+
+/* fd is made non blocking, ring_size is in bytes */
+ZBStream *ZB_streamOpen(int fd, int ring_size);
+/* fd is not closed */
+void ZB_streamClose(ZBStream *s);
+
+/* a connected Unix socket, or -1 */
+int ZB_streamConnect(const char *path);
+
+/*
+ * Encode the tiles of damage that changed in the ring and write what the
+ * file descriptor takes. Returns -1 without a frame buffer (ZB_openBands())
+ * or when the file descriptor failed, 0 otherwise.
+ */
+int ZB_streamFrame(ZBuffer *zb, ZBStream *s, const ZBDamage *damage);
+/* write what the file descriptor takes of the ring, returns the bytes left in it or -1 */
+int ZB_streamFlush(ZBStream *s);
+
+void ZB_streamStats(ZBStream *s, ZBStreamStats *stats);
+
+} // namespace fp
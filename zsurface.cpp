@@ -0,0 +1,168 @@
+/*
+ * Render surfaces: aligned, pre-faulted, on huge pages when possible
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zsurface.hpp"
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fp {
+
+/* in the ZB_SURFACE_ALIGN bytes before each buffer */
+typedef struct {
+    void *base;    /* of the allocation */
+    size_t length; /* allocated or mapped from base */
+    int kind;
+} ZBSurfaceHeader;
+
+static pthread_mutex_t ZB_surfaceLock = PTHREAD_MUTEX_INITIALIZER;
+static ZBSurfaceStats ZB_surfaceCount;
+
+/* one write per page, the memory being already zero */
+static void ZB_surfaceTouch(unsigned char *p, size_t length, size_t page) {
+    size_t i;
+
+    for (i = 0; i < length; i += page)
+        ((volatile unsigned char *)p)[i] = 0;
+}
+
+#ifdef __unix__
+
+static pthread_once_t ZB_surfaceOnce = PTHREAD_ONCE_INIT;
+static int ZB_surfaceThp;
+
+/* transparent huge pages, unless the kernel has none or never gives them */
+static void ZB_surfaceProbe(void) {
+#ifdef MADV_HUGEPAGE
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    char mode[128];
+
+    if (f == NULL)
+        return;
+    if (fgets(mode, sizeof(mode), f) != NULL && strstr(mode, "[never]") == NULL)
+        ZB_surfaceThp = 1;
+    fclose(f);
+#endif
+}
+
+static unsigned char *ZB_surfaceMap(size_t size, ZBSurfaceHeader *h) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE), huge = ZB_SURFACE_HUGE;
+    unsigned char *p;
+
+    pthread_once(&ZB_surfaceOnce, ZB_surfaceProbe);
+#ifdef MAP_HUGETLB
+    /* reserved huge pages, given at the mapping or not at all */
+    if (size >= huge) {
+        h->length = (size + huge - 1) & ~(huge - 1);
+        p = (unsigned char *)mmap(NULL, h->length, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            h->base = p;
+            h->kind = ZB_SURFACE_HUGETLB;
+            ZB_surfaceTouch(p, h->length, huge);
+            return p;
+        }
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    /* the huge pages of the kernel cover aligned ranges: the mapping is trimmed to them */
+    if (size >= huge && ZB_surfaceThp) {
+        unsigned char *start;
+
+        h->length = (size + huge - 1) & ~(huge - 1);
+        p = (unsigned char *)mmap(NULL, h->length + huge, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        start = (unsigned char *)(((size_t)p + huge - 1) & ~(huge - 1));
+        if (start > p)
+            munmap(p, start - p);
+        munmap(start + h->length, p + huge - start);
+        h->base = start;
+        h->kind = madvise(start, h->length, MADV_HUGEPAGE) == 0 ? ZB_SURFACE_THP : ZB_SURFACE_PAGES;
+        ZB_surfaceTouch(start, h->length, page);
+        return start;
+    }
+#endif
+    h->length = (size + page - 1) & ~(page - 1);
+    p = (unsigned char *)mmap(NULL, h->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    h->base = p;
+    h->kind = ZB_SURFACE_PAGES;
+    ZB_surfaceTouch(p, h->length, page);
+    return p;
+}
+
+#endif
+
+void *ZB_surfaceAlloc(size_t size) {
+    size_t total = size + ZB_SURFACE_ALIGN;
+    unsigned char *p = NULL;
+    ZBSurfaceHeader h;
+
+#ifdef __unix__
+    if (size >= ZB_SURFACE_MAP)
+        p = ZB_surfaceMap(total, &h);
+#endif
+    if (p == NULL) {
+        if (posix_memalign(&h.base, ZB_SURFACE_ALIGN, total) != 0)
+            return NULL;
+        p = (unsigned char *)h.base;
+        h.length = total;
+        h.kind = ZB_SURFACE_HEAP;
+        /* zero and fault in */
+        memset(p, 0, total);
+    }
+    memcpy(p, &h, sizeof(h));
+
+    pthread_mutex_lock(&ZB_surfaceLock);
+    ZB_surfaceCount.buffers[h.kind]++;
+    ZB_surfaceCount.bytes[h.kind] += h.length;
+    if (size >= ZB_SURFACE_HUGE && h.kind != ZB_SURFACE_HUGETLB && h.kind != ZB_SURFACE_THP)
+        ZB_surfaceCount.huge_fallbacks++;
+    pthread_mutex_unlock(&ZB_surfaceLock);
+    return p + ZB_SURFACE_ALIGN;
+}
+
+void ZB_surfaceFree(void *p) {
+    ZBSurfaceHeader h;
+
+    if (p == NULL)
+        return;
+    memcpy(&h, (unsigned char *)p - ZB_SURFACE_ALIGN, sizeof(h));
+
+    pthread_mutex_lock(&ZB_surfaceLock);
+    ZB_surfaceCount.buffers[h.kind]--;
+    ZB_surfaceCount.bytes[h.kind] -= h.length;
+    pthread_mutex_unlock(&ZB_surfaceLock);
+
+#ifdef __unix__
+    if (h.kind != ZB_SURFACE_HEAP) {
+        munmap(h.base, h.length);
+        return;
+    }
+#endif
+    free(h.base);
+}
+
+int ZB_surfaceKind(const void *p) {
+    ZBSurfaceHeader h;
+
+    memcpy(&h, (const unsigned char *)p - ZB_SURFACE_ALIGN, sizeof(h));
+    return h.kind;
+}
+
+void ZB_surfaceStats(ZBSurfaceStats *stats) {
+    pthread_mutex_lock(&ZB_surfaceLock);
+    *stats = ZB_surfaceCount;
+    pthread_mutex_unlock(&ZB_surfaceLock);
+}
+
+} // namespace fp
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Render surfaces: the color, z and texture buffers, read and written
+ * every frame.
+ *
+ * ZB_surfaceAlloc() returns zeroed memory aligned on ZB_SURFACE_ALIGN
+ * bytes whose pages are all faulted in, so that the first frame drawn in
+ * it does not take the page faults. The buffers of at least
+ * ZB_SURFACE_HUGE bytes are mapped on the huge pages reserved by the
+ * system (MAP_HUGETLB) if any, else on normal pages the kernel is asked
+ * to back with transparent huge pages. The buffers of at least
+ * ZB_SURFACE_MAP bytes are mapped on normal pages and the others come
+ * from the heap. What each buffer got is counted in ZBSurfaceStats.
+ */
+
+#define ZB_SURFACE_ALIGN 64
+#define ZB_SURFACE_MAP   (64 << 10)
+#define ZB_SURFACE_HUGE  (2 << 20)
+
+/* kinds of memory */
+#define ZB_SURFACE_HEAP    0
+#define ZB_SURFACE_PAGES   1
+#define ZB_SURFACE_THP     2 /* transparent huge pages asked with madvise() */
+#define ZB_SURFACE_HUGETLB 3
+#define ZB_SURFACE_KINDS   4
+
+namespace fp {
+
+typedef struct {
+    unsigned int buffers[ZB_SURFACE_KINDS]; /* in use, of each kind */
+    size_t bytes[ZB_SURFACE_KINDS];         /* of those buffers, as mapped */
+    unsigned int huge_fallbacks; /* buffers which asked for huge pages and got none */
+} ZBSurfaceStats;
+
+/* NULL if out of memory */
+void *ZB_surfaceAlloc(size_t size);
+void ZB_surfaceFree(void *p);
+/* ZB_SURFACE_* of the memory of p */
+int ZB_surfaceKind(const void *p);
+void ZB_surfaceStats(ZBSurfaceStats *stats);
+
+} // namespace fp
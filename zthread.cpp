@@ -0,0 +1,256 @@
+/*
+ * Persistent worker threads
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include "zthread.hpp"
+
+namespace fp {
+
+typedef struct {
+    ZBThreadPool *pool;
+    int index;
+} ZBWorker;
+
+struct ZBThreadPool {
+    int nb_threads;
+    pthread_t *threads;
+    ZBWorker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    int generation; /* incremented for every ZB_poolRun() */
+    int running;    /* workers still busy with the current generation */
+    int quit;
+
+    ZB_jobFunc func;
+    void *arg;
+    int nb_jobs;
+    std::atomic<int> next_job;
+
+    unsigned long long run_time; /* when the current generation was started */
+    ZBPoolStats stats;
+};
+
+typedef struct {
+    ZB_rowsFunc func;
+    void *arg;
+    int nb_rows, band;
+} ZBPoolRows;
+
+static unsigned long long ZB_poolTime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ZB_poolJobs(ZBThreadPool *pool, int thread) {
+    int job;
+
+    while ((job = pool->next_job.fetch_add(1, std::memory_order_relaxed)) < pool->nb_jobs)
+        pool->func(pool->arg, job, thread);
+}
+
+static void *ZB_poolWorker(void *arg) {
+    ZBWorker *worker = (ZBWorker *)arg;
+    ZBThreadPool *pool = worker->pool;
+    int generation = 0;
+    unsigned long long wake;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == generation && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        wake = ZB_poolTime() - pool->run_time;
+        pthread_mutex_unlock(&pool->lock);
+
+        ZB_poolJobs(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.wake_ns += wake;
+        if (wake > pool->stats.wake_max_ns)
+            pool->stats.wake_max_ns = wake;
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int ZB_poolCpus(void) {
+#ifdef __linux__
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0)
+        return CPU_COUNT(&allowed);
+#endif
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+ZBThreadPool *ZB_poolOpen(int nb_threads) {
+    ZBThreadPool *pool;
+    int i;
+#ifdef __linux__
+    /* the cpus of the affinity mask of the process, in order */
+    int cpu[CPU_SETSIZE], nb_cpus = 0;
+    cpu_set_t allowed, cpus;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allowed))
+                cpu[nb_cpus++] = i;
+        }
+    }
+#endif
+
+    if (nb_threads < 1)
+        nb_threads = 1;
+
+    pool = new ZBThreadPool;
+    pool->nb_threads = 1;
+    pool->threads = (pthread_t *)malloc(nb_threads * sizeof(pthread_t));
+    pool->workers = (ZBWorker *)malloc(nb_threads * sizeof(ZBWorker));
+    /* without them the caller runs all the jobs */
+    if (pool->threads == NULL || pool->workers == NULL)
+        nb_threads = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->quit = 0;
+    pool->func = NULL;
+    pool->arg = NULL;
+    pool->nb_jobs = 0;
+    pool->next_job = 0;
+    pool->run_time = 0;
+    pool->stats.runs = 0;
+    pool->stats.wake_ns = 0;
+    pool->stats.wake_max_ns = 0;
+    pool->stats.run_ns = 0;
+
+    /* if a thread cannot be created we simply run with fewer of them */
+    for (i = 1; i < nb_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, ZB_poolWorker, &pool->workers[i]) != 0)
+            break;
+#ifdef __linux__
+        /* the workers keep their caches, the scheduler may still move the caller */
+        if (nb_cpus > 1) {
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu[i % nb_cpus], &cpus);
+            pthread_setaffinity_np(pool->threads[i], sizeof(cpus), &cpus);
+        }
+#endif
+        pool->nb_threads++;
+    }
+    pool->stats.nb_threads = pool->nb_threads;
+    return pool;
+}
+
+void ZB_poolClose(ZBThreadPool *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->nb_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool->threads);
+    delete pool;
+}
+
+int ZB_poolThreads(ZBThreadPool *pool) {
+    return pool->nb_threads;
+}
+
+void ZB_poolRun(ZBThreadPool *pool, ZB_jobFunc func, void *arg, int nb_jobs) {
+    unsigned long long start;
+
+    if (nb_jobs <= 0)
+        return;
+
+    /* not worth waking up the workers */
+    if (pool->nb_threads == 1 || nb_jobs == 1) {
+        int job;
+        for (job = 0; job < nb_jobs; job++)
+            func(arg, job, 0);
+        return;
+    }
+
+    start = ZB_poolTime();
+    pthread_mutex_lock(&pool->lock);
+    pool->run_time = start;
+    pool->func = func;
+    pool->arg = arg;
+    pool->nb_jobs = nb_jobs;
+    pool->next_job = 0;
+    pool->running = pool->nb_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    ZB_poolJobs(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pool->stats.runs++;
+    pool->stats.run_ns += ZB_poolTime() - start;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void ZB_poolBand(void *arg, int job, int thread) {
+    ZBPoolRows *rows = (ZBPoolRows *)arg;
+    int y0 = job * rows->band;
+    int y1 = y0 + rows->band < rows->nb_rows ? y0 + rows->band : rows->nb_rows;
+
+    rows->func(rows->arg, y0, y1, thread);
+}
+
+void ZB_poolRows(ZBThreadPool *pool, ZB_rowsFunc func, void *arg, int nb_rows, int align) {
+    ZBPoolRows rows;
+
+    if (nb_rows <= 0)
+        return;
+
+    /* a few bands per thread for the balance, all of them aligned */
+    rows.band = (nb_rows + pool->nb_threads * 4 - 1) / (pool->nb_threads * 4);
+    rows.band = (rows.band + align - 1) / align * align;
+    rows.func = func;
+    rows.arg = arg;
+    rows.nb_rows = nb_rows;
+    ZB_poolRun(pool, ZB_poolBand, &rows, (nb_rows + rows.band - 1) / rows.band);
+}
+
+int ZB_poolAlign(int linesize) {
+    int align = 1;
+
+    while (((align * linesize) & (ZB_CACHE_LINE - 1)) != 0)
+        align <<= 1;
+    return align;
+}
+
+void ZB_poolStats(ZBThreadPool *pool, ZBPoolStats *stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+} // namespace fp
@@ -0,0 +1,55 @@
+#pragma once
+
+/*
+ * Persistent worker threads used by the rasterizer.
+ *
+ * The threads are created once and sleep between two calls to
+ * ZB_poolRun(). The calling thread takes part in the work, so a pool of
+ * n threads only starts n - 1 workers. On Linux worker i is pinned to the
+ * i-th cpu of the affinity mask of the process, the caller keeps its own
+ * placement.
+ */
+
+/* the row bands of ZB_poolRows() start on a multiple of it in the buffers */
+#define ZB_CACHE_LINE 64
+
+namespace fp {
+
+typedef struct ZBThreadPool ZBThreadPool;
+
+/* job is in [0, nb_jobs[, thread in [0, nb_threads[ (0 is the caller) */
+typedef void (*ZB_jobFunc)(void *arg, int job, int thread);
+
+/* rows in [y0, y1[ */
+typedef void (*ZB_rowsFunc)(void *arg, int y0, int y1, int thread);
+
+typedef struct {
+    int nb_threads;
+    unsigned int runs;     /* ZB_poolRun() which woke the workers up */
+    unsigned long long wake_ns, wake_max_ns; /* from a run to a worker starting it, summed over the workers */
+    unsigned long long run_ns; /* time spent in these runs */
+} ZBPoolStats;
+
+/* cpus the process may run on, from its affinity mask on Linux */
+int ZB_poolCpus(void);
+
+ZBThreadPool *ZB_poolOpen(int nb_threads);
+void ZB_poolClose(ZBThreadPool *pool);
+
+int ZB_poolThreads(ZBThreadPool *pool);
+
+/* run func on every job and return when all of them are done */
+void ZB_poolRun(ZBThreadPool *pool, ZB_jobFunc func, void *arg, int nb_jobs);
+
+/*
+ * run func on bands of rows covering [0, nb_rows[, each starting on a
+ * multiple of align rows
+ */
+void ZB_poolRows(ZBThreadPool *pool, ZB_rowsFunc func, void *arg, int nb_rows, int align);
+
+/* rows to start on a cache line of a buffer of linesize bytes per row */
+int ZB_poolAlign(int linesize);
+
+void ZB_poolStats(ZBThreadPool *pool, ZBPoolStats *stats);
+
+} // namespace fp
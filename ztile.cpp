@@ -0,0 +1,391 @@
+/*
+ * Tile binned rasterization
+ */
+#include <stdlib.h>
+#include "ztile.hpp"
+
+namespace fp {
+
+static void ZB_tileAllocBins(ZBTiler *tl) {
+    ZBuffer *zb = tl->zb;
+
+    tl->xtiles = (zb->xsize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT;
+    tl->ytiles = (zb->ysize + ZB_TILE_SIZE - 1) >> ZB_TILE_SHIFT;
+    tl->bins = (ZBTileBin *)calloc(tl->xtiles * tl->ytiles, sizeof(ZBTileBin));
+    tl->active = (int *)malloc(tl->xtiles * tl->ytiles * sizeof(int));
+    tl->nb_active = 0;
+    tl->first_job = 0;
+}
+
+static void ZB_tileFreeBins(ZBTiler *tl) {
+    int i;
+
+    for (i = 0; i < tl->xtiles * tl->ytiles; i++)
+        free(tl->bins[i].triangles);
+    free(tl->bins);
+    free(tl->active);
+}
+
+int ZB_tileOpen(ZBuffer *zb, int nb_threads) {
+    ZBTiler *tl;
+
+    if (zb->tiler != NULL)
+        ZB_tileClose(zb);
+
+    tl = (ZBTiler *)malloc(sizeof(ZBTiler));
+    if (tl == NULL)
+        return -1;
+    tl->triangles = (ZBTriangle *)malloc(ZB_TILE_MAX_TRIANGLES * sizeof(ZBTriangle));
+    if (tl->triangles == NULL) {
+        free(tl);
+        return -1;
+    }
+    tl->nb_triangles = 0;
+    tl->max_triangles = ZB_TILE_MAX_TRIANGLES;
+    tl->zb = zb;
+    tl->nb_threads = nb_threads;
+    ZB_tileAllocBins(tl);
+
+    zb->tiler = tl;
+    return 0;
+}
+
+void ZB_tileClose(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+
+    if (tl == NULL)
+        return;
+
+    ZB_tileFlush(zb);
+    zb->tiler = NULL;
+
+    ZB_tileFreeBins(tl);
+    free(tl->triangles);
+    free(tl);
+}
+
+void ZB_tileResize(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+
+    if (tl == NULL)
+        return;
+
+    ZB_tileDiscard(zb);
+    ZB_tileFreeBins(tl);
+    ZB_tileAllocBins(tl);
+}
+
+/*
+ * add the triangle index to the bins of the tiles touched by [xmin, xmax] x
+ * [ymin, ymax], -1 and in none of them when out of memory
+ */
+static int ZB_tileBin(ZBTiler *tl, int index, int xmin, int ymin, int xmax, int ymax) {
+    int tx, ty;
+
+    /* room in all the bins first */
+    for (ty = ymin >> ZB_TILE_SHIFT; ty <= ymax >> ZB_TILE_SHIFT; ty++) {
+        for (tx = xmin >> ZB_TILE_SHIFT; tx <= xmax >> ZB_TILE_SHIFT; tx++) {
+            ZBTileBin *bin = &tl->bins[ty * tl->xtiles + tx];
+
+            if (bin->nb_triangles == bin->max_triangles) {
+                int max_triangles = bin->max_triangles ? bin->max_triangles * 2 : 64;
+                int *triangles = (int *)realloc(bin->triangles, max_triangles * sizeof(int));
+
+                if (triangles == NULL)
+                    return -1;
+                bin->triangles = triangles;
+                bin->max_triangles = max_triangles;
+            }
+        }
+    }
+    for (ty = ymin >> ZB_TILE_SHIFT; ty <= ymax >> ZB_TILE_SHIFT; ty++) {
+        for (tx = xmin >> ZB_TILE_SHIFT; tx <= xmax >> ZB_TILE_SHIFT; tx++) {
+            int tile = ty * tl->xtiles + tx;
+            ZBTileBin *bin = &tl->bins[tile];
+
+            if (bin->nb_triangles == 0)
+                tl->active[tl->nb_active++] = tile;
+            bin->triangles[bin->nb_triangles++] = index;
+        }
+    }
+    return 0;
+}
+
+/* a free triangle, NULL when there is no room left in band rendering */
+static ZBTriangle *ZB_tileAlloc(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+
+    if (tl->nb_triangles == tl->max_triangles) {
+        ZBTriangle *triangles = NULL;
+
+        /* the depth prepass and the bands keep the triangles of the whole frame */
+        if (zb->depth_prepass || zb->band_rows > 0)
+            triangles = (ZBTriangle *)realloc(tl->triangles, 2 * tl->max_triangles * sizeof(ZBTriangle));
+        if (triangles != NULL) {
+            tl->triangles = triangles;
+            tl->max_triangles *= 2;
+        } else if (zb->band_rows > 0) {
+            return NULL;
+        } else {
+            ZB_tileFlush(zb);
+        }
+    }
+    return &tl->triangles[tl->nb_triangles++];
+}
+
+void ZB_tileTriangle(ZBuffer *zb, ZB_fillTriangleFunc fill,
+                     ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+    ZBTiler *tl = zb->tiler;
+    ZBTriangle *tri;
+    int xmin, ymin, xmax, ymax;
+
+    /*
+     * The edge walk may put the span ends one pixel outside of the
+     * bounding box of the vertices, so the box is widened by one pixel.
+     */
+    xmin = p0->x;
+    xmax = p0->x;
+    if (p1->x < xmin) xmin = p1->x;
+    if (p1->x > xmax) xmax = p1->x;
+    if (p2->x < xmin) xmin = p2->x;
+    if (p2->x > xmax) xmax = p2->x;
+    ymin = p0->y;
+    ymax = p0->y;
+    if (p1->y < ymin) ymin = p1->y;
+    if (p1->y > ymax) ymax = p1->y;
+    if (p2->y < ymin) ymin = p2->y;
+    if (p2->y > ymax) ymax = p2->y;
+    xmin -= 1;
+    xmax += 1;
+
+    if (xmin < zb->clip_xmin) xmin = zb->clip_xmin;
+    if (ymin < zb->clip_ymin) ymin = zb->clip_ymin;
+    if (xmax >= zb->clip_xmax) xmax = zb->clip_xmax - 1;
+    if (ymax >= zb->clip_ymax) ymax = zb->clip_ymax - 1;
+    if (xmin > xmax || ymin > ymax)
+        return;
+
+    /* out of memory in band rendering, the triangle is lost */
+    tri = ZB_tileAlloc(zb);
+    if (tri == NULL)
+        return;
+    tri->fill = fill;
+    tri->texture = zb->current_texture;
+    tri->state = zb->state;
+    tri->alpha_lo = zb->alpha_lo;
+    tri->alpha_range = zb->alpha_range;
+    tri->blend = zb->blend;
+    tri->p[0] = *p0;
+    tri->p[1] = *p1;
+    tri->p[2] = *p2;
+
+    /* out of memory for the bins, the triangle is lost */
+    if (ZB_tileBin(tl, tri - tl->triangles, xmin, ymin, xmax, ymax) < 0)
+        tl->nb_triangles--;
+}
+
+/*
+ * The clears recorded by ZB_tileClear(): the ZB_CLEARED_* flags in p[0].s,
+ * the clear z in p[0].z and the clear color in p[0].r. The pending clear
+ * of the tile is written first, then this one with the same code.
+ */
+static void ZB_tileClearFill(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+    int xmin = zb->clip_xmin, ymin = zb->clip_ymin, xmax = zb->clip_xmax - 1, ymax = zb->clip_ymax - 1;
+
+    (void)p1;
+    (void)p2;
+
+    ZB_clearResolve(zb, xmin, ymin, xmax, ymax);
+    zb->cleared[(ymin >> ZB_TILE_SHIFT) * zb->cleared_xsize + (xmin >> ZB_TILE_SHIFT)] = p0->s;
+    zb->clear_z = p0->z;
+    zb->clear_color = (PIXEL)p0->r;
+    ZB_clearResolve(zb, xmin, ymin, xmax, ymax);
+    if (p0->s & ZB_CLEARED_Z)
+        ZB_hizUpdate(zb, xmin, ymin, xmax + 1, ymax + 1);
+}
+
+int ZB_tileClear(ZBuffer *zb, int clear_z, int z, int clear_color, PIXEL color) {
+    ZBTiler *tl = zb->tiler;
+    ZBTriangle *tri;
+
+    if (tl == NULL || tl->nb_triangles == 0)
+        return -1;
+    tri = ZB_tileAlloc(zb);
+    if (tri == NULL)
+        return 0;
+    tri->fill = ZB_tileClearFill;
+    tri->texture = NULL;
+    tri->state = 0;
+    tri->alpha_lo = 0;
+    tri->alpha_range = 255;
+    tri->blend = 0;
+    tri->p[0].s = (clear_z ? ZB_CLEARED_Z : 0) | (clear_color ? ZB_CLEARED_COLOR : 0);
+    tri->p[0].z = z;
+    tri->p[0].r = (int)color;
+    /* out of memory as above, the clear is lost */
+    if (ZB_tileBin(tl, tri - tl->triangles, 0, 0, zb->xsize - 1, zb->ysize - 1) < 0)
+        tl->nb_triangles--;
+    return 0;
+}
+
+/* state of the triangles whose z can be drawn before their colors, mirrored by ZB_flipDepth() */
+#define ZB_TILE_OPAQUE(state) \
+    (((state) & ~ZB_STATE_COLOR16) == ((ZB_DEPTH_LESS << ZB_STATE_DEPTH_SHIFT) | ZB_STATE_ZWRITE) || \
+     ((state) & ~ZB_STATE_COLOR16) == ((ZB_DEPTH_LEQUAL << ZB_STATE_DEPTH_SHIFT) | ZB_STATE_ZWRITE) || \
+     ((state) & ~ZB_STATE_COLOR16) == ((ZB_DEPTH_GREATER << ZB_STATE_DEPTH_SHIFT) | ZB_STATE_ZWRITE) || \
+     ((state) & ~ZB_STATE_COLOR16) == ((ZB_DEPTH_GEQUAL << ZB_STATE_DEPTH_SHIFT) | ZB_STATE_ZWRITE))
+
+static void ZB_tileJob(void *arg, int job, int thread) {
+    ZBTiler *tl = (ZBTiler *)arg;
+    int tile = tl->active[tl->first_job + job];
+    ZBTileBin *bin = &tl->bins[tile];
+    ZBuffer zb;
+    int i, j, x, y, nb_prepass;
+    unsigned int prepass;
+
+    (void)thread;
+
+    /* private copy of the zbuffer sharing its buffers, clipped to the tile */
+    zb = *tl->zb;
+    zb.tiler = NULL;
+    x = (tile % tl->xtiles) << ZB_TILE_SHIFT;
+    y = (tile / tl->xtiles) << ZB_TILE_SHIFT;
+    if (zb.tiled)
+        ZB_tileView(tl->zb, &zb, x >> ZB_TILE_SHIFT, y >> ZB_TILE_SHIFT);
+    if (zb.clip_xmin < x) zb.clip_xmin = x;
+    if (zb.clip_ymin < y) zb.clip_ymin = y;
+    if (zb.clip_xmax > x + ZB_TILE_SIZE) zb.clip_xmax = x + ZB_TILE_SIZE;
+    if (zb.clip_ymax > y + ZB_TILE_SIZE) zb.clip_ymax = y + ZB_TILE_SIZE;
+
+    /*
+     * final z of the first opaque triangles with the same depth test, then
+     * the colors of their visible pixels only
+     */
+    nb_prepass = 0;
+    prepass = tl->triangles[bin->triangles[0]].state & ~ZB_STATE_SHADE_MASK;
+    if (zb.depth_prepass && ZB_TILE_OPAQUE(prepass)) {
+        zb.state = prepass;
+        for (; nb_prepass < bin->nb_triangles; nb_prepass++) {
+            ZBTriangle *tri = &tl->triangles[bin->triangles[nb_prepass]];
+            ZBufferPoint p0 = tri->p[0], p1 = tri->p[1], p2 = tri->p[2];
+
+            if ((tri->state & ~ZB_STATE_SHADE_MASK) != prepass)
+                break;
+            ZB_fillTriangleDepth(&zb, &p0, &p1, &p2);
+        }
+        /* the hidden triangles and spans are skipped with the final z */
+        if (nb_prepass > 0) {
+            ZB_clearResolve(&zb, zb.clip_xmin, zb.clip_ymin, zb.clip_xmax - 1, zb.clip_ymax - 1);
+            ZB_hizUpdate(&zb, zb.clip_xmin, zb.clip_ymin, zb.clip_xmax, zb.clip_ymax);
+        }
+    }
+
+    for (i = 0; i < bin->nb_triangles; i++) {
+        ZBTriangle *tri;
+        ZBufferPoint p0, p1, p2;
+
+        /*
+         * the last triangle at the final z is drawn last with GL_LEQUAL,
+         * the first one with GL_LESS
+         */
+        j = i < nb_prepass && (ZB_STATE_DEPTH(prepass) == ZB_DEPTH_LESS ||
+                               ZB_STATE_DEPTH(prepass) == ZB_DEPTH_GREATER) ? nb_prepass - 1 - i : i;
+        tri = &tl->triangles[bin->triangles[j]];
+        /* the fill functions may write temporaries in the points */
+        p0 = tri->p[0];
+        p1 = tri->p[1];
+        p2 = tri->p[2];
+
+        zb.current_texture = tri->texture;
+        zb.state = tri->state;
+        zb.alpha_lo = tri->alpha_lo;
+        zb.alpha_range = tri->alpha_range;
+        zb.blend = tri->blend;
+        if (i < nb_prepass)
+            zb.state = (zb.state & ~(ZB_STATE_DEPTH_MASK | ZB_STATE_ZWRITE)) |
+                       (ZB_DEPTH_EQUAL << ZB_STATE_DEPTH_SHIFT);
+        tri->fill(&zb, &p0, &p1, &p2);
+    }
+    bin->nb_triangles = 0;
+}
+
+/* draw the active tiles from first to last, excluded */
+static void ZB_tileJobs(ZBTiler *tl, int first, int last) {
+    tl->first_job = first;
+    if (tl->nb_threads == 1) {
+        int job;
+        for (job = 0; job < last - first; job++)
+            ZB_tileJob(tl, job, 0);
+    } else {
+        ZB_poolRun(ZB_threadPool(tl->zb), ZB_tileJob, tl, last - first);
+    }
+    tl->first_job = 0;
+}
+
+void ZB_tileFlush(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+
+    /* the bands wait for the whole frame */
+    if (tl == NULL || tl->nb_triangles == 0 || zb->band_rows > 0)
+        return;
+
+    ZB_tileJobs(tl, 0, tl->nb_active);
+    tl->nb_active = 0;
+    tl->nb_triangles = 0;
+}
+
+static int ZB_tileCompare(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * The bands address their buffers with the coordinates of the screen:
+ * zbuf and pbuf are moved up by the first row of the band while it is
+ * drawn, and the tiles in order of their index are grouped by band.
+ */
+void ZB_tileBands(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+    unsigned short *zbuf = zb->zbuf;
+    PIXEL *pbuf = zb->pbuf;
+    int y, y1, first, last, band_tiles;
+
+    if (tl == NULL || zb->band_rows <= 0)
+        return;
+
+    qsort(tl->active, tl->nb_active, sizeof(int), ZB_tileCompare);
+    band_tiles = (zb->band_rows >> ZB_TILE_SHIFT) * tl->xtiles;
+    first = 0;
+    for (y = 0; y < zb->ysize; y = y1) {
+        y1 = y + zb->band_rows < zb->ysize ? y + zb->band_rows : zb->ysize;
+        for (last = first; last < tl->nb_active && tl->active[last] < (y / zb->band_rows + 1) * band_tiles; last++)
+            ;
+
+        zb->zbuf = zbuf - y * zb->zlinesize;
+        zb->pbuf = (PIXEL *)((char *)pbuf - y * zb->linesize);
+        ZB_tileJobs(tl, first, last);
+        /* the tiles without triangles only have their clear */
+        ZB_clearResolve(zb, 0, y, zb->xsize - 1, y1 - 1);
+        zb->zbuf = zbuf;
+        zb->pbuf = pbuf;
+
+        zb->band_func(zb->band_arg, pbuf, zb->linesize, y, y1 - y);
+        first = last;
+    }
+    tl->nb_active = 0;
+    tl->nb_triangles = 0;
+}
+
+void ZB_tileDiscard(ZBuffer *zb) {
+    ZBTiler *tl = zb->tiler;
+    int i;
+
+    if (tl == NULL)
+        return;
+
+    for (i = 0; i < tl->nb_active; i++)
+        tl->bins[tl->active[i]].nb_triangles = 0;
+    tl->nb_active = 0;
+    tl->nb_triangles = 0;
+}
+
+} // namespace fp
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "zbuffer.hpp"
+#include "zthread.hpp"
+
+/*
+ * Tile binned rasterization.
+ *
+ * Triangles are not drawn when they are submitted: they are recorded with
+ * their fill function and binned into the 64x64 tiles their bounding box
+ * touches. ZB_tileFlush() then rasterizes every tile on the worker threads,
+ * each tile drawing its triangles in submission order through a clip
+ * rectangle, so the result is the same as the serial rasterizer.
+ *
+ * With zb->depth_prepass, the triangle list grows to hold a whole frame
+ * and each tile first draws the z of its opaque triangles, then draws them
+ * again with an equal depth test: only the pixels that stay visible are
+ * shaded or textured, and the last triangle at the final z wins as with
+ * the serial rasterizer. The prepass stops at the first triangle of the
+ * tile that blends, tests alpha or does not test and write its z with
+ * GL_LESS or GL_LEQUAL (mirrored by ZB_flipDepth()): it and the
+ * following ones are drawn in order.
+ */
+
+/* number of triangles recorded before an implicit flush, without depth prepass */
+#define ZB_TILE_MAX_TRIANGLES 4096
+
+namespace fp {
+
+typedef struct {
+    ZB_fillTriangleFunc fill;
+    PIXEL *texture;
+    unsigned int state;
+    int alpha_lo, alpha_range;
+    int blend;
+    ZBufferPoint p[3];
+} ZBTriangle;
+
+typedef struct {
+    int *triangles; /* indexes in ZBTiler::triangles, in submission order */
+    int nb_triangles, max_triangles;
+} ZBTileBin;
+
+struct ZBTiler {
+    ZBuffer *zb;
+    int nb_threads; /* as asked to ZB_tileOpen(), 1 draws without the workers of the zbuffer */
+
+    int xtiles, ytiles;
+    ZBTileBin *bins;
+    int *active; /* tiles with at least one triangle */
+    int nb_active;
+
+    ZBTriangle *triangles;
+    int nb_triangles, max_triangles;
+
+    int first_job; /* index in active of the tile of the job 0 */
+};
+
+/* nb_threads != 1 draws the tiles on ZB_threadPool() */
+int ZB_tileOpen(ZBuffer *zb, int nb_threads);
+void ZB_tileClose(ZBuffer *zb);
+
+/* called by ZB_resize() to match the new buffer size */
+void ZB_tileResize(ZBuffer *zb);
+
+void ZB_tileTriangle(ZBuffer *zb, ZB_fillTriangleFunc fill,
+                     ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2);
+
+/* draw all the pending triangles, except in band rendering */
+void ZB_tileFlush(ZBuffer *zb);
+
+/*
+ * Band rendering: record a clear between the pending triangles of the
+ * frame. Returns -1 when there is none, for ZB_clear() to clear the
+ * buffers itself.
+ */
+int ZB_tileClear(ZBuffer *zb, int clear_z, int z, int clear_color, PIXEL color);
+
+/* band rendering: draw the frame and send the bands, see ZB_openBands() */
+void ZB_tileBands(ZBuffer *zb);
+
+/* forget the pending triangles, used when the whole buffer is cleared */
+void ZB_tileDiscard(ZBuffer *zb);
+
+} // namespace fp
@@ -1,31 +1,131 @@
 #include <stdlib.h>
 #include "zbuffer.hpp"
+#include "zsimd.hpp"
+#include "zjit.hpp"
 
 #include "fixed_point_type.hpp"
 #include "fixed_point_operations.hpp"
 
-#define ZCMP(z, zpix) ((z) >= (zpix))
-
 namespace fp {
 
+/* blocks of a row of the half-space rasterizer tested at a time */
+#define ZB_HALF_SPACE_BLOCKS 64
+
+/*
+ * Coverage mask of the pixels [x, min(xe, xmax)] of line y, bit 0 being x,
+ * for the half-space rasterizer of ztriangle.in. xe - x is at most 7.
+ */
+static inline unsigned int ZB_halfSpaceMask(const int *ea, const int *eb, const int *ec,
+                                            int x, int xe, int xmax, int y) {
+    unsigned int mask = 0;
+    int e0, e1, e2, i;
+
+    if (xe > xmax)
+        xe = xmax;
+    e0 = ea[0] * x + eb[0] * y + ec[0];
+    e1 = ea[1] * x + eb[1] * y + ec[1];
+    e2 = ea[2] * x + eb[2] * y + ec[2];
+    for (i = 0; i < 8; i++) {
+        /* the sign bit is set when a pixel is outside of any edge */
+        mask |= (~(unsigned int)(e0 | e1 | e2) >> 31) << i;
+        e0 += ea[0];
+        e1 += ea[1];
+        e2 += ea[2];
+    }
+    return mask & ((2u << (xe - x)) - 1);
+}
+
+/*
+ * Pending clear of the tiles the triangle may touch: inside the clip
+ * rectangle, up to one pixel outside of its edges.
+ */
+static inline void ZB_clearTriangle(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+    int xmin, xmax, ymin, ymax;
+
+    xmin = xmax = p0->x;
+    ymin = ymax = p0->y;
+    if (p1->x < xmin) xmin = p1->x;
+    if (p1->x > xmax) xmax = p1->x;
+    if (p2->x < xmin) xmin = p2->x;
+    if (p2->x > xmax) xmax = p2->x;
+    if (p1->y < ymin) ymin = p1->y;
+    if (p1->y > ymax) ymax = p1->y;
+    if (p2->y < ymin) ymin = p2->y;
+    if (p2->y > ymax) ymax = p2->y;
+    if (--xmin < zb->clip_xmin) xmin = zb->clip_xmin;
+    if (--ymin < zb->clip_ymin) ymin = zb->clip_ymin;
+    if (++xmax >= zb->clip_xmax) xmax = zb->clip_xmax - 1;
+    if (++ymax >= zb->clip_ymax) ymax = zb->clip_ymax - 1;
+    if (xmin <= xmax && ymin <= ymax)
+        ZB_clearResolve(zb, xmin, ymin, xmax, ymax);
+}
+
+/*
+ * The spans are drawn by the kernel of zsimd.in selected by the state word
+ * of the triangle and its shading. SPAN_INIT() sets up the fields of the
+ * span which are constant over the triangle, SPAN_LINE() the span
+ * [x1 + nskip, xr] of the current line.
+ */
+#define SPAN_INIT(shade) \
+    { \
+        kernel = ZB_spans->func[zb->state | (shade)]; \
+        if (zb->jit && ZB_jitSpanFuncs[zb->state | (shade)] != NULL) \
+            kernel = ZB_jitSpanFuncs[zb->state | (shade)]; \
+        span.dzdx = dzdx; \
+        span.alpha_lo = zb->alpha_lo; \
+        span.alpha_range = zb->alpha_range; \
+        span.blend = zb->blend; \
+    }
+
+#define SPAN_LINE() \
+    { \
+        span.pp = (char *)pp1 + (x1 + nskip) * zb->pixel_size; \
+        span.pz = pz1 + x1 + nskip; \
+        span.n = xr - (x1 + nskip) + 1; \
+        span.z = z1 + (unsigned int)nskip * dzdx; \
+    }
+
+/*
+ * Depth only triangle, for the depth prepass of the tiler.
+ */
+
+void ZB_fillTriangleDepth(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+    ZBSpan span;
+    ZB_spanFunc kernel;
+
+#define INTERP_Z
+
+#define DRAW_INIT() \
+    { \
+        SPAN_INIT(ZB_SHADE_DEPTH); \
+    }
+
+#define DRAW_LINE() \
+    { \
+        SPAN_LINE(); \
+        kernel(&span); \
+    }
+
+#include "ztriangle.in"
+}
+
 void ZB_fillTriangleFlat(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
-int color;
+    ZBSpan span;
+    ZB_spanFunc kernel;
 
 #define INTERP_Z
 
 #define DRAW_INIT() \
     { \
-        color = RGB_TO_PIXEL(p2->r, p2->g, p2->b); \
+        SPAN_INIT(ZB_SHADE_FLAT); \
+        span.color = RGB_TO_PIXEL(p2->r, p2->g, p2->b); \
+        span.a = p2->a; \
     }
 
-#define PUT_PIXEL(_a) \
+#define DRAW_LINE() \
     { \
-        zz = z >> ZB_POINT_Z_FRAC_BITS; \
-        if (ZCMP(zz, pz[_a])) { \
-            pp[_a] = color; \
-            pz[_a] = zz; \
-        } \
-        z += dzdx; \
+        SPAN_LINE(); \
+        kernel(&span); \
     }
 
 #include "ztriangle.in"
@@ -33,189 +133,34 @@ int color;
 
 /*
  * Smooth filled triangle.
- * The code below is very tricky :)
  */
 
 void ZB_fillTriangleSmooth(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+    ZBSpan span;
+    ZB_spanFunc kernel;
+
 #define INTERP_Z
 #define INTERP_RGB
 
-#define SAR_RND_TO_ZERO(v, n) (v / (1 << n))
-
 #define DRAW_INIT() \
     { \
+        SPAN_INIT(ZB_SHADE_SMOOTH); \
+        span.drdx = drdx; \
+        span.dgdx = dgdx; \
+        span.dbdx = dbdx; \
+        span.dadx = dadx; \
     }
 
-#define PUT_PIXEL(_a) \
+#define DRAW_LINE() \
     { \
-        zz = z >> ZB_POINT_Z_FRAC_BITS; \
-        if (ZCMP(zz, pz[_a])) { \
-            pp[_a] = RGB_TO_PIXEL(or1, og1, ob1); \
-            pz[_a] = zz; \
-        } \
-        z += dzdx; \
-        og1 += dgdx; \
-        or1 += drdx; \
-        ob1 += dbdx; \
+        SPAN_LINE(); \
+        span.r = r1 + (unsigned int)nskip * drdx; \
+        span.g = g1 + (unsigned int)nskip * dgdx; \
+        span.b = b1 + (unsigned int)nskip * dbdx; \
+        span.a = a1 + (unsigned int)nskip * dadx; \
+        kernel(&span); \
     }
 
-#ifdef __ARM_NEON__
-#define DRAW_LINE() \
-{ \
-    PIXEL *pp; \
-    int n; \
-    unsigned short *pz; \
-    unsigned short z, zz; \
-    unsigned short or1, og1, ob1; \
-    n = (x2 >> 16) - x1; \
-    pp = (PIXEL *)((char *)pp1 + x1 * PSZB); \
-    /* INTERP_Z */ \
-    pz = pz1 + x1; \
-    z = z1; \
-    /* INTERP_RGB */ \
-    or1 = r1; \
-    og1 = g1; \
-    ob1 = b1; \
-    unsigned short multiplier[4] = {0, 1, 2, 3}; \
-    asm volatile ( \
-        /* local vectors z, or1, og1, ob1 */ \
-        "zzz .req d0\n"  /* d0     q0 */ \
-        "red .req d1\n"  /* d1        */ \
-        "grn .req d2\n"  /* d2     q1 */ \
-        "blu .req d3\n"  /* d3        */ \
-        /* {x4, x4, x4, x4} d*dx vectors */ \
-        "dlz .req d4\n"  /* d4     q2 */ \
-        "dlr .req d5\n"  /* d5        */ \
-        "dlg .req d6\n"  /* d6     q3 */ \
-        "dlb .req d7\n"  /* d7        */ \
-        /* output pixel halves        */ \
-        "rgba .req q4\n" /* d8     q4 */ \
-        "rg  .req d8\n"  /* d8     q4 */ \
-        "ba  .req d9\n"  /* d9        */ \
-        /* local memory copies        */ \
-        "pz  .req d10\n" /* d10    q5 */ \
-        "zz2 .req d11\n"  /* d11       */ \
-        "dst .req q6\n"  /* d12-13 q6 */ \
-        "ds1 .req d12\n" /* d12    q6 */ \
-        "ds2 .req d13\n" /* d13       */ \
-        /* zbuf and pixel output masks are filled with a z test */ \
-        "zma .req d14\n" /* d14    q7 */ \
-        /* left-side half-pixel mask  */ \
-        "lma .req d15\n" /* d15       */ \
-        "pma .req q8\n"  /* d16    q8 */ \
-        /* temporary vectors:         */ \
-        /* initial {x0, x1, x2, x3} d*dx vectors */ \
-        "tlz .req d8\n"  /* d8     q4 */ \
-        "tlr .req d9\n"  /* d9        */ \
-        "tlg .req d10\n" /* d10    q5 */ \
-        "tlb .req d11\n" /* d11       */ \
-        /* initial {x0, x1, x2, x3} multiplier */ \
-        "tml .req d12\n" /* d12       */ \
-        /* preload pixel and zbuf */ \
-        "pld [%[pp]]\n" \
-        "pld [%[pz]]\n" \
-        /* early terminate condition */ \
-        "cmp %[n], #3\n" \
-        "blt .end\n" \
-        /* 0xFF00 mask */ \
-        "vmov.u16 lma, #0xFF00\n" \
-        /* multiplier */ \
-        "vld1.16 {tml}, [%[multiplier]]\n" \
-        /* duplicate and align our locals */ \
-        "vdup.16 zzz, %[z]\n" \
-        "vdup.16 red, %[r1]\n" \
-        "vdup.16 grn, %[g1]\n" \
-        "vdup.16 blu, %[b1]\n" \
-        /* load delta vectors */ \
-        "vdup.u16 tlz, %[dzdx]\n" \
-        "vdup.u16 tlr, %[drdx]\n" \
-        "vdup.u16 tlg, %[dgdx]\n" \
-        "vdup.u16 tlb, %[dbdx]\n" \
-        "vdup.u16 dlz, %[dzdx]\n" \
-        "vdup.u16 dlr, %[drdx]\n" \
-        "vdup.u16 dlg, %[dgdx]\n" \
-        "vdup.u16 dlb, %[dbdx]\n" \
-        /* multiply delta vectors */ \
-        "vmul.u16 tlz, tml\n" \
-        "vmul.u16 tlr, tml\n" \
-        "vmul.u16 tlg, tml\n" \
-        "vmul.u16 tlb, tml\n" \
-        "vmov.u16 tml, #4\n" \
-        "vmul.u16 dlz, tml\n" \
-        "vmul.u16 dlr, tml\n" \
-        "vmul.u16 dlg, tml\n" \
-        "vmul.u16 dlb, tml\n" \
-        /* set initial z+color vector states */ \
-        "vadd.u16 zzz, zzz, tlz\n" \
-        "vadd.u16 red, red, tlr\n" \
-        "vadd.u16 grn, grn, tlg\n" \
-        "vadd.u16 blu, blu, tlb\n" \
-        /* skip partway into the loop */ \
-        /* to save some duplicate instructions later */ \
-        "b .first\n" \
-        ".loop:\n" \
-            "vadd.u16 zzz, zzz, dlz\n" \
-            "vadd.u16 red, red, dlr\n" \
-            "vadd.u16 grn, grn, dlg\n" \
-            "vadd.u16 blu, blu, dlb\n" \
-            "vshr.u16 zz2, zzz, %[zb_point_z_frac_bits]\n" \
-            ".first:\n" \
-            /* pixel countdown */ \
-            "sub %[n], %[n], #4\n" \
-            /* load zbuf */ \
-            "vld1.16 {pz}, [%[pz]]\n" \
-            /* make z mask from z vec >= zbuf */ \
-            "vcge.u16 zma, zz2, pz\n" \
-            /* load dst pixels */ \
-            "vld1.32 {dst}, [%[pp]]\n" \
-            /* convert mask and load red, blue into rgba pixel */ \
-            "vand.16 rg, red, lma\n" \
-            "vand.16 ba, blu, lma\n" \
-            /* extend z mask to 32-bits for pixel output */ \
-            "vmovl.s16 pma, zma\n" \
-            /* convert inject green into (rg)ba pixel */ \
-            "vsri.16 rg, grn, #8\n" \
-            /* use z mask to update passing zbuf and pixels */ \
-            "vbit pz, zz2, zma\n" \
-            "vbit dst, rgba, pma\n" \
-            /* store updated pixel and zbuf to memory */ \
-            "vst1.16 {pz}, [%[pz]]!\n" \
-            /* TODO: make sure this pixel store is right */ \
-            "vst2.32 {ds1, ds2}, [%[pp]]!\n" \
-            /* get started on preloading, because ! increments */ \
-            "pld [%[pz], #8]\n" \
-            "pld [%[pp], #32]\n" \
-            /* continue if we have at least 4 pixels left */ \
-            "cmp %[n], #3\n" \
-            "bge .loop\n" \
-        "vadd.u16 zzz, zzz, dlz\n" \
-        "vadd.u16 red, red, dlr\n" \
-        "vadd.u16 grn, grn, dlg\n" \
-        "vadd.u16 blu, blu, dlb\n" \
-        "vmov.u16 %[z], zzz[0]\n" \
-        "vmov.u16 %[r1], red[0]\n" \
-        "vmov.u16 %[g1], grn[0]\n" \
-        "vmov.u16 %[b1], blu[0]\n" \
-        ".end:\n" \
-        : [z]"+r"(z), [r1]"+r"(or1), [g1]"+r"(og1), [b1]"+r"(ob1), \
-          [n]"+r"(n), [pp]"+r"(pp), [pz]"+r"(pz) \
-        /* TODO: use pixel width %[pw]? */ \
-        : [dzdx]"r"(dzdx), [drdx]"r"(drdx), [dgdx]"r"(dgdx), [dbdx]"r"(dbdx), \
-          [multiplier]"r"(multiplier), \
-          [zb_point_z_frac_bits]"i"(ZB_POINT_Z_FRAC_BITS), \
-          [pw]"i"(4 * PSZB) \
-        : "q0", "q1", "q2", "q3", "q4", "q5", "q6", "q7", "q8" \
-    ); \
-    while (n >= 0) { \
-        PUT_PIXEL(0); \
-        /* INTERP_Z */ \
-        pz += 1; \
-        pp = (PIXEL *)((char *)pp + PSZB); \
-        n -= 1; \
-    } \
-}
-#endif
-
 #include "ztriangle.in"
 }
 
@@ -223,27 +168,33 @@ void ZB_setTexture(ZBuffer *zb, PIXEL *texture) {
     zb->current_texture=texture;
 }
 
+/*
+ * The texture is RGB only: the alpha of the textured triangles is the one
+ * of their last vertex, as the color of the flat ones.
+ */
+
 void ZB_fillTriangleMapping(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
-    PIXEL *texture;
+    ZBSpan span;
+    ZB_spanFunc kernel;
 
 #define INTERP_Z
 #define INTERP_ST
 
 #define DRAW_INIT() \
     { \
-        texture = zb->current_texture; \
+        SPAN_INIT(ZB_SHADE_MAPPING); \
+        span.texture = zb->current_texture; \
+        span.a = p2->a; \
+        span.dsdx = dsdx; \
+        span.dtdx = dtdx; \
     }
 
-#define PUT_PIXEL(_a) \
+#define DRAW_LINE() \
     { \
-        zz = z >> ZB_POINT_Z_FRAC_BITS; \
-        if (ZCMP(zz, pz[_a])) { \
-            pp[_a] = texture[((t & 0x3FC00000) | s) >> 14]; \
-            pz[_a] = zz; \
-        } \
-        z += dzdx; \
-        s += dsdx; \
-        t += dtdx; \
+        SPAN_LINE(); \
+        span.s = s1 + (unsigned int)nskip * dsdx; \
+        span.t = t1 + (unsigned int)nskip * dtdx; \
+        kernel(&span); \
     }
 
 #include "ztriangle.in"
@@ -256,7 +207,8 @@ void ZB_fillTriangleMapping(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBu
  */
 
 void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
-    PIXEL *texture;
+    ZBSpan span;
+    ZB_spanFunc kernel;
     tGLfixed fdzdx, fndzdx, ndszdx, ndtzdx;
 
 #define INTERP_Z
@@ -266,43 +218,46 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 
 #define DRAW_INIT() \
     { \
-        texture = zb->current_texture;\
+        SPAN_INIT(ZB_SHADE_MAPPING); \
+        span.texture = zb->current_texture; \
+        span.a = p2->a; \
         fdzdx = (tGLfixed)dzdx;\
         fndzdx = NB_INTERP * fdzdx;\
         ndszdx = NB_INTERP * dszdx;\
         ndtzdx = NB_INTERP * dtzdx;\
     }
 
-
-#define PUT_PIXEL(_a) \
-    { \
-        zz = z >> ZB_POINT_Z_FRAC_BITS; \
-        if (ZCMP(zz, pz[_a])) { \
-            pp[_a] = *(PIXEL *)((char *)texture + \
-                    (((t & 0x3FC00000) | (s & 0x003FC000)) >> (17 - PSZSH)));\
-            pz[_a] = zz; \
-        } \
-        z += dzdx; \
-        s += dsdx; \
-        t += dtdx; \
-    }
-
+/*
+ * s and t are computed exactly every NB_INTERP pixels and linearly
+ * interpolated in between by the mapping kernel.
+ */
 #define DRAW_LINE() \
     { \
         unsigned short *pz; \
-        PIXEL *pp; \
-        unsigned int s, t, z, zz; \
-        int n, dsdx, dtdx; \
+        char *pp; \
+        unsigned int s, t, z; \
+        int n, m, dsdx, dtdx; \
         tGLfixed sz, tz, fz, zinv; \
-        n = (x2 >> 16) - x1; \
+        n = xr - x1; \
         fz = (tGLfixed)z1; \
-        zinv = 1.0 / fz; \
-        pp = (PIXEL *)((char *)pp1 + x1 * PSZB); \
+        pp = (char *)pp1 + x1 * zb->pixel_size; \
         pz = pz1 + x1; \
         z = z1; \
         sz = sz1; \
         tz = tz1; \
-        while (n >= (NB_INTERP - 1)) { \
+        /* the groups left of the clip rectangle only advance the gradients */ \
+        while (nskip >= NB_INTERP) { \
+            fz += fndzdx; \
+            sz += ndszdx; \
+            tz += ndtzdx; \
+            z += NB_INTERP * dzdx; \
+            pz += NB_INTERP; \
+            pp += NB_INTERP * zb->pixel_size; \
+            n -= NB_INTERP; \
+            nskip -= NB_INTERP; \
+        } \
+        zinv = 1.0 / fz; \
+        while (n >= 0) { \
             { \
                 tGLfixed ss, tt; \
                 ss = (sz * zinv); \
@@ -311,41 +266,36 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
                 t = (int)tt; \
                 dsdx = (int)((dszdx - ss*fdzdx) * zinv); \
                 dtdx = (int)((dtzdx - tt*fdzdx) * zinv); \
+            } \
+            /* pixels in this group */ \
+            m = n >= NB_INTERP - 1 ? NB_INTERP : n + 1; \
+            if (m == NB_INTERP) { \
                 fz += fndzdx; \
                 zinv = 1.0 / fz; \
             } \
-            PUT_PIXEL(0); \
-            PUT_PIXEL(1); \
-            PUT_PIXEL(2); \
-            PUT_PIXEL(3); \
-            PUT_PIXEL(4); \
-            PUT_PIXEL(5); \
-            PUT_PIXEL(6); \
-            PUT_PIXEL(7); \
+            span.pp = pp + nskip * zb->pixel_size; \
+            span.pz = pz + nskip; \
+            span.n = m - nskip; \
+            span.z = z + (unsigned int)nskip * dzdx; \
+            span.s = s + (unsigned int)nskip * dsdx; \
+            span.t = t + (unsigned int)nskip * dtdx; \
+            span.dsdx = dsdx; \
+            span.dtdx = dtdx; \
+            kernel(&span); \
+            nskip = 0; \
+            z += NB_INTERP * dzdx; \
             pz += NB_INTERP; \
-            pp = (PIXEL *)((char *)pp + NB_INTERP * PSZB);\
+            pp += NB_INTERP * zb->pixel_size; \
             n -= NB_INTERP; \
             sz += ndszdx;\
             tz += ndtzdx;\
         } \
-        { \
-            tGLfixed ss, tt; \
-            ss = (sz * zinv); \
-            tt = (tz * zinv); \
-            s =(int) ss; \
-            t =(int) tt; \
-            dsdx = (int)((dszdx - ss*fdzdx)*zinv); \
-            dtdx = (int)((dtzdx - tt*fdzdx)*zinv); \
-        }\
-        while (n >= 0) { \
-            PUT_PIXEL(0); \
-            pz+=1; \
-            pp=(PIXEL *)((char *)pp + PSZB);\
-            n-=1; \
-        } \
     }
 
 #include "ztriangle.in"
 }
 
+#undef SPAN_INIT
+#undef SPAN_LINE
+
 } // namespace fp